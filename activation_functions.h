@@ -0,0 +1,132 @@
+#pragma once
+
+#include "project2_a_basics.h"
+#include <cmath>
+#include <cstddef>
+#include <typeinfo>
+
+// Activation functions as compile-time policies. Each policy evaluates
+// sigma and its derivative inline and provides whole-buffer versions that
+// work on a contiguous layer buffer, so a layer makes one call per
+// forward/backward pass instead of one virtual call per neuron.
+//
+// sigma and dsigma give bitwise the same values as the corresponding
+// ActivationFunction classes. Policies that can also get the derivative
+// from the output, sigma'(z) = f(sigma(z)), provide dsigma_from_output;
+// the forward pass of training then stores sigma'(z) next to sigma(z)
+// at the cost of a multiply, and the backward pass never evaluates the
+// activation again.
+//
+// Everything is templated on the scalar type T (double or float); for
+// float, tanh and cosh are evaluated in single precision, and the
+// ActivationFunction fallback goes through double.
+
+// tanh, evaluated exactly as TanhActivationFunction does
+struct TanhActivation {
+    template <class T>
+    static T sigma(T x) { return std::tanh(x); }
+    template <class T>
+    static T dsigma(T x) { return T(1) / (std::cosh(x) * std::cosh(x)); }
+
+    // tanh'(z) = 1 - tanh(z)^2. (Agrees with dsigma to a few ulps, except
+    // that it becomes exactly zero once tanh(z) rounds to +-1, |z| > ~19.)
+    static constexpr bool has_derivative_from_output = true;
+    template <class T>
+    static T dsigma_from_output(T a) { return T(1) - a * a; }
+
+    // a[i] = sigma(z[i])
+    template <class T>
+    static void apply(const T* z, T* a, std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) a[i] = sigma(z[i]);
+    }
+
+    // d[i] = sigma'(z[i])
+    template <class T>
+    static void apply_derivative(const T* z, T* d, std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) d[i] = dsigma(z[i]);
+    }
+
+    // delta[i] *= sigma'(z[i]), the step of the backward pass
+    template <class T>
+    static void scale_by_derivative(const T* z, T* delta, std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) delta[i] *= dsigma(z[i]);
+    }
+
+    // a[i] = sigma(z[i]) and d[i] = sigma'(z[i]), from the output
+    template <class T>
+    static void apply_with_derivative(const T* z, T* a, T* d, std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) {
+            a[i] = sigma(z[i]);
+            d[i] = dsigma_from_output(a[i]);
+        }
+    }
+};
+
+// Closed set of activations a runtime-sized layer can dispatch to without
+// virtual calls. Anything else goes through the ActivationFunction's
+// virtual functions (still once per layer, then per neuron).
+enum class ActivationKind { Tanh, Virtual };
+
+// Kind for a given activation function object. Only the exact class is
+// mapped to a policy: a class derived from it may override sigma/dsigma.
+inline ActivationKind classify_activation(const ActivationFunction* act_func) {
+    if (act_func != nullptr && typeid(*act_func) == typeid(TanhActivationFunction)) {
+        return ActivationKind::Tanh;
+    }
+    return ActivationKind::Virtual;
+}
+
+// Runtime-dispatched whole-buffer entry points: the switch is done once per
+// call, the loops inside are the inlined policy loops
+template <class T>
+inline void apply_activation(ActivationKind kind, ActivationFunction* act_func,
+                             const T* z, T* a, std::size_t n) {
+    switch (kind) {
+    case ActivationKind::Tanh:
+        TanhActivation::apply(z, a, n);
+        break;
+    default:
+        for (std::size_t i = 0; i < n; ++i) a[i] = T(act_func->sigma(z[i]));
+    }
+}
+
+template <class T>
+inline void apply_activation_derivative(ActivationKind kind, ActivationFunction* act_func,
+                                        const T* z, T* d, std::size_t n) {
+    switch (kind) {
+    case ActivationKind::Tanh:
+        TanhActivation::apply_derivative(z, d, n);
+        break;
+    default:
+        for (std::size_t i = 0; i < n; ++i) d[i] = T(act_func->dsigma(z[i]));
+    }
+}
+
+// a[i] = sigma(z[i]) and d[i] = sigma'(z[i]), for the forward pass of
+// training. Activations without a policy evaluate dsigma(z) directly.
+template <class T>
+inline void apply_activation_with_derivative(ActivationKind kind, ActivationFunction* act_func,
+                                             const T* z, T* a, T* d, std::size_t n) {
+    switch (kind) {
+    case ActivationKind::Tanh:
+        TanhActivation::apply_with_derivative(z, a, d, n);
+        break;
+    default:
+        for (std::size_t i = 0; i < n; ++i) {
+            a[i] = T(act_func->sigma(z[i]));
+            d[i] = T(act_func->dsigma(z[i]));
+        }
+    }
+}
+
+template <class T>
+inline void scale_by_activation_derivative(ActivationKind kind, ActivationFunction* act_func,
+                                           const T* z, T* delta, std::size_t n) {
+    switch (kind) {
+    case ActivationKind::Tanh:
+        TanhActivation::scale_by_derivative(z, delta, n);
+        break;
+    default:
+        for (std::size_t i = 0; i < n; ++i) delta[i] *= T(act_func->dsigma(z[i]));
+    }
+}
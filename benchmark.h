@@ -0,0 +1,79 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <streambuf>
+
+// Timing helpers shared by the benchmark drivers
+
+// Distribution of the wall-clock time (in nanoseconds) of a single call,
+// over the timed repetitions
+struct TimingStatistics {
+    double median_ns = 0.0;
+    double p10_ns = 0.0, p90_ns = 0.0; // 10th and 90th percentiles
+    double min_ns = 0.0, max_ns = 0.0;
+    unsigned long calls_per_repetition = 0;
+    unsigned repetitions = 0;
+};
+
+// Percentile q (0 to 100) of sorted values, interpolating linearly
+// between the nearest ranks
+inline double percentile(const std::vector<double>& sorted_values, double q) {
+    if (sorted_values.empty()) return 0.0;
+    double rank = q / 100.0 * (sorted_values.size() - 1);
+    std::size_t below = (std::size_t)rank;
+    if (below + 1 >= sorted_values.size()) return sorted_values.back();
+    double fraction = rank - below;
+    return sorted_values[below] + fraction * (sorted_values[below + 1] - sorted_values[below]);
+}
+
+// Times single calls to f. The number of calls per timed repetition is
+// calibrated so each repetition takes at least min_repetition_ns; one
+// untimed repetition is run as warmup.
+template <class F>
+TimingStatistics time_per_call(F&& f, unsigned repetitions = 11, double min_repetition_ns = 2.0e6) {
+    using clock = std::chrono::steady_clock;
+    auto time_calls = [&](unsigned long n_calls) {
+        auto start = clock::now();
+        for (unsigned long c = 0; c < n_calls; ++c) f();
+        return std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    };
+
+    // Calibrate (this doubles as the warmup)
+    unsigned long n_calls = 1;
+    while (time_calls(n_calls) < min_repetition_ns && n_calls < (1ul << 30)) {
+        n_calls *= 2;
+    }
+
+    std::vector<double> times;
+    for (unsigned r = 0; r < std::max(repetitions, 1u); ++r) {
+        times.push_back(time_calls(n_calls) / n_calls);
+    }
+    std::sort(times.begin(), times.end());
+
+    TimingStatistics statistics;
+    statistics.median_ns = times[times.size() / 2];
+    statistics.p10_ns = percentile(times, 10.0);
+    statistics.p90_ns = percentile(times, 90.0);
+    statistics.min_ns = times.front();
+    statistics.max_ns = times.back();
+    statistics.calls_per_repetition = n_calls;
+    statistics.repetitions = times.size();
+    return statistics;
+}
+
+// Median wall-clock time (in nanoseconds) of a single call to f
+template <class F>
+double median_time_per_call_ns(F&& f, unsigned repetitions = 11, double min_repetition_ns = 2.0e6) {
+    return time_per_call(f, repetitions, min_repetition_ns).median_ns;
+}
+
+// Stream buffer that throws everything away, for timing output code
+// without the cost of the output itself
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
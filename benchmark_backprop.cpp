@@ -0,0 +1,85 @@
+#include "project2_a.h"
+#include "benchmark.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+
+// Per-sample backpropagation time on the (2,16,16,1) network: the backward
+// pass using sigma'(z) stored by the forward pass (NeuralNetwork::
+// backpropagation) against the previous scheme, where the forward pass only
+// keeps z and the backward pass evaluates dsigma(z) for every neuron.
+
+// Backpropagation as it was done before sigma'(z) was cached
+void backpropagation_recomputing_derivatives(const NeuralNetwork& net, const DoubleVector& input,
+                                             const DoubleVector& target, NeuralNetworkWorkspace& workspace) {
+    const auto& layers = net.get_layers();
+    auto& activations = workspace.activations;
+    auto& zs = workspace.zs;
+    auto& deltas = workspace.deltas;
+
+    for (unsigned i = 0; i < input.n(); ++i) {
+        activations[0][i] = input[i];
+    }
+    for (unsigned l = 0; l < layers.size(); ++l) {
+        layers[l].forward(activations[l], zs[l], activations[l + 1]);
+    }
+
+    DoubleVector& delta = deltas.back();
+    for (unsigned i = 0; i < delta.n(); ++i) {
+        delta[i] = activations.back()[i] - target[i];
+    }
+    layers.back().scale_by_derivative(zs.back().data(), delta.data(), delta.n());
+    outer_product(delta, activations[activations.size() - 2], workspace.grad_w.back());
+    workspace.grad_b.back() = delta;
+
+    for (int l = (int)layers.size() - 2; l >= 0; --l) {
+        multiply_transposed(layers[l + 1].get_weights(), deltas[l + 1], deltas[l]);
+        layers[l].scale_by_derivative(zs[l].data(), deltas[l].data(), deltas[l].n());
+        outer_product(deltas[l], activations[l], workspace.grad_w[l]);
+        workspace.grad_b[l] = deltas[l];
+    }
+}
+
+int main() {
+    TanhActivationFunction tanh_act;
+    NeuralNetwork net(2, {{16, &tanh_act}, {16, &tanh_act}, {1, &tanh_act}});
+    net.initialise_parameters();
+    NeuralNetworkWorkspace workspace = net.make_workspace();
+
+    // Inputs spread over the unit square
+    std::vector<std::pair<DoubleVector, DoubleVector>> samples;
+    std::mt19937 gen(1234);
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    for (unsigned s = 0; s < 64; ++s) {
+        DoubleVector input(2), target(1);
+        input[0] = dist(gen);
+        input[1] = dist(gen);
+        target[0] = (input[0] > input[1]) ? 1.0 : -1.0;
+        samples.emplace_back(input, target);
+    }
+
+    // Each timed call does one sample, cycling through the set
+    unsigned next = 0;
+    double before_ns = median_time_per_call_ns([&]() {
+        const auto& [input, target] = samples[next++ % samples.size()];
+        backpropagation_recomputing_derivatives(net, input, target, workspace);
+    });
+    double after_ns = median_time_per_call_ns([&]() {
+        const auto& [input, target] = samples[next++ % samples.size()];
+        net.backpropagation(input, target, workspace);
+    });
+
+    std::cout << "Per-sample backpropagation, (2,16,16,1) network (median per sample)" << std::endl;
+    std::cout << std::left << std::setw(32) << "dsigma(z) in backward pass: " << std::setprecision(4) << before_ns << " ns" << std::endl;
+    std::cout << std::setw(32) << "sigma'(z) cached in forward: " << std::setprecision(4) << after_ns << " ns"
+              << " (x" << std::setprecision(3) << before_ns / after_ns << ")" << std::endl;
+
+    std::ofstream out("backprop_benchmark.dat");
+    out << "# variant ns_per_sample\n";
+    out << "recompute_dsigma " << before_ns << "\n";
+    out << "cached_dsigma " << after_ns << "\n";
+    std::cout << "Timings saved to backprop_benchmark.dat." << std::endl;
+    return 0;
+}
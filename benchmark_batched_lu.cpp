@@ -0,0 +1,83 @@
+#include "dense_linear_algebra.h"
+#include "benchmark.h"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace BasicDenseLinearAlgebra;
+
+// Many small random systems (n = 10, 20, 50, 100, 200), solved one at a
+// time with LULinearSolver::lu_solve and all together with
+// BatchedLULinearSolver, serial and on n_threads threads. The number of
+// systems k is n_systems, or fewer for large n (so the matrices take at
+// most 64 MB). Every system is checked to get the same solution, bit for
+// bit, from both solvers.
+//
+// Usage: benchmark_batched_lu [n_systems] [n_threads]
+// (default: 4096 and the number of hardware threads)
+
+int main(int argc, char* argv[]) {
+    unsigned max_systems = (argc > 1) ? std::atoi(argv[1]) : 4096;
+    unsigned n_threads = (argc > 2) ? std::atoi(argv[2]) : ThreadPool::default_size();
+    ThreadPool pool(n_threads);
+
+    std::cout << "Time per system (median) for k independent n x n systems; batched on " << pool.size()
+              << " thread(s) with " << Kernels::Batch_lanes << " systems per batch" << std::endl;
+    std::cout << std::setw(6) << "n" << std::setw(7) << "k" << std::setw(14) << "lu_solve us" << std::setw(14)
+              << "batched us" << std::setw(10) << "speedup" << std::setw(14) << "threaded us" << std::setw(10)
+              << "speedup" << std::setw(12) << "identical" << std::endl;
+
+    std::ofstream out("batched_lu_benchmark.dat");
+    out << "# n k lu_solve_seconds batched_seconds threaded_seconds (per system) identical\n";
+
+    std::mt19937 gen(1234);
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+    for (unsigned n : {10u, 20u, 50u, 100u, 200u}) {
+        unsigned k = std::max(1u, std::min(max_systems, unsigned((1u << 23) / (n * n))));
+        std::vector<double> matrices(std::size_t(k) * n * n), rhs(std::size_t(k) * n);
+        for (double& value : matrices) value = dist(gen);
+        for (double& value : rhs) value = dist(gen);
+
+        // One system at a time, as the callers do now
+        std::vector<double> solutions(rhs.size());
+        double lu_solve_ns = median_time_per_call_ns([&]() {
+            LULinearSolver solver;
+            SquareDoubleMatrix matrix(n);
+            DoubleVector b(n);
+            for (unsigned s = 0; s < k; ++s) {
+                std::copy(&matrices[std::size_t(s) * n * n], &matrices[std::size_t(s + 1) * n * n], matrix.data());
+                std::copy(&rhs[std::size_t(s) * n], &rhs[std::size_t(s + 1) * n], b.data());
+                DoubleVector x = solver.lu_solve(matrix, b);
+                std::copy(x.data(), x.data() + n, &solutions[std::size_t(s) * n]);
+            }
+        }, 5);
+
+        std::vector<bool> singular;
+        BatchedLULinearSolver serial_solver;
+        std::vector<double> batched;
+        double batched_ns =
+            median_time_per_call_ns([&]() { batched = serial_solver.solve(n, matrices, rhs, singular); }, 5);
+        BatchedLULinearSolver threaded_solver;
+        threaded_solver.set_thread_pool(&pool);
+        std::vector<double> threaded;
+        double threaded_ns =
+            median_time_per_call_ns([&]() { threaded = threaded_solver.solve(n, matrices, rhs, singular); }, 5);
+
+        bool identical = std::memcmp(batched.data(), solutions.data(), solutions.size() * sizeof(double)) == 0 &&
+                         std::memcmp(threaded.data(), solutions.data(), solutions.size() * sizeof(double)) == 0;
+
+        std::cout << std::setw(6) << n << std::setw(7) << k << std::setprecision(4) << std::setw(14)
+                  << 1.0e-3 * lu_solve_ns / k << std::setw(14) << 1.0e-3 * batched_ns / k << std::setw(10)
+                  << std::setprecision(3) << lu_solve_ns / batched_ns << std::setprecision(4) << std::setw(14)
+                  << 1.0e-3 * threaded_ns / k << std::setw(10) << std::setprecision(3)
+                  << lu_solve_ns / threaded_ns << std::setw(12) << (identical ? "yes" : "NO") << std::endl;
+        out << n << " " << k << " " << 1.0e-9 * lu_solve_ns / k << " " << 1.0e-9 * batched_ns / k << " "
+            << 1.0e-9 * threaded_ns / k << " " << identical << "\n";
+    }
+    std::cout << "Timings saved to batched_lu_benchmark.dat." << std::endl;
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "project2_a.h"
+#include "dataset.h"
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Single against double precision training of the (2,16,16,1) network on
+// spiral_training_data.dat: throughput of train() and the cost reached
+// after the same number of iterations, from the same initial generator
+// state, per sample and with mini-batches. The final cost is evaluated by
+// each network's own cost_for_training_data (compensated for float).
+//
+// Usage: benchmark_float_training [n_iterations]
+// (default: 2000)
+
+struct TrainingResult {
+    double samples_per_second = 0.0;
+    double final_cost = 0.0;
+    unsigned iterations = 0;
+};
+
+template <class T>
+TrainingResult train_network(const Dataset& training_data, unsigned batch_size, unsigned n_iterations) {
+    TanhActivationFunction tanh_act;
+    BasicNeuralNetwork<T> net(2, {{16, &tanh_act}, {16, &tanh_act}, {1, &tanh_act}});
+
+    std::mt19937 gen(5489);
+    TrainingOptions options;
+    options.batch_size = batch_size;
+    options.random_number_generator = &gen;
+    options.log_stream = nullptr;
+    options.exact_cost_interval = 0;
+    TrainingReport report;
+    options.report = &report;
+
+    std::vector<double> cost_log;
+    net.train(training_data, 0.01, 0.0, n_iterations, cost_log, 0.0, options);
+
+    TrainingResult result;
+    result.samples_per_second = report.samples_per_second;
+    result.final_cost = net.cost_for_training_data(training_data);
+    result.iterations = report.iterations;
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    unsigned n_iterations = (argc > 1) ? std::atoi(argv[1]) : 2000;
+
+    Dataset training_data;
+    try {
+        training_data = Dataset::load("spiral_training_data.dat");
+    } catch (const std::exception& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "Loaded " << training_data.n_samples() << " training samples; float kernels: "
+              << Kernels::isa_name(Kernels::float_kernels().isa) << ", double kernels: "
+              << Kernels::isa_name(Kernels::kernels().isa) << "." << std::endl;
+
+    std::ofstream out("float_training_comparison.dat");
+    out << "# batch_size precision iterations samples_per_second final_cost\n";
+    std::cout << std::setw(8) << "batch" << std::setw(11) << "precision" << std::setw(14) << "samples/s"
+              << std::setw(16) << "final cost" << std::setw(10) << "speedup" << std::endl;
+
+    for (unsigned batch_size : {1u, 32u}) {
+        TrainingResult double_result = train_network<double>(training_data, batch_size, n_iterations);
+        TrainingResult float_result = train_network<float>(training_data, batch_size, n_iterations);
+
+        struct Row {
+            const char* precision;
+            const TrainingResult& result;
+        };
+        for (const Row& row : {Row{"double", double_result}, Row{"float", float_result}}) {
+            std::cout << std::setw(8) << batch_size << std::setw(11) << row.precision << std::setw(14)
+                      << std::setprecision(4) << row.result.samples_per_second << std::setw(16)
+                      << std::setprecision(6) << row.result.final_cost << std::setw(10) << std::setprecision(3)
+                      << row.result.samples_per_second / double_result.samples_per_second << std::endl;
+            out << batch_size << " " << row.precision << " " << row.result.iterations << " "
+                << row.result.samples_per_second << " " << row.result.final_cost << "\n";
+        }
+    }
+    std::cout << "Results saved to float_training_comparison.dat." << std::endl;
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include "grid_output.h"
+#include "benchmark.h"
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+// Time to produce grid_output text for the (2,16,16,1) network: the
+// drivers' point-by-point loop against write_grid_output, for the drivers'
+// grid (step 0.01 on [0,1]) and for finer grids. The text is discarded,
+// so only evaluation and formatting are timed.
+//
+// Usage: benchmark_grid_output [n_threads]
+// (default: the number of hardware threads)
+
+void write_grid_output_point_by_point(const NeuralNetwork& net, const std::vector<double>& axis,
+                                      std::ostream& out) {
+    for (double X1 : axis) {
+        for (double X2 : axis) {
+            DoubleVector input(2), output(1);
+            input[0] = X1;
+            input[1] = X2;
+            net.feed_forward(input, output);
+            out << X1 << " " << X2 << " " << output[0] << "\n";
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    unsigned n_threads = (argc > 1) ? std::atoi(argv[1]) : ThreadPool::default_size();
+
+    TanhActivationFunction tanh_act;
+    NeuralNetwork net(2, {{16, &tanh_act}, {16, &tanh_act}, {1, &tanh_act}});
+    net.initialise_parameters();
+
+    NullBuffer null_buffer;
+    std::ostream null_stream(&null_buffer);
+
+    std::ofstream out("grid_output_benchmark.dat");
+    out << "# n_points_per_side point_by_point_ms write_grid_output_1_thread_ms write_grid_output_ms n_threads\n";
+    std::cout << "Grid output, (2,16,16,1) network, " << n_threads << " threads" << std::endl;
+    std::cout << std::setw(10) << "grid" << std::setw(18) << "point-by-point" << std::setw(18) << "tiled, 1 thread"
+              << std::setw(18) << "tiled, threads" << std::endl;
+
+    std::vector<std::vector<double>> axes = {grid_axis(0.0, 1.0, 0.01), uniform_grid_axis(0.0, 1.0, 501),
+                                             uniform_grid_axis(0.0, 1.0, 2000)};
+    for (const auto& axis : axes) {
+        unsigned repetitions = (axis.size() > 1000) ? 3 : 5;
+
+        double point_by_point_ms = 1e-6 * median_time_per_call_ns([&]() {
+            write_grid_output_point_by_point(net, axis, null_stream);
+        }, repetitions);
+        double serial_ms = 1e-6 * median_time_per_call_ns([&]() {
+            write_grid_output(net, axis, axis, null_stream, 1);
+        }, repetitions);
+        double parallel_ms = 1e-6 * median_time_per_call_ns([&]() {
+            write_grid_output(net, axis, axis, null_stream, n_threads);
+        }, repetitions);
+
+        std::cout << std::setw(5) << axis.size() << " x " << std::setw(4) << axis.size() << std::setprecision(4)
+                  << std::setw(15) << point_by_point_ms << " ms" << std::setw(15) << serial_ms << " ms"
+                  << std::setw(15) << parallel_ms << " ms" << std::endl;
+        out << axis.size() << " " << point_by_point_ms << " " << serial_ms << " " << parallel_ms << " " << n_threads
+            << "\n";
+    }
+    std::cout << "Timings saved to grid_output_benchmark.dat." << std::endl;
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include "dense_linear_algebra.h"
+#include "benchmark.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <string>
+
+using namespace BasicDenseLinearAlgebra;
+using namespace BasicDenseLinearAlgebra::Kernels;
+
+// Shapes: our layers (2 inputs, 4/8/16 hidden, 1 output) plus larger widths
+struct Shape {
+    unsigned n, m, p;
+};
+
+std::vector<double> random_vector(std::mt19937& gen, unsigned long size) {
+    std::normal_distribution<double> dist(0.0, 1.0);
+    std::vector<double> v(size);
+    for (auto& x : v) x = dist(gen);
+    return v;
+}
+
+// Time one kernel for every available instruction set and report the
+// speedup over the scalar version
+template <class Run>
+void benchmark_kernel(const std::string& kernel, const Shape& shape,
+                      const std::vector<ISA>& isas, Run&& run, std::ofstream& out) {
+    std::cout << std::setw(22) << kernel << std::setw(6) << shape.n << std::setw(6) << shape.m
+              << std::setw(6) << shape.p;
+    out << kernel << " " << shape.n << " " << shape.m << " " << shape.p;
+    double scalar_ns = 0.0;
+    for (ISA isa : isas) {
+        const KernelTable& table = kernel_table(isa);
+        double ns = median_time_per_call_ns([&]() { run(table); });
+        if (isa == ISA::Scalar) scalar_ns = ns;
+        std::cout << std::setw(12) << std::setprecision(4) << ns << " ns";
+        if (isa != ISA::Scalar) std::cout << " (x" << std::setprecision(3) << scalar_ns / ns << ")";
+        out << " " << ns;
+    }
+    std::cout << std::endl;
+    out << "\n";
+}
+
+int main() {
+    std::vector<ISA> isas;
+    for (ISA isa : {ISA::Scalar, ISA::SSE2, ISA::AVX2, ISA::AVX512}) {
+        if (isa_supported(isa)) isas.push_back(isa);
+    }
+
+    std::cout << "Kernel timings (median per call); speedups relative to scalar" << std::endl;
+    std::cout << std::setw(22) << "kernel" << std::setw(6) << "n" << std::setw(6) << "m" << std::setw(6) << "p";
+    for (ISA isa : isas) std::cout << std::setw(16) << isa_name(isa);
+    std::cout << std::endl;
+
+    std::ofstream out("kernel_benchmark.dat");
+    out << "# kernel n m p";
+    for (ISA isa : isas) out << " " << isa_name(isa) << "_ns";
+    out << "\n";
+
+    std::mt19937 gen(1234);
+    std::vector<Shape> vector_shapes = {
+        {4, 2, 1}, {8, 2, 1}, {16, 2, 1}, {4, 4, 1}, {8, 8, 1}, {16, 16, 1},
+        {1, 4, 1}, {1, 8, 1}, {1, 16, 1}, {256, 256, 1}, {1024, 1024, 1}};
+
+    for (const Shape& s : vector_shapes) {
+        std::vector<double> a = random_vector(gen, (unsigned long)s.n * s.m);
+        std::vector<double> x = random_vector(gen, s.m), b = random_vector(gen, s.n);
+        std::vector<double> d = random_vector(gen, s.n), y(s.m), z(s.n);
+
+        benchmark_kernel("gemv (W*x+b)", s, isas, [&](const KernelTable& k) {
+            k.gemv(s.n, s.m, a.data(), s.m, x.data(), b.data(), z.data());
+        }, out);
+        benchmark_kernel("gemv_t (W^T*d)", s, isas, [&](const KernelTable& k) {
+            k.gemv_t(s.n, s.m, a.data(), s.m, d.data(), y.data());
+        }, out);
+        benchmark_kernel("ger (rank-1)", s, isas, [&](const KernelTable& k) {
+            k.ger(s.n, s.m, -1.0e-9, d.data(), x.data(), a.data(), s.m);
+        }, out);
+        benchmark_kernel("fused_backward_update", s, isas, [&](const KernelTable& k) {
+            k.fused_backward_update(s.n, s.m, a.data(), s.m, d.data(), x.data(), 1.0e-9, 0.0, y.data());
+        }, out);
+    }
+
+    // Mini-batch products: W*X (n x m times m x p) and W^T*Delta
+    std::vector<Shape> batch_shapes = {
+        {4, 2, 32}, {8, 2, 32}, {16, 2, 32}, {4, 4, 32}, {8, 8, 32}, {16, 16, 32},
+        {1, 16, 32}, {256, 256, 64}, {1024, 1024, 64}};
+
+    for (const Shape& s : batch_shapes) {
+        std::vector<double> a = random_vector(gen, (unsigned long)s.n * s.m);
+        std::vector<double> x = random_vector(gen, (unsigned long)s.m * s.p);
+        std::vector<double> d = random_vector(gen, (unsigned long)s.n * s.p);
+        std::vector<double> b = random_vector(gen, s.n);
+        std::vector<double> c((unsigned long)s.n * s.p), e((unsigned long)s.m * s.p);
+        std::vector<double> g((unsigned long)s.n * s.m);
+
+        benchmark_kernel("gemm (W*X+b)", s, isas, [&](const KernelTable& k) {
+            k.gemm(s.n, s.m, s.p, a.data(), s.m, 1, x.data(), s.p, b.data(), c.data(), s.p);
+        }, out);
+        benchmark_kernel("gemm (W^T*Delta)", s, isas, [&](const KernelTable& k) {
+            k.gemm(s.m, s.n, s.p, a.data(), 1, s.m, d.data(), s.p, nullptr, e.data(), s.p);
+        }, out);
+        benchmark_kernel("gemm_nt (Delta*A^T)", s, isas, [&](const KernelTable& k) {
+            k.gemm_nt(s.n, s.m, s.p, 1.0, d.data(), s.p, x.data(), s.p, g.data(), s.m);
+        }, out);
+        benchmark_kernel("gemm_sub (C-=A*B)", s, isas, [&](const KernelTable& k) {
+            k.gemm_sub(s.n, s.m, s.p, a.data(), s.m, x.data(), s.p, c.data(), s.p);
+        }, out);
+    }
+
+    out.close();
+    std::cout << "Timings saved to kernel_benchmark.dat." << std::endl;
+    return 0;
+}
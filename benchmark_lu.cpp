@@ -0,0 +1,97 @@
+#include "dense_linear_algebra.h"
+#include "benchmark.h"
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace BasicDenseLinearAlgebra;
+
+// LULinearSolver::factorise on random n x n systems, n = 64, 128, ...,
+// max_n: Crout's algorithm against the blocked right-looking one, serial
+// and on n_threads threads. Crout's algorithm reads the matrix down its
+// columns and gets very slow for large n, so it only runs up to
+// max_crout_n. The accuracy of each factorisation is checked by solving
+// for a random right-hand side (max_error: the largest entry of the
+// residual).
+//
+// Usage: benchmark_lu [max_n] [max_crout_n] [n_threads]
+// (default: 4096 1024 and the number of hardware threads)
+
+struct LUResult {
+    double seconds = 0.0;
+    double error = 0.0;
+};
+
+LUResult time_factorisation(LULinearSolver& solver, const SquareDoubleMatrix& matrix, const DoubleVector& rhs) {
+    // Fewer repetitions for the large systems, which take seconds each
+    unsigned repetitions = (matrix.n() <= 512) ? 11 : 3;
+    LUResult result;
+    result.seconds = 1.0e-9 * median_time_per_call_ns([&]() { solver.factorise(matrix); }, repetitions);
+    result.error = max_error(matrix, rhs, solver.solve(rhs));
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    unsigned max_n = (argc > 1) ? std::atoi(argv[1]) : 4096;
+    unsigned max_crout_n = (argc > 2) ? std::atoi(argv[2]) : 1024;
+    unsigned n_threads = (argc > 3) ? std::atoi(argv[3]) : ThreadPool::default_size();
+    ThreadPool pool(n_threads);
+
+    std::cout << "LU factorisation times (median) and max_error of the solution; blocked on "
+              << pool.size() << " thread(s)" << std::endl;
+    std::cout << std::setw(6) << "n" << std::setw(12) << "crout s" << std::setw(12) << "error" << std::setw(12)
+              << "blocked s" << std::setw(12) << "error" << std::setw(10) << "speedup" << std::setw(12)
+              << "threaded s" << std::setw(12) << "error" << std::setw(10) << "speedup" << std::endl;
+
+    std::ofstream out("lu_benchmark.dat");
+    out << "# n crout_seconds crout_error blocked_seconds blocked_error threaded_seconds threaded_error"
+        << " (-1: not run)\n";
+
+    std::mt19937 gen(1234);
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+    for (unsigned n = 64; n <= max_n; n *= 2) {
+        SquareDoubleMatrix matrix(n);
+        DoubleVector rhs(n);
+        for (unsigned i = 0; i < n; ++i) {
+            for (unsigned j = 0; j < n; ++j) matrix(i, j) = dist(gen);
+            rhs[i] = dist(gen);
+        }
+
+        LUResult crout = {-1.0, -1.0};
+        if (n <= max_crout_n) {
+            LULinearSolver solver;
+            solver.disable_blocked_factorisation();
+            crout = time_factorisation(solver, matrix, rhs);
+        }
+        LULinearSolver serial_solver;
+        LUResult blocked = time_factorisation(serial_solver, matrix, rhs);
+        LULinearSolver threaded_solver;
+        threaded_solver.set_thread_pool(&pool);
+        LUResult threaded = time_factorisation(threaded_solver, matrix, rhs);
+
+        std::cout << std::setw(6) << n << std::setprecision(3);
+        if (crout.seconds < 0.0) {
+            std::cout << std::setw(12) << "-" << std::setw(12) << "-";
+        } else {
+            std::cout << std::setw(12) << crout.seconds << std::setw(12) << crout.error;
+        }
+        for (const LUResult& result : {blocked, threaded}) {
+            std::cout << std::setw(12) << result.seconds << std::setw(12) << result.error << std::setw(10);
+            if (crout.seconds < 0.0) {
+                std::cout << "-";
+            } else {
+                std::cout << crout.seconds / result.seconds;
+            }
+        }
+        std::cout << std::endl;
+
+        out << n << " " << crout.seconds << " " << crout.error << " " << blocked.seconds << " " << blocked.error
+            << " " << threaded.seconds << " " << threaded.error << "\n";
+    }
+    std::cout << "Timings saved to lu_benchmark.dat." << std::endl;
+    return 0;
+}
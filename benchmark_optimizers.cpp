@@ -0,0 +1,147 @@
+#include "project2_a.h"
+#include "dataset.h"
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Wall-clock time to reach a target cost on spiral_training_data.dat for
+// the (2,4,4,1), (2,8,8,1) and (2,16,16,1) networks, with each optimizer
+// (see optimizer.h) against plain per-sample SGD at learning rate 0.01,
+// as the main_arch drivers train. Every run starts from the same initial
+// generator state and stops at the target cost or after n_iterations.
+// Besides the time to the target, the table gives the time to the
+// milestones 0.1 and 0.01, from the first logged cost below them (the
+// cost is logged every 50 iterations, and the time per iteration is
+// constant, so these are the run's time scaled by the iteration reached).
+//
+// Usage: benchmark_optimizers [n_iterations] [target_cost]
+// (default: 20000 1e-3)
+
+struct OptimizerConfig {
+    const char* name;
+    OptimizerKind kind;
+    double learning_rate;
+    unsigned batch_size;
+    bool cosine; // cosine schedule with warmup
+};
+
+struct OptimizerResult {
+    double seconds = 0.0;
+    unsigned iterations = 0;
+    double final_cost = 0.0;
+    std::vector<double> milestone_seconds; // negative if not reached
+};
+
+OptimizerResult train_network(const Dataset& training_data, unsigned hidden_size, const OptimizerConfig& config,
+                              unsigned n_iterations, double target_cost, const std::vector<double>& milestones) {
+    TanhActivationFunction tanh_act;
+    NeuralNetwork net(2, {{hidden_size, &tanh_act}, {hidden_size, &tanh_act}, {1, &tanh_act}});
+
+    std::mt19937 gen(5489);
+    TrainingOptions options;
+    options.batch_size = config.batch_size;
+    options.random_number_generator = &gen;
+    options.log_stream = nullptr;
+    options.optimizer.kind = config.kind;
+    if (config.cosine) {
+        options.schedule.kind = LearningRateScheduleKind::Cosine;
+        options.schedule.min_factor = 0.01;
+        options.schedule.warmup_iterations = 100;
+    }
+    TrainingReport report;
+    options.report = &report;
+
+    std::vector<double> cost_log;
+    net.train(training_data, config.learning_rate, target_cost, n_iterations, cost_log, 0.0, options);
+
+    OptimizerResult result;
+    result.seconds = report.seconds;
+    result.iterations = report.iterations;
+    result.final_cost = report.final_cost;
+    for (double milestone : milestones) {
+        double seconds = -1.0;
+        for (std::size_t i = 0; i < cost_log.size(); ++i) {
+            if (cost_log[i] <= milestone) {
+                seconds = report.seconds * double(i * 50 + 1) / report.iterations;
+                break;
+            }
+        }
+        result.milestone_seconds.push_back(seconds);
+    }
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    unsigned n_iterations = (argc > 1) ? std::atoi(argv[1]) : 20000;
+    double target_cost = (argc > 2) ? std::atof(argv[2]) : 1e-3;
+
+    Dataset training_data;
+    try {
+        training_data = Dataset::load("spiral_training_data.dat");
+    } catch (const std::exception& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
+        return 1;
+    }
+    std::cout << "Loaded " << training_data.n_samples() << " training samples; target cost " << target_cost
+              << ", at most " << n_iterations << " iterations." << std::endl;
+
+    const std::vector<OptimizerConfig> configs = {
+        {"sgd", OptimizerKind::SGD, 0.01, 1, false},
+        {"momentum", OptimizerKind::Momentum, 0.001, 1, false},
+        {"nesterov", OptimizerKind::Nesterov, 0.001, 1, false},
+        {"rmsprop", OptimizerKind::RMSProp, 0.003, 32, false},
+        {"adam", OptimizerKind::Adam, 0.003, 32, false},
+        {"adam-cosine", OptimizerKind::Adam, 0.003, 32, true},
+    };
+    const std::vector<double> milestones = {0.1, 0.01};
+
+    std::ofstream out("optimizer_comparison.dat");
+    out << "# architecture optimizer learning_rate batch_size iterations seconds final_cost"
+        << " seconds_to_0.1 seconds_to_0.01 (-1: not reached)\n";
+    std::cout << std::setw(12) << "network" << std::setw(13) << "optimizer" << std::setw(8) << "rate"
+              << std::setw(7) << "batch" << std::setw(11) << "iterations" << std::setw(10) << "seconds"
+              << std::setw(13) << "final cost" << std::setw(9) << "to 0.1" << std::setw(9) << "to 0.01"
+              << std::setw(10) << "speedup" << std::endl;
+
+    for (unsigned hidden_size : {4u, 8u, 16u}) {
+        std::string architecture = "2-" + std::to_string(hidden_size) + "-" + std::to_string(hidden_size) + "-1";
+        double sgd_seconds = 0.0; // 0 if SGD did not reach the target
+        for (const OptimizerConfig& config : configs) {
+            OptimizerResult result =
+                train_network(training_data, hidden_size, config, n_iterations, target_cost, milestones);
+            bool reached = (result.final_cost <= target_cost);
+            if (config.kind == OptimizerKind::SGD && reached) sgd_seconds = result.seconds;
+
+            std::cout << std::setw(12) << architecture << std::setw(13) << config.name << std::setw(8)
+                      << config.learning_rate << std::setw(7) << config.batch_size << std::setw(11)
+                      << result.iterations << std::setw(10) << std::setprecision(4) << result.seconds
+                      << std::setw(13) << std::setprecision(4) << result.final_cost;
+            for (double seconds : result.milestone_seconds) {
+                if (seconds < 0.0) {
+                    std::cout << std::setw(9) << "-";
+                } else {
+                    std::cout << std::setw(9) << std::setprecision(3) << seconds;
+                }
+            }
+            // Speedup only means something if both reached the target
+            std::cout << std::setw(10);
+            if (reached && sgd_seconds > 0.0) {
+                std::cout << std::setprecision(3) << sgd_seconds / result.seconds;
+            } else {
+                std::cout << "-";
+            }
+            std::cout << (reached ? "" : "  (target not reached)") << std::endl;
+
+            out << architecture << " " << config.name << " " << config.learning_rate << " " << config.batch_size
+                << " " << result.iterations << " " << result.seconds << " " << result.final_cost;
+            for (double seconds : result.milestone_seconds) out << " " << seconds;
+            out << "\n";
+        }
+    }
+    std::cout << "Results saved to optimizer_comparison.dat." << std::endl;
+    return 0;
+}
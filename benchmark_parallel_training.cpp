@@ -0,0 +1,118 @@
+#include "project2_a.h"
+#include "dataset.h"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Scaling of multithreaded training from 1 to N threads, on
+// spiral_training_data.dat and on larger generated two-spiral datasets,
+// for the deterministic data-parallel mode (mini-batches split across the
+// threads) and for Hogwild.
+//
+// Usage: benchmark_parallel_training [max_threads]
+// (default: the number of hardware threads)
+
+using TrainingData = std::vector<std::pair<DoubleVector, DoubleVector>>;
+
+// Two interleaved noisy spirals in the unit square, labelled +1 and -1
+TrainingData generate_spirals(unsigned n_points, unsigned seed) {
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> radius(0.05, 1.0);
+    std::normal_distribution<double> noise(0.0, 0.02);
+    TrainingData training_data;
+    for (unsigned k = 0; k < n_points; ++k) {
+        double r = radius(gen);
+        double label = (k % 2 == 0) ? 1.0 : -1.0;
+        double angle = 3.0 * M_PI * r + ((label > 0.0) ? 0.0 : M_PI);
+        DoubleVector input(2), output(1);
+        input[0] = 0.5 + 0.45 * r * std::cos(angle) + noise(gen);
+        input[1] = 0.5 + 0.45 * r * std::sin(angle) + noise(gen);
+        output[0] = label;
+        training_data.emplace_back(input, output);
+    }
+    return training_data;
+}
+
+// Wall-clock seconds per epoch for the (2,16,16,1) network
+double seconds_per_epoch(const TrainingData& training_data, const TrainingOptions& options, unsigned n_epochs) {
+    TanhActivationFunction tanh_act;
+    NeuralNetwork net(2, {{16, &tanh_act}, {16, &tanh_act}, {1, &tanh_act}});
+    std::vector<double> cost_log;
+
+    auto start = std::chrono::steady_clock::now();
+    net.train(training_data, 0.01, 0.0, n_epochs, cost_log, 0.0, options);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return seconds / n_epochs;
+}
+
+int main(int argc, char* argv[]) {
+    unsigned max_threads = (argc > 1) ? std::atoi(argv[1]) : ThreadPool::default_size();
+    std::vector<unsigned> thread_counts;
+    for (unsigned n = 1; n < max_threads; n *= 2) thread_counts.push_back(n);
+    thread_counts.push_back(std::max(max_threads, 1u));
+
+    struct BenchmarkSet {
+        std::string name;
+        TrainingData data;
+    };
+    std::vector<BenchmarkSet> datasets = {{"spiral_training_data.dat", {}},
+                                          {"generated_20000", generate_spirals(20000, 1)},
+                                          {"generated_200000", generate_spirals(200000, 2)}};
+    try {
+        datasets[0].data = load_training_data("spiral_training_data.dat");
+    } catch (const std::exception& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
+    }
+
+    struct Mode {
+        std::string name;
+        ParallelMode parallel_mode;
+        unsigned batch_size;
+    };
+    std::vector<Mode> modes = {{"deterministic_batch256", ParallelMode::Deterministic, 256},
+                               {"hogwild_per_sample", ParallelMode::Hogwild, 1},
+                               {"hogwild_batch32", ParallelMode::Hogwild, 32}};
+
+    std::ofstream out("parallel_training_scaling.dat");
+    out << "# dataset mode n_threads seconds_per_epoch samples_per_second speedup\n";
+    std::cout << "Training scaling, (2,16,16,1) network" << std::endl;
+    std::cout << std::left << std::setw(26) << "dataset" << std::setw(26) << "mode" << std::right
+              << std::setw(8) << "threads" << std::setw(14) << "s/epoch" << std::setw(14) << "samples/s"
+              << std::setw(10) << "speedup" << std::endl;
+
+    for (const auto& dataset : datasets) {
+        if (dataset.data.empty()) {
+            std::cerr << "Skipping " << dataset.name << " (no data)" << std::endl;
+            continue;
+        }
+        // Enough epochs for roughly 2 million samples per measurement
+        unsigned n_epochs = std::max(1u, unsigned(2000000 / dataset.data.size()));
+        for (const auto& mode : modes) {
+            double serial_seconds = 0.0;
+            for (unsigned n_threads : thread_counts) {
+                TrainingOptions options;
+                options.batch_size = mode.batch_size;
+                options.n_threads = n_threads;
+                options.parallel_mode = mode.parallel_mode;
+                options.log_stream = nullptr;
+                double seconds = seconds_per_epoch(dataset.data, options, n_epochs);
+                if (n_threads == 1) serial_seconds = seconds;
+                double samples_per_second = dataset.data.size() / seconds;
+
+                std::cout << std::left << std::setw(26) << dataset.name << std::setw(26) << mode.name << std::right
+                          << std::setw(8) << n_threads << std::setw(14) << std::setprecision(4) << seconds
+                          << std::setw(14) << samples_per_second << std::setw(10) << std::setprecision(3)
+                          << serial_seconds / seconds << std::endl;
+                out << dataset.name << " " << mode.name << " " << n_threads << " " << seconds << " "
+                    << samples_per_second << " " << serial_seconds / seconds << "\n";
+            }
+        }
+    }
+    std::cout << "Timings saved to parallel_training_scaling.dat." << std::endl;
+    return 0;
+}
@@ -0,0 +1,290 @@
+#include "project2_a.h"
+#include "grid_output.h"
+#include "dataset.h"
+#include "benchmark.h"
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace BasicDenseLinearAlgebra;
+
+// Microbenchmarks of the network's kernels over a range of layer widths and
+// depths, to track regressions and to size hardware for sweeps:
+//
+//   layer_forward          NeuralNetworkLayer::forward, one width x width
+//                          layer, one sample (per width)
+//   lu_solve               LULinearSolver::lu_solve, width x width system
+//                          (per width)
+//   feed_forward           NeuralNetwork::feed_forward, one sample
+//   backpropagation        NeuralNetwork::backpropagation, one sample
+//   train_epoch            one sweep of per-sample SGD through train()
+//   cost_for_training_data cost over the whole training set
+//   grid_output            write_grid_output on a grid of grid points
+//                          (text discarded)
+//
+// The last five run on networks 2 -> depth hidden layers of width -> 1
+// with tanh activations, for every width and depth. Every benchmark is
+// warmed up and timed over a number of repetitions; the table shows the
+// median and the 10th/90th percentiles of the time per call, and all
+// statistics are written as JSON.
+//
+// Usage: benchmark_suite [--widths 4,8,16,64,256,1024] [--depths 2,...,10]
+//            [--filter NAME] [--repetitions N] [--samples N]
+//            [--grid-points N] [--threads N] [--json FILE]
+//
+// --filter only runs benchmarks whose name contains NAME. --samples is the
+// size of the (synthetic) training set, --grid-points the number of grid
+// points per side, and --threads the threads used by write_grid_output.
+// Benchmarks whose single call takes longer than 50 ms are timed over
+// three single-call repetitions instead.
+
+struct SuiteSettings {
+    std::vector<unsigned> widths = {4, 8, 16, 64, 256, 1024};
+    std::vector<unsigned> depths = {2, 3, 4, 5, 6, 7, 8, 9, 10};
+    std::string filter;
+    unsigned repetitions = 11;
+    unsigned n_samples = 256;
+    unsigned grid_points = 32;
+    unsigned n_threads = 1;
+    std::string json_filename = "benchmark_suite.json";
+};
+
+struct BenchmarkRecord {
+    std::string name;
+    unsigned width = 0, depth = 0;
+    std::string unit; // what one call does, e.g. "sample" or "epoch"
+    TimingStatistics statistics;
+};
+
+class BenchmarkSuite {
+public:
+    explicit BenchmarkSuite(const SuiteSettings& settings) : settings(settings) {}
+
+    // Times f (one call = one unit) unless it is filtered out
+    template <class F>
+    void run(const std::string& name, unsigned width, unsigned depth, const std::string& unit, F&& f) {
+        if (!selected(name)) return;
+
+        // Long calls: a few single calls are enough
+        auto start = std::chrono::steady_clock::now();
+        f();
+        double probe_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        bool long_call = (probe_ns > 5.0e7);
+
+        BenchmarkRecord record;
+        record.name = name;
+        record.width = width;
+        record.depth = depth;
+        record.unit = unit;
+        record.statistics = long_call ? time_per_call(f, 3, 0.0) : time_per_call(f, settings.repetitions);
+        print(record);
+        records.push_back(record);
+    }
+
+    bool selected(const std::string& name) const {
+        return settings.filter.empty() || name.find(settings.filter) != std::string::npos;
+    }
+
+    void write_json(std::ostream& out) const {
+        out << "{\n";
+        out << "  \"benchmark\": \"benchmark_suite\",\n";
+        out << "  \"kernels\": \"" << Kernels::isa_name(Kernels::kernels().isa) << "\",\n";
+        out << "  \"grid_threads\": " << settings.n_threads << ",\n";
+        out << "  \"training_samples\": " << settings.n_samples << ",\n";
+        out << "  \"grid_points\": " << settings.grid_points << ",\n";
+        out << "  \"results\": [";
+        for (std::size_t r = 0; r < records.size(); ++r) {
+            const BenchmarkRecord& record = records[r];
+            const TimingStatistics& statistics = record.statistics;
+            out << (r == 0 ? "\n" : ",\n");
+            out << "    {\"name\": \"" << record.name << "\", \"width\": " << record.width
+                << ", \"depth\": " << record.depth << ", \"unit\": \"" << record.unit << "\""
+                << ", \"median_ns\": " << number(statistics.median_ns) << ", \"p10_ns\": " << number(statistics.p10_ns)
+                << ", \"p90_ns\": " << number(statistics.p90_ns) << ", \"min_ns\": " << number(statistics.min_ns)
+                << ", \"max_ns\": " << number(statistics.max_ns) << ", \"repetitions\": " << statistics.repetitions
+                << ", \"calls_per_repetition\": " << statistics.calls_per_repetition << "}";
+        }
+        out << "\n  ]\n}\n";
+    }
+
+private:
+    static std::string number(double value) {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%.6g", value);
+        return buffer;
+    }
+
+    static void print(const BenchmarkRecord& record) {
+        const TimingStatistics& statistics = record.statistics;
+        std::cout << std::left << std::setw(24) << record.name << std::right << std::setw(6) << record.width
+                  << std::setw(6) << record.depth << std::setw(14) << number(statistics.median_ns)
+                  << std::setw(14) << number(statistics.p10_ns) << std::setw(14) << number(statistics.p90_ns)
+                  << "  ns/" << record.unit << std::endl;
+    }
+
+    SuiteSettings settings;
+    std::vector<BenchmarkRecord> records;
+};
+
+// Training set of points in the unit square labelled +-1 by a circle
+Dataset synthetic_training_data(unsigned n_samples) {
+    std::mt19937 gen(1234);
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    Dataset data(2, 1);
+    for (unsigned s = 0; s < n_samples; ++s) {
+        double input[2], target[1];
+        input[0] = dist(gen);
+        input[1] = dist(gen);
+        double dx = input[0] - 0.5, dy = input[1] - 0.5;
+        target[0] = (dx * dx + dy * dy < 0.1) ? 1.0 : -1.0;
+        data.add_sample(input, target);
+    }
+    return data;
+}
+
+std::vector<unsigned> parse_sizes(const std::string& text) {
+    std::vector<unsigned> sizes;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        int size = std::stoi(item);
+        if (size <= 0) throw std::invalid_argument("Sizes must be positive: " + text);
+        sizes.push_back(size);
+    }
+    if (sizes.empty()) throw std::invalid_argument("No sizes in: " + text);
+    return sizes;
+}
+
+int main(int argc, char* argv[]) {
+    SuiteSettings settings;
+    try {
+        for (int a = 1; a < argc; ++a) {
+            std::string option = argv[a];
+            if (a + 1 >= argc) throw std::invalid_argument("Missing value for " + option);
+            std::string value = argv[++a];
+            if (option == "--widths") {
+                settings.widths = parse_sizes(value);
+            } else if (option == "--depths") {
+                settings.depths = parse_sizes(value);
+            } else if (option == "--filter") {
+                settings.filter = value;
+            } else if (option == "--repetitions") {
+                settings.repetitions = std::stoul(value);
+            } else if (option == "--samples") {
+                settings.n_samples = std::stoul(value);
+            } else if (option == "--grid-points") {
+                settings.grid_points = std::stoul(value);
+            } else if (option == "--threads") {
+                settings.n_threads = std::stoul(value);
+            } else if (option == "--json") {
+                settings.json_filename = value;
+            } else {
+                throw std::invalid_argument("Unknown option " + option);
+            }
+        }
+        if (settings.n_samples == 0) throw std::invalid_argument("--samples must be positive");
+    } catch (const std::exception& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [--widths 4,8,...] [--depths 2,3,...] [--filter NAME]"
+                  << " [--repetitions N] [--samples N] [--grid-points N] [--threads N] [--json FILE]" << std::endl;
+        return 1;
+    }
+
+    BenchmarkSuite suite(settings);
+    TanhActivationFunction tanh_act;
+    std::mt19937 gen(42);
+    Dataset training_data = synthetic_training_data(settings.n_samples);
+    std::vector<double> grid = uniform_grid_axis(0.0, 1.0, settings.grid_points);
+    NullBuffer null_buffer;
+    std::ostream null_stream(&null_buffer);
+
+    std::cout << std::left << std::setw(24) << "benchmark" << std::right << std::setw(6) << "width" << std::setw(6)
+              << "depth" << std::setw(14) << "median" << std::setw(14) << "p10" << std::setw(14) << "p90"
+              << std::endl;
+
+    // Single layers and linear solves: width only
+    for (unsigned width : settings.widths) {
+        NeuralNetworkLayer layer(width, width, &tanh_act);
+        std::normal_distribution<double> dist(0.0, 1.0);
+        for (unsigned i = 0; i < width; ++i) {
+            for (unsigned j = 0; j < width; ++j) layer.get_weights()(i, j) = dist(gen) / std::sqrt(double(width));
+            layer.get_biases()[i] = dist(gen);
+        }
+        DoubleVector input(width), z(width), output(width);
+        for (unsigned j = 0; j < width; ++j) input[j] = dist(gen);
+        suite.run("layer_forward", width, 1, "sample", [&]() { layer.forward(input, z, output); });
+
+        if (suite.selected("lu_solve")) {
+            // Diagonally dominant, so the solve is well conditioned
+            SquareDoubleMatrix matrix(width);
+            for (unsigned i = 0; i < width; ++i) {
+                for (unsigned j = 0; j < width; ++j) matrix(i, j) = dist(gen);
+                matrix(i, i) += width;
+            }
+            LULinearSolver solver;
+            suite.run("lu_solve", width, 0, "solve", [&]() { solver.lu_solve(matrix, input); });
+        }
+    }
+
+    // Whole networks: width and depth
+    for (unsigned width : settings.widths) {
+        for (unsigned depth : settings.depths) {
+            std::vector<std::pair<unsigned, ActivationFunction*>> layers_config(depth, {width, &tanh_act});
+            layers_config.emplace_back(1, &tanh_act);
+            NeuralNetwork net(2, layers_config);
+            net.initialise_parameters(gen);
+
+            NeuralNetworkWorkspace workspace = net.make_workspace();
+            DoubleVector output(1);
+            unsigned long next = 0;
+            suite.run("feed_forward", width, depth, "sample", [&]() {
+                DoubleVector input(2);
+                input[0] = training_data.input(next % settings.n_samples)[0];
+                input[1] = training_data.input(next++ % settings.n_samples)[1];
+                net.feed_forward(input, output);
+            });
+            suite.run("backpropagation", width, depth, "sample", [&]() {
+                unsigned long s = next++ % settings.n_samples;
+                net.backpropagation(training_data.input(s), training_data.target(s), workspace);
+            });
+
+            // One sweep: train() starts from freshly initialised parameters
+            // and stops after one iteration; no exact cost evaluation
+            if (suite.selected("train_epoch")) {
+                NeuralNetwork training_net = net;
+                std::mt19937 training_gen(7);
+                TrainingOptions options;
+                options.random_number_generator = &training_gen;
+                options.log_stream = nullptr;
+                options.exact_cost_interval = 0;
+                std::vector<double> cost_log;
+                suite.run("train_epoch", width, depth, "epoch", [&]() {
+                    cost_log.clear();
+                    training_net.train(training_data, 0.01, 0.0, 1, cost_log, 0.0, options);
+                });
+            }
+
+            NeuralNetworkWorkspace cost_workspace = net.make_workspace(std::min(settings.n_samples, 256u));
+            suite.run("cost_for_training_data", width, depth, "dataset", [&]() {
+                net.cost_for_training_data(training_data, cost_workspace);
+            });
+            suite.run("grid_output", width, depth, "grid", [&]() {
+                write_grid_output(net, grid, grid, null_stream, settings.n_threads);
+            });
+        }
+    }
+
+    std::ofstream json_file(settings.json_filename);
+    if (!json_file) {
+        std::cerr << "Error: Could not open " << settings.json_filename << " for writing." << std::endl;
+        return 1;
+    }
+    suite.write_json(json_file);
+    std::cout << "Results saved to " << settings.json_filename << "." << std::endl;
+    return 0;
+}
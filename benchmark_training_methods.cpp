@@ -0,0 +1,121 @@
+#include "project2_a.h"
+#include "dataset.h"
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Wall-clock time to reach a target cost with Levenberg-Marquardt and
+// L-BFGS training against plain per-sample SGD: the (2,3,3,1) network of
+// fix.cpp on
+// project_training_data.dat (target 1e-4, SGD learning rate 0.1, as in
+// fix.cpp), and the (2,8,8,1) and (2,16,16,1) networks on
+// spiral_training_data.dat (target 1e-2, SGD learning rate 0.01, as the
+// main_arch drivers train). All methods start from the same initial
+// parameters, for each of a few generator seeds, since the second-order
+// runs can also stop in a local minimum.
+//
+// Usage: benchmark_training_methods [sgd_iterations] [lm_iterations]
+//            [lbfgs_iterations]
+// (default: 20000 1000 5000)
+
+struct Problem {
+    const char* filename;
+    unsigned hidden_size;
+    double target_cost;
+    double sgd_learning_rate;
+};
+
+struct RunResult {
+    unsigned iterations = 0;
+    double seconds = 0.0;
+    double final_cost = 0.0;
+};
+
+RunResult train_network(const Dataset& training_data, const Problem& problem, TrainingMethod method,
+                        unsigned seed, unsigned max_iterations) {
+    TanhActivationFunction tanh_act;
+    NeuralNetwork net(2, {{problem.hidden_size, &tanh_act}, {problem.hidden_size, &tanh_act}, {1, &tanh_act}});
+
+    std::mt19937 gen(seed);
+    TrainingOptions options;
+    options.random_number_generator = &gen;
+    options.log_stream = nullptr;
+    options.method = method;
+    TrainingReport report;
+    options.report = &report;
+
+    std::vector<double> cost_log;
+    net.train(training_data, problem.sgd_learning_rate, problem.target_cost, max_iterations, cost_log, 0.0,
+              options);
+
+    RunResult result;
+    result.iterations = report.iterations;
+    result.seconds = report.seconds;
+    result.final_cost = report.final_cost;
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    unsigned sgd_iterations = (argc > 1) ? std::atoi(argv[1]) : 20000;
+    unsigned lm_iterations = (argc > 2) ? std::atoi(argv[2]) : 1000;
+    unsigned lbfgs_iterations = (argc > 3) ? std::atoi(argv[3]) : 5000;
+
+    const std::vector<Problem> problems = {
+        {"project_training_data.dat", 3, 1e-4, 0.1},
+        {"spiral_training_data.dat", 8, 1e-2, 0.01},
+        {"spiral_training_data.dat", 16, 1e-2, 0.01},
+    };
+    const std::vector<unsigned> seeds = {5489, 1, 2};
+
+    std::ofstream out("training_method_comparison.dat");
+    out << "# dataset architecture seed method iterations seconds final_cost reached\n";
+    std::cout << std::setw(26) << "dataset" << std::setw(11) << "network" << std::setw(6) << "seed"
+              << std::setw(8) << "method" << std::setw(11) << "iterations" << std::setw(10) << "seconds"
+              << std::setw(13) << "final cost" << std::setw(10) << "speedup" << std::endl;
+
+    for (const Problem& problem : problems) {
+        Dataset training_data;
+        try {
+            training_data = Dataset::load(problem.filename);
+        } catch (const std::exception& error) {
+            std::cerr << "Error: " << error.what() << std::endl;
+            return 1;
+        }
+        std::string architecture = "2-" + std::to_string(problem.hidden_size) + "-" +
+                                   std::to_string(problem.hidden_size) + "-1";
+
+        for (unsigned seed : seeds) {
+            RunResult sgd = train_network(training_data, problem, TrainingMethod::FirstOrder, seed, sgd_iterations);
+            RunResult lm = train_network(training_data, problem, TrainingMethod::LevenbergMarquardt, seed,
+                                         lm_iterations);
+            RunResult lbfgs = train_network(training_data, problem, TrainingMethod::LBFGS, seed, lbfgs_iterations);
+            bool sgd_reached = (sgd.final_cost <= problem.target_cost);
+
+            for (const auto& [name, result] : {std::make_pair("sgd", sgd), std::make_pair("lm", lm),
+                                               std::make_pair("lbfgs", lbfgs)}) {
+                bool reached = (result.final_cost <= problem.target_cost);
+                std::cout << std::setw(26) << problem.filename << std::setw(11) << architecture << std::setw(6)
+                          << seed << std::setw(8) << name << std::setw(11) << result.iterations << std::setw(10)
+                          << std::setprecision(4) << result.seconds << std::setw(13) << std::setprecision(4)
+                          << result.final_cost << std::setw(10);
+                // Speedup only means something if both reached the target
+                if (name != std::string("sgd") && sgd_reached && reached) {
+                    std::cout << std::setprecision(3) << sgd.seconds / result.seconds;
+                } else {
+                    std::cout << "-";
+                }
+                std::cout << (reached ? "" : "  (target not reached)") << std::endl;
+
+                out << problem.filename << " " << architecture << " " << seed << " " << name << " "
+                    << result.iterations << " " << result.seconds << " " << result.final_cost << " " << reached
+                    << "\n";
+            }
+        }
+    }
+    std::cout << "Results saved to training_method_comparison.dat." << std::endl;
+    return 0;
+}
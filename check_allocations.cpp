@@ -0,0 +1,158 @@
+#include "project2_a.h"
+#include "dataset.h"
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+// Checks that training does not touch the heap once its buffers exist.
+// Global operator new is replaced by a counting version; every training
+// step is warmed up on its workspace and then run 100 times with the
+// count watched. train() allocates its workspaces up front, so it is run
+// for 2 and for 20 iterations, and both runs must allocate the same
+// amount: the iterations in between allocate nothing.
+//
+// Usage: check_allocations (the exit status is 1 if anything allocates)
+
+std::atomic<unsigned long> n_allocations{0};
+
+void* counted_allocation(std::size_t size) {
+    ++n_allocations;
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void* counted_allocation(std::size_t size, std::align_val_t alignment) {
+    ++n_allocations;
+    std::size_t a = static_cast<std::size_t>(alignment);
+    void* p = std::aligned_alloc(a, (size + a - 1) / a * a);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(std::size_t size) { return counted_allocation(size); }
+void* operator new[](std::size_t size) { return counted_allocation(size); }
+void* operator new(std::size_t size, std::align_val_t alignment) { return counted_allocation(size, alignment); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return counted_allocation(size, alignment); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+bool all_passed = true;
+
+// Runs step once to warm up and then n_rounds times, and reports whether
+// those rounds allocated
+template <class F>
+void check(const std::string& name, F&& step, unsigned n_rounds = 100) {
+    step();
+    unsigned long before = n_allocations;
+    for (unsigned round = 0; round < n_rounds; ++round) step();
+    unsigned long count = n_allocations - before;
+    std::cout << (count == 0 ? "ok    " : "FAILED") << "  " << name << ": " << count << " allocations"
+              << std::endl;
+    if (count != 0) all_passed = false;
+}
+
+// Allocations of a whole train() run of n_iterations sweeps
+unsigned long train_allocations(NeuralNetwork& net, const Dataset& training_data, const TrainingOptions& options,
+                                unsigned n_iterations) {
+    std::vector<double> cost_log;
+    cost_log.reserve(n_iterations);
+    unsigned long before = n_allocations;
+    net.train(training_data, 0.01, 0.0, n_iterations, cost_log, 0.0, options);
+    return n_allocations - before;
+}
+
+// train() with these options must allocate the same for 2 and for 20
+// iterations
+void check_train(const std::string& name, NeuralNetwork& net, const Dataset& training_data,
+                 TrainingOptions options) {
+    std::mt19937 gen(5489);
+    options.random_number_generator = &gen;
+    options.log_stream = nullptr;
+    unsigned long short_run = train_allocations(net, training_data, options, 2);
+    unsigned long long_run = train_allocations(net, training_data, options, 20);
+    bool passed = (short_run == long_run);
+    std::cout << (passed ? "ok    " : "FAILED") << "  train, " << name << ": " << short_run << " allocations in 2 "
+              << "iterations, " << long_run << " in 20" << std::endl;
+    if (!passed) all_passed = false;
+}
+
+int main() {
+    Dataset training_data;
+    try {
+        training_data = Dataset::load("spiral_training_data.dat");
+    } catch (const std::exception& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
+        return 1;
+    }
+
+    TanhActivationFunction tanh_act;
+    NeuralNetwork net(2, {{16, &tanh_act}, {16, &tanh_act}, {1, &tanh_act}});
+    std::mt19937 gen(5489);
+    net.initialise_parameters(gen);
+
+    const unsigned batch_size = 32;
+    NeuralNetworkWorkspace workspace = net.make_workspace(batch_size);
+    DoubleVector input(2), target(1);
+    input[0] = training_data.input(0)[0];
+    input[1] = training_data.input(0)[1];
+    target[0] = training_data.target(0)[0];
+    unsigned long s = 0;
+    auto next_sample = [&]() { s = (s + 1) % training_data.n_samples(); };
+
+    check("sgd_step", [&]() {
+        net.sgd_step(training_data.input(s), training_data.target(s), 1e-3, 0.0, workspace);
+        next_sample();
+    });
+    check("sgd_step (DoubleVector)", [&]() { net.sgd_step(input, target, 1e-3, 0.0, workspace); });
+    check("backpropagation (single sample)", [&]() {
+        net.backpropagation(training_data.input(s), training_data.target(s), workspace);
+        next_sample();
+    });
+    check("backpropagation (DoubleVector)", [&]() { net.backpropagation(input, target, workspace); });
+    check("backpropagation (DatasetBatch)", [&]() {
+        net.backpropagation(training_data.batch(0, batch_size), workspace);
+    });
+    for (OptimizerKind kind : {OptimizerKind::SGD, OptimizerKind::Adam}) {
+        OptimizerOptions optimizer_options;
+        optimizer_options.kind = kind;
+        auto optimizer = net.make_optimizer(optimizer_options);
+        check(std::string("update_parameters (") + (kind == OptimizerKind::SGD ? "sgd" : "adam") + ")", [&]() {
+            optimizer.begin_step(1e-3);
+            net.update_parameters(workspace, optimizer, 1e-5);
+        });
+    }
+
+    TrainingOptions options;
+    check_train("per-sample sgd", net, training_data, options);
+    options.optimizer.kind = OptimizerKind::Adam;
+    check_train("per-sample adam", net, training_data, options);
+    options.batch_size = batch_size;
+    check_train("mini-batch adam", net, training_data, options);
+    options.optimizer.kind = OptimizerKind::SGD;
+    options.shuffle = true;
+    options.exact_cost_interval = 0;
+    check_train("mini-batch sgd, shuffled, running cost", net, training_data, options);
+    options.shuffle = false;
+    options.exact_cost_interval = 1;
+    options.n_threads = 2;
+    check_train("mini-batch sgd, 2 threads", net, training_data, options);
+    options.optimizer.kind = OptimizerKind::Adam;
+    check_train("mini-batch adam, 2 threads", net, training_data, options);
+    options.optimizer.kind = OptimizerKind::SGD;
+    options.parallel_mode = ParallelMode::Hogwild;
+    check_train("mini-batch sgd, 2 threads, Hogwild", net, training_data, options);
+
+    std::cout << (all_passed ? "No allocations in the training steps." : "Training steps allocate.") << std::endl;
+    return all_passed ? 0 : 1;
+}
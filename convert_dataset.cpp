@@ -0,0 +1,62 @@
+#include "dataset.h"
+#include <chrono>
+#include <iostream>
+#include <string>
+
+// Converts a text dataset (e.g. spiral_training_data.dat) to the binary
+// format that Dataset::map_binary maps, and reports how long loading each
+// version takes.
+//
+// Usage: convert_dataset input.dat output.bin
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " input.dat output.bin" << std::endl;
+        return 1;
+    }
+    std::string input_filename = argv[1];
+    std::string output_filename = argv[2];
+
+    try {
+        auto start = std::chrono::steady_clock::now();
+        Dataset text_dataset = Dataset::load_text(input_filename);
+        double text_seconds = seconds_since(start);
+        std::cout << "Read " << text_dataset.n_samples() << " samples (" << text_dataset.input_size()
+                  << " inputs, " << text_dataset.output_size() << " outputs) from " << input_filename << " in "
+                  << text_seconds * 1e3 << " ms." << std::endl;
+
+        text_dataset.save_binary(output_filename);
+
+        // Check the result and time the mapping
+        start = std::chrono::steady_clock::now();
+        Dataset mapped_dataset = Dataset::map_binary(output_filename);
+        double sum = 0.0;
+        for (unsigned long s = 0; s < mapped_dataset.n_samples(); ++s) {
+            sum += mapped_dataset.input(s)[0];
+        }
+        double mapped_seconds = seconds_since(start);
+
+        for (unsigned long s = 0; s < text_dataset.n_samples(); ++s) {
+            for (unsigned i = 0; i < text_dataset.input_size(); ++i) {
+                if (text_dataset.input(s)[i] != mapped_dataset.input(s)[i]) {
+                    throw std::runtime_error("Mapped file differs from " + input_filename);
+                }
+            }
+            for (unsigned i = 0; i < text_dataset.output_size(); ++i) {
+                if (text_dataset.target(s)[i] != mapped_dataset.target(s)[i]) {
+                    throw std::runtime_error("Mapped file differs from " + input_filename);
+                }
+            }
+        }
+        std::cout << "Wrote " << output_filename << "; mapping it and touching every sample took "
+                  << mapped_seconds * 1e3 << " ms (checksum " << sum << ")." << std::endl;
+    } catch (const std::exception& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
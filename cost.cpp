@@ -1,83 +1,109 @@
-#include "cost.h"
+#include "project2_a.h"
+#include "dataset.h"
+#include "benchmark.h"
 #include <iostream>
 #include <fstream>
 #include <vector>
-#include <chrono>
+#include <cstdlib>
 #include <iomanip>
 
 using namespace BasicDenseLinearAlgebra;
 
-void measure_costs(NeuralNetwork& net, const std::vector<std::pair<DoubleVector, DoubleVector>>& training_data, const std::string& output_file) {
+// Cost per sample of computing the gradient of the (2,4,4,1) network by
+// forward and central finite differences and by backpropagation (median
+// time per call, in nanoseconds), and the largest deviation between the
+// finite-difference and backpropagation gradients over the samples.
+//
+// Usage: cost [n_threads]
+// (threads used by the finite differences; default 1)
+
+void measure_costs(const NeuralNetwork& net, const Dataset& training_data, unsigned n_threads,
+                   const std::string& output_file) {
     std::ofstream out(output_file);
     if (!out.is_open()) {
         std::cerr << "Error: Could not open " << output_file << " for writing." << std::endl;
         return;
     }
 
-    out << "SampleIndex,FiniteDifferencingTime,BackpropagationTime\n";
-
-    for (size_t sample_idx = 0; sample_idx < training_data.size(); ++sample_idx) {
-        const auto& [input, target] = training_data[sample_idx];
-
-        // Measure finite differencing cost
-        auto start_fd = std::chrono::high_resolution_clock::now();
-        std::vector<DoubleMatrix> grad_w_fd(net.get_layer_count());
-        std::vector<DoubleVector> grad_b_fd(net.get_layer_count());
-        for (unsigned l = 0; l < net.get_layer_count(); ++l) {
-            grad_w_fd[l] = DoubleMatrix(net.get_weights(l).n(), net.get_weights(l).m());
-            grad_b_fd[l] = DoubleVector(net.get_biases(l).n());
-        }
-        net.compute_finite_difference(input, target, grad_w_fd, grad_b_fd);
-        auto end_fd = std::chrono::high_resolution_clock::now();
-        auto duration_fd = std::chrono::duration_cast<std::chrono::microseconds>(end_fd - start_fd).count();
-
-        // Measure backpropagation cost
-        auto start_bp = std::chrono::high_resolution_clock::now();
-        std::vector<DoubleMatrix> grad_w_bp(net.get_layer_count());
-        std::vector<DoubleVector> grad_b_bp(net.get_layer_count());
-        for (unsigned l = 0; l < net.get_layer_count(); ++l) {
-            grad_w_bp[l] = DoubleMatrix(net.get_weights(l).n(), net.get_weights(l).m());
-            grad_b_bp[l] = DoubleVector(net.get_biases(l).n());
-        }
-        net.compute_backpropagation(input, target, grad_w_bp, grad_b_bp);
-        auto end_bp = std::chrono::high_resolution_clock::now();
-        auto duration_bp = std::chrono::duration_cast<std::chrono::microseconds>(end_bp - start_bp).count();
-
-        // Output results to the file
-        out << sample_idx << "," << duration_fd << "," << duration_bp << "\n";
+    out << "SampleIndex,ForwardDifferenceNs,CentralDifferenceNs,BackpropagationNs\n";
+
+    FiniteDifferenceOptions forward_options, central_options;
+    forward_options.n_threads = n_threads;
+    central_options.scheme = FiniteDifferenceScheme::Central;
+    central_options.n_threads = n_threads;
+    FiniteDifferenceGradient forward_difference(forward_options), central_difference(central_options);
+
+    std::vector<DoubleMatrix> grad_w;
+    std::vector<DoubleVector> grad_b;
+    NeuralNetworkWorkspace workspace = net.make_workspace();
+
+    GradientCheckResult worst_forward, worst_central;
+    double total_forward_ns = 0.0, total_central_ns = 0.0, total_backpropagation_ns = 0.0;
+
+    for (unsigned long s = 0; s < training_data.n_samples(); ++s) {
+        const double* input = training_data.input(s);
+        const double* target = training_data.target(s);
+
+        double forward_ns = median_time_per_call_ns([&]() {
+            forward_difference.compute(net, input, target, grad_w, grad_b);
+        }, 5, 2.0e5);
+        double central_ns = median_time_per_call_ns([&]() {
+            central_difference.compute(net, input, target, grad_w, grad_b);
+        }, 5, 2.0e5);
+        double backpropagation_ns = median_time_per_call_ns([&]() {
+            net.backpropagation(input, target, workspace);
+        }, 5, 2.0e5);
+
+        total_forward_ns += forward_ns;
+        total_central_ns += central_ns;
+        total_backpropagation_ns += backpropagation_ns;
+        out << s << "," << forward_ns << "," << central_ns << "," << backpropagation_ns << "\n";
+
+        // Gradient check
+        DoubleVector input_vector(training_data.input_size()), target_vector(training_data.output_size());
+        for (unsigned i = 0; i < input_vector.n(); ++i) input_vector[i] = input[i];
+        for (unsigned i = 0; i < target_vector.n(); ++i) target_vector[i] = target[i];
+        GradientCheckResult forward_check = net.check_gradient(input_vector, target_vector, forward_options);
+        GradientCheckResult central_check = net.check_gradient(input_vector, target_vector, central_options);
+        if (forward_check.max_abs_deviation > worst_forward.max_abs_deviation) worst_forward = forward_check;
+        if (central_check.max_abs_deviation > worst_central.max_abs_deviation) worst_central = central_check;
     }
 
     out.close();
+
+    double n = training_data.n_samples();
+    std::cout << std::setprecision(4) << "Mean time per sample: forward differences " << total_forward_ns / n
+              << " ns, central differences " << total_central_ns / n << " ns, backpropagation "
+              << total_backpropagation_ns / n << " ns" << std::endl;
+    std::cout << "Largest deviation from backpropagation: forward differences " << worst_forward.max_abs_deviation
+              << ", central differences " << worst_central.max_abs_deviation << " (layer " << worst_central.layer
+              << (worst_central.is_bias ? ", bias " : ", weight ") << worst_central.row;
+    if (!worst_central.is_bias) std::cout << "," << worst_central.column;
+    std::cout << ")" << std::endl;
     std::cout << "Computational costs saved to " << output_file << std::endl;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    unsigned n_threads = (argc > 1) ? std::atoi(argv[1]) : 1;
+
     // Load the training data
-    std::vector<std::pair<DoubleVector, DoubleVector>> training_data;
-    std::ifstream training_file("project_training_data.dat");
-    if (!training_file.is_open()) {
-        std::cerr << "Error: Could not open project_training_data.dat" << std::endl;
+    Dataset training_data;
+    try {
+        training_data = Dataset::load("project_training_data.dat");
+    } catch (const std::exception& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
         return 1;
     }
 
-    double x1, x2, label;
-    while (training_file >> x1 >> x2 >> label) {
-        DoubleVector input(2), target(1);
-        input[0] = x1;
-        input[1] = x2;
-        target[0] = label;
-        training_data.emplace_back(input, target);
-    }
-    training_file.close();
-
-    std::cout << "Loaded " << training_data.size() << " training samples." << std::endl;
+    std::cout << "Loaded " << training_data.n_samples() << " training samples." << std::endl;
 
     // Define the network architecture
-    std::vector<unsigned> layers = {4, 4, 1};
-    NeuralNetwork net(2, layers);
+    TanhActivationFunction tanh_act;
+    NeuralNetwork net(2, {{4, &tanh_act}, {4, &tanh_act}, {1, &tanh_act}});
+    net.initialise_parameters();
 
     // Measure costs for finite differencing and backpropagation
-    measure_costs(net, training_data, "computational_cost_comparison.csv");
+    measure_costs(net, training_data, n_threads, "computational_cost_comparison.csv");
 
     return 0;
 }
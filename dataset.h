@@ -0,0 +1,393 @@
+#pragma once
+
+#include "dense_linear_algebra.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define DATASET_USE_MMAP
+#endif
+
+// Training/test sets as two flat arrays of doubles, all inputs in one and
+// all targets in the other, sample by sample. Compared with a vector of
+// (input, target) DoubleVector pairs (two heap blocks per sample), a sweep
+// over the set reads memory sequentially, and a batch of consecutive
+// samples is a view into the arrays. Sets are built in memory (64-byte
+// aligned), loaded from the text files, or memory-mapped from the binary
+// format below.
+//
+// Text files (spiral_training_data.dat, project_training_data.dat) start
+// with a header of three lines, the number of samples, the input size and
+// the output size, followed by one sample per line (inputs, then targets)
+// and optionally "end_of_file". Files without the header (whose first
+// line holds a whole sample) are read with the given default sizes.
+//
+// The binary format is the header below followed by all inputs and then
+// all targets, sample by sample, in native byte order. map_binary() maps
+// the file read-only and shared, so loading costs no parsing and no copy,
+// and processes that train on the same file at the same time share one
+// copy of it in the page cache.
+
+// 64-byte header of the binary format; the arrays start at 64-byte
+// aligned offsets
+struct DatasetFileHeader {
+    char magic[8];               // "NNDATA1"
+    std::uint32_t byte_order;    // Dataset_byte_order_mark as written
+    std::uint32_t input_size;
+    std::uint32_t output_size;
+    std::uint32_t unused;
+    std::uint64_t n_samples;
+    std::uint64_t inputs_offset;  // in bytes, from the start of the file
+    std::uint64_t targets_offset;
+    char padding[16];
+};
+static_assert(sizeof(DatasetFileHeader) == 64, "DatasetFileHeader must be 64 bytes");
+
+constexpr char Dataset_magic[8] = "NNDATA1";
+constexpr std::uint32_t Dataset_byte_order_mark = 0x01020304;
+
+// Contents of a file mapped read-only and shared (read into memory where
+// mmap is not available); the mapping lives as long as data does
+struct FileMapping {
+    std::shared_ptr<const void> data;
+    std::size_t size = 0;
+
+    const char* bytes() const { return static_cast<const char*>(data.get()); }
+};
+
+inline FileMapping map_file(const std::string& filename) {
+    FileMapping mapping;
+#ifdef DATASET_USE_MMAP
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Could not open " + filename);
+    struct stat file_status;
+    if (::fstat(fd, &file_status) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Could not stat " + filename);
+    }
+    std::size_t size = file_status.st_size;
+    if (size == 0) {
+        // mmap rejects empty files
+        ::close(fd);
+        mapping.data = std::make_shared<char>(0);
+        return mapping;
+    }
+    void* address = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED) throw std::runtime_error("Could not map " + filename);
+    mapping.data = std::shared_ptr<const void>(address, [size](const void* p) {
+        ::munmap(const_cast<void*>(p), size);
+    });
+    mapping.size = size;
+#else
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) throw std::runtime_error("Could not open " + filename);
+    auto buffer = std::make_shared<std::vector<char>>(std::istreambuf_iterator<char>(file),
+                                                      std::istreambuf_iterator<char>());
+    mapping.data = std::shared_ptr<const void>(buffer, buffer->data());
+    mapping.size = buffer->size();
+#endif
+    return mapping;
+}
+
+// Allocator for cache-line aligned buffers
+template <class T, std::size_t Alignment = 64>
+struct AlignedAllocator {
+    using value_type = T;
+    template <class U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+    template <class U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+    void deallocate(T* p, std::size_t) { ::operator delete(p, std::align_val_t(Alignment)); }
+
+    template <class U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <class U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+// View of n_samples consecutive samples of a Dataset
+struct DatasetBatch {
+    const double* inputs;
+    const double* targets;
+    unsigned long n_samples;
+    unsigned input_size, output_size;
+
+    const double* input(unsigned long s) const { return inputs + s * input_size; }
+    const double* target(unsigned long s) const { return targets + s * output_size; }
+};
+
+class Dataset {
+public:
+    Dataset() = default;
+
+    // Empty set with the given sizes, for add_sample
+    Dataset(unsigned input_size, unsigned output_size) : n_inputs(input_size), n_outputs(output_size) {}
+
+    // Copy of samples in the form NeuralNetwork::train used to take
+    explicit Dataset(const std::vector<std::pair<BasicDenseLinearAlgebra::DoubleVector,
+                                                 BasicDenseLinearAlgebra::DoubleVector>>& samples) {
+        if (samples.empty()) return;
+        n_inputs = samples.front().first.n();
+        n_outputs = samples.front().second.n();
+        owned_inputs.reserve(samples.size() * n_inputs);
+        owned_targets.reserve(samples.size() * n_outputs);
+        for (const auto& [input, target] : samples) {
+            if (input.n() != n_inputs || target.n() != n_outputs) {
+                throw std::invalid_argument("All samples must have the same input and target sizes.");
+            }
+            add_sample(input.data(), target.data());
+        }
+    }
+
+    // Binary files are mapped, anything else is read as text
+    static Dataset load(const std::string& filename, unsigned default_input_size = 2,
+                        unsigned default_output_size = 1) {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file) throw std::runtime_error("Could not open " + filename);
+        char magic[sizeof(Dataset_magic)] = {};
+        file.read(magic, sizeof(magic));
+        file.close();
+        if (std::memcmp(magic, Dataset_magic, sizeof(magic)) == 0) {
+            return map_binary(filename);
+        }
+        return load_text(filename, default_input_size, default_output_size);
+    }
+
+    static Dataset load_text(const std::string& filename, unsigned default_input_size = 2,
+                             unsigned default_output_size = 1) {
+        std::ifstream file(filename);
+        if (!file) throw std::runtime_error("Could not open " + filename);
+        std::stringstream contents;
+        contents << file.rdbuf();
+        std::string text = contents.str();
+
+        // The header is a first line with a single number
+        const char* position = text.c_str();
+        std::string first_line = text.substr(0, text.find('\n'));
+        std::istringstream first_line_stream(first_line);
+        std::string token;
+        unsigned n_tokens = 0;
+        while (first_line_stream >> token) ++n_tokens;
+
+        Dataset dataset(default_input_size, default_output_size);
+        unsigned long n_expected = 0;
+        bool has_header = (n_tokens == 1);
+        if (has_header) {
+            double header[3];
+            for (double& value : header) {
+                if (!read_number(position, value) || value < 0.0) {
+                    throw std::runtime_error("Invalid header in " + filename);
+                }
+            }
+            n_expected = header[0];
+            dataset.n_inputs = header[1];
+            dataset.n_outputs = header[2];
+            dataset.owned_inputs.reserve(n_expected * dataset.n_inputs);
+            dataset.owned_targets.reserve(n_expected * dataset.n_outputs);
+        }
+
+        std::vector<double> sample(dataset.n_inputs + dataset.n_outputs);
+        while (!has_header || dataset.count < n_expected) {
+            unsigned k = 0;
+            while (k < sample.size() && read_number(position, sample[k])) ++k;
+            if (k == 0 && !has_header) break;
+            if (k < sample.size()) {
+                throw std::runtime_error(filename + ": incomplete sample " + std::to_string(dataset.count + 1) +
+                                         (has_header ? " of " + std::to_string(n_expected) : std::string()));
+            }
+            dataset.add_sample(sample.data(), sample.data() + dataset.n_inputs);
+        }
+
+        // Only "end_of_file" may follow
+        std::istringstream rest(position);
+        if (rest >> token && (token != "end_of_file" || rest >> token)) {
+            throw std::runtime_error(filename + ": unexpected \"" + token + "\" after the last sample");
+        }
+        return dataset;
+    }
+
+    // Maps a file written by save_binary
+    static Dataset map_binary(const std::string& filename) {
+        Dataset dataset;
+        FileMapping file = map_file(filename);
+        std::size_t size = file.size;
+        const char* bytes = file.bytes();
+        if (size < sizeof(DatasetFileHeader)) throw std::runtime_error(filename + " is not a dataset file");
+        dataset.mapping = file.data;
+
+        DatasetFileHeader header;
+        std::memcpy(&header, bytes, sizeof(header));
+        if (std::memcmp(header.magic, Dataset_magic, sizeof(Dataset_magic)) != 0) {
+            throw std::runtime_error(filename + " is not a dataset file");
+        }
+        if (header.byte_order != Dataset_byte_order_mark) {
+            throw std::runtime_error(filename + " was written with a different byte order");
+        }
+        if (!section_fits(header.inputs_offset, header.n_samples, header.input_size, size) ||
+            !section_fits(header.targets_offset, header.n_samples, header.output_size, size)) {
+            throw std::runtime_error(filename + " is truncated or corrupt");
+        }
+
+        dataset.count = header.n_samples;
+        dataset.n_inputs = header.input_size;
+        dataset.n_outputs = header.output_size;
+        dataset.mapped_inputs = reinterpret_cast<const double*>(bytes + header.inputs_offset);
+        dataset.mapped_targets = reinterpret_cast<const double*>(bytes + header.targets_offset);
+        return dataset;
+    }
+
+    // Writes the file map_binary reads. It is written under a temporary
+    // name and renamed into place, so processes that have the old file
+    // mapped keep it intact and filename only ever holds a complete file.
+    void save_binary(const std::string& filename) const {
+        std::uint64_t inputs_bytes = std::uint64_t(count) * n_inputs * sizeof(double);
+        DatasetFileHeader header = {};
+        std::memcpy(header.magic, Dataset_magic, sizeof(Dataset_magic));
+        header.byte_order = Dataset_byte_order_mark;
+        header.input_size = n_inputs;
+        header.output_size = n_outputs;
+        header.n_samples = count;
+        header.inputs_offset = sizeof(DatasetFileHeader);
+        header.targets_offset = aligned_offset(header.inputs_offset + inputs_bytes);
+
+        std::string temporary_filename = filename + ".tmp";
+        std::ofstream file(temporary_filename, std::ios::binary);
+        if (!file) throw std::runtime_error("Could not open " + temporary_filename + " for writing");
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(inputs()), inputs_bytes);
+        std::vector<char> padding(header.targets_offset - header.inputs_offset - inputs_bytes, 0);
+        file.write(padding.data(), padding.size());
+        file.write(reinterpret_cast<const char*>(targets()), std::uint64_t(count) * n_outputs * sizeof(double));
+        file.close();
+        if (!file || std::rename(temporary_filename.c_str(), filename.c_str()) != 0) {
+            std::remove(temporary_filename.c_str());
+            throw std::runtime_error("Could not write " + filename);
+        }
+    }
+
+    void add_sample(const double* input, const double* target) {
+        if (is_mapped()) throw std::logic_error("Cannot add samples to a mapped dataset");
+        owned_inputs.insert(owned_inputs.end(), input, input + n_inputs);
+        owned_targets.insert(owned_targets.end(), target, target + n_outputs);
+        ++count;
+    }
+
+    unsigned long n_samples() const { return count; }
+    unsigned input_size() const { return n_inputs; }
+    unsigned output_size() const { return n_outputs; }
+    bool is_mapped() const { return mapping != nullptr; }
+
+    // All inputs (targets), n_samples() x input_size() (output_size()),
+    // sample by sample
+    const double* inputs() const { return is_mapped() ? mapped_inputs : owned_inputs.data(); }
+    const double* targets() const { return is_mapped() ? mapped_targets : owned_targets.data(); }
+
+    const double* input(unsigned long s) const { return inputs() + s * n_inputs; }
+    const double* target(unsigned long s) const { return targets() + s * n_outputs; }
+
+    // Samples [start, start + n_samples)
+    DatasetBatch batch(unsigned long start, unsigned long n_samples) const {
+        return DatasetBatch{input(start), target(start), n_samples, n_inputs, n_outputs};
+    }
+
+    // destination = the samples in the given order (a permutation or any
+    // other selection of sample indices). Reading is random but writing is
+    // sequential, so a training sweep in shuffled order can gather the
+    // samples once per epoch and then read destination sequentially.
+    // destination's buffers are reused.
+    void reorder(const std::vector<unsigned long>& order, Dataset& destination) const {
+        if (&destination == this) throw std::invalid_argument("Cannot reorder a dataset into itself.");
+        destination.mapping.reset();
+        destination.count = order.size();
+        destination.n_inputs = n_inputs;
+        destination.n_outputs = n_outputs;
+        destination.owned_inputs.resize(order.size() * n_inputs);
+        destination.owned_targets.resize(order.size() * n_outputs);
+        double* destination_input = destination.owned_inputs.data();
+        double* destination_target = destination.owned_targets.data();
+        for (unsigned long index : order) {
+            destination_input = std::copy(input(index), input(index) + n_inputs, destination_input);
+            destination_target = std::copy(target(index), target(index) + n_outputs, destination_target);
+        }
+    }
+
+    // Copy in the form of (input, target) pairs
+    std::vector<std::pair<BasicDenseLinearAlgebra::DoubleVector, BasicDenseLinearAlgebra::DoubleVector>>
+    training_data() const {
+        using BasicDenseLinearAlgebra::DoubleVector;
+        std::vector<std::pair<DoubleVector, DoubleVector>> samples;
+        samples.reserve(count);
+        for (unsigned long s = 0; s < count; ++s) {
+            DoubleVector input(n_inputs), target(n_outputs);
+            std::copy(this->input(s), this->input(s) + n_inputs, input.data());
+            std::copy(this->target(s), this->target(s) + n_outputs, target.data());
+            samples.emplace_back(std::move(input), std::move(target));
+        }
+        return samples;
+    }
+
+private:
+    // Parses the next number and advances position past it
+    static bool read_number(const char*& position, double& value) {
+        char* end;
+        value = std::strtod(position, &end);
+        if (end == position) return false;
+        position = end;
+        return true;
+    }
+
+    static std::uint64_t aligned_offset(std::uint64_t offset) { return (offset + 63) / 64 * 64; }
+
+    // Whether n_samples rows of row_size doubles at offset (after the
+    // header, aligned) lie within a file of file_size bytes. Checked by
+    // division, so no size taken from a corrupt header can overflow.
+    static bool section_fits(std::uint64_t offset, std::uint64_t n_samples, std::uint32_t row_size,
+                             std::uint64_t file_size) {
+        if (offset < sizeof(DatasetFileHeader) || offset % alignof(double) != 0 || offset > file_size) {
+            return false;
+        }
+        std::uint64_t row_bytes = std::uint64_t(row_size) * sizeof(double);
+        return row_bytes == 0 || n_samples <= (file_size - offset) / row_bytes;
+    }
+
+    unsigned long count = 0;
+    unsigned n_inputs = 0, n_outputs = 0;
+    std::vector<double, AlignedAllocator<double>> owned_inputs, owned_targets;
+
+    // Keeps the mapped file alive for all copies of the dataset
+    std::shared_ptr<const void> mapping;
+    const double* mapped_inputs = nullptr;
+    const double* mapped_targets = nullptr;
+};
+
+// Samples of a text or binary dataset file as (input, target) pairs
+inline std::vector<std::pair<BasicDenseLinearAlgebra::DoubleVector, BasicDenseLinearAlgebra::DoubleVector>>
+load_training_data(const std::string& filename) {
+    return Dataset::load(filename).training_data();
+}
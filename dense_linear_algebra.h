@@ -3,6 +3,8 @@
 
 
 // C++ includes
+#include<algorithm>
+#include<limits>
 #include<vector>
 #include<string>
 #include<fstream>
@@ -12,6 +14,12 @@
 #include<chrono>
 #include<iostream>
 
+// Low-level (vectorised) kernels
+#include "dense_linear_algebra_kernels.h"
+
+// Worker threads for the blocked LU factorisation
+#include "thread_pool.h"
+
 
 // ############################################################
 /// Helper file with functions/classes for basic linear algebra
@@ -29,18 +37,20 @@ namespace BasicDenseLinearAlgebra
  
 //===================================================
 /// Class for a dense general (not necessarily
-/// square) matrix of doubles
+/// square) matrix of scalars of type T (double or
+/// float)
 //===================================================
- class DoubleMatrix
+ template<class T>
+ class DenseMatrix
  {
  
  public:
 
   /// Constructor: Pass size (n rows, m columns)
-  DoubleMatrix(const unsigned& n, const unsigned& m) : N(n), M(m)
+  DenseMatrix(const unsigned& n, const unsigned& m) : N(n), M(m)
    {
     // Flat packed storage: a(i,j) = a_flat_packed(i*M+j) (row by row)
-    Matrix_storage.resize(N*M,0.0);
+    Matrix_storage.resize(N*M,T(0));
    }
   
   /// Number of rows
@@ -56,7 +66,7 @@ namespace BasicDenseLinearAlgebra
    }
  
   /// Const access to (i,j)-th entry
-  double operator()(const unsigned& i, const unsigned& j) const
+  T operator()(const unsigned& i, const unsigned& j) const
    {
 #ifdef RANGE_CHECKING
     assert(i<N);
@@ -66,7 +76,7 @@ namespace BasicDenseLinearAlgebra
    }
 
   /// Read/write access to (i,j)-th entry
-  double& operator()(const unsigned& i, const unsigned& j) 
+  T& operator()(const unsigned& i, const unsigned& j) 
    {
 #ifdef RANGE_CHECKING
     assert(i<N);
@@ -75,6 +85,18 @@ namespace BasicDenseLinearAlgebra
     return Matrix_storage[i*M+j];
    }
 
+  /// Pointer to the flat packed (row by row) storage
+  T* data()
+   {
+    return Matrix_storage.data();
+   }
+
+  /// Const pointer to the flat packed (row by row) storage
+  const T* data() const
+   {
+    return Matrix_storage.data();
+   }
+
   /// Output to std::cout
   void output() const
    {
@@ -157,7 +179,7 @@ namespace BasicDenseLinearAlgebra
 
   /// Entries are flat packed, row by row:
   /// a(i,j) = a_flat_packed(i*M+j) (row by row)
-  std::vector<double> Matrix_storage;
+  std::vector<T> Matrix_storage;
 
   
  };
@@ -170,15 +192,17 @@ namespace BasicDenseLinearAlgebra
 
  
 //===================================================
-/// Class for a dense square matrix of doubles
+/// Class for a dense square matrix of scalars of
+/// type T
 //===================================================
- class SquareDoubleMatrix : public DoubleMatrix
+ template<class T>
+ class SquareDenseMatrix : public DenseMatrix<T>
  {
 
  public:
 
   /// Constructor: Pass size
-  SquareDoubleMatrix(const unsigned& n) : DoubleMatrix(n,n)
+  SquareDenseMatrix(const unsigned& n) : DenseMatrix<T>(n,n)
    {}
   
  };
@@ -191,18 +215,19 @@ namespace BasicDenseLinearAlgebra
 
  
 //===================================================
-/// Class for a vector of doubles
+/// Class for a vector of scalars of type T
 //===================================================
- class DoubleVector
+ template<class T>
+ class DenseVector
  {
  
  public:
  
   /// Constructor: Pass size
-  DoubleVector(const unsigned& n=0) : N(n)
+  DenseVector(const unsigned& n=0) : N(n)
    {
     // Resize storage and initialise entries to zero
-    Vector_storage.resize(N,0.0);
+    Vector_storage.resize(N,T(0));
    }
 
   
@@ -213,7 +238,7 @@ namespace BasicDenseLinearAlgebra
    }
  
   /// Const access to i-th entry
-  double operator[](const unsigned& i) const
+  T operator[](const unsigned& i) const
    {
 #ifdef RANGE_CHECKING
     assert(i<N);
@@ -222,7 +247,7 @@ namespace BasicDenseLinearAlgebra
    }
 
   /// Read/write access to i-th entry
-  double& operator[](const unsigned& i)
+  T& operator[](const unsigned& i)
    {
 #ifdef RANGE_CHECKING
     assert(i<N);
@@ -234,10 +259,22 @@ namespace BasicDenseLinearAlgebra
  void resize(const unsigned& n)
   {
    N=n;
-   Vector_storage.resize(n,0.0);
+   Vector_storage.resize(n,T(0));
   }
 
 
+  /// Pointer to the storage
+  T* data()
+   {
+    return Vector_storage.data();
+   }
+
+  /// Const pointer to the storage
+  const T* data() const
+   {
+    return Vector_storage.data();
+   }
+
   /// Output to std::cout
   void output() const
    {
@@ -301,13 +338,32 @@ namespace BasicDenseLinearAlgebra
   // N from the outside so the two stay in sync.
   unsigned N;
  
-  /// Entries are stored internally as a std::vector of doubles
-  std::vector<double> Vector_storage;
+  /// Entries are stored internally as a std::vector of T
+  std::vector<T> Vector_storage;
  
  };
 
 
 
+/////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////
+
+
+ /// Double precision containers (used throughout)
+ typedef DenseMatrix<double> DoubleMatrix;
+ typedef SquareDenseMatrix<double> SquareDoubleMatrix;
+ typedef DenseVector<double> DoubleVector;
+
+ /// Single precision containers
+ typedef DenseMatrix<float> FloatMatrix;
+ typedef SquareDenseMatrix<float> SquareFloatMatrix;
+ typedef DenseVector<float> FloatVector;
+
+
+
+
+
 
 /////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////
@@ -342,6 +398,13 @@ namespace BasicDenseLinearAlgebra
 /////////////////////////////////////////////////////////////
 
  
+// The solvers' own loops must round like the kernels they share their
+// work with (see dense_linear_algebra_kernels.h), so gcc must not
+// contract them into fused multiply-adds either
+#ifdef __GNUC__
+#pragma GCC push_options
+#pragma GCC optimize ("fp-contract=off")
+#endif
  
 //=============================================================================
 /// Dense LU decomposition-based solver
@@ -365,13 +428,86 @@ namespace BasicDenseLinearAlgebra
   DoubleVector lu_solve(const SquareDoubleMatrix&  matrix,
                         const DoubleVector& rhs); 
 
+  /// Perform the LU decomposition of the matrix and keep the
+  /// LU factors and the permutation index for any number of
+  /// subsequent solves. Throws a LinearSolverError if the matrix
+  /// is singular (and then there are no factors to solve with).
+  void factorise(const SquareDoubleMatrix& matrix);
+
+  /// Use the blocked, right-looking factorisation (the default):
+  /// the matrix is factorised one panel of columns at a time, and
+  /// the rest of the matrix is updated with the vectorised
+  /// matrix-matrix kernel, spread over the thread pool (if any).
+  /// Every entry receives the same updates in the same order as
+  /// in Crout's algorithm, so the factors are the same.
+  void enable_blocked_factorisation()
+   {
+    Use_blocked_factorisation=true;
+   }
+
+  /// Use Crout's (unblocked, left-looking) algorithm instead
+  void disable_blocked_factorisation()
+   {
+    Use_blocked_factorisation=false;
+   }
+
+  /// Number of columns per panel in the blocked factorisation
+  void set_block_size(const unsigned& block_size)
+   {
+    if (block_size==0)
+     {
+      throw LinearSolverError("The block size must be positive");
+     }
+    Block_size=block_size;
+   }
+
+  /// Threads for the trailing-matrix updates of the blocked
+  /// factorisation (not owned by the solver; null: serial). The
+  /// factors do not depend on the number of threads.
+  void set_thread_pool(ThreadPool* pool)
+   {
+    Thread_pool_pt=pool;
+   }
+
+  /// Has a matrix been factorised (by factorise or lu_solve)?
+  bool is_factorised() const
+   {
+    return Factorised;
+   }
+
+  /// Solve with the LU factors of the last matrix: O(n^2)
+  DoubleVector solve(const DoubleVector& rhs) const;
+
+  /// Solve for a block of right-hand sides, one per column of
+  /// the n x m matrix rhs; returns the solutions as the columns
+  /// of an n x m matrix. The substitutions sweep entire rows of
+  /// the block with the vectorised rank-1 update kernel, and
+  /// every column is computed exactly (bitwise) as solve would
+  /// compute it on its own.
+  DoubleMatrix solve(const DoubleMatrix& rhs) const;
+
  private:
 
-  /// Perform the LU decomposition of the matrix
-  void factorise(const SquareDoubleMatrix& matrix);
- 
   /// Do the backsubstitution step to solve the system LU result = rhs
-  DoubleVector backsub(const DoubleVector& rhs);
+  DoubleVector backsub(const DoubleVector& rhs) const;
+
+  /// Check that there are LU factors for n unknowns
+  void check_factorised(const unsigned& n) const;
+
+  /// Crout's algorithm on the n x n matrix in LU_factors
+  void crout_factorisation(const unsigned& n);
+
+  /// Blocked right-looking algorithm on the n x n matrix in LU_factors
+  void blocked_factorisation(const unsigned& n);
+
+  /// Pivot search in column j (rows j and below), row swap in the
+  /// columns [0, panel_end) and elimination within the panel
+  void pivot_column(const unsigned& n, const unsigned& j,
+                    const unsigned& panel_end);
+
+  /// Trailing-matrix update A22 -= L21 U12 for the panel [k, k_end)
+  void update_trailing_matrix(const unsigned& n, const unsigned& k,
+                              const unsigned& k_end);
 
   /// Storage for the index of permutations in the LU solve
   /// (used to handle pivoting)
@@ -379,6 +515,18 @@ namespace BasicDenseLinearAlgebra
  
   /// Storage for the LU decomposition (flat-packed into nxn vector)
   std::vector<double> LU_factors;
+
+  /// Are Index and LU_factors those of a complete factorisation?
+  bool Factorised=false;
+
+  /// Use the blocked factorisation?
+  bool Use_blocked_factorisation=true;
+
+  /// Columns per panel in the blocked factorisation
+  unsigned Block_size=64;
+
+  /// Threads for the blocked factorisation (null: serial)
+  ThreadPool* Thread_pool_pt=nullptr;
  
  };
 
@@ -411,6 +559,9 @@ namespace BasicDenseLinearAlgebra
  {
   // Set the number of unknowns
   const unsigned n = matrix.n();
+
+  // Not until we've got through the whole matrix
+  Factorised = false;
    
   // Allocate storage for the LU factors and the permutation index
   // set entries to zero.
@@ -428,7 +579,27 @@ namespace BasicDenseLinearAlgebra
       ++count;
      }
    }
+
+  if (Use_blocked_factorisation)
+   {
+    blocked_factorisation(n);
+   }
+  else
+   {
+    crout_factorisation(n);
+   }
+ 
+  Factorised = true;
+ }
  
+
+
+//=============================================================================
+/// Crout's algorithm: column j of L and U is computed from the
+/// columns to its left with dot products.
+//=============================================================================
+ void LULinearSolver::crout_factorisation(const unsigned& n)
+ {
   // Loop over columns
   for (unsigned j = 0; j < n; j++)
    {
@@ -503,14 +674,203 @@ namespace BasicDenseLinearAlgebra
    
    } // End of loop over columns
  
- 
  }
- 
+
+
+
+//=============================================================================
+/// Blocked right-looking LU decomposition with partial pivoting. For
+/// each panel of columns [k, k_end):
+/// - the panel (rows k and below) is factorised column by column, with
+///   rank-1 updates that are confined to the panel;
+/// - its row swaps are applied to the columns right of it (pivoting
+///   swaps the rest of the rows right away);
+/// - the block row U12 to the right of the panel is solved with the unit
+///   lower triangle L11 of the panel;
+/// - the trailing matrix is updated: A22 -= L21 U12, which is where
+///   almost all the work is, as one matrix-matrix product.
+/// Each entry is reduced by its products l_ik u_kj in order of k, as
+/// in Crout's algorithm, so the pivots, the factors and the error for a
+/// singular matrix are the same (none of the kernels fuse a multiply
+/// and an add).
+//=============================================================================
+ void LULinearSolver::blocked_factorisation(const unsigned& n)
+ {
+  double* a = LU_factors.data();
+  for (unsigned k = 0; k < n; k += Block_size)
+   {
+    const unsigned k_end = std::min(n, k + Block_size);
+
+    // Factorise the panel
+    for (unsigned j = k; j < k_end; j++)
+     {
+      pivot_column(n, j, k_end);
+     }
+
+    // Apply the panel's row swaps to the columns right of it
+    for (unsigned j = k; j < k_end; j++)
+     {
+      unsigned imax = Index[j];
+      if (imax != j)
+       {
+        std::swap_ranges(a + std::size_t(n) * j + k_end,
+                         a + std::size_t(n) * (j + 1),
+                         a + std::size_t(n) * imax + k_end);
+       }
+     }
+
+    if (k_end == n)
+     {
+      break;
+     }
+
+    // U12 = L11^{-1} A12, one row of A12 at a time
+    std::vector<double> l_column(k_end - k);
+    for (unsigned j = k; j + 1 < k_end; j++)
+     {
+      for (unsigned i = j + 1; i < k_end; i++)
+       {
+        l_column[i - k] = a[std::size_t(n) * i + j];
+       }
+      Kernels::ger(k_end - j - 1, n - k_end, -1.0, &l_column[j + 1 - k],
+                   a + std::size_t(n) * j + k_end,
+                   a + std::size_t(n) * (j + 1) + k_end, n);
+     }
+
+    update_trailing_matrix(n, k, k_end);
+   }
+ }
+
+
+
+//=============================================================================
+/// Pivoting and elimination for column j of the panel [.., panel_end):
+/// find the largest entry in column j on or below the diagonal, swap its
+/// row with row j (in the columns up to panel_end), divide the column below
+/// the diagonal by the pivot and subtract the resulting rank-1 update
+/// from the panel columns right of j.
+//=============================================================================
+ void LULinearSolver::pivot_column(const unsigned& n, const unsigned& j,
+                                   const unsigned& panel_end)
+ {
+  double* a = LU_factors.data();
+
+  // Initialise search for largest pivot element
+  unsigned imax = j;
+  double largest_entry = 0.0;
+  for (unsigned i = j; i < n; i++)
+   {
+    double tmp = std::fabs(a[std::size_t(n) * i + j]);
+    if (tmp >= largest_entry)
+     {
+      largest_entry = tmp;
+      imax = i;
+     }
+   }
+
+  // Swap rows j and imax up to the end of the panel (the rest of the
+  // rows is swapped when the panel is done)
+  if (imax != j)
+   {
+    std::swap_ranges(a + std::size_t(n) * j, a + std::size_t(n) * j + panel_end,
+                     a + std::size_t(n) * imax);
+   }
+  Index[j] = imax;
+
+  if (j == n - 1)
+   {
+    return;
+   }
+
+  // Divide by pivot element
+  double pivot = a[std::size_t(n) * j + j];
+  if (pivot == 0.0)
+   {
+    std::string error_message=
+     "Singular matrix: zero pivot in row "+std::to_string(j);
+    throw LinearSolverError(error_message.c_str());
+   }
+  double tmp = 1.0 / pivot;
+  std::vector<double> l_column(n - j - 1);
+  for (unsigned i = j + 1; i < n; i++)
+   {
+    a[std::size_t(n) * i + j] *= tmp;
+    l_column[i - j - 1] = a[std::size_t(n) * i + j];
+   }
+
+  // Rank-1 update of the rest of the panel
+  if (j + 1 < panel_end)
+   {
+    Kernels::ger(n - j - 1, panel_end - j - 1, -1.0, l_column.data(),
+                 a + std::size_t(n) * j + j + 1,
+                 a + std::size_t(n) * (j + 1) + j + 1, n);
+   }
+ }
+
+
+
+//=============================================================================
+/// A22 -= L21 U12 for the panel [k, k_end): the rows of A22 are shared
+/// out between the threads (in multiples of the kernel's 4-row register
+/// block), and each thread works through its rows in blocks of columns,
+/// so the part of U12 it reads stays in cache. Each entry subtracts its
+/// products in the same order however the work is split, so the result
+/// does not depend on the number of threads.
+//=============================================================================
+ void LULinearSolver::update_trailing_matrix(const unsigned& n,
+                                             const unsigned& k,
+                                             const unsigned& k_end)
+ {
+  double* a = LU_factors.data();
+  const unsigned n_rows = n - k_end;
+  const unsigned width = k_end - k;
+
+  // Columns per block of U12
+  const unsigned column_block = 256;
+
+  auto update_rows = [&](unsigned row_begin, unsigned row_end)
+   {
+    for (unsigned c = k_end; c < n; c += column_block)
+     {
+      unsigned n_columns = std::min(column_block, n - c);
+      Kernels::gemm_sub(row_end - row_begin, width, n_columns,
+                        a + std::size_t(n) * row_begin + k, n,
+                        a + std::size_t(n) * k + c, n,
+                        a + std::size_t(n) * row_begin + c, n);
+     }
+   };
+
+  // Not worth waking the threads for a small update
+  unsigned n_threads = (Thread_pool_pt == nullptr) ? 1 : Thread_pool_pt->size();
+  if (std::size_t(n_rows) * n_rows * width < 1000000)
+   {
+    n_threads = 1;
+   }
+  if (n_threads == 1)
+   {
+    update_rows(k_end, n);
+    return;
+   }
+
+  const unsigned rows_per_thread = ((n_rows + n_threads - 1) / n_threads + 3) / 4 * 4;
+  Thread_pool_pt->run([&](unsigned t)
+                      {
+                       unsigned row_begin = std::min(n, k_end + t * rows_per_thread);
+                       unsigned row_end = std::min(n, row_begin + rows_per_thread);
+                       if (row_begin < row_end)
+                        {
+                         update_rows(row_begin, row_end);
+                        }
+                      });
+ }
+
+
+
 
 //=============================================================================
 /// Do the backsubstitution for the DenseLU solver.
 //=============================================================================
- DoubleVector LULinearSolver::backsub(const DoubleVector& rhs)
+ DoubleVector LULinearSolver::backsub(const DoubleVector& rhs) const
  {
  
   // Initially copy the rhs vector into the result vector
@@ -560,6 +920,470 @@ namespace BasicDenseLinearAlgebra
 
 
 
+//=============================================================================
+/// Check that there are LU factors for n unknowns
+//=============================================================================
+ void LULinearSolver::check_factorised(const unsigned& n) const
+ {
+  if (!Factorised)
+   {
+    throw LinearSolverError("No LU factors to solve with: "
+                            "factorise a matrix first");
+   }
+  if (n*n != LU_factors.size())
+   {
+    throw LinearSolverError("Right-hand side has "+std::to_string(n)+
+                            " rows, but the factorised matrix has "+
+                            std::to_string(Index.size()));
+   }
+ }
+
+
+
+
+//=============================================================================
+/// Solve with the stored LU factors
+//=============================================================================
+ DoubleVector LULinearSolver::solve(const DoubleVector& rhs) const
+ {
+  check_factorised(rhs.n());
+  return backsub(rhs);
+ }
+
+
+
+
+//=============================================================================
+/// Solve for a block of right-hand sides (the columns of rhs). Same
+/// operations as backsub, but each one acts on an entire row of the
+/// block (one entry per right-hand side) through Kernels::ger:
+/// row_i += (-l) row_j gives l_i - l*row_j bitwise, since negation is
+/// exact. The forward substitution applies the row swaps first (backsub
+/// only swaps entries it has not used yet, so this is equivalent), then
+/// eliminates column by column: the rows below row j are updated with
+/// one kernel call, in the same order as backsub's sums. backsub skips
+/// the leading zeros of the rhs, which only drops terms l*0.
+//=============================================================================
+ DoubleMatrix LULinearSolver::solve(const DoubleMatrix& rhs) const
+ {
+  const unsigned n = rhs.n();
+  const unsigned m = rhs.m();
+  check_factorised(n);
+  DoubleMatrix result(rhs);
+  double* b = result.data();
+
+  // Row swaps
+  for (unsigned i = 0; i < n; i++)
+   {
+    unsigned ip = Index[i];
+    if (ip != i)
+     {
+      std::swap_ranges(b + std::size_t(m) * i, b + std::size_t(m) * (i + 1),
+                       b + std::size_t(m) * ip);
+     }
+   }
+
+  // Forward substitution with the unit lower triangle: column j of L
+  // (below the diagonal) is gathered so the kernel can read it
+  std::vector<double> l_column(n);
+  for (unsigned j = 0; j + 1 < n; j++)
+   {
+    for (unsigned i = j + 1; i < n; i++)
+     {
+      l_column[i] = LU_factors[n * i + j];
+     }
+    Kernels::ger(n - j - 1, m, -1.0, &l_column[j + 1],
+                 b + std::size_t(m) * j, b + std::size_t(m) * (j + 1), m);
+   }
+
+  // Back substitution with the upper triangle, one row at a time
+  const double one = 1.0;
+  for (int i = n - 1; i >= 0; i--)
+   {
+    double* row = b + std::size_t(m) * i;
+    for (unsigned j = i + 1; j < n; j++)
+     {
+      Kernels::ger(1, m, -LU_factors[n * i + j], &one,
+                   b + std::size_t(m) * j, row, m);
+     }
+    double pivot = LU_factors[n * i + i];
+    for (unsigned k = 0; k < m; k++)
+     {
+      row[k] /= pivot;
+     }
+   }
+
+  return result;
+ }
+
+
+
+
+////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////
+
+
+
+//=============================================================================
+/// LU solver for many small, independent systems A_s x_s = b_s
+/// (s = 0, ..., k-1) of the same size n. The systems are copied into
+/// interleaved batches of Kernels::Batch_lanes systems (entry by entry),
+/// so the vectorised batch kernels factorise and solve all systems of a
+/// batch in lockstep, one per SIMD lane. The batches are shared out
+/// between the threads of the thread pool (if any). A singular system
+/// does not stop the others: it is flagged, rather than reported by a
+/// LinearSolverError.
+//=============================================================================
+ class BatchedLULinearSolver
+ {
+
+ public:
+
+  /// Constructor
+  BatchedLULinearSolver() {}
+
+  /// Destructor
+  ~BatchedLULinearSolver() {}
+
+  /// Threads to share the batches between (not owned by the solver;
+  /// null: serial)
+  void set_thread_pool(ThreadPool* pool)
+   {
+    Thread_pool_pt=pool;
+   }
+
+  /// Number of columns per panel: the matrices of a batch are
+  /// factorised like LULinearSolver's (blocked) factorisation
+  void set_block_size(const unsigned& block_size)
+   {
+    if (block_size==0)
+     {
+      throw LinearSolverError("The block size must be positive");
+     }
+    Block_size=block_size;
+   }
+
+  /// Solve the k systems whose n x n matrices are packed one after
+  /// the other (each row by row) in matrices, for the right-hand sides
+  /// packed in rhs (k*n values); returns the solutions, packed like
+  /// rhs. singular[s] is set if system s has a zero pivot (even if
+  /// only the last one is zero, which LULinearSolver lets through),
+  /// and its solution is then NaN. Every other system is solved exactly
+  /// (bitwise) as LULinearSolver::lu_solve would solve it on its own.
+  std::vector<double> solve(const unsigned& n,
+                            const std::vector<double>& matrices,
+                            const std::vector<double>& rhs,
+                            std::vector<bool>& singular) const;
+
+ private:
+
+  /// Factorise and solve one interleaved batch in place. Entry (i,j)
+  /// of the matrix in lane l is a[(i*n+j)*Batch_lanes+l] and entry i of
+  /// its rhs is b[i*Batch_lanes+l]; index (n*Batch_lanes values) is
+  /// workspace for the pivot rows. Sets singular[l] for the lanes with
+  /// a zero pivot.
+  void solve_batch(const unsigned& n, double* a, double* b,
+                   unsigned* index, char* singular) const;
+
+  /// Copy the first n_systems of the packed vectors of size (each
+  /// n_values long) into the lanes of the interleaved vector
+  /// interleaved
+  void interleave(const std::size_t& n_values, const unsigned& n_systems,
+                  const double* packed, double* interleaved) const
+   {
+    const unsigned lanes = Kernels::Batch_lanes;
+    if (n_systems == lanes)
+     {
+      // (A constant number of lanes in the inner loop)
+      for (std::size_t e = 0; e < n_values; e++)
+       {
+        for (unsigned l = 0; l < lanes; l++)
+         {
+          interleaved[e * lanes + l] = packed[l * n_values + e];
+         }
+       }
+     }
+    else
+     {
+      for (std::size_t e = 0; e < n_values; e++)
+       {
+        for (unsigned l = 0; l < n_systems; l++)
+         {
+          interleaved[e * lanes + l] = packed[l * n_values + e];
+         }
+       }
+     }
+   }
+
+  /// In every lane l, swap row j with row imax[l] in the columns
+  /// [c_begin, c_end) of the interleaved matrices a
+  void swap_rows(const unsigned& n, double* a, const unsigned& j,
+                 const unsigned* imax, const unsigned& c_begin,
+                 const unsigned& c_end) const
+   {
+    const unsigned lanes = Kernels::Batch_lanes;
+    const std::size_t row = std::size_t(n) * lanes;
+    double* row_j = a + j * row;
+    for (unsigned l = 0; l < lanes; l++)
+     {
+      double* row_imax = a + imax[l] * row;
+      if (imax[l] != j)
+       {
+        for (unsigned c = c_begin; c < c_end; c++)
+         {
+          std::swap(row_j[c * lanes + l], row_imax[c * lanes + l]);
+         }
+       }
+     }
+   }
+
+  /// Columns per panel in the factorisation of a batch
+  unsigned Block_size=16;
+
+  /// Threads for the batches (null: serial)
+  ThreadPool* Thread_pool_pt=nullptr;
+
+ };
+
+
+
+
+//=============================================================================
+/// Solve the packed systems, batch by batch. The last batch is padded
+/// with identity matrices.
+//=============================================================================
+ std::vector<double> BatchedLULinearSolver::solve(
+  const unsigned& n,
+  const std::vector<double>& matrices,
+  const std::vector<double>& rhs,
+  std::vector<bool>& singular) const
+ {
+  const unsigned lanes = Kernels::Batch_lanes;
+  const std::size_t n_entries = std::size_t(n) * n;
+  if (n == 0 || rhs.size() % n != 0 || matrices.size() != rhs.size() * n)
+   {
+    throw LinearSolverError("Batched solve needs k matrices of size "+
+                            std::to_string(n)+"x"+std::to_string(n)+
+                            " and k right-hand sides of size "+
+                            std::to_string(n));
+   }
+  const std::size_t k = rhs.size() / n;
+  const std::size_t n_batches = (k + lanes - 1) / lanes;
+  std::vector<double> solutions(rhs.size());
+
+  // One flag per lane (not a vector<bool>, which the threads could not
+  // write to concurrently)
+  std::vector<char> lane_singular(n_batches * lanes, 0);
+
+  // Batches first, first + stride, ...
+  auto solve_batches = [&](std::size_t first, std::size_t stride)
+   {
+    std::vector<double> a(n_entries * lanes);
+    std::vector<double> b(std::size_t(n) * lanes);
+    std::vector<unsigned> index(std::size_t(n) * lanes);
+    for (std::size_t batch = first; batch < n_batches; batch += stride)
+     {
+      const std::size_t first_system = batch * lanes;
+      const unsigned n_systems = std::min<std::size_t>(lanes, k - first_system);
+
+      // Interleave
+      interleave(n_entries, n_systems, &matrices[first_system * n_entries], a.data());
+      interleave(n, n_systems, &rhs[first_system * n], b.data());
+
+      // Pad the last batch with identity matrices
+      for (unsigned l = n_systems; l < lanes; l++)
+       {
+        for (std::size_t e = 0; e < n_entries; e++)
+         {
+          a[e * lanes + l] = 0.0;
+         }
+        for (unsigned i = 0; i < n; i++)
+         {
+          a[(std::size_t(i) * n + i) * lanes + l] = 1.0;
+          b[i * lanes + l] = 0.0;
+         }
+       }
+
+      solve_batch(n, a.data(), b.data(), index.data(),
+                  &lane_singular[first_system]);
+
+      for (unsigned l = 0; l < n_systems; l++)
+       {
+        double* x = &solutions[(first_system + l) * n];
+        for (unsigned i = 0; i < n; i++)
+         {
+          x[i] = lane_singular[first_system + l] ?
+           std::numeric_limits<double>::quiet_NaN() : b[i * lanes + l];
+         }
+       }
+     }
+   };
+
+  if (Thread_pool_pt == nullptr || Thread_pool_pt->size() == 1 || n_batches == 1)
+   {
+    solve_batches(0, 1);
+   }
+  else
+   {
+    const unsigned n_threads = Thread_pool_pt->size();
+    Thread_pool_pt->run([&](unsigned t)
+                        {
+                         solve_batches(t, n_threads);
+                        });
+   }
+
+  singular.assign(k, false);
+  for (std::size_t s = 0; s < k; s++)
+   {
+    singular[s] = (lane_singular[s] != 0);
+   }
+  return solutions;
+ }
+
+
+
+
+//=============================================================================
+/// Factorise and solve one interleaved batch: the operations of
+/// LULinearSolver's blocked factorisation and of its backsubstitution,
+/// in the same order, in every lane. The row swaps differ from lane to
+/// lane and are done one lane at a time; the pivot search, the
+/// elimination and the substitutions run in lockstep, through
+/// Kernels::batch_pivot_search, Kernels::batch_ger,
+/// Kernels::batch_gemm_sub (the trailing-matrix updates) and
+/// Kernels::batch_dot_sub. A lane with a zero pivot carries on with
+/// zero multipliers (rather than infinite ones), and its solution is
+/// discarded.
+//=============================================================================
+ void BatchedLULinearSolver::solve_batch(const unsigned& n, double* a,
+                                         double* b, unsigned* index,
+                                         char* singular) const
+ {
+  const unsigned lanes = Kernels::Batch_lanes;
+
+  // Distance between the rows of the matrices
+  const std::size_t row = std::size_t(n) * lanes;
+
+  double reciprocal[Kernels::Batch_lanes];
+  for (unsigned k = 0; k < n; k += Block_size)
+   {
+    const unsigned k_end = std::min(n, k + Block_size);
+
+    // Factorise the panel [k, k_end)
+    for (unsigned j = k; j < k_end; j++)
+     {
+      // Largest entry in column j on or below the diagonal (the last
+      // one on a tie, as in LULinearSolver)
+      unsigned* imax = index + std::size_t(j) * lanes;
+      Kernels::batch_pivot_search(n - j, a + j * row + std::size_t(j) * lanes,
+                                  row, j, imax);
+
+      // Swap rows j and imax up to the end of the panel
+      swap_rows(n, a, j, imax, 0, k_end);
+
+      // Divide by the pivot
+      const double* pivot = a + j * row + std::size_t(j) * lanes;
+      for (unsigned l = 0; l < lanes; l++)
+       {
+        if (pivot[l] == 0.0)
+         {
+          singular[l] = 1;
+          reciprocal[l] = 0.0;
+         }
+        else
+         {
+          reciprocal[l] = 1.0 / pivot[l];
+         }
+       }
+      for (unsigned i = j + 1; i < n; i++)
+       {
+        double* a_ij = a + i * row + std::size_t(j) * lanes;
+        for (unsigned l = 0; l < lanes; l++)
+         {
+          a_ij[l] *= reciprocal[l];
+         }
+       }
+
+      // Rank-1 update of the rest of the panel
+      if (j + 1 < k_end)
+       {
+        Kernels::batch_ger(n - j - 1, k_end - j - 1,
+                           a + (j + 1) * row + std::size_t(j) * lanes, row,
+                           a + j * row + std::size_t(j + 1) * lanes,
+                           a + (j + 1) * row + std::size_t(j + 1) * lanes,
+                           row);
+       }
+     }
+
+    if (k_end == n)
+     {
+      break;
+     }
+
+    // The panel's row swaps in the columns right of it
+    for (unsigned j = k; j < k_end; j++)
+     {
+      swap_rows(n, a, j, index + std::size_t(j) * lanes, k_end, n);
+     }
+
+    // U12 = L11^{-1} A12, one row of A12 at a time
+    for (unsigned j = k; j + 1 < k_end; j++)
+     {
+      Kernels::batch_ger(k_end - j - 1, n - k_end,
+                         a + (j + 1) * row + std::size_t(j) * lanes, row,
+                         a + j * row + std::size_t(k_end) * lanes,
+                         a + (j + 1) * row + std::size_t(k_end) * lanes,
+                         row);
+     }
+
+    // A22 -= L21 U12
+    Kernels::batch_gemm_sub(n - k_end, k_end - k, n - k_end,
+                            a + k_end * row + std::size_t(k) * lanes, row,
+                            a + k * row + std::size_t(k_end) * lanes, row,
+                            a + k_end * row + std::size_t(k_end) * lanes,
+                            row);
+   }
+
+  // Row swaps of the right-hand sides
+  for (unsigned i = 0; i < n; i++)
+   {
+    for (unsigned l = 0; l < lanes; l++)
+     {
+      unsigned ip = index[std::size_t(i) * lanes + l];
+      if (ip != i)
+       {
+        std::swap(b[std::size_t(i) * lanes + l], b[std::size_t(ip) * lanes + l]);
+       }
+     }
+   }
+
+  // Forward substitution with the unit lower triangle
+  for (unsigned i = 1; i < n; i++)
+   {
+    Kernels::batch_dot_sub(i, a + i * row, b, b + std::size_t(i) * lanes);
+   }
+
+  // Back substitution with the upper triangle
+  for (int i = n - 1; i >= 0; i--)
+   {
+    double* b_i = b + std::size_t(i) * lanes;
+    Kernels::batch_dot_sub(n - i - 1, a + i * row + std::size_t(i + 1) * lanes,
+                           b_i + lanes, b_i);
+    const double* pivot = a + i * row + std::size_t(i) * lanes;
+    for (unsigned l = 0; l < lanes; l++)
+     {
+      b_i[l] /= pivot[l];
+     }
+   }
+ }
+
+#ifdef __GNUC__
+#pragma GCC pop_options
+#endif
+
+
+
 ////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////
@@ -575,14 +1399,22 @@ namespace BasicDenseLinearAlgebra
                   const DoubleVector& soln)
  {
   unsigned n=rhs.n();
+
+  // Residual rhs - A soln = rhs + A (-soln) (same rounding since
+  // negation is exact), from the vectorised matrix-vector kernel
+  DoubleVector minus_soln(n);
+  for (unsigned j=0;j<n;j++)
+   {
+    minus_soln[j]=-soln[j];
+   }
+  DoubleVector residual(n);
+  Kernels::gemv(n,n,matrix.data(),n,minus_soln.data(),rhs.data(),
+                residual.data());
+
   double max_error=0.0;
   for (unsigned i=0;i<n;i++)
    {
-    double error=rhs[i];
-    for (unsigned j=0;j<n;j++)
-     {
-      error-=matrix(i,j)*soln[j];
-     }
+    double error=residual[i];
     if (fabs(error)>max_error) max_error=fabs(error);
    }
   return max_error;
@@ -0,0 +1,2687 @@
+#ifndef DENSE_LINEAR_ALGEBRA_KERNELS_H
+#define DENSE_LINEAR_ALGEBRA_KERNELS_H
+
+
+// C++ includes
+#include<cstddef>
+#include<string>
+#include<stdexcept>
+
+// Vector intrinsics are only used with gcc/clang on x86 where we can
+// compile individual functions for a given instruction set and pick
+// one at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) \
+ && !defined(DENSE_LINEAR_ALGEBRA_SCALAR_KERNELS)
+#define DENSE_LINEAR_ALGEBRA_X86_KERNELS
+#include<immintrin.h>
+#endif
+
+
+// ############################################################
+/// Low-level kernels (matrix-vector, rank-1 update, matrix-matrix)
+/// acting on flat packed row-by-row storage, plus kernels for
+/// batches of small systems interleaved entry by entry. Each kernel exists in a
+/// scalar version and in SSE2, AVX2 and AVX-512 versions; the best one
+/// supported by the CPU is selected once at runtime. Single precision
+/// kernels exist in scalar and AVX2 versions.
+///
+/// Apart from gemm_nt, the vectorised kernels accumulate every entry
+/// of the result in exactly the same order as the scalar reference
+/// (no reassociation and no fused multiply-adds), so they give
+/// bitwise identical results. Vectorisation is therefore across
+/// independent outputs (rows of A, columns of B), never across a sum.
+/// With gcc this holds with -mfma or -march=native too, as contraction
+/// into fused multiply-adds is switched off for all the kernels; other
+/// compilers need -ffp-contract=off.
+// ############################################################
+
+
+
+//============================================================
+/// Namespace for basic dense linear algebra
+//============================================================
+namespace BasicDenseLinearAlgebra
+{
+
+//============================================================
+/// Namespace for the kernels
+//============================================================
+ namespace Kernels
+ {
+
+  /// Instruction sets for which kernels are available
+  enum class ISA {Scalar, SSE2, AVX2, AVX512};
+
+  /// Name of instruction set (for output)
+  inline const char* isa_name(const ISA& isa)
+  {
+   switch (isa)
+    {
+    case ISA::SSE2: return "SSE2";
+    case ISA::AVX2: return "AVX2";
+    case ISA::AVX512: return "AVX-512";
+    default: return "Scalar";
+    }
+  }
+
+  /// Number of systems in an interleaved batch: entry (i,j) of all
+  /// of them is stored in Batch_lanes consecutive values, so the
+  /// batch kernels handle one system per SIMD lane (8 doubles fill
+  /// one AVX-512 register)
+  const unsigned Batch_lanes=8;
+
+
+/////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////
+
+
+// Stop gcc from contracting separate multiplies and adds into fused
+// multiply-adds (as it does with -mfma or -march=native) anywhere in
+// the kernels, the scalar ones included: that would change the
+// rounding, so the scalar and vectorised kernels would no longer agree.
+#ifdef __GNUC__
+#pragma GCC push_options
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+//============================================================
+/// Scalar reference kernels, for doubles and floats. These define
+/// the order in which all other versions accumulate their results.
+//============================================================
+  namespace Scalar
+  {
+
+   /// y = b + A x for the n x m matrix A (row stride lda);
+   /// b may be null (then y = A x)
+   template<class T>
+   inline void gemv(unsigned n, unsigned m,
+                    const T* a, unsigned lda,
+                    const T* x, const T* b, T* y)
+   {
+    for (unsigned i=0;i<n;i++)
+     {
+      const T* a_row=a+std::size_t(i)*lda;
+      T sum=(b!=0) ? b[i] : T(0);
+      for (unsigned j=0;j<m;j++)
+       {
+        sum+=a_row[j]*x[j];
+       }
+      y[i]=sum;
+     }
+   }
+
+   /// y = A^T x for the n x m matrix A (row stride lda); y has
+   /// m entries. The rows of A are swept in storage order.
+   template<class T>
+   inline void gemv_t(unsigned n, unsigned m,
+                      const T* a, unsigned lda,
+                      const T* x, T* y)
+   {
+    for (unsigned j=0;j<m;j++)
+     {
+      y[j]=T(0);
+     }
+    for (unsigned i=0;i<n;i++)
+     {
+      const T* a_row=a+std::size_t(i)*lda;
+      T x_i=x[i];
+      for (unsigned j=0;j<m;j++)
+       {
+        y[j]+=a_row[j]*x_i;
+       }
+     }
+   }
+
+   /// Rank-1 update A += alpha x y^T for the n x m matrix A
+   template<class T>
+   inline void ger(unsigned n, unsigned m, T alpha,
+                   const T* x, const T* y,
+                   T* a, unsigned lda)
+   {
+    for (unsigned i=0;i<n;i++)
+     {
+      T* a_row=a+std::size_t(i)*lda;
+      T alpha_x_i=alpha*x[i];
+      for (unsigned j=0;j<m;j++)
+       {
+        a_row[j]+=alpha_x_i*y[j];
+       }
+     }
+   }
+
+   /// Fused backward step and regularised rank-1 update for the
+   /// n x m matrix A: first y = A^T d (skipped if y is null), using
+   /// the old entries, then A = A - rate (d x^T + lambda A).
+   template<class T>
+   inline void fused_backward_update(unsigned n, unsigned m,
+                                     T* a, unsigned lda,
+                                     const T* d, const T* x,
+                                     T rate, T lambda,
+                                     T* y)
+   {
+    if (y!=0)
+     {
+      for (unsigned j=0;j<m;j++)
+       {
+        y[j]=T(0);
+       }
+     }
+    for (unsigned i=0;i<n;i++)
+     {
+      T* a_row=a+std::size_t(i)*lda;
+      T d_i=d[i];
+      for (unsigned j=0;j<m;j++)
+       {
+        T w=a_row[j];
+        if (y!=0) y[j]+=w*d_i;
+        a_row[j]=w-rate*(d_i*x[j]+lambda*w);
+       }
+     }
+   }
+
+   /// C = bias + A B for the n x m matrix A and the m x p matrix B
+   /// (row stride ldb); C is n x p (row stride ldc). A is addressed
+   /// as A(i,k) = a[i*a_row_stride+k*a_col_stride], so the kernel
+   /// also computes A^T B without forming the transpose. bias
+   /// (one entry per row of C) may be null.
+   template<class T>
+   inline void gemm(unsigned n, unsigned m, unsigned p,
+                    const T* a, unsigned a_row_stride,
+                    unsigned a_col_stride,
+                    const T* b, unsigned ldb,
+                    const T* bias, T* c, unsigned ldc)
+   {
+    for (unsigned i=0;i<n;i++)
+     {
+      const T* a_row=a+std::size_t(i)*a_row_stride;
+      T* c_row=c+std::size_t(i)*ldc;
+      for (unsigned s=0;s<p;s++)
+       {
+        T sum=(bias!=0) ? bias[i] : T(0);
+        for (unsigned k=0;k<m;k++)
+         {
+          sum+=a_row[std::size_t(k)*a_col_stride]*b[std::size_t(k)*ldb+s];
+         }
+        c_row[s]=sum;
+       }
+     }
+   }
+
+   /// C = alpha A B^T for the n x p matrix A and the m x p matrix B;
+   /// C is n x m. Entries are dot products of rows, so the vectorised
+   /// versions sum in a different (but fixed) order.
+   template<class T>
+   inline void gemm_nt(unsigned n, unsigned m, unsigned p, T alpha,
+                       const T* a, unsigned lda,
+                       const T* b, unsigned ldb,
+                       T* c, unsigned ldc)
+   {
+    for (unsigned i=0;i<n;i++)
+     {
+      const T* a_row=a+std::size_t(i)*lda;
+      for (unsigned j=0;j<m;j++)
+       {
+        const T* b_row=b+std::size_t(j)*ldb;
+        T sum=T(0);
+        for (unsigned s=0;s<p;s++)
+         {
+          sum+=a_row[s]*b_row[s];
+         }
+        c[std::size_t(i)*ldc+j]=alpha*sum;
+       }
+     }
+   }
+
+   /// C = C - A B for the n x m matrix A (row stride lda) and the
+   /// m x p matrix B (row stride ldb); C is n x p (row stride ldc).
+   /// Every entry subtracts its products one at a time, in order of
+   /// k (the trailing update of a blocked LU factorisation).
+   template<class T>
+   inline void gemm_sub(unsigned n, unsigned m, unsigned p,
+                        const T* a, unsigned lda,
+                        const T* b, unsigned ldb,
+                        T* c, unsigned ldc)
+   {
+    for (unsigned i=0;i<n;i++)
+     {
+      const T* a_row=a+std::size_t(i)*lda;
+      T* c_row=c+std::size_t(i)*ldc;
+      for (unsigned s=0;s<p;s++)
+       {
+        T sum=c_row[s];
+        for (unsigned k=0;k<m;k++)
+         {
+          sum-=a_row[k]*b[std::size_t(k)*ldb+s];
+         }
+        c_row[s]=sum;
+       }
+     }
+   }
+
+   /// Interleaved batches: in every lane, first plus the index of the
+   /// largest |x_i| for i < n, with x_i = x + i*incx (the last one on a
+   /// tie; first if there are only NaNs), for a pivot search
+   template<class T>
+   inline void batch_pivot_search(unsigned n, const T* x, unsigned incx,
+                                  unsigned first, unsigned* imax)
+   {
+    for (unsigned k=0;k<Batch_lanes;k++)
+     {
+      T largest=0;
+      imax[k]=first;
+      for (unsigned i=0;i<n;i++)
+       {
+        T tmp=std::fabs(x[std::size_t(i)*incx+k]);
+        if (tmp>=largest)
+         {
+          largest=tmp;
+          imax[k]=first+i;
+         }
+       }
+     }
+   }
+
+   /// Interleaved batches: A_ic -= l_i x_c in every lane, for the
+   /// n x m block of A_ic = a + i*lda + c*Batch_lanes, with
+   /// l_i = l + i*ldl and x_c = x + c*Batch_lanes (each pointing
+   /// to one value per lane)
+   template<class T>
+   inline void batch_ger(unsigned n, unsigned m, const T* l, unsigned ldl,
+                         const T* x, T* a, unsigned lda)
+   {
+    for (unsigned i=0;i<n;i++)
+     {
+      const T* l_i=l+std::size_t(i)*ldl;
+      T* a_i=a+std::size_t(i)*lda;
+      for (unsigned c=0;c<m;c++)
+       {
+        for (unsigned k=0;k<Batch_lanes;k++)
+         {
+          a_i[c*Batch_lanes+k]-=l_i[k]*x[c*Batch_lanes+k];
+         }
+       }
+     }
+   }
+
+   /// Interleaved batches: y -= u_c x_c in every lane, in order of
+   /// c < m, with u_c = u + c*Batch_lanes and x_c = x + c*incx
+   template<class T>
+   inline void batch_dot_sub(unsigned m, const T* u, const T* x,
+                             unsigned incx, T* y)
+   {
+    for (unsigned k=0;k<Batch_lanes;k++)
+     {
+      T sum=y[k];
+      for (unsigned c=0;c<m;c++)
+       {
+        sum-=u[c*Batch_lanes+k]*x[std::size_t(c)*incx+k];
+       }
+      y[k]=sum;
+     }
+   }
+
+   /// y -= u_c x_c with x_c = x + c*Batch_lanes
+   template<class T>
+   inline void batch_dot_sub(unsigned m, const T* u, const T* x, T* y)
+   {
+    batch_dot_sub(m,u,x,Batch_lanes,y);
+   }
+
+   /// Interleaved batches: C_is -= A_ik B_ks in every lane, in order
+   /// of k < m, for the n x p block of C_is = c + i*ldc + s*Batch_lanes,
+   /// with A_ik = a + i*lda + k*Batch_lanes and
+   /// B_ks = b + k*ldb + s*Batch_lanes
+   template<class T>
+   inline void batch_gemm_sub(unsigned n, unsigned m, unsigned p,
+                              const T* a, unsigned lda,
+                              const T* b, unsigned ldb,
+                              T* c, unsigned ldc)
+   {
+    for (unsigned i=0;i<n;i++)
+     {
+      for (unsigned s=0;s<p;s++)
+       {
+        batch_dot_sub(m,a+std::size_t(i)*lda,b+s*Batch_lanes,ldb,
+                      c+std::size_t(i)*ldc+s*Batch_lanes);
+       }
+     }
+   }
+
+  } // end of namespace Scalar
+
+
+
+#ifdef DENSE_LINEAR_ALGEBRA_X86_KERNELS
+
+// Silence the spurious maybe-uninitialized warnings that gcc's own
+// AVX-512 intrinsics headers trigger
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+  /// Number of rows of A swept per pass in gemv_t and
+  /// fused_backward_update: the vector loads then walk along a few
+  /// rows at a time (rather than down all rows of a column block),
+  /// which keeps large matrices streaming through the cache
+  const unsigned Row_block_size=8;
+
+/////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////
+
+
+//============================================================
+/// SSE2 kernels: two doubles per register. Also provide the
+/// two-row building blocks used for leftover rows by the wider
+/// instruction sets.
+//============================================================
+  namespace SSE2
+  {
+
+   /// gemv for two consecutive rows: the 2x2 blocks of A are
+   /// transposed in registers so each lane accumulates one row
+   /// in the scalar order
+   __attribute__((target("sse2")))
+   inline void gemv_2_rows(unsigned m, const double* a, unsigned lda,
+                           const double* x, const double* b, double* y)
+   {
+    const double* a0=a;
+    const double* a1=a+lda;
+    __m128d acc=(b!=0) ? _mm_loadu_pd(b) : _mm_setzero_pd();
+    unsigned j=0;
+    for (;j+2<=m;j+=2)
+     {
+      __m128d r0=_mm_loadu_pd(a0+j);
+      __m128d r1=_mm_loadu_pd(a1+j);
+      acc=_mm_add_pd(acc,_mm_mul_pd(_mm_unpacklo_pd(r0,r1),
+                                    _mm_set1_pd(x[j])));
+      acc=_mm_add_pd(acc,_mm_mul_pd(_mm_unpackhi_pd(r0,r1),
+                                    _mm_set1_pd(x[j+1])));
+     }
+    if (j<m)
+     {
+      acc=_mm_add_pd(acc,_mm_mul_pd(_mm_set_pd(a1[j],a0[j]),
+                                    _mm_set1_pd(x[j])));
+     }
+    _mm_storeu_pd(y,acc);
+   }
+
+   /// y = b + A x
+   __attribute__((target("sse2")))
+   inline void gemv(unsigned n, unsigned m,
+                    const double* a, unsigned lda,
+                    const double* x, const double* b, double* y)
+   {
+    unsigned i=0;
+    for (;i+2<=n;i+=2)
+     {
+      gemv_2_rows(m,a+std::size_t(i)*lda,lda,x,(b!=0) ? b+i : 0,y+i);
+     }
+    if (i<n)
+     {
+      Scalar::gemv(n-i,m,a+std::size_t(i)*lda,lda,x,(b!=0) ? b+i : 0,y+i);
+     }
+   }
+
+   /// y = A^T x
+   __attribute__((target("sse2")))
+   inline void gemv_t(unsigned n, unsigned m,
+                      const double* a, unsigned lda,
+                      const double* x, double* y)
+   {
+    // (With no rows the scalar kernel just zeroes y)
+    unsigned m_vec=(n>0) ? m-m%2 : 0;
+    // Sweep the rows in blocks; within a block, eight columns at a
+    // time are kept in registers. Partial sums carry over from one
+    // block of rows to the next through y, so the order is unchanged.
+    for (unsigned i0=0;i0<n;i0+=Row_block_size)
+     {
+      unsigned i1=(n-i0<Row_block_size) ? n : i0+Row_block_size;
+      unsigned j=0;
+      for (;j+8<=m_vec;j+=8)
+       {
+        __m128d y0=_mm_setzero_pd(), y1=_mm_setzero_pd();
+        __m128d y2=_mm_setzero_pd(), y3=_mm_setzero_pd();
+        if (i0>0)
+         {
+          y0=_mm_loadu_pd(y+j); y1=_mm_loadu_pd(y+j+2);
+          y2=_mm_loadu_pd(y+j+4); y3=_mm_loadu_pd(y+j+6);
+         }
+        for (unsigned i=i0;i<i1;i++)
+         {
+          const double* a_row=a+std::size_t(i)*lda+j;
+          __m128d x_i=_mm_set1_pd(x[i]);
+          y0=_mm_add_pd(y0,_mm_mul_pd(_mm_loadu_pd(a_row),x_i));
+          y1=_mm_add_pd(y1,_mm_mul_pd(_mm_loadu_pd(a_row+2),x_i));
+          y2=_mm_add_pd(y2,_mm_mul_pd(_mm_loadu_pd(a_row+4),x_i));
+          y3=_mm_add_pd(y3,_mm_mul_pd(_mm_loadu_pd(a_row+6),x_i));
+         }
+        _mm_storeu_pd(y+j,y0);
+        _mm_storeu_pd(y+j+2,y1);
+        _mm_storeu_pd(y+j+4,y2);
+        _mm_storeu_pd(y+j+6,y3);
+       }
+      for (;j<m_vec;j+=2)
+       {
+        __m128d y0=(i0>0) ? _mm_loadu_pd(y+j) : _mm_setzero_pd();
+        for (unsigned i=i0;i<i1;i++)
+         {
+          y0=_mm_add_pd(y0,_mm_mul_pd(_mm_loadu_pd(a+std::size_t(i)*lda+j),
+                                      _mm_set1_pd(x[i])));
+         }
+        _mm_storeu_pd(y+j,y0);
+       }
+     }
+    if (m_vec<m)
+     {
+      Scalar::gemv_t(n,m-m_vec,a+m_vec,lda,x,y+m_vec);
+     }
+   }
+
+   /// A += alpha x y^T
+   __attribute__((target("sse2")))
+   inline void ger(unsigned n, unsigned m, double alpha,
+                   const double* x, const double* y,
+                   double* a, unsigned lda)
+   {
+    for (unsigned i=0;i<n;i++)
+     {
+      double* a_row=a+std::size_t(i)*lda;
+      double alpha_x_i=alpha*x[i];
+      __m128d ax=_mm_set1_pd(alpha_x_i);
+      unsigned j=0;
+      for (;j+2<=m;j+=2)
+       {
+        _mm_storeu_pd(a_row+j,
+                      _mm_add_pd(_mm_loadu_pd(a_row+j),
+                                 _mm_mul_pd(ax,_mm_loadu_pd(y+j))));
+       }
+      if (j<m)
+       {
+        a_row[j]+=alpha_x_i*y[j];
+       }
+     }
+   }
+
+   /// y = A^T d, then A = A - rate (d x^T + lambda A)
+   __attribute__((target("sse2")))
+   inline void fused_backward_update(unsigned n, unsigned m,
+                                     double* a, unsigned lda,
+                                     const double* d, const double* x,
+                                     double rate, double lambda,
+                                     double* y)
+   {
+    __m128d r=_mm_set1_pd(rate);
+    __m128d l=_mm_set1_pd(lambda);
+    unsigned m_vec=(n>0) ? m-m%2 : 0;
+    // Same blocking of the rows as in gemv_t
+    for (unsigned i0=0;i0<n;i0+=Row_block_size)
+     {
+      unsigned i1=(n-i0<Row_block_size) ? n : i0+Row_block_size;
+      for (unsigned j=0;j<m_vec;j+=2)
+       {
+        __m128d x_j=_mm_loadu_pd(x+j);
+        __m128d y_j=(y!=0 && i0>0) ? _mm_loadu_pd(y+j) : _mm_setzero_pd();
+        for (unsigned i=i0;i<i1;i++)
+         {
+          double* a_ij=a+std::size_t(i)*lda+j;
+          __m128d w=_mm_loadu_pd(a_ij);
+          __m128d d_i=_mm_set1_pd(d[i]);
+          y_j=_mm_add_pd(y_j,_mm_mul_pd(w,d_i));
+          __m128d g=_mm_add_pd(_mm_mul_pd(d_i,x_j),_mm_mul_pd(l,w));
+          _mm_storeu_pd(a_ij,_mm_sub_pd(w,_mm_mul_pd(r,g)));
+         }
+        if (y!=0) _mm_storeu_pd(y+j,y_j);
+       }
+     }
+    if (m_vec<m)
+     {
+      Scalar::fused_backward_update(n,m-m_vec,a+m_vec,lda,d,x+m_vec,
+                                    rate,lambda,(y!=0) ? y+m_vec : 0);
+     }
+   }
+
+   /// C = bias + A B for up to four rows of C, with a register
+   /// block of 4 rows by 4 columns; an odd last column is done by
+   /// the scalar kernel
+   __attribute__((target("sse2")))
+   inline void gemm_rows(unsigned n_rows, unsigned m, unsigned p,
+                         const double* a, unsigned a_row_stride,
+                         unsigned a_col_stride,
+                         const double* b, unsigned ldb,
+                         const double* bias, double* c, unsigned ldc)
+   {
+    unsigned s=0;
+    while (s+2<=p)
+     {
+      // Two registers per row, unless only two columns are left
+      unsigned n_regs=(p-s>=4) ? 2 : 1;
+      __m128d acc[4][2];
+      for (unsigned r=0;r<n_rows;r++)
+       {
+        acc[r][0]=acc[r][1]=
+         (bias!=0) ? _mm_set1_pd(bias[r]) : _mm_setzero_pd();
+       }
+      for (unsigned k=0;k<m;k++)
+       {
+        const double* b_k=b+std::size_t(k)*ldb+s;
+        __m128d b0=_mm_loadu_pd(b_k);
+        __m128d b1=(n_regs==2) ? _mm_loadu_pd(b_k+2) : _mm_setzero_pd();
+        for (unsigned r=0;r<n_rows;r++)
+         {
+          __m128d a_rk=_mm_set1_pd(a[std::size_t(r)*a_row_stride+
+                                     std::size_t(k)*a_col_stride]);
+          acc[r][0]=_mm_add_pd(acc[r][0],_mm_mul_pd(a_rk,b0));
+          acc[r][1]=_mm_add_pd(acc[r][1],_mm_mul_pd(a_rk,b1));
+         }
+       }
+      for (unsigned r=0;r<n_rows;r++)
+       {
+        _mm_storeu_pd(c+std::size_t(r)*ldc+s,acc[r][0]);
+        if (n_regs==2) _mm_storeu_pd(c+std::size_t(r)*ldc+s+2,acc[r][1]);
+       }
+      s+=2*n_regs;
+     }
+    if (s<p)
+     {
+      Scalar::gemm(n_rows,m,p-s,a,a_row_stride,a_col_stride,b+s,ldb,
+                   bias,c+s,ldc);
+     }
+   }
+
+   /// C = bias + A B
+   __attribute__((target("sse2")))
+   inline void gemm(unsigned n, unsigned m, unsigned p,
+                    const double* a, unsigned a_row_stride,
+                    unsigned a_col_stride,
+                    const double* b, unsigned ldb,
+                    const double* bias, double* c, unsigned ldc)
+   {
+    for (unsigned i=0;i<n;i+=4)
+     {
+      unsigned n_rows=(n-i<4) ? n-i : 4;
+      gemm_rows(n_rows,m,p,a+std::size_t(i)*a_row_stride,a_row_stride,
+                a_col_stride,b,ldb,(bias!=0) ? bias+i : 0,
+                c+std::size_t(i)*ldc,ldc);
+     }
+   }
+
+   /// C = alpha A B^T
+   __attribute__((target("sse2")))
+   inline void gemm_nt(unsigned n, unsigned m, unsigned p, double alpha,
+                       const double* a, unsigned lda,
+                       const double* b, unsigned ldb,
+                       double* c, unsigned ldc)
+   {
+    for (unsigned i=0;i<n;i++)
+     {
+      const double* a_row=a+std::size_t(i)*lda;
+      for (unsigned j=0;j<m;j++)
+       {
+        const double* b_row=b+std::size_t(j)*ldb;
+        __m128d acc=_mm_setzero_pd();
+        unsigned s=0;
+        for (;s+2<=p;s+=2)
+         {
+          acc=_mm_add_pd(acc,_mm_mul_pd(_mm_loadu_pd(a_row+s),
+                                        _mm_loadu_pd(b_row+s)));
+         }
+        double sum=_mm_cvtsd_f64(_mm_add_sd(acc,_mm_unpackhi_pd(acc,acc)));
+        if (s<p) sum+=a_row[s]*b_row[s];
+        c[std::size_t(i)*ldc+j]=alpha*sum;
+       }
+     }
+   }
+
+   /// C = C - A B with a register block of 4 rows by 4 columns; an
+   /// odd last column is done by the scalar kernel
+   __attribute__((target("sse2")))
+   inline void gemm_sub(unsigned n, unsigned m, unsigned p,
+                        const double* a, unsigned lda,
+                        const double* b, unsigned ldb,
+                        double* c, unsigned ldc)
+   {
+    unsigned p_vec=p-p%2;
+    for (unsigned i=0;i<n;i+=4)
+     {
+      unsigned n_rows=(n-i<4) ? n-i : 4;
+      const double* a_i=a+std::size_t(i)*lda;
+      double* c_i=c+std::size_t(i)*ldc;
+      for (unsigned s=0;s<p_vec;s+=4)
+       {
+        // Two registers per row, unless only two columns are left
+        unsigned n_regs=(p_vec-s>=4) ? 2 : 1;
+        __m128d acc[4][2];
+        for (unsigned r=0;r<n_rows;r++)
+         {
+          acc[r][0]=_mm_loadu_pd(c_i+std::size_t(r)*ldc+s);
+          acc[r][1]=(n_regs==2) ? _mm_loadu_pd(c_i+std::size_t(r)*ldc+s+2)
+                                : _mm_setzero_pd();
+         }
+        for (unsigned k=0;k<m;k++)
+         {
+          const double* b_k=b+std::size_t(k)*ldb+s;
+          __m128d b0=_mm_loadu_pd(b_k);
+          __m128d b1=(n_regs==2) ? _mm_loadu_pd(b_k+2) : _mm_setzero_pd();
+          for (unsigned r=0;r<n_rows;r++)
+           {
+            __m128d a_rk=_mm_set1_pd(a_i[std::size_t(r)*lda+k]);
+            acc[r][0]=_mm_sub_pd(acc[r][0],_mm_mul_pd(a_rk,b0));
+            acc[r][1]=_mm_sub_pd(acc[r][1],_mm_mul_pd(a_rk,b1));
+           }
+         }
+        for (unsigned r=0;r<n_rows;r++)
+         {
+          _mm_storeu_pd(c_i+std::size_t(r)*ldc+s,acc[r][0]);
+          if (n_regs==2) _mm_storeu_pd(c_i+std::size_t(r)*ldc+s+2,acc[r][1]);
+         }
+       }
+     }
+    if (p_vec<p)
+     {
+      Scalar::gemm_sub(n,m,p-p_vec,a,lda,b+p_vec,ldb,c+p_vec,ldc);
+     }
+   }
+
+   /// Interleaved batches: pivot search, four registers per entry.
+   /// The indices are kept as doubles, so they can be selected with
+   /// the same comparison masks as the entries.
+   __attribute__((target("sse2")))
+   inline void batch_pivot_search(unsigned n, const double* x, unsigned incx,
+                                  unsigned first, unsigned* imax)
+   {
+    const __m128d sign=_mm_set1_pd(-0.0);
+    __m128d largest[4], index[4];
+    for (unsigned v=0;v<4;v++)
+     {
+      largest[v]=_mm_setzero_pd();
+      index[v]=_mm_set1_pd(first);
+     }
+    for (unsigned i=0;i<n;i++)
+     {
+      const double* x_i=x+std::size_t(i)*incx;
+      __m128d i_vector=_mm_set1_pd(first+i);
+      for (unsigned v=0;v<4;v++)
+       {
+        __m128d tmp=_mm_andnot_pd(sign,_mm_loadu_pd(x_i+2*v));
+        __m128d larger=_mm_cmpge_pd(tmp,largest[v]);
+        largest[v]=_mm_or_pd(_mm_and_pd(larger,tmp),
+                             _mm_andnot_pd(larger,largest[v]));
+        index[v]=_mm_or_pd(_mm_and_pd(larger,i_vector),
+                           _mm_andnot_pd(larger,index[v]));
+       }
+     }
+    double result[Batch_lanes];
+    for (unsigned v=0;v<4;v++)
+     {
+      _mm_storeu_pd(result+2*v,index[v]);
+     }
+    for (unsigned k=0;k<Batch_lanes;k++)
+     {
+      imax[k]=unsigned(result[k]);
+     }
+   }
+
+   /// Interleaved batches: A_ic -= l_i x_c, four registers per entry
+   __attribute__((target("sse2")))
+   inline void batch_ger(unsigned n, unsigned m, const double* l, unsigned ldl,
+                         const double* x, double* a, unsigned lda)
+   {
+    for (unsigned i=0;i<n;i++)
+     {
+      const double* l_i=l+std::size_t(i)*ldl;
+      double* a_i=a+std::size_t(i)*lda;
+      __m128d l0=_mm_loadu_pd(l_i);
+      __m128d l1=_mm_loadu_pd(l_i+2);
+      __m128d l2=_mm_loadu_pd(l_i+4);
+      __m128d l3=_mm_loadu_pd(l_i+6);
+      for (unsigned c=0;c<m;c++)
+       {
+        const double* x_c=x+c*Batch_lanes;
+        double* a_ic=a_i+c*Batch_lanes;
+        _mm_storeu_pd(a_ic,_mm_sub_pd(_mm_loadu_pd(a_ic),
+                                      _mm_mul_pd(l0,_mm_loadu_pd(x_c))));
+        _mm_storeu_pd(a_ic+2,_mm_sub_pd(_mm_loadu_pd(a_ic+2),
+                                        _mm_mul_pd(l1,_mm_loadu_pd(x_c+2))));
+        _mm_storeu_pd(a_ic+4,_mm_sub_pd(_mm_loadu_pd(a_ic+4),
+                                        _mm_mul_pd(l2,_mm_loadu_pd(x_c+4))));
+        _mm_storeu_pd(a_ic+6,_mm_sub_pd(_mm_loadu_pd(a_ic+6),
+                                        _mm_mul_pd(l3,_mm_loadu_pd(x_c+6))));
+       }
+     }
+   }
+
+   /// Interleaved batches: y -= u_c x_c, four registers per entry
+   __attribute__((target("sse2")))
+   inline void batch_dot_sub(unsigned m, const double* u, const double* x,
+                             double* y)
+   {
+    __m128d y0=_mm_loadu_pd(y);
+    __m128d y1=_mm_loadu_pd(y+2);
+    __m128d y2=_mm_loadu_pd(y+4);
+    __m128d y3=_mm_loadu_pd(y+6);
+    for (unsigned c=0;c<m;c++)
+     {
+      const double* u_c=u+c*Batch_lanes;
+      const double* x_c=x+c*Batch_lanes;
+      y0=_mm_sub_pd(y0,_mm_mul_pd(_mm_loadu_pd(u_c),_mm_loadu_pd(x_c)));
+      y1=_mm_sub_pd(y1,_mm_mul_pd(_mm_loadu_pd(u_c+2),_mm_loadu_pd(x_c+2)));
+      y2=_mm_sub_pd(y2,_mm_mul_pd(_mm_loadu_pd(u_c+4),_mm_loadu_pd(x_c+4)));
+      y3=_mm_sub_pd(y3,_mm_mul_pd(_mm_loadu_pd(u_c+6),_mm_loadu_pd(x_c+6)));
+     }
+    _mm_storeu_pd(y,y0);
+    _mm_storeu_pd(y+2,y1);
+    _mm_storeu_pd(y+4,y2);
+    _mm_storeu_pd(y+6,y3);
+   }
+
+   /// Interleaved batches: C_is -= A_ik B_ks, one entry (four
+   /// registers) at a time
+   __attribute__((target("sse2")))
+   inline void batch_gemm_sub(unsigned n, unsigned m, unsigned p,
+                              const double* a, unsigned lda,
+                              const double* b, unsigned ldb,
+                              double* c, unsigned ldc)
+   {
+    for (unsigned i=0;i<n;i++)
+     {
+      const double* a_i=a+std::size_t(i)*lda;
+      for (unsigned s=0;s<p;s++)
+       {
+        double* c_is=c+std::size_t(i)*ldc+s*Batch_lanes;
+        __m128d acc[4];
+        for (unsigned v=0;v<4;v++)
+         {
+          acc[v]=_mm_loadu_pd(c_is+2*v);
+         }
+        for (unsigned k=0;k<m;k++)
+         {
+          const double* a_ik=a_i+k*Batch_lanes;
+          const double* b_ks=b+std::size_t(k)*ldb+s*Batch_lanes;
+          for (unsigned v=0;v<4;v++)
+           {
+            acc[v]=_mm_sub_pd(acc[v],_mm_mul_pd(_mm_loadu_pd(a_ik+2*v),
+                                                _mm_loadu_pd(b_ks+2*v)));
+           }
+         }
+        for (unsigned v=0;v<4;v++)
+         {
+          _mm_storeu_pd(c_is+2*v,acc[v]);
+         }
+       }
+     }
+   }
+
+  } // end of namespace SSE2
+
+
+
+/////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////
+
+
+//============================================================
+/// AVX2 kernels: four doubles per register. Columns left over
+/// at the end of a row are handed to the SSE2 kernels (masked
+/// loads/stores turned out to be slower than that for the very
+/// short rows of our networks); only the matrix-matrix kernels,
+/// whose masks are set up once per block, use them.
+//============================================================
+  namespace AVX2
+  {
+
+   /// Mask selecting the first r (0<=r<=4) doubles of a register
+   __attribute__((target("avx2")))
+   inline __m256i tail_mask(unsigned r)
+   {
+    return _mm256_set_epi64x(r>3 ? -1 : 0, r>2 ? -1 : 0,
+                             r>1 ? -1 : 0, r>0 ? -1 : 0);
+   }
+
+   /// Transpose the 4x4 block held in the rows r0..r3
+   __attribute__((target("avx2")))
+   inline void transpose_4x4(__m256d r0, __m256d r1, __m256d r2, __m256d r3,
+                             __m256d* c)
+   {
+    __m256d t0=_mm256_unpacklo_pd(r0,r1);
+    __m256d t1=_mm256_unpackhi_pd(r0,r1);
+    __m256d t2=_mm256_unpacklo_pd(r2,r3);
+    __m256d t3=_mm256_unpackhi_pd(r2,r3);
+    c[0]=_mm256_permute2f128_pd(t0,t2,0x20);
+    c[1]=_mm256_permute2f128_pd(t1,t3,0x20);
+    c[2]=_mm256_permute2f128_pd(t0,t2,0x31);
+    c[3]=_mm256_permute2f128_pd(t1,t3,0x31);
+   }
+
+   /// gemv for four consecutive rows (4x4 blocks transposed in
+   /// registers so each lane accumulates one row)
+   __attribute__((target("avx2")))
+   inline void gemv_4_rows(unsigned m, const double* a, unsigned lda,
+                           const double* x, const double* b, double* y)
+   {
+    const double* a0=a;
+    const double* a1=a0+lda;
+    const double* a2=a1+lda;
+    const double* a3=a2+lda;
+    __m256d acc=(b!=0) ? _mm256_loadu_pd(b) : _mm256_setzero_pd();
+    __m256d c[4];
+    unsigned j=0;
+    for (;j+4<=m;j+=4)
+     {
+      transpose_4x4(_mm256_loadu_pd(a0+j),_mm256_loadu_pd(a1+j),
+                    _mm256_loadu_pd(a2+j),_mm256_loadu_pd(a3+j),c);
+      acc=_mm256_add_pd(acc,_mm256_mul_pd(c[0],_mm256_set1_pd(x[j])));
+      acc=_mm256_add_pd(acc,_mm256_mul_pd(c[1],_mm256_set1_pd(x[j+1])));
+      acc=_mm256_add_pd(acc,_mm256_mul_pd(c[2],_mm256_set1_pd(x[j+2])));
+      acc=_mm256_add_pd(acc,_mm256_mul_pd(c[3],_mm256_set1_pd(x[j+3])));
+     }
+    if (j+2<=m)
+     {
+      // Two columns: pair up the 128-bit rows as (0,2) and (1,3)
+      __m256d r02=_mm256_insertf128_pd(
+       _mm256_castpd128_pd256(_mm_loadu_pd(a0+j)),_mm_loadu_pd(a2+j),1);
+      __m256d r13=_mm256_insertf128_pd(
+       _mm256_castpd128_pd256(_mm_loadu_pd(a1+j)),_mm_loadu_pd(a3+j),1);
+      acc=_mm256_add_pd(acc,_mm256_mul_pd(_mm256_unpacklo_pd(r02,r13),
+                                          _mm256_set1_pd(x[j])));
+      acc=_mm256_add_pd(acc,_mm256_mul_pd(_mm256_unpackhi_pd(r02,r13),
+                                          _mm256_set1_pd(x[j+1])));
+      j+=2;
+     }
+    if (j<m)
+     {
+      acc=_mm256_add_pd(acc,_mm256_mul_pd(_mm256_set_pd(a3[j],a2[j],
+                                                        a1[j],a0[j]),
+                                          _mm256_set1_pd(x[j])));
+     }
+    _mm256_storeu_pd(y,acc);
+   }
+
+   /// y = b + A x
+   __attribute__((target("avx2")))
+   inline void gemv(unsigned n, unsigned m,
+                    const double* a, unsigned lda,
+                    const double* x, const double* b, double* y)
+   {
+    unsigned i=0;
+    for (;i+4<=n;i+=4)
+     {
+      gemv_4_rows(m,a+std::size_t(i)*lda,lda,x,(b!=0) ? b+i : 0,y+i);
+     }
+    if (i+2<=n)
+     {
+      SSE2::gemv_2_rows(m,a+std::size_t(i)*lda,lda,x,(b!=0) ? b+i : 0,y+i);
+      i+=2;
+     }
+    if (i<n)
+     {
+      Scalar::gemv(n-i,m,a+std::size_t(i)*lda,lda,x,(b!=0) ? b+i : 0,y+i);
+     }
+   }
+
+   /// y = A^T x
+   __attribute__((target("avx2")))
+   inline void gemv_t(unsigned n, unsigned m,
+                      const double* a, unsigned lda,
+                      const double* x, double* y)
+   {
+    // Rows narrower than a register: hand over straight away
+    if (m<4)
+     {
+      SSE2::gemv_t(n,m,a,lda,x,y);
+      return;
+     }
+    unsigned m_vec=(n>0) ? m-m%4 : 0;
+    for (unsigned i0=0;i0<n;i0+=Row_block_size)
+     {
+      unsigned i1=(n-i0<Row_block_size) ? n : i0+Row_block_size;
+      unsigned j=0;
+      for (;j+16<=m_vec;j+=16)
+       {
+        __m256d y0=_mm256_setzero_pd(), y1=_mm256_setzero_pd();
+        __m256d y2=_mm256_setzero_pd(), y3=_mm256_setzero_pd();
+        if (i0>0)
+         {
+          y0=_mm256_loadu_pd(y+j); y1=_mm256_loadu_pd(y+j+4);
+          y2=_mm256_loadu_pd(y+j+8); y3=_mm256_loadu_pd(y+j+12);
+         }
+        for (unsigned i=i0;i<i1;i++)
+         {
+          const double* a_row=a+std::size_t(i)*lda+j;
+          __m256d x_i=_mm256_set1_pd(x[i]);
+          y0=_mm256_add_pd(y0,_mm256_mul_pd(_mm256_loadu_pd(a_row),x_i));
+          y1=_mm256_add_pd(y1,_mm256_mul_pd(_mm256_loadu_pd(a_row+4),x_i));
+          y2=_mm256_add_pd(y2,_mm256_mul_pd(_mm256_loadu_pd(a_row+8),x_i));
+          y3=_mm256_add_pd(y3,_mm256_mul_pd(_mm256_loadu_pd(a_row+12),x_i));
+         }
+        _mm256_storeu_pd(y+j,y0);
+        _mm256_storeu_pd(y+j+4,y1);
+        _mm256_storeu_pd(y+j+8,y2);
+        _mm256_storeu_pd(y+j+12,y3);
+       }
+      for (;j<m_vec;j+=4)
+       {
+        __m256d y0=(i0>0) ? _mm256_loadu_pd(y+j) : _mm256_setzero_pd();
+        for (unsigned i=i0;i<i1;i++)
+         {
+          y0=_mm256_add_pd(y0,_mm256_mul_pd(
+                            _mm256_loadu_pd(a+std::size_t(i)*lda+j),
+                            _mm256_set1_pd(x[i])));
+         }
+        _mm256_storeu_pd(y+j,y0);
+       }
+     }
+    if (m_vec<m)
+     {
+      SSE2::gemv_t(n,m-m_vec,a+m_vec,lda,x,y+m_vec);
+     }
+   }
+
+   /// A += alpha x y^T
+   __attribute__((target("avx2")))
+   inline void ger(unsigned n, unsigned m, double alpha,
+                   const double* x, const double* y,
+                   double* a, unsigned lda)
+   {
+    if (m<4)
+     {
+      SSE2::ger(n,m,alpha,x,y,a,lda);
+      return;
+     }
+    unsigned m_vec=m-m%4;
+    for (unsigned i=0;i<n;i++)
+     {
+      double* a_row=a+std::size_t(i)*lda;
+      __m256d ax=_mm256_set1_pd(alpha*x[i]);
+      for (unsigned j=0;j<m_vec;j+=4)
+       {
+        _mm256_storeu_pd(a_row+j,
+                         _mm256_add_pd(_mm256_loadu_pd(a_row+j),
+                                       _mm256_mul_pd(ax,
+                                                     _mm256_loadu_pd(y+j))));
+       }
+     }
+    if (m_vec<m)
+     {
+      SSE2::ger(n,m-m_vec,alpha,x,y+m_vec,a+m_vec,lda);
+     }
+   }
+
+   /// y = A^T d, then A = A - rate (d x^T + lambda A)
+   __attribute__((target("avx2")))
+   inline void fused_backward_update(unsigned n, unsigned m,
+                                     double* a, unsigned lda,
+                                     const double* d, const double* x,
+                                     double rate, double lambda,
+                                     double* y)
+   {
+    if (m<4)
+     {
+      SSE2::fused_backward_update(n,m,a,lda,d,x,rate,lambda,y);
+      return;
+     }
+    __m256d r=_mm256_set1_pd(rate);
+    __m256d l=_mm256_set1_pd(lambda);
+    unsigned m_vec=(n>0) ? m-m%4 : 0;
+    for (unsigned i0=0;i0<n;i0+=Row_block_size)
+     {
+      unsigned i1=(n-i0<Row_block_size) ? n : i0+Row_block_size;
+      for (unsigned j=0;j<m_vec;j+=4)
+       {
+        __m256d x_j=_mm256_loadu_pd(x+j);
+        __m256d y_j=(y!=0 && i0>0) ? _mm256_loadu_pd(y+j) :
+         _mm256_setzero_pd();
+        for (unsigned i=i0;i<i1;i++)
+         {
+          double* a_ij=a+std::size_t(i)*lda+j;
+          __m256d w=_mm256_loadu_pd(a_ij);
+          __m256d d_i=_mm256_set1_pd(d[i]);
+          y_j=_mm256_add_pd(y_j,_mm256_mul_pd(w,d_i));
+          __m256d g=_mm256_add_pd(_mm256_mul_pd(d_i,x_j),
+                                  _mm256_mul_pd(l,w));
+          _mm256_storeu_pd(a_ij,_mm256_sub_pd(w,_mm256_mul_pd(r,g)));
+         }
+        if (y!=0) _mm256_storeu_pd(y+j,y_j);
+       }
+     }
+    if (m_vec<m)
+     {
+      SSE2::fused_backward_update(n,m-m_vec,a+m_vec,lda,d,x+m_vec,
+                                  rate,lambda,(y!=0) ? y+m_vec : 0);
+     }
+   }
+
+   /// C = bias + A B for up to four rows of C, with a register block
+   /// of 4 rows by 8 columns
+   __attribute__((target("avx2")))
+   inline void gemm_rows(unsigned n_rows, unsigned m, unsigned p,
+                         const double* a, unsigned a_row_stride,
+                         unsigned a_col_stride,
+                         const double* b, unsigned ldb,
+                         const double* bias, double* c, unsigned ldc)
+   {
+    for (unsigned s=0;s<p;s+=8)
+     {
+      __m256i mask0=tail_mask(p-s);
+      __m256i mask1=tail_mask(p-s>4 ? p-s-4 : 0);
+      __m256d acc[4][2];
+      for (unsigned r=0;r<n_rows;r++)
+       {
+        acc[r][0]=acc[r][1]=
+         (bias!=0) ? _mm256_set1_pd(bias[r]) : _mm256_setzero_pd();
+       }
+      for (unsigned k=0;k<m;k++)
+       {
+        const double* b_k=b+std::size_t(k)*ldb+s;
+        __m256d b0=_mm256_maskload_pd(b_k,mask0);
+        __m256d b1=_mm256_maskload_pd(b_k+4,mask1);
+        for (unsigned r=0;r<n_rows;r++)
+         {
+          __m256d a_rk=_mm256_set1_pd(a[std::size_t(r)*a_row_stride+
+                                        std::size_t(k)*a_col_stride]);
+          acc[r][0]=_mm256_add_pd(acc[r][0],_mm256_mul_pd(a_rk,b0));
+          acc[r][1]=_mm256_add_pd(acc[r][1],_mm256_mul_pd(a_rk,b1));
+         }
+       }
+      for (unsigned r=0;r<n_rows;r++)
+       {
+        _mm256_maskstore_pd(c+std::size_t(r)*ldc+s,mask0,acc[r][0]);
+        _mm256_maskstore_pd(c+std::size_t(r)*ldc+s+4,mask1,acc[r][1]);
+       }
+     }
+   }
+
+   /// C = bias + A B
+   __attribute__((target("avx2")))
+   inline void gemm(unsigned n, unsigned m, unsigned p,
+                    const double* a, unsigned a_row_stride,
+                    unsigned a_col_stride,
+                    const double* b, unsigned ldb,
+                    const double* bias, double* c, unsigned ldc)
+   {
+    for (unsigned i=0;i<n;i+=4)
+     {
+      unsigned n_rows=(n-i<4) ? n-i : 4;
+      gemm_rows(n_rows,m,p,a+std::size_t(i)*a_row_stride,a_row_stride,
+                a_col_stride,b,ldb,(bias!=0) ? bias+i : 0,
+                c+std::size_t(i)*ldc,ldc);
+     }
+   }
+
+   /// Horizontal sum ((v0+v1)+(v2+v3))
+   __attribute__((target("avx2")))
+   inline double horizontal_sum(__m256d v)
+   {
+    __m128d lo=_mm256_castpd256_pd128(v);
+    __m128d hi=_mm256_extractf128_pd(v,1);
+    lo=_mm_add_pd(lo,hi);
+    return _mm_cvtsd_f64(_mm_add_sd(lo,_mm_unpackhi_pd(lo,lo)));
+   }
+
+   /// C = alpha A B^T; each row of A is dotted with four rows of B
+   /// at a time
+   __attribute__((target("avx2")))
+   inline void gemm_nt(unsigned n, unsigned m, unsigned p, double alpha,
+                       const double* a, unsigned lda,
+                       const double* b, unsigned ldb,
+                       double* c, unsigned ldc)
+   {
+    for (unsigned i=0;i<n;i++)
+     {
+      const double* a_row=a+std::size_t(i)*lda;
+      double* c_row=c+std::size_t(i)*ldc;
+      for (unsigned j=0;j<m;j+=4)
+       {
+        unsigned n_cols=(m-j<4) ? m-j : 4;
+        __m256d acc[4]={_mm256_setzero_pd(),_mm256_setzero_pd(),
+                        _mm256_setzero_pd(),_mm256_setzero_pd()};
+        for (unsigned s=0;s<p;s+=4)
+         {
+          __m256i mask=tail_mask(p-s);
+          __m256d a_s=_mm256_maskload_pd(a_row+s,mask);
+          for (unsigned q=0;q<n_cols;q++)
+           {
+            acc[q]=_mm256_add_pd(acc[q],_mm256_mul_pd(
+                                  a_s,_mm256_maskload_pd(
+                                   b+std::size_t(j+q)*ldb+s,mask)));
+           }
+         }
+        for (unsigned q=0;q<n_cols;q++)
+         {
+          c_row[j+q]=alpha*horizontal_sum(acc[q]);
+         }
+       }
+     }
+   }
+
+   /// C = C - A B with a register block of 4 rows by 8 columns
+   __attribute__((target("avx2")))
+   inline void gemm_sub(unsigned n, unsigned m, unsigned p,
+                        const double* a, unsigned lda,
+                        const double* b, unsigned ldb,
+                        double* c, unsigned ldc)
+   {
+    for (unsigned i=0;i<n;i+=4)
+     {
+      unsigned n_rows=(n-i<4) ? n-i : 4;
+      const double* a_i=a+std::size_t(i)*lda;
+      double* c_i=c+std::size_t(i)*ldc;
+      for (unsigned s=0;s<p;s+=8)
+       {
+        __m256i mask0=tail_mask(p-s);
+        __m256i mask1=tail_mask(p-s>4 ? p-s-4 : 0);
+        __m256d acc[4][2];
+        for (unsigned r=0;r<n_rows;r++)
+         {
+          acc[r][0]=_mm256_maskload_pd(c_i+std::size_t(r)*ldc+s,mask0);
+          acc[r][1]=_mm256_maskload_pd(c_i+std::size_t(r)*ldc+s+4,mask1);
+         }
+        for (unsigned k=0;k<m;k++)
+         {
+          const double* b_k=b+std::size_t(k)*ldb+s;
+          __m256d b0=_mm256_maskload_pd(b_k,mask0);
+          __m256d b1=_mm256_maskload_pd(b_k+4,mask1);
+          for (unsigned r=0;r<n_rows;r++)
+           {
+            __m256d a_rk=_mm256_set1_pd(a_i[std::size_t(r)*lda+k]);
+            acc[r][0]=_mm256_sub_pd(acc[r][0],_mm256_mul_pd(a_rk,b0));
+            acc[r][1]=_mm256_sub_pd(acc[r][1],_mm256_mul_pd(a_rk,b1));
+           }
+         }
+        for (unsigned r=0;r<n_rows;r++)
+         {
+          _mm256_maskstore_pd(c_i+std::size_t(r)*ldc+s,mask0,acc[r][0]);
+          _mm256_maskstore_pd(c_i+std::size_t(r)*ldc+s+4,mask1,acc[r][1]);
+         }
+       }
+     }
+   }
+
+   /// Interleaved batches: pivot search, two registers per entry
+   /// (with the indices as doubles)
+   __attribute__((target("avx2")))
+   inline void batch_pivot_search(unsigned n, const double* x, unsigned incx,
+                                  unsigned first, unsigned* imax)
+   {
+    const __m256d sign=_mm256_set1_pd(-0.0);
+    __m256d largest[2], index[2];
+    for (unsigned v=0;v<2;v++)
+     {
+      largest[v]=_mm256_setzero_pd();
+      index[v]=_mm256_set1_pd(first);
+     }
+    for (unsigned i=0;i<n;i++)
+     {
+      const double* x_i=x+std::size_t(i)*incx;
+      __m256d i_vector=_mm256_set1_pd(first+i);
+      for (unsigned v=0;v<2;v++)
+       {
+        __m256d tmp=_mm256_andnot_pd(sign,_mm256_loadu_pd(x_i+4*v));
+        __m256d larger=_mm256_cmp_pd(tmp,largest[v],_CMP_GE_OQ);
+        largest[v]=_mm256_blendv_pd(largest[v],tmp,larger);
+        index[v]=_mm256_blendv_pd(index[v],i_vector,larger);
+       }
+     }
+    double result[Batch_lanes];
+    _mm256_storeu_pd(result,index[0]);
+    _mm256_storeu_pd(result+4,index[1]);
+    for (unsigned k=0;k<Batch_lanes;k++)
+     {
+      imax[k]=unsigned(result[k]);
+     }
+   }
+
+   /// Interleaved batches: A_ic -= l_i x_c, two registers per entry
+   __attribute__((target("avx2")))
+   inline void batch_ger(unsigned n, unsigned m, const double* l, unsigned ldl,
+                         const double* x, double* a, unsigned lda)
+   {
+    for (unsigned i=0;i<n;i++)
+     {
+      const double* l_i=l+std::size_t(i)*ldl;
+      double* a_i=a+std::size_t(i)*lda;
+      __m256d l0=_mm256_loadu_pd(l_i);
+      __m256d l1=_mm256_loadu_pd(l_i+4);
+      for (unsigned c=0;c<m;c++)
+       {
+        const double* x_c=x+c*Batch_lanes;
+        double* a_ic=a_i+c*Batch_lanes;
+        _mm256_storeu_pd(a_ic,_mm256_sub_pd(_mm256_loadu_pd(a_ic),
+                                            _mm256_mul_pd(l0,_mm256_loadu_pd(x_c))));
+        _mm256_storeu_pd(a_ic+4,_mm256_sub_pd(_mm256_loadu_pd(a_ic+4),
+                                              _mm256_mul_pd(l1,_mm256_loadu_pd(x_c+4))));
+       }
+     }
+   }
+
+   /// Interleaved batches: y -= u_c x_c, two registers per entry
+   __attribute__((target("avx2")))
+   inline void batch_dot_sub(unsigned m, const double* u, const double* x,
+                             double* y)
+   {
+    __m256d y0=_mm256_loadu_pd(y);
+    __m256d y1=_mm256_loadu_pd(y+4);
+    for (unsigned c=0;c<m;c++)
+     {
+      const double* u_c=u+c*Batch_lanes;
+      const double* x_c=x+c*Batch_lanes;
+      y0=_mm256_sub_pd(y0,_mm256_mul_pd(_mm256_loadu_pd(u_c),_mm256_loadu_pd(x_c)));
+      y1=_mm256_sub_pd(y1,_mm256_mul_pd(_mm256_loadu_pd(u_c+4),_mm256_loadu_pd(x_c+4)));
+     }
+    _mm256_storeu_pd(y,y0);
+    _mm256_storeu_pd(y+4,y1);
+   }
+
+   /// Interleaved batches: an R x C block of entries of C -= A B (two
+   /// registers each), kept in registers throughout
+   template<unsigned R, unsigned C>
+   __attribute__((target("avx2")))
+   inline void batch_gemm_sub_block(unsigned m, const double* a, unsigned lda,
+                                    const double* b, unsigned ldb,
+                                    double* c, unsigned ldc)
+   {
+    __m256d acc[R][C][2];
+    #pragma GCC unroll 4
+    for (unsigned r=0;r<R;r++)
+     {
+      #pragma GCC unroll 4
+      for (unsigned s=0;s<C;s++)
+       {
+        const double* c_rs=c+std::size_t(r)*ldc+s*Batch_lanes;
+        acc[r][s][0]=_mm256_loadu_pd(c_rs);
+        acc[r][s][1]=_mm256_loadu_pd(c_rs+4);
+       }
+     }
+    for (unsigned k=0;k<m;k++)
+     {
+      __m256d b_k[C][2];
+      #pragma GCC unroll 4
+      for (unsigned s=0;s<C;s++)
+       {
+        const double* b_ks=b+std::size_t(k)*ldb+s*Batch_lanes;
+        b_k[s][0]=_mm256_loadu_pd(b_ks);
+        b_k[s][1]=_mm256_loadu_pd(b_ks+4);
+       }
+      #pragma GCC unroll 4
+      for (unsigned r=0;r<R;r++)
+       {
+        const double* a_rk=a+std::size_t(r)*lda+k*Batch_lanes;
+        __m256d a0=_mm256_loadu_pd(a_rk);
+        __m256d a1=_mm256_loadu_pd(a_rk+4);
+        #pragma GCC unroll 4
+        for (unsigned s=0;s<C;s++)
+         {
+          acc[r][s][0]=_mm256_sub_pd(acc[r][s][0],_mm256_mul_pd(a0,b_k[s][0]));
+          acc[r][s][1]=_mm256_sub_pd(acc[r][s][1],_mm256_mul_pd(a1,b_k[s][1]));
+         }
+       }
+     }
+    #pragma GCC unroll 4
+    for (unsigned r=0;r<R;r++)
+     {
+      #pragma GCC unroll 4
+      for (unsigned s=0;s<C;s++)
+       {
+        double* c_rs=c+std::size_t(r)*ldc+s*Batch_lanes;
+        _mm256_storeu_pd(c_rs,acc[r][s][0]);
+        _mm256_storeu_pd(c_rs+4,acc[r][s][1]);
+       }
+     }
+   }
+
+   /// Interleaved batches: C_is -= A_ik B_ks with register blocks of
+   /// 2 x 2 entries
+   __attribute__((target("avx2")))
+   inline void batch_gemm_sub(unsigned n, unsigned m, unsigned p,
+                              const double* a, unsigned lda,
+                              const double* b, unsigned ldb,
+                              double* c, unsigned ldc)
+   {
+    const unsigned n_full=n-n%2;
+    const unsigned p_full=p-p%2;
+    for (unsigned i=0;i<n;i+=2)
+     {
+      const double* a_i=a+std::size_t(i)*lda;
+      double* c_i=c+std::size_t(i)*ldc;
+      for (unsigned s=0;s<p;s+=2)
+       {
+        const double* b_s=b+s*Batch_lanes;
+        double* c_is=c_i+s*Batch_lanes;
+        if (i<n_full && s<p_full)
+         {
+          batch_gemm_sub_block<2,2>(m,a_i,lda,b_s,ldb,c_is,ldc);
+         }
+        else if (i<n_full)
+         {
+          batch_gemm_sub_block<2,1>(m,a_i,lda,b_s,ldb,c_is,ldc);
+         }
+        else if (s<p_full)
+         {
+          batch_gemm_sub_block<1,2>(m,a_i,lda,b_s,ldb,c_is,ldc);
+         }
+        else
+         {
+          batch_gemm_sub_block<1,1>(m,a_i,lda,b_s,ldb,c_is,ldc);
+         }
+       }
+     }
+   }
+
+  } // end of namespace AVX2
+
+
+
+/////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////
+
+
+//============================================================
+/// AVX-512 kernels: eight doubles per register. Leftover columns
+/// go to the AVX2 kernels; the matrix-matrix kernels use mask
+/// registers for partial blocks. There is no AVX-512 gemv: the
+/// 8x8 register transpose it needs costs more than it gains over
+/// the AVX2 4x4 version, which the AVX-512 table therefore uses.
+//============================================================
+  namespace AVX512
+  {
+
+   /// Mask selecting the first r (0<=r<=8) doubles of a register
+   inline __mmask8 tail_mask(unsigned r)
+   {
+    return (r>=8) ? __mmask8(0xFF) : __mmask8((1u<<r)-1u);
+   }
+
+   /// y = A^T x
+   __attribute__((target("avx512f")))
+   inline void gemv_t(unsigned n, unsigned m,
+                      const double* a, unsigned lda,
+                      const double* x, double* y)
+   {
+    // Rows narrower than a register: hand over straight away
+    if (m<8)
+     {
+      AVX2::gemv_t(n,m,a,lda,x,y);
+      return;
+     }
+    unsigned m_vec=(n>0) ? m-m%8 : 0;
+    for (unsigned i0=0;i0<n;i0+=Row_block_size)
+     {
+      unsigned i1=(n-i0<Row_block_size) ? n : i0+Row_block_size;
+      unsigned j=0;
+      for (;j+32<=m_vec;j+=32)
+       {
+        __m512d y0=_mm512_setzero_pd(), y1=_mm512_setzero_pd();
+        __m512d y2=_mm512_setzero_pd(), y3=_mm512_setzero_pd();
+        if (i0>0)
+         {
+          y0=_mm512_loadu_pd(y+j); y1=_mm512_loadu_pd(y+j+8);
+          y2=_mm512_loadu_pd(y+j+16); y3=_mm512_loadu_pd(y+j+24);
+         }
+        for (unsigned i=i0;i<i1;i++)
+         {
+          const double* a_row=a+std::size_t(i)*lda+j;
+          __m512d x_i=_mm512_set1_pd(x[i]);
+          y0=_mm512_add_pd(y0,_mm512_mul_pd(_mm512_loadu_pd(a_row),x_i));
+          y1=_mm512_add_pd(y1,_mm512_mul_pd(_mm512_loadu_pd(a_row+8),x_i));
+          y2=_mm512_add_pd(y2,_mm512_mul_pd(_mm512_loadu_pd(a_row+16),x_i));
+          y3=_mm512_add_pd(y3,_mm512_mul_pd(_mm512_loadu_pd(a_row+24),x_i));
+         }
+        _mm512_storeu_pd(y+j,y0);
+        _mm512_storeu_pd(y+j+8,y1);
+        _mm512_storeu_pd(y+j+16,y2);
+        _mm512_storeu_pd(y+j+24,y3);
+       }
+      for (;j<m_vec;j+=8)
+       {
+        __m512d y0=(i0>0) ? _mm512_loadu_pd(y+j) : _mm512_setzero_pd();
+        for (unsigned i=i0;i<i1;i++)
+         {
+          y0=_mm512_add_pd(y0,_mm512_mul_pd(
+                            _mm512_loadu_pd(a+std::size_t(i)*lda+j),
+                            _mm512_set1_pd(x[i])));
+         }
+        _mm512_storeu_pd(y+j,y0);
+       }
+     }
+    if (m_vec<m)
+     {
+      AVX2::gemv_t(n,m-m_vec,a+m_vec,lda,x,y+m_vec);
+     }
+   }
+
+   /// A += alpha x y^T
+   __attribute__((target("avx512f")))
+   inline void ger(unsigned n, unsigned m, double alpha,
+                   const double* x, const double* y,
+                   double* a, unsigned lda)
+   {
+    if (m<8)
+     {
+      AVX2::ger(n,m,alpha,x,y,a,lda);
+      return;
+     }
+    unsigned m_vec=m-m%8;
+    for (unsigned i=0;i<n;i++)
+     {
+      double* a_row=a+std::size_t(i)*lda;
+      __m512d ax=_mm512_set1_pd(alpha*x[i]);
+      for (unsigned j=0;j<m_vec;j+=8)
+       {
+        _mm512_storeu_pd(a_row+j,
+                         _mm512_add_pd(_mm512_loadu_pd(a_row+j),
+                                       _mm512_mul_pd(ax,
+                                                     _mm512_loadu_pd(y+j))));
+       }
+     }
+    if (m_vec<m)
+     {
+      AVX2::ger(n,m-m_vec,alpha,x,y+m_vec,a+m_vec,lda);
+     }
+   }
+
+   /// y = A^T d, then A = A - rate (d x^T + lambda A)
+   __attribute__((target("avx512f")))
+   inline void fused_backward_update(unsigned n, unsigned m,
+                                     double* a, unsigned lda,
+                                     const double* d, const double* x,
+                                     double rate, double lambda,
+                                     double* y)
+   {
+    if (m<8)
+     {
+      AVX2::fused_backward_update(n,m,a,lda,d,x,rate,lambda,y);
+      return;
+     }
+    __m512d r=_mm512_set1_pd(rate);
+    __m512d l=_mm512_set1_pd(lambda);
+    unsigned m_vec=(n>0) ? m-m%8 : 0;
+    for (unsigned i0=0;i0<n;i0+=Row_block_size)
+     {
+      unsigned i1=(n-i0<Row_block_size) ? n : i0+Row_block_size;
+      for (unsigned j=0;j<m_vec;j+=8)
+       {
+        __m512d x_j=_mm512_loadu_pd(x+j);
+        __m512d y_j=(y!=0 && i0>0) ? _mm512_loadu_pd(y+j) :
+         _mm512_setzero_pd();
+        for (unsigned i=i0;i<i1;i++)
+         {
+          double* a_ij=a+std::size_t(i)*lda+j;
+          __m512d w=_mm512_loadu_pd(a_ij);
+          __m512d d_i=_mm512_set1_pd(d[i]);
+          y_j=_mm512_add_pd(y_j,_mm512_mul_pd(w,d_i));
+          __m512d g=_mm512_add_pd(_mm512_mul_pd(d_i,x_j),
+                                  _mm512_mul_pd(l,w));
+          _mm512_storeu_pd(a_ij,_mm512_sub_pd(w,_mm512_mul_pd(r,g)));
+         }
+        if (y!=0) _mm512_storeu_pd(y+j,y_j);
+       }
+     }
+    if (m_vec<m)
+     {
+      AVX2::fused_backward_update(n,m-m_vec,a+m_vec,lda,d,x+m_vec,
+                                  rate,lambda,(y!=0) ? y+m_vec : 0);
+     }
+   }
+
+   /// C = bias + A B with a register block of 4 rows by 16 columns
+   __attribute__((target("avx512f")))
+   inline void gemm(unsigned n, unsigned m, unsigned p,
+                    const double* a, unsigned a_row_stride,
+                    unsigned a_col_stride,
+                    const double* b, unsigned ldb,
+                    const double* bias, double* c, unsigned ldc)
+   {
+    for (unsigned i=0;i<n;i+=4)
+     {
+      unsigned n_rows=(n-i<4) ? n-i : 4;
+      const double* a_i=a+std::size_t(i)*a_row_stride;
+      double* c_i=c+std::size_t(i)*ldc;
+      for (unsigned s=0;s<p;s+=16)
+       {
+        __mmask8 mask0=tail_mask(p-s);
+        __mmask8 mask1=tail_mask(p-s>8 ? p-s-8 : 0);
+        __m512d acc[4][2];
+        for (unsigned r=0;r<n_rows;r++)
+         {
+          acc[r][0]=acc[r][1]=
+           (bias!=0) ? _mm512_set1_pd(bias[i+r]) : _mm512_setzero_pd();
+         }
+        for (unsigned k=0;k<m;k++)
+         {
+          const double* b_k=b+std::size_t(k)*ldb+s;
+          __m512d b0=_mm512_maskz_loadu_pd(mask0,b_k);
+          __m512d b1=_mm512_maskz_loadu_pd(mask1,b_k+8);
+          for (unsigned r=0;r<n_rows;r++)
+           {
+            __m512d a_rk=_mm512_set1_pd(a_i[std::size_t(r)*a_row_stride+
+                                            std::size_t(k)*a_col_stride]);
+            acc[r][0]=_mm512_add_pd(acc[r][0],_mm512_mul_pd(a_rk,b0));
+            acc[r][1]=_mm512_add_pd(acc[r][1],_mm512_mul_pd(a_rk,b1));
+           }
+         }
+        for (unsigned r=0;r<n_rows;r++)
+         {
+          _mm512_mask_storeu_pd(c_i+std::size_t(r)*ldc+s,mask0,acc[r][0]);
+          _mm512_mask_storeu_pd(c_i+std::size_t(r)*ldc+s+8,mask1,acc[r][1]);
+         }
+       }
+     }
+   }
+
+   /// C = alpha A B^T; each row of A is dotted with four rows of B
+   /// at a time
+   __attribute__((target("avx512f")))
+   inline void gemm_nt(unsigned n, unsigned m, unsigned p, double alpha,
+                       const double* a, unsigned lda,
+                       const double* b, unsigned ldb,
+                       double* c, unsigned ldc)
+   {
+    for (unsigned i=0;i<n;i++)
+     {
+      const double* a_row=a+std::size_t(i)*lda;
+      double* c_row=c+std::size_t(i)*ldc;
+      for (unsigned j=0;j<m;j+=4)
+       {
+        unsigned n_cols=(m-j<4) ? m-j : 4;
+        __m512d acc[4]={_mm512_setzero_pd(),_mm512_setzero_pd(),
+                        _mm512_setzero_pd(),_mm512_setzero_pd()};
+        for (unsigned s=0;s<p;s+=8)
+         {
+          __mmask8 mask=tail_mask(p-s);
+          __m512d a_s=_mm512_maskz_loadu_pd(mask,a_row+s);
+          for (unsigned q=0;q<n_cols;q++)
+           {
+            acc[q]=_mm512_add_pd(acc[q],_mm512_mul_pd(
+                                  a_s,_mm512_maskz_loadu_pd(
+                                   mask,b+std::size_t(j+q)*ldb+s)));
+           }
+         }
+        for (unsigned q=0;q<n_cols;q++)
+         {
+          c_row[j+q]=alpha*_mm512_reduce_add_pd(acc[q]);
+         }
+       }
+     }
+   }
+
+   /// C = C - A B with a register block of 4 rows by 16 columns
+   __attribute__((target("avx512f")))
+   inline void gemm_sub(unsigned n, unsigned m, unsigned p,
+                        const double* a, unsigned lda,
+                        const double* b, unsigned ldb,
+                        double* c, unsigned ldc)
+   {
+    for (unsigned i=0;i<n;i+=4)
+     {
+      unsigned n_rows=(n-i<4) ? n-i : 4;
+      const double* a_i=a+std::size_t(i)*lda;
+      double* c_i=c+std::size_t(i)*ldc;
+      for (unsigned s=0;s<p;s+=16)
+       {
+        __mmask8 mask0=tail_mask(p-s);
+        __mmask8 mask1=tail_mask(p-s>8 ? p-s-8 : 0);
+        __m512d acc[4][2];
+        for (unsigned r=0;r<n_rows;r++)
+         {
+          acc[r][0]=_mm512_maskz_loadu_pd(mask0,c_i+std::size_t(r)*ldc+s);
+          acc[r][1]=_mm512_maskz_loadu_pd(mask1,c_i+std::size_t(r)*ldc+s+8);
+         }
+        for (unsigned k=0;k<m;k++)
+         {
+          const double* b_k=b+std::size_t(k)*ldb+s;
+          __m512d b0=_mm512_maskz_loadu_pd(mask0,b_k);
+          __m512d b1=_mm512_maskz_loadu_pd(mask1,b_k+8);
+          for (unsigned r=0;r<n_rows;r++)
+           {
+            __m512d a_rk=_mm512_set1_pd(a_i[std::size_t(r)*lda+k]);
+            acc[r][0]=_mm512_sub_pd(acc[r][0],_mm512_mul_pd(a_rk,b0));
+            acc[r][1]=_mm512_sub_pd(acc[r][1],_mm512_mul_pd(a_rk,b1));
+           }
+         }
+        for (unsigned r=0;r<n_rows;r++)
+         {
+          _mm512_mask_storeu_pd(c_i+std::size_t(r)*ldc+s,mask0,acc[r][0]);
+          _mm512_mask_storeu_pd(c_i+std::size_t(r)*ldc+s+8,mask1,acc[r][1]);
+         }
+       }
+     }
+   }
+
+   /// Interleaved batches: pivot search, one register per entry
+   /// (with the indices as doubles)
+   __attribute__((target("avx512f")))
+   inline void batch_pivot_search(unsigned n, const double* x, unsigned incx,
+                                  unsigned first, unsigned* imax)
+   {
+    __m512d largest=_mm512_setzero_pd();
+    __m512d index=_mm512_set1_pd(first);
+    for (unsigned i=0;i<n;i++)
+     {
+      __m512d tmp=_mm512_abs_pd(_mm512_loadu_pd(x+std::size_t(i)*incx));
+      __mmask8 larger=_mm512_cmp_pd_mask(tmp,largest,_CMP_GE_OQ);
+      largest=_mm512_mask_mov_pd(largest,larger,tmp);
+      index=_mm512_mask_mov_pd(index,larger,_mm512_set1_pd(first+i));
+     }
+    double result[Batch_lanes];
+    _mm512_storeu_pd(result,index);
+    for (unsigned k=0;k<Batch_lanes;k++)
+     {
+      imax[k]=unsigned(result[k]);
+     }
+   }
+
+   /// Interleaved batches: A_ic -= l_i x_c, one register per entry
+   __attribute__((target("avx512f")))
+   inline void batch_ger(unsigned n, unsigned m, const double* l, unsigned ldl,
+                         const double* x, double* a, unsigned lda)
+   {
+    for (unsigned i=0;i<n;i++)
+     {
+      double* a_i=a+std::size_t(i)*lda;
+      __m512d l_i=_mm512_loadu_pd(l+std::size_t(i)*ldl);
+      for (unsigned c=0;c<m;c++)
+       {
+        double* a_ic=a_i+c*Batch_lanes;
+        __m512d x_c=_mm512_loadu_pd(x+c*Batch_lanes);
+        _mm512_storeu_pd(a_ic,_mm512_sub_pd(_mm512_loadu_pd(a_ic),
+                                            _mm512_mul_pd(l_i,x_c)));
+       }
+     }
+   }
+
+   /// Interleaved batches: y -= u_c x_c, one register per entry
+   __attribute__((target("avx512f")))
+   inline void batch_dot_sub(unsigned m, const double* u, const double* x,
+                             double* y)
+   {
+    __m512d sum=_mm512_loadu_pd(y);
+    for (unsigned c=0;c<m;c++)
+     {
+      sum=_mm512_sub_pd(sum,_mm512_mul_pd(_mm512_loadu_pd(u+c*Batch_lanes),
+                                          _mm512_loadu_pd(x+c*Batch_lanes)));
+     }
+    _mm512_storeu_pd(y,sum);
+   }
+
+   /// Interleaved batches: an R x C block of entries of C -= A B (one
+   /// register each), kept in registers throughout
+   template<unsigned R, unsigned C>
+   __attribute__((target("avx512f")))
+   inline void batch_gemm_sub_block(unsigned m, const double* a, unsigned lda,
+                                    const double* b, unsigned ldb,
+                                    double* c, unsigned ldc)
+   {
+    __m512d acc[R][C];
+    #pragma GCC unroll 4
+    for (unsigned r=0;r<R;r++)
+     {
+      #pragma GCC unroll 4
+      for (unsigned s=0;s<C;s++)
+       {
+        acc[r][s]=_mm512_loadu_pd(c+std::size_t(r)*ldc+s*Batch_lanes);
+       }
+     }
+    for (unsigned k=0;k<m;k++)
+     {
+      __m512d b_k[C];
+      #pragma GCC unroll 4
+      for (unsigned s=0;s<C;s++)
+       {
+        b_k[s]=_mm512_loadu_pd(b+std::size_t(k)*ldb+s*Batch_lanes);
+       }
+      #pragma GCC unroll 4
+      for (unsigned r=0;r<R;r++)
+       {
+        __m512d a_rk=_mm512_loadu_pd(a+std::size_t(r)*lda+k*Batch_lanes);
+        #pragma GCC unroll 4
+        for (unsigned s=0;s<C;s++)
+         {
+          acc[r][s]=_mm512_sub_pd(acc[r][s],_mm512_mul_pd(a_rk,b_k[s]));
+         }
+       }
+     }
+    #pragma GCC unroll 4
+    for (unsigned r=0;r<R;r++)
+     {
+      #pragma GCC unroll 4
+      for (unsigned s=0;s<C;s++)
+       {
+        _mm512_storeu_pd(c+std::size_t(r)*ldc+s*Batch_lanes,acc[r][s]);
+       }
+     }
+   }
+
+   /// Interleaved batches: C_is -= A_ik B_ks with register blocks of
+   /// 4 x 4 entries
+   __attribute__((target("avx512f")))
+   inline void batch_gemm_sub(unsigned n, unsigned m, unsigned p,
+                              const double* a, unsigned lda,
+                              const double* b, unsigned ldb,
+                              double* c, unsigned ldc)
+   {
+    const unsigned n_full=n-n%4;
+    const unsigned p_full=p-p%4;
+    for (unsigned i=0;i<n_full;i+=4)
+     {
+      const double* a_i=a+std::size_t(i)*lda;
+      double* c_i=c+std::size_t(i)*ldc;
+      for (unsigned s=0;s<p_full;s+=4)
+       {
+        batch_gemm_sub_block<4,4>(m,a_i,lda,b+s*Batch_lanes,ldb,
+                                  c_i+s*Batch_lanes,ldc);
+       }
+      for (unsigned s=p_full;s<p;s++)
+       {
+        batch_gemm_sub_block<4,1>(m,a_i,lda,b+s*Batch_lanes,ldb,
+                                  c_i+s*Batch_lanes,ldc);
+       }
+     }
+    for (unsigned i=n_full;i<n;i++)
+     {
+      const double* a_i=a+std::size_t(i)*lda;
+      double* c_i=c+std::size_t(i)*ldc;
+      for (unsigned s=0;s<p_full;s+=4)
+       {
+        batch_gemm_sub_block<1,4>(m,a_i,lda,b+s*Batch_lanes,ldb,
+                                  c_i+s*Batch_lanes,ldc);
+       }
+      for (unsigned s=p_full;s<p;s++)
+       {
+        batch_gemm_sub_block<1,1>(m,a_i,lda,b+s*Batch_lanes,ldb,
+                                  c_i+s*Batch_lanes,ldc);
+       }
+     }
+   }
+
+  } // end of namespace AVX512
+
+
+/////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////
+
+
+//============================================================
+/// AVX2 kernels for floats: eight floats per register. Same
+/// structure (and summation order) as the double versions;
+/// leftover rows/columns go to the scalar kernels. Machines with
+/// AVX-512 use these as well.
+//============================================================
+  namespace AVX2
+  {
+
+   /// Mask selecting the first r (0<=r<=8) floats of a register
+   __attribute__((target("avx2")))
+   inline __m256i tail_mask_ps(unsigned r)
+   {
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32(int(r)),
+                              _mm256_setr_epi32(0,1,2,3,4,5,6,7));
+   }
+
+   /// Transpose the 8x8 block held in the rows r[0..7]
+   __attribute__((target("avx2")))
+   inline void transpose_8x8(const __m256* r, __m256* c)
+   {
+    __m256 t0=_mm256_unpacklo_ps(r[0],r[1]);
+    __m256 t1=_mm256_unpackhi_ps(r[0],r[1]);
+    __m256 t2=_mm256_unpacklo_ps(r[2],r[3]);
+    __m256 t3=_mm256_unpackhi_ps(r[2],r[3]);
+    __m256 t4=_mm256_unpacklo_ps(r[4],r[5]);
+    __m256 t5=_mm256_unpackhi_ps(r[4],r[5]);
+    __m256 t6=_mm256_unpacklo_ps(r[6],r[7]);
+    __m256 t7=_mm256_unpackhi_ps(r[6],r[7]);
+    __m256 s0=_mm256_shuffle_ps(t0,t2,_MM_SHUFFLE(1,0,1,0));
+    __m256 s1=_mm256_shuffle_ps(t0,t2,_MM_SHUFFLE(3,2,3,2));
+    __m256 s2=_mm256_shuffle_ps(t1,t3,_MM_SHUFFLE(1,0,1,0));
+    __m256 s3=_mm256_shuffle_ps(t1,t3,_MM_SHUFFLE(3,2,3,2));
+    __m256 s4=_mm256_shuffle_ps(t4,t6,_MM_SHUFFLE(1,0,1,0));
+    __m256 s5=_mm256_shuffle_ps(t4,t6,_MM_SHUFFLE(3,2,3,2));
+    __m256 s6=_mm256_shuffle_ps(t5,t7,_MM_SHUFFLE(1,0,1,0));
+    __m256 s7=_mm256_shuffle_ps(t5,t7,_MM_SHUFFLE(3,2,3,2));
+    c[0]=_mm256_permute2f128_ps(s0,s4,0x20);
+    c[1]=_mm256_permute2f128_ps(s1,s5,0x20);
+    c[2]=_mm256_permute2f128_ps(s2,s6,0x20);
+    c[3]=_mm256_permute2f128_ps(s3,s7,0x20);
+    c[4]=_mm256_permute2f128_ps(s0,s4,0x31);
+    c[5]=_mm256_permute2f128_ps(s1,s5,0x31);
+    c[6]=_mm256_permute2f128_ps(s2,s6,0x31);
+    c[7]=_mm256_permute2f128_ps(s3,s7,0x31);
+   }
+
+   /// gemv for eight consecutive rows (8x8 blocks transposed in
+   /// registers so each lane accumulates one row)
+   __attribute__((target("avx2")))
+   inline void gemv_8_rows(unsigned m, const float* a, unsigned lda,
+                           const float* x, const float* b, float* y)
+   {
+    const float* rows[8];
+    for (unsigned r=0;r<8;r++)
+     {
+      rows[r]=a+std::size_t(r)*lda;
+     }
+    __m256 acc=(b!=0) ? _mm256_loadu_ps(b) : _mm256_setzero_ps();
+    __m256 r[8], c[8];
+    unsigned j=0;
+    for (;j+8<=m;j+=8)
+     {
+      for (unsigned q=0;q<8;q++)
+       {
+        r[q]=_mm256_loadu_ps(rows[q]+j);
+       }
+      transpose_8x8(r,c);
+      for (unsigned q=0;q<8;q++)
+       {
+        acc=_mm256_add_ps(acc,_mm256_mul_ps(c[q],_mm256_set1_ps(x[j+q])));
+       }
+     }
+    for (;j<m;j++)
+     {
+      __m256 column=_mm256_setr_ps(rows[0][j],rows[1][j],rows[2][j],
+                                   rows[3][j],rows[4][j],rows[5][j],
+                                   rows[6][j],rows[7][j]);
+      acc=_mm256_add_ps(acc,_mm256_mul_ps(column,_mm256_set1_ps(x[j])));
+     }
+    _mm256_storeu_ps(y,acc);
+   }
+
+   /// y = b + A x
+   __attribute__((target("avx2")))
+   inline void gemv(unsigned n, unsigned m,
+                    const float* a, unsigned lda,
+                    const float* x, const float* b, float* y)
+   {
+    unsigned i=0;
+    for (;i+8<=n;i+=8)
+     {
+      gemv_8_rows(m,a+std::size_t(i)*lda,lda,x,(b!=0) ? b+i : 0,y+i);
+     }
+    if (i<n)
+     {
+      Scalar::gemv(n-i,m,a+std::size_t(i)*lda,lda,x,(b!=0) ? b+i : 0,y+i);
+     }
+   }
+
+   /// y = A^T x
+   __attribute__((target("avx2")))
+   inline void gemv_t(unsigned n, unsigned m,
+                      const float* a, unsigned lda,
+                      const float* x, float* y)
+   {
+    if (m<8)
+     {
+      Scalar::gemv_t(n,m,a,lda,x,y);
+      return;
+     }
+    unsigned m_vec=(n>0) ? m-m%8 : 0;
+    for (unsigned i0=0;i0<n;i0+=Row_block_size)
+     {
+      unsigned i1=(n-i0<Row_block_size) ? n : i0+Row_block_size;
+      for (unsigned j=0;j<m_vec;j+=8)
+       {
+        __m256 y0=(i0>0) ? _mm256_loadu_ps(y+j) : _mm256_setzero_ps();
+        for (unsigned i=i0;i<i1;i++)
+         {
+          y0=_mm256_add_ps(y0,_mm256_mul_ps(
+                            _mm256_loadu_ps(a+std::size_t(i)*lda+j),
+                            _mm256_set1_ps(x[i])));
+         }
+        _mm256_storeu_ps(y+j,y0);
+       }
+     }
+    if (m_vec<m)
+     {
+      Scalar::gemv_t(n,m-m_vec,a+m_vec,lda,x,y+m_vec);
+     }
+   }
+
+   /// A += alpha x y^T
+   __attribute__((target("avx2")))
+   inline void ger(unsigned n, unsigned m, float alpha,
+                   const float* x, const float* y,
+                   float* a, unsigned lda)
+   {
+    if (m<8)
+     {
+      Scalar::ger(n,m,alpha,x,y,a,lda);
+      return;
+     }
+    unsigned m_vec=m-m%8;
+    for (unsigned i=0;i<n;i++)
+     {
+      float* a_row=a+std::size_t(i)*lda;
+      __m256 ax=_mm256_set1_ps(alpha*x[i]);
+      for (unsigned j=0;j<m_vec;j+=8)
+       {
+        _mm256_storeu_ps(a_row+j,
+                         _mm256_add_ps(_mm256_loadu_ps(a_row+j),
+                                       _mm256_mul_ps(ax,
+                                                     _mm256_loadu_ps(y+j))));
+       }
+     }
+    if (m_vec<m)
+     {
+      Scalar::ger(n,m-m_vec,alpha,x,y+m_vec,a+m_vec,lda);
+     }
+   }
+
+   /// y = A^T d, then A = A - rate (d x^T + lambda A)
+   __attribute__((target("avx2")))
+   inline void fused_backward_update(unsigned n, unsigned m,
+                                     float* a, unsigned lda,
+                                     const float* d, const float* x,
+                                     float rate, float lambda,
+                                     float* y)
+   {
+    if (m<8)
+     {
+      Scalar::fused_backward_update(n,m,a,lda,d,x,rate,lambda,y);
+      return;
+     }
+    __m256 r=_mm256_set1_ps(rate);
+    __m256 l=_mm256_set1_ps(lambda);
+    unsigned m_vec=(n>0) ? m-m%8 : 0;
+    for (unsigned i0=0;i0<n;i0+=Row_block_size)
+     {
+      unsigned i1=(n-i0<Row_block_size) ? n : i0+Row_block_size;
+      for (unsigned j=0;j<m_vec;j+=8)
+       {
+        __m256 x_j=_mm256_loadu_ps(x+j);
+        __m256 y_j=(y!=0 && i0>0) ? _mm256_loadu_ps(y+j) :
+         _mm256_setzero_ps();
+        for (unsigned i=i0;i<i1;i++)
+         {
+          float* a_ij=a+std::size_t(i)*lda+j;
+          __m256 w=_mm256_loadu_ps(a_ij);
+          __m256 d_i=_mm256_set1_ps(d[i]);
+          y_j=_mm256_add_ps(y_j,_mm256_mul_ps(w,d_i));
+          __m256 g=_mm256_add_ps(_mm256_mul_ps(d_i,x_j),
+                                 _mm256_mul_ps(l,w));
+          _mm256_storeu_ps(a_ij,_mm256_sub_ps(w,_mm256_mul_ps(r,g)));
+         }
+        if (y!=0) _mm256_storeu_ps(y+j,y_j);
+       }
+     }
+    if (m_vec<m)
+     {
+      Scalar::fused_backward_update(n,m-m_vec,a+m_vec,lda,d,x+m_vec,
+                                    rate,lambda,(y!=0) ? y+m_vec : 0);
+     }
+   }
+
+   /// C = bias + A B for up to four rows of C, with a register block
+   /// of 4 rows by 16 columns
+   __attribute__((target("avx2")))
+   inline void gemm_rows(unsigned n_rows, unsigned m, unsigned p,
+                         const float* a, unsigned a_row_stride,
+                         unsigned a_col_stride,
+                         const float* b, unsigned ldb,
+                         const float* bias, float* c, unsigned ldc)
+   {
+    for (unsigned s=0;s<p;s+=16)
+     {
+      __m256i mask0=tail_mask_ps(p-s);
+      __m256i mask1=tail_mask_ps(p-s>8 ? p-s-8 : 0);
+      __m256 acc[4][2];
+      for (unsigned r=0;r<n_rows;r++)
+       {
+        acc[r][0]=acc[r][1]=
+         (bias!=0) ? _mm256_set1_ps(bias[r]) : _mm256_setzero_ps();
+       }
+      for (unsigned k=0;k<m;k++)
+       {
+        const float* b_k=b+std::size_t(k)*ldb+s;
+        __m256 b0=_mm256_maskload_ps(b_k,mask0);
+        __m256 b1=_mm256_maskload_ps(b_k+8,mask1);
+        for (unsigned r=0;r<n_rows;r++)
+         {
+          __m256 a_rk=_mm256_set1_ps(a[std::size_t(r)*a_row_stride+
+                                       std::size_t(k)*a_col_stride]);
+          acc[r][0]=_mm256_add_ps(acc[r][0],_mm256_mul_ps(a_rk,b0));
+          acc[r][1]=_mm256_add_ps(acc[r][1],_mm256_mul_ps(a_rk,b1));
+         }
+       }
+      for (unsigned r=0;r<n_rows;r++)
+       {
+        _mm256_maskstore_ps(c+std::size_t(r)*ldc+s,mask0,acc[r][0]);
+        _mm256_maskstore_ps(c+std::size_t(r)*ldc+s+8,mask1,acc[r][1]);
+       }
+     }
+   }
+
+   /// C = bias + A B
+   __attribute__((target("avx2")))
+   inline void gemm(unsigned n, unsigned m, unsigned p,
+                    const float* a, unsigned a_row_stride,
+                    unsigned a_col_stride,
+                    const float* b, unsigned ldb,
+                    const float* bias, float* c, unsigned ldc)
+   {
+    for (unsigned i=0;i<n;i+=4)
+     {
+      unsigned n_rows=(n-i<4) ? n-i : 4;
+      gemm_rows(n_rows,m,p,a+std::size_t(i)*a_row_stride,a_row_stride,
+                a_col_stride,b,ldb,(bias!=0) ? bias+i : 0,
+                c+std::size_t(i)*ldc,ldc);
+     }
+   }
+
+   /// Horizontal sum (((v0+v4)+(v2+v6))+((v1+v5)+(v3+v7)))
+   __attribute__((target("avx2")))
+   inline float horizontal_sum(__m256 v)
+   {
+    __m128 lo=_mm256_castps256_ps128(v);
+    __m128 hi=_mm256_extractf128_ps(v,1);
+    lo=_mm_add_ps(lo,hi);
+    lo=_mm_add_ps(lo,_mm_movehl_ps(lo,lo));
+    return _mm_cvtss_f32(_mm_add_ss(lo,_mm_shuffle_ps(lo,lo,1)));
+   }
+
+   /// C = alpha A B^T; each row of A is dotted with four rows of B
+   /// at a time
+   __attribute__((target("avx2")))
+   inline void gemm_nt(unsigned n, unsigned m, unsigned p, float alpha,
+                       const float* a, unsigned lda,
+                       const float* b, unsigned ldb,
+                       float* c, unsigned ldc)
+   {
+    for (unsigned i=0;i<n;i++)
+     {
+      const float* a_row=a+std::size_t(i)*lda;
+      float* c_row=c+std::size_t(i)*ldc;
+      for (unsigned j=0;j<m;j+=4)
+       {
+        unsigned n_cols=(m-j<4) ? m-j : 4;
+        __m256 acc[4]={_mm256_setzero_ps(),_mm256_setzero_ps(),
+                       _mm256_setzero_ps(),_mm256_setzero_ps()};
+        for (unsigned s=0;s<p;s+=8)
+         {
+          __m256i mask=tail_mask_ps(p-s);
+          __m256 a_s=_mm256_maskload_ps(a_row+s,mask);
+          for (unsigned q=0;q<n_cols;q++)
+           {
+            acc[q]=_mm256_add_ps(acc[q],_mm256_mul_ps(
+                                  a_s,_mm256_maskload_ps(
+                                   b+std::size_t(j+q)*ldb+s,mask)));
+           }
+         }
+        for (unsigned q=0;q<n_cols;q++)
+         {
+          c_row[j+q]=alpha*horizontal_sum(acc[q]);
+         }
+       }
+     }
+   }
+
+   /// C = C - A B with a register block of 4 rows by 16 columns
+   __attribute__((target("avx2")))
+   inline void gemm_sub(unsigned n, unsigned m, unsigned p,
+                        const float* a, unsigned lda,
+                        const float* b, unsigned ldb,
+                        float* c, unsigned ldc)
+   {
+    for (unsigned i=0;i<n;i+=4)
+     {
+      unsigned n_rows=(n-i<4) ? n-i : 4;
+      const float* a_i=a+std::size_t(i)*lda;
+      float* c_i=c+std::size_t(i)*ldc;
+      for (unsigned s=0;s<p;s+=16)
+       {
+        __m256i mask0=tail_mask_ps(p-s);
+        __m256i mask1=tail_mask_ps(p-s>8 ? p-s-8 : 0);
+        __m256 acc[4][2];
+        for (unsigned r=0;r<n_rows;r++)
+         {
+          acc[r][0]=_mm256_maskload_ps(c_i+std::size_t(r)*ldc+s,mask0);
+          acc[r][1]=_mm256_maskload_ps(c_i+std::size_t(r)*ldc+s+8,mask1);
+         }
+        for (unsigned k=0;k<m;k++)
+         {
+          const float* b_k=b+std::size_t(k)*ldb+s;
+          __m256 b0=_mm256_maskload_ps(b_k,mask0);
+          __m256 b1=_mm256_maskload_ps(b_k+8,mask1);
+          for (unsigned r=0;r<n_rows;r++)
+           {
+            __m256 a_rk=_mm256_set1_ps(a_i[std::size_t(r)*lda+k]);
+            acc[r][0]=_mm256_sub_ps(acc[r][0],_mm256_mul_ps(a_rk,b0));
+            acc[r][1]=_mm256_sub_ps(acc[r][1],_mm256_mul_ps(a_rk,b1));
+           }
+         }
+        for (unsigned r=0;r<n_rows;r++)
+         {
+          _mm256_maskstore_ps(c_i+std::size_t(r)*ldc+s,mask0,acc[r][0]);
+          _mm256_maskstore_ps(c_i+std::size_t(r)*ldc+s+8,mask1,acc[r][1]);
+         }
+       }
+     }
+   }
+
+   /// Interleaved batches: pivot search, one register per entry
+   __attribute__((target("avx2")))
+   inline void batch_pivot_search(unsigned n, const float* x, unsigned incx,
+                                  unsigned first, unsigned* imax)
+   {
+    const __m256 sign=_mm256_set1_ps(-0.0f);
+    __m256 largest=_mm256_setzero_ps();
+    __m256i index=_mm256_set1_epi32(int(first));
+    for (unsigned i=0;i<n;i++)
+     {
+      __m256 tmp=_mm256_andnot_ps(sign,
+                                  _mm256_loadu_ps(x+std::size_t(i)*incx));
+      __m256 larger=_mm256_cmp_ps(tmp,largest,_CMP_GE_OQ);
+      largest=_mm256_blendv_ps(largest,tmp,larger);
+      index=_mm256_castps_si256(
+       _mm256_blendv_ps(_mm256_castsi256_ps(index),
+                        _mm256_castsi256_ps(_mm256_set1_epi32(int(first+i))),
+                        larger));
+     }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(imax),index);
+   }
+
+   /// Interleaved batches: A_ic -= l_i x_c, one register per entry
+   __attribute__((target("avx2")))
+   inline void batch_ger(unsigned n, unsigned m, const float* l, unsigned ldl,
+                         const float* x, float* a, unsigned lda)
+   {
+    for (unsigned i=0;i<n;i++)
+     {
+      float* a_i=a+std::size_t(i)*lda;
+      __m256 l_i=_mm256_loadu_ps(l+std::size_t(i)*ldl);
+      for (unsigned c=0;c<m;c++)
+       {
+        float* a_ic=a_i+c*Batch_lanes;
+        __m256 x_c=_mm256_loadu_ps(x+c*Batch_lanes);
+        _mm256_storeu_ps(a_ic,_mm256_sub_ps(_mm256_loadu_ps(a_ic),
+                                            _mm256_mul_ps(l_i,x_c)));
+       }
+     }
+   }
+
+   /// Interleaved batches: y -= u_c x_c, one register per entry
+   __attribute__((target("avx2")))
+   inline void batch_dot_sub(unsigned m, const float* u, const float* x,
+                             float* y)
+   {
+    __m256 sum=_mm256_loadu_ps(y);
+    for (unsigned c=0;c<m;c++)
+     {
+      sum=_mm256_sub_ps(sum,_mm256_mul_ps(_mm256_loadu_ps(u+c*Batch_lanes),
+                                          _mm256_loadu_ps(x+c*Batch_lanes)));
+     }
+    _mm256_storeu_ps(y,sum);
+   }
+
+   /// Interleaved batches: an R x C block of entries of C -= A B (one
+   /// register each), kept in registers throughout
+   template<unsigned R, unsigned C>
+   __attribute__((target("avx2")))
+   inline void batch_gemm_sub_block(unsigned m, const float* a, unsigned lda,
+                                    const float* b, unsigned ldb,
+                                    float* c, unsigned ldc)
+   {
+    __m256 acc[R][C];
+    #pragma GCC unroll 4
+    for (unsigned r=0;r<R;r++)
+     {
+      #pragma GCC unroll 4
+      for (unsigned s=0;s<C;s++)
+       {
+        acc[r][s]=_mm256_loadu_ps(c+std::size_t(r)*ldc+s*Batch_lanes);
+       }
+     }
+    for (unsigned k=0;k<m;k++)
+     {
+      __m256 b_k[C];
+      #pragma GCC unroll 4
+      for (unsigned s=0;s<C;s++)
+       {
+        b_k[s]=_mm256_loadu_ps(b+std::size_t(k)*ldb+s*Batch_lanes);
+       }
+      #pragma GCC unroll 4
+      for (unsigned r=0;r<R;r++)
+       {
+        __m256 a_rk=_mm256_loadu_ps(a+std::size_t(r)*lda+k*Batch_lanes);
+        #pragma GCC unroll 4
+        for (unsigned s=0;s<C;s++)
+         {
+          acc[r][s]=_mm256_sub_ps(acc[r][s],_mm256_mul_ps(a_rk,b_k[s]));
+         }
+       }
+     }
+    #pragma GCC unroll 4
+    for (unsigned r=0;r<R;r++)
+     {
+      #pragma GCC unroll 4
+      for (unsigned s=0;s<C;s++)
+       {
+        _mm256_storeu_ps(c+std::size_t(r)*ldc+s*Batch_lanes,acc[r][s]);
+       }
+     }
+   }
+
+   /// Interleaved batches: C_is -= A_ik B_ks with register blocks of
+   /// 2 x 4 entries
+   __attribute__((target("avx2")))
+   inline void batch_gemm_sub(unsigned n, unsigned m, unsigned p,
+                              const float* a, unsigned lda,
+                              const float* b, unsigned ldb,
+                              float* c, unsigned ldc)
+   {
+    const unsigned n_full=n-n%2;
+    const unsigned p_full=p-p%4;
+    for (unsigned i=0;i<n_full;i+=2)
+     {
+      const float* a_i=a+std::size_t(i)*lda;
+      float* c_i=c+std::size_t(i)*ldc;
+      for (unsigned s=0;s<p_full;s+=4)
+       {
+        batch_gemm_sub_block<2,4>(m,a_i,lda,b+s*Batch_lanes,ldb,
+                                  c_i+s*Batch_lanes,ldc);
+       }
+      for (unsigned s=p_full;s<p;s++)
+       {
+        batch_gemm_sub_block<2,1>(m,a_i,lda,b+s*Batch_lanes,ldb,
+                                  c_i+s*Batch_lanes,ldc);
+       }
+     }
+    if (n_full<n)
+     {
+      const float* a_i=a+std::size_t(n_full)*lda;
+      float* c_i=c+std::size_t(n_full)*ldc;
+      for (unsigned s=0;s<p_full;s+=4)
+       {
+        batch_gemm_sub_block<1,4>(m,a_i,lda,b+s*Batch_lanes,ldb,
+                                  c_i+s*Batch_lanes,ldc);
+       }
+      for (unsigned s=p_full;s<p;s++)
+       {
+        batch_gemm_sub_block<1,1>(m,a_i,lda,b+s*Batch_lanes,ldb,
+                                  c_i+s*Batch_lanes,ldc);
+       }
+     }
+   }
+
+  } // end of namespace AVX2
+
+#pragma GCC diagnostic pop
+
+#endif // DENSE_LINEAR_ALGEBRA_X86_KERNELS
+
+#ifdef __GNUC__
+#pragma GCC pop_options
+#endif
+
+
+
+/////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////
+
+
+//============================================================
+/// Table of kernels for one instruction set and scalar type
+//============================================================
+  template<class T>
+  struct BasicKernelTable
+  {
+   /// Instruction set
+   ISA isa;
+
+   /// y = b + A x
+   void (*gemv)(unsigned, unsigned, const T*, unsigned,
+                const T*, const T*, T*);
+
+   /// y = A^T x
+   void (*gemv_t)(unsigned, unsigned, const T*, unsigned,
+                  const T*, T*);
+
+   /// A += alpha x y^T
+   void (*ger)(unsigned, unsigned, T, const T*, const T*,
+               T*, unsigned);
+
+   /// y = A^T d, then A = A - rate (d x^T + lambda A)
+   void (*fused_backward_update)(unsigned, unsigned, T*, unsigned,
+                                 const T*, const T*,
+                                 T, T, T*);
+
+   /// C = bias + A B
+   void (*gemm)(unsigned, unsigned, unsigned, const T*, unsigned,
+                unsigned, const T*, unsigned, const T*,
+                T*, unsigned);
+
+   /// C = alpha A B^T
+   void (*gemm_nt)(unsigned, unsigned, unsigned, T, const T*,
+                   unsigned, const T*, unsigned, T*, unsigned);
+
+   /// C = C - A B
+   void (*gemm_sub)(unsigned, unsigned, unsigned, const T*, unsigned,
+                    const T*, unsigned, T*, unsigned);
+
+   /// Index of the largest |x_i| in every lane (interleaved batches)
+   void (*batch_pivot_search)(unsigned, const T*, unsigned, unsigned,
+                              unsigned*);
+
+   /// A_ic -= l_i x_c (interleaved batches)
+   void (*batch_ger)(unsigned, unsigned, const T*, unsigned, const T*,
+                     T*, unsigned);
+
+   /// y -= sum of u_c x_c (interleaved batches)
+   void (*batch_dot_sub)(unsigned, const T*, const T*, T*);
+
+   /// C -= A B (interleaved batches)
+   void (*batch_gemm_sub)(unsigned, unsigned, unsigned, const T*,
+                          unsigned, const T*, unsigned, T*, unsigned);
+  };
+
+  /// Kernels for doubles
+  typedef BasicKernelTable<double> KernelTable;
+
+  /// Kernels for floats
+  typedef BasicKernelTable<float> FloatKernelTable;
+
+
+//============================================================
+/// Does the CPU we're running on support the instruction set?
+//============================================================
+  inline bool isa_supported(const ISA& isa)
+  {
+#ifdef DENSE_LINEAR_ALGEBRA_X86_KERNELS
+   __builtin_cpu_init();
+   switch (isa)
+    {
+    case ISA::AVX512: return __builtin_cpu_supports("avx512f");
+    case ISA::AVX2: return __builtin_cpu_supports("avx2");
+    case ISA::SSE2: return __builtin_cpu_supports("sse2");
+    default: return true;
+    }
+#else
+   return isa==ISA::Scalar;
+#endif
+  }
+
+
+//============================================================
+/// Kernel table for a given instruction set. Throws if
+/// the instruction set is not supported.
+//============================================================
+  inline const KernelTable& kernel_table(const ISA& isa)
+  {
+   static const KernelTable scalar_table=
+    {ISA::Scalar,Scalar::gemv,Scalar::gemv_t,Scalar::ger,
+     Scalar::fused_backward_update,Scalar::gemm,Scalar::gemm_nt,
+     Scalar::gemm_sub,Scalar::batch_pivot_search,Scalar::batch_ger,
+     Scalar::batch_dot_sub,Scalar::batch_gemm_sub};
+   if (!isa_supported(isa))
+    {
+     throw std::runtime_error(std::string("Kernels for ")+isa_name(isa)+
+                              " are not supported on this machine");
+    }
+#ifdef DENSE_LINEAR_ALGEBRA_X86_KERNELS
+   static const KernelTable sse2_table=
+    {ISA::SSE2,SSE2::gemv,SSE2::gemv_t,SSE2::ger,
+     SSE2::fused_backward_update,SSE2::gemm,SSE2::gemm_nt,
+     SSE2::gemm_sub,SSE2::batch_pivot_search,SSE2::batch_ger,
+     SSE2::batch_dot_sub,SSE2::batch_gemm_sub};
+   static const KernelTable avx2_table=
+    {ISA::AVX2,AVX2::gemv,AVX2::gemv_t,AVX2::ger,
+     AVX2::fused_backward_update,AVX2::gemm,AVX2::gemm_nt,
+     AVX2::gemm_sub,AVX2::batch_pivot_search,AVX2::batch_ger,
+     AVX2::batch_dot_sub,AVX2::batch_gemm_sub};
+   static const KernelTable avx512_table=
+    {ISA::AVX512,AVX2::gemv,AVX512::gemv_t,AVX512::ger,
+     AVX512::fused_backward_update,AVX512::gemm,AVX512::gemm_nt,
+     AVX512::gemm_sub,AVX512::batch_pivot_search,AVX512::batch_ger,
+     AVX512::batch_dot_sub,AVX512::batch_gemm_sub};
+   switch (isa)
+    {
+    case ISA::AVX512: return avx512_table;
+    case ISA::AVX2: return avx2_table;
+    case ISA::SSE2: return sse2_table;
+    default: break;
+    }
+#endif
+   return scalar_table;
+  }
+
+
+//============================================================
+/// Kernel table for the widest instruction set supported by
+/// the CPU (determined once, on first use)
+//============================================================
+  inline const KernelTable& kernels()
+  {
+   static const KernelTable& best=
+    isa_supported(ISA::AVX512) ? kernel_table(ISA::AVX512) :
+    isa_supported(ISA::AVX2) ? kernel_table(ISA::AVX2) :
+    isa_supported(ISA::SSE2) ? kernel_table(ISA::SSE2) :
+    kernel_table(ISA::Scalar);
+   return best;
+  }
+
+
+//============================================================
+/// Kernel table for floats for a given instruction set. There
+/// are scalar and AVX2 float kernels: SSE2 gets the scalar ones
+/// and AVX-512 the AVX2 ones (the table's isa says which). Throws
+/// if the instruction set is not supported.
+//============================================================
+  inline const FloatKernelTable& float_kernel_table(const ISA& isa)
+  {
+   static const FloatKernelTable scalar_table=
+    {ISA::Scalar,Scalar::gemv,Scalar::gemv_t,Scalar::ger,
+     Scalar::fused_backward_update,Scalar::gemm,Scalar::gemm_nt,
+     Scalar::gemm_sub,Scalar::batch_pivot_search,Scalar::batch_ger,
+     Scalar::batch_dot_sub,Scalar::batch_gemm_sub};
+   if (!isa_supported(isa))
+    {
+     throw std::runtime_error(std::string("Kernels for ")+isa_name(isa)+
+                              " are not supported on this machine");
+    }
+#ifdef DENSE_LINEAR_ALGEBRA_X86_KERNELS
+   static const FloatKernelTable avx2_table=
+    {ISA::AVX2,AVX2::gemv,AVX2::gemv_t,AVX2::ger,
+     AVX2::fused_backward_update,AVX2::gemm,AVX2::gemm_nt,
+     AVX2::gemm_sub,AVX2::batch_pivot_search,AVX2::batch_ger,
+     AVX2::batch_dot_sub,AVX2::batch_gemm_sub};
+   if (isa==ISA::AVX2 || isa==ISA::AVX512)
+    {
+     return avx2_table;
+    }
+#endif
+   return scalar_table;
+  }
+
+
+//============================================================
+/// Float kernel table for the widest instruction set supported
+/// by the CPU (determined once, on first use)
+//============================================================
+  inline const FloatKernelTable& float_kernels()
+  {
+   static const FloatKernelTable& best=
+    isa_supported(ISA::AVX2) ? float_kernel_table(ISA::AVX2) :
+    float_kernel_table(ISA::Scalar);
+   return best;
+  }
+
+
+  /// y = b + A x (b may be null)
+  inline void gemv(unsigned n, unsigned m, const double* a, unsigned lda,
+                   const double* x, const double* b, double* y)
+  {
+   kernels().gemv(n,m,a,lda,x,b,y);
+  }
+
+  /// y = A^T x
+  inline void gemv_t(unsigned n, unsigned m, const double* a, unsigned lda,
+                     const double* x, double* y)
+  {
+   kernels().gemv_t(n,m,a,lda,x,y);
+  }
+
+  /// A += alpha x y^T
+  inline void ger(unsigned n, unsigned m, double alpha,
+                  const double* x, const double* y, double* a, unsigned lda)
+  {
+   kernels().ger(n,m,alpha,x,y,a,lda);
+  }
+
+  /// y = A^T d (skipped if y is null), then
+  /// A = A - rate (d x^T + lambda A)
+  inline void fused_backward_update(unsigned n, unsigned m,
+                                    double* a, unsigned lda,
+                                    const double* d, const double* x,
+                                    double rate, double lambda, double* y)
+  {
+   kernels().fused_backward_update(n,m,a,lda,d,x,rate,lambda,y);
+  }
+
+  /// C = bias + A B (bias may be null); A(i,k) is
+  /// a[i*a_row_stride+k*a_col_stride]
+  inline void gemm(unsigned n, unsigned m, unsigned p,
+                   const double* a, unsigned a_row_stride,
+                   unsigned a_col_stride,
+                   const double* b, unsigned ldb,
+                   const double* bias, double* c, unsigned ldc)
+  {
+   kernels().gemm(n,m,p,a,a_row_stride,a_col_stride,b,ldb,bias,c,ldc);
+  }
+
+  /// C = alpha A B^T
+  inline void gemm_nt(unsigned n, unsigned m, unsigned p, double alpha,
+                      const double* a, unsigned lda,
+                      const double* b, unsigned ldb,
+                      double* c, unsigned ldc)
+  {
+   kernels().gemm_nt(n,m,p,alpha,a,lda,b,ldb,c,ldc);
+  }
+
+  /// C = C - A B
+  inline void gemm_sub(unsigned n, unsigned m, unsigned p,
+                       const double* a, unsigned lda,
+                       const double* b, unsigned ldb,
+                       double* c, unsigned ldc)
+  {
+   kernels().gemm_sub(n,m,p,a,lda,b,ldb,c,ldc);
+  }
+
+  /// Index of the largest |x_i| in every lane of an interleaved batch
+  inline void batch_pivot_search(unsigned n, const double* x,
+                                 unsigned incx, unsigned first,
+                                 unsigned* imax)
+  {
+   kernels().batch_pivot_search(n,x,incx,first,imax);
+  }
+
+  /// A_ic -= l_i x_c in every lane of an interleaved batch
+  inline void batch_ger(unsigned n, unsigned m, const double* l,
+                        unsigned ldl, const double* x, double* a,
+                        unsigned lda)
+  {
+   kernels().batch_ger(n,m,l,ldl,x,a,lda);
+  }
+
+  /// y -= sum of u_c x_c in every lane of an interleaved batch
+  inline void batch_dot_sub(unsigned m, const double* u, const double* x,
+                            double* y)
+  {
+   kernels().batch_dot_sub(m,u,x,y);
+  }
+
+  /// C -= A B in every lane of an interleaved batch
+  inline void batch_gemm_sub(unsigned n, unsigned m, unsigned p,
+                             const double* a, unsigned lda,
+                             const double* b, unsigned ldb,
+                             double* c, unsigned ldc)
+  {
+   kernels().batch_gemm_sub(n,m,p,a,lda,b,ldb,c,ldc);
+  }
+
+  /// Single precision versions of the above
+
+  inline void gemv(unsigned n, unsigned m, const float* a, unsigned lda,
+                   const float* x, const float* b, float* y)
+  {
+   float_kernels().gemv(n,m,a,lda,x,b,y);
+  }
+
+  inline void gemv_t(unsigned n, unsigned m, const float* a, unsigned lda,
+                     const float* x, float* y)
+  {
+   float_kernels().gemv_t(n,m,a,lda,x,y);
+  }
+
+  inline void ger(unsigned n, unsigned m, float alpha,
+                  const float* x, const float* y, float* a, unsigned lda)
+  {
+   float_kernels().ger(n,m,alpha,x,y,a,lda);
+  }
+
+  inline void fused_backward_update(unsigned n, unsigned m,
+                                    float* a, unsigned lda,
+                                    const float* d, const float* x,
+                                    float rate, float lambda, float* y)
+  {
+   float_kernels().fused_backward_update(n,m,a,lda,d,x,rate,lambda,y);
+  }
+
+  inline void gemm(unsigned n, unsigned m, unsigned p,
+                   const float* a, unsigned a_row_stride,
+                   unsigned a_col_stride,
+                   const float* b, unsigned ldb,
+                   const float* bias, float* c, unsigned ldc)
+  {
+   float_kernels().gemm(n,m,p,a,a_row_stride,a_col_stride,b,ldb,bias,c,ldc);
+  }
+
+  inline void gemm_nt(unsigned n, unsigned m, unsigned p, float alpha,
+                      const float* a, unsigned lda,
+                      const float* b, unsigned ldb,
+                      float* c, unsigned ldc)
+  {
+   float_kernels().gemm_nt(n,m,p,alpha,a,lda,b,ldb,c,ldc);
+  }
+
+  inline void gemm_sub(unsigned n, unsigned m, unsigned p,
+                       const float* a, unsigned lda,
+                       const float* b, unsigned ldb,
+                       float* c, unsigned ldc)
+  {
+   float_kernels().gemm_sub(n,m,p,a,lda,b,ldb,c,ldc);
+  }
+
+  inline void batch_pivot_search(unsigned n, const float* x,
+                                 unsigned incx, unsigned first,
+                                 unsigned* imax)
+  {
+   float_kernels().batch_pivot_search(n,x,incx,first,imax);
+  }
+
+  inline void batch_ger(unsigned n, unsigned m, const float* l,
+                        unsigned ldl, const float* x, float* a,
+                        unsigned lda)
+  {
+   float_kernels().batch_ger(n,m,l,ldl,x,a,lda);
+  }
+
+  inline void batch_dot_sub(unsigned m, const float* u, const float* x,
+                            float* y)
+  {
+   float_kernels().batch_dot_sub(m,u,x,y);
+  }
+
+  inline void batch_gemm_sub(unsigned n, unsigned m, unsigned p,
+                             const float* a, unsigned lda,
+                             const float* b, unsigned ldb,
+                             float* c, unsigned ldc)
+  {
+   float_kernels().batch_gemm_sub(n,m,p,a,lda,b,ldb,c,ldc);
+  }
+
+ } // end of namespace Kernels
+
+} // end of namespace
+
+
+#endif
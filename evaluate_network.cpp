@@ -0,0 +1,79 @@
+#include "project2_a.h"
+#include "grid_output.h"
+#include "dataset.h"
+#include "benchmark.h"
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Uses a trained network without training it again: loads it from a file
+// (the binary format of NeuralNetwork::save, or the text format of
+// project_test_data.dat) and reports how long loading takes, then
+// optionally saves it in the binary format, evaluates its cost on a
+// dataset and writes its output on the usual grid.
+//
+// Usage: evaluate_network NETWORK_FILE [--save FILE] [--data FILE]
+//            [--grid FILE] [--threads N]
+//
+// e.g. evaluate_network project_test_data.dat --save test_network.bin
+//      evaluate_network test_network.bin --data spiral_training_data.dat
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || argc % 2 != 0) {
+        std::cerr << "Usage: " << argv[0] << " NETWORK_FILE [--save FILE] [--data FILE] [--grid FILE]"
+                  << " [--threads N]" << std::endl;
+        return 1;
+    }
+    std::string network_filename = argv[1];
+    std::string save_filename, data_filename, grid_filename;
+    unsigned n_threads = ThreadPool::default_size();
+
+    try {
+        for (int a = 2; a < argc; a += 2) {
+            std::string option = argv[a];
+            std::string value = argv[a + 1];
+            if (option == "--save") {
+                save_filename = value;
+            } else if (option == "--data") {
+                data_filename = value;
+            } else if (option == "--grid") {
+                grid_filename = value;
+            } else if (option == "--threads") {
+                n_threads = std::stoul(value);
+            } else {
+                throw std::invalid_argument("Unknown option " + option);
+            }
+        }
+
+        NeuralNetwork net = NeuralNetwork::load(network_filename);
+        double load_ns = median_time_per_call_ns([&]() { net = NeuralNetwork::load(network_filename); });
+        std::cout << "Loaded " << network_filename << " (" << net.get_layer_count() << " layers) in "
+                  << load_ns * 1e-3 << " us." << std::endl;
+
+        if (!save_filename.empty()) {
+            net.save(save_filename);
+            double binary_load_ns = median_time_per_call_ns([&]() { NeuralNetwork::load(save_filename); });
+            std::cout << "Saved " << save_filename << "; loading it takes " << binary_load_ns * 1e-3 << " us."
+                      << std::endl;
+        }
+
+        if (!data_filename.empty()) {
+            Dataset data = Dataset::load(data_filename);
+            std::cout << "Cost over the " << data.n_samples() << " samples of " << data_filename << ": "
+                      << net.cost_for_training_data(data) << std::endl;
+        }
+
+        if (!grid_filename.empty()) {
+            std::ofstream grid_output_file(grid_filename);
+            if (!grid_output_file) throw std::runtime_error("Could not open " + grid_filename + " for writing.");
+            std::vector<double> grid = grid_axis(0.0, 1.0, 0.01);
+            write_grid_output(net, grid, grid, grid_output_file, n_threads);
+            std::cout << "Grid output saved to " << grid_filename << "." << std::endl;
+        }
+    } catch (const std::exception& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
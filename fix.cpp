@@ -1,4 +1,5 @@
 #include "project2_a.h"
+#include "dataset.h"
 #include <iostream>
 #include <vector>
 #include <fstream>
@@ -19,22 +20,13 @@ int main() {
 
     // Load training data
     std::vector<std::pair<DoubleVector, DoubleVector>> training_data;
-    std::ifstream training_file("project_training_data.dat");
-    if (!training_file) {
-        std::cerr << "Error: Could not open training data file." << std::endl;
+    try {
+        training_data = load_training_data("project_training_data.dat");
+    } catch (const std::exception& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
         return 1;
     }
 
-    double x1, x2, y;
-    while (training_file >> x1 >> x2 >> y) {
-        DoubleVector input(2), output(1);
-        input[0] = x1;
-        input[1] = x2;
-        output[0] = y;
-        training_data.emplace_back(input, output);
-    }
-    training_file.close();
-
     std::cout << "Loaded " << training_data.size() << " training samples." << std::endl;
 
     // Training parameters
@@ -0,0 +1,345 @@
+#pragma once
+
+#include "project2_a.h"
+#include <array>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+
+// Neural network whose topology is fixed at compile time, e.g.
+// FixedNeuralNetwork<2, 8, 8, 1> for the (2,8,8,1) architecture. All
+// weights, biases and training buffers live in std::arrays inside the
+// object and every loop has compile-time bounds, so the compiler can
+// unroll them and keep a small network entirely in registers. All layers
+// use tanh.
+//
+// The arithmetic is done in exactly the same order as in NeuralNetwork
+// (per-sample SGD), and the parameters are initialised from the same
+// random number stream, so for the same architecture both classes
+// produce the same cost history and outputs. (This assumes both are
+// compiled without floating-point contraction into fused
+// multiply-adds; the vectorised kernels used by NeuralNetwork never
+// contract, but e.g. -march=native -O3 may do it in the loops here.)
+
+// One fully connected layer with In inputs and Out neurons; the weights
+// are stored row by row (weight(i, j) connects input j to neuron i)
+template <unsigned In, unsigned Out>
+struct FixedNeuralNetworkLayer {
+    using Input = std::array<double, In>;
+    using Output = std::array<double, Out>;
+
+    double& weight(unsigned i, unsigned j) { return weights[i * In + j]; }
+    double weight(unsigned i, unsigned j) const { return weights[i * In + j]; }
+
+    // output = sigma(W*input + b)
+    void forward(const Input& input, Output& output) const {
+        for (unsigned i = 0; i < Out; ++i) {
+            output[i] = TanhActivation::sigma(weighted_input(input, i));
+        }
+    }
+
+    // Forward pass for training, also storing sigma'(z) (from the output)
+    void forward(const Input& input, Output& output, Output& dsigma) const {
+        for (unsigned i = 0; i < Out; ++i) {
+            output[i] = TanhActivation::sigma(weighted_input(input, i));
+            dsigma[i] = TanhActivation::dsigma_from_output(output[i]);
+        }
+    }
+
+    // z_i = b_i + sum_j w_ij input_j
+    double weighted_input(const Input& input, unsigned i) const {
+        double sum = biases[i];
+        for (unsigned j = 0; j < In; ++j) {
+            sum += weights[i * In + j] * input[j];
+        }
+        return sum;
+    }
+
+    std::array<double, Out * In> weights{};
+    std::array<double, Out> biases{};
+};
+
+// Calls f(std::integral_constant<std::size_t, I>()) for I = 0, ..., N-1,
+// or in reverse order
+template <class F, std::size_t... I>
+void fixed_for_each_index(F&& f, std::index_sequence<I...>) {
+    (f(std::integral_constant<std::size_t, I>()), ...);
+}
+
+template <class F, std::size_t... I>
+void fixed_for_each_index_reversed(F&& f, std::index_sequence<I...>) {
+    (f(std::integral_constant<std::size_t, sizeof...(I) - 1 - I>()), ...);
+}
+
+template <unsigned... Sizes>
+class FixedNeuralNetwork : public NeuralNetworkBasis {
+    static_assert(sizeof...(Sizes) >= 2, "Need at least an input and an output layer");
+
+public:
+    // Number of layers (excluding the input) and the number of neurons in
+    // each (including the input)
+    static constexpr std::size_t n_layers = sizeof...(Sizes) - 1;
+    static constexpr std::array<unsigned, sizeof...(Sizes)> sizes{Sizes...};
+    static constexpr unsigned input_size = sizes.front();
+    static constexpr unsigned output_size = sizes.back();
+
+    using Input = std::array<double, input_size>;
+    using Output = std::array<double, output_size>;
+    using Sample = std::pair<Input, Output>;
+
+private:
+    using LayerIndices = std::make_index_sequence<n_layers>;
+
+    template <std::size_t... L>
+    static auto make_layers(std::index_sequence<L...>)
+        -> std::tuple<FixedNeuralNetworkLayer<sizes[L], sizes[L + 1]>...>;
+
+    template <std::size_t... L>
+    static auto make_buffers(std::index_sequence<L...>)
+        -> std::tuple<std::array<double, sizes[L]>...>;
+
+public:
+    // Parameters of all layers; also used to return gradients
+    using Layers = decltype(make_layers(LayerIndices()));
+
+    // One array per layer, including the input (activations[0])
+    using Activations = decltype(make_buffers(std::make_index_sequence<n_layers + 1>()));
+
+    // Layer access, e.g. net.layer<0>().weight(i, j)
+    template <std::size_t L>
+    auto& layer() { return std::get<L>(layers); }
+    template <std::size_t L>
+    const auto& layer() const { return std::get<L>(layers); }
+
+    Output feed_forward(const Input& input) const {
+        Activations activation;
+        std::get<0>(activation) = input;
+        forward(activation);
+        return std::get<n_layers>(activation);
+    }
+
+    void feed_forward(const DoubleVector& input, DoubleVector& output) const override {
+        Output result = feed_forward(to_input(input));
+        output = DoubleVector(output_size);
+        for (unsigned i = 0; i < output_size; ++i) {
+            output[i] = result[i];
+        }
+    }
+
+    double cost(const Input& input, const Output& target_output) const {
+        Output output = feed_forward(input);
+        double cost_val = 0.0;
+        for (unsigned i = 0; i < output_size; ++i) {
+            double diff = output[i] - target_output[i];
+            cost_val += 0.5 * diff * diff;
+        }
+        return cost_val;
+    }
+
+    double cost(const DoubleVector& input, const DoubleVector& target_output) const override {
+        return cost(to_input(input), to_output(target_output));
+    }
+
+    double cost_for_training_data(const std::vector<Sample>& training_data) const {
+        double total_cost = 0.0;
+        for (const auto& [input, target] : training_data) {
+            total_cost += cost(input, target);
+        }
+        return total_cost / training_data.size();
+    }
+
+    double cost_for_training_data(const std::vector<std::pair<DoubleVector, DoubleVector>>& training_data) const override {
+        return cost_for_training_data(to_samples(training_data));
+    }
+
+    // Same random numbers, drawn in the same order, as
+    // NeuralNetwork::initialise_parameters()
+    void initialise_parameters() {
+        std::mt19937& gen = RandomNumber::Random_number_generator;
+        std::normal_distribution<double> dist(0.0, 0.1);
+        fixed_for_each_index([&](auto l) {
+            auto& current = std::get<decltype(l)::value>(layers);
+            for (auto& w : current.weights) w = dist(gen);
+            for (auto& b : current.biases) b = dist(gen);
+        }, LayerIndices());
+    }
+
+    // Per-sample SGD, as NeuralNetwork::train() with batch_size = 1
+    void train(const std::vector<Sample>& training_data,
+               double learning_rate, double target_cost, unsigned max_iterations,
+               std::vector<double>& cost_log, double regularization_lambda) {
+        initialise_parameters();
+        unsigned iteration = 0;
+        double current_cost = cost_for_training_data(training_data);
+
+        while (current_cost > target_cost && iteration < max_iterations) {
+            for (const auto& [input, target] : training_data) {
+                sgd_step(input, target, learning_rate, regularization_lambda);
+            }
+
+            // Log cost every 50 iterations
+            if (iteration % 50 == 0) {
+                current_cost = cost_for_training_data(training_data);
+                cost_log.push_back(current_cost);
+                std::cout << "Iteration " << iteration << ": Cost = " << current_cost << std::endl;
+            }
+            ++iteration;
+        }
+
+        if (current_cost <= target_cost) {
+            std::cout << "Training converged successfully after " << iteration << " iterations." << std::endl;
+        } else {
+            std::cout << "Training stopped after reaching the maximum number of iterations." << std::endl;
+        }
+    }
+
+    void train(const std::vector<std::pair<DoubleVector, DoubleVector>>& training_data,
+               double learning_rate, double target_cost, unsigned max_iterations,
+               std::vector<double>& cost_log, double regularization_lambda) {
+        train(to_samples(training_data), learning_rate, target_cost, max_iterations,
+              cost_log, regularization_lambda);
+    }
+
+    // Gradients of the cost for one sample, returned in grad (which has the
+    // same layout as the network's parameters)
+    void backpropagation(const Input& input, const Output& target, Layers& grad) const {
+        Activations activation, dsigma, delta;
+        std::get<0>(activation) = input;
+        forward(activation, dsigma);
+        output_delta(activation, dsigma, target, delta);
+
+        fixed_for_each_index_reversed([&](auto l) {
+            constexpr std::size_t L = decltype(l)::value;
+            constexpr unsigned n = sizes[L + 1], m = sizes[L];
+            const auto& current = std::get<L>(layers);
+            const auto& delta_l = std::get<L + 1>(delta);
+            const auto& a = std::get<L>(activation);
+            auto& g = std::get<L>(grad);
+
+            for (unsigned i = 0; i < n; ++i) {
+                for (unsigned j = 0; j < m; ++j) {
+                    g.weights[i * m + j] = delta_l[i] * a[j];
+                }
+                g.biases[i] = delta_l[i];
+            }
+
+            if constexpr (L > 0) {
+                auto& delta_prev = std::get<L>(delta);
+                delta_prev.fill(0.0);
+                for (unsigned i = 0; i < n; ++i) {
+                    for (unsigned j = 0; j < m; ++j) {
+                        delta_prev[j] += current.weights[i * m + j] * delta_l[i];
+                    }
+                }
+                for (unsigned j = 0; j < m; ++j) {
+                    delta_prev[j] *= std::get<L>(dsigma)[j];
+                }
+            }
+        }, LayerIndices());
+    }
+
+    // Backpropagation and SGD update for one sample, fused as in
+    // NeuralNetwork::sgd_step(): each weight contributes to W^T * delta with
+    // its old value and is then updated in place
+    void sgd_step(const Input& input, const Output& target,
+                  double learning_rate, double regularization_lambda) {
+        Activations activation, dsigma, delta;
+        std::get<0>(activation) = input;
+        forward(activation, dsigma);
+        output_delta(activation, dsigma, target, delta);
+
+        fixed_for_each_index_reversed([&](auto l) {
+            constexpr std::size_t L = decltype(l)::value;
+            constexpr unsigned n = sizes[L + 1], m = sizes[L];
+            auto& current = std::get<L>(layers);
+            const auto& delta_l = std::get<L + 1>(delta);
+            const auto& a = std::get<L>(activation);
+
+            if constexpr (L > 0) {
+                std::get<L>(delta).fill(0.0);
+            }
+            for (unsigned i = 0; i < n; ++i) {
+                double d_i = delta_l[i];
+                for (unsigned j = 0; j < m; ++j) {
+                    double w = current.weights[i * m + j];
+                    if constexpr (L > 0) {
+                        std::get<L>(delta)[j] += w * d_i;
+                    }
+                    current.weights[i * m + j] = w - learning_rate * (d_i * a[j] + regularization_lambda * w);
+                }
+            }
+            for (unsigned i = 0; i < n; ++i) {
+                current.biases[i] -= learning_rate * delta_l[i];
+            }
+
+            if constexpr (L > 0) {
+                for (unsigned j = 0; j < m; ++j) {
+                    std::get<L>(delta)[j] *= std::get<L>(dsigma)[j];
+                }
+            }
+        }, LayerIndices());
+    }
+
+    // Conversions from the runtime-sized containers (which must have the
+    // right sizes)
+    static Input to_input(const DoubleVector& vec) {
+        if (vec.n() != input_size) {
+            throw std::invalid_argument("Input vector does not match the network's input size.");
+        }
+        Input input;
+        for (unsigned i = 0; i < input_size; ++i) input[i] = vec[i];
+        return input;
+    }
+
+    static Output to_output(const DoubleVector& vec) {
+        if (vec.n() != output_size) {
+            throw std::invalid_argument("Output vector does not match the network's output size.");
+        }
+        Output output;
+        for (unsigned i = 0; i < output_size; ++i) output[i] = vec[i];
+        return output;
+    }
+
+    static std::vector<Sample> to_samples(const std::vector<std::pair<DoubleVector, DoubleVector>>& data) {
+        std::vector<Sample> samples;
+        samples.reserve(data.size());
+        for (const auto& [input, target] : data) {
+            samples.emplace_back(to_input(input), to_output(target));
+        }
+        return samples;
+    }
+
+private:
+    // Forward pass from activation[0], filling the other activations
+    void forward(Activations& activation) const {
+        fixed_for_each_index([&](auto l) {
+            constexpr std::size_t L = decltype(l)::value;
+            std::get<L>(layers).forward(std::get<L>(activation), std::get<L + 1>(activation));
+        }, LayerIndices());
+    }
+
+    // Forward pass for training, also filling dsigma with sigma'(z) (laid
+    // out like the activations; dsigma[0] is unused)
+    void forward(Activations& activation, Activations& dsigma) const {
+        fixed_for_each_index([&](auto l) {
+            constexpr std::size_t L = decltype(l)::value;
+            std::get<L>(layers).forward(std::get<L>(activation), std::get<L + 1>(activation),
+                                        std::get<L + 1>(dsigma));
+        }, LayerIndices());
+    }
+
+    // Output layer: delta = (a^(L) - y) * sigma'(z^(L))
+    static void output_delta(const Activations& activation, const Activations& dsigma,
+                             const Output& target, Activations& delta) {
+        for (unsigned i = 0; i < output_size; ++i) {
+            std::get<n_layers>(delta)[i] = (std::get<n_layers>(activation)[i] - target[i]) *
+                                           std::get<n_layers>(dsigma)[i];
+        }
+    }
+
+    Layers layers;
+};
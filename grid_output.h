@@ -0,0 +1,153 @@
+#pragma once
+
+#include "project2_a.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Output of a network with two inputs on a rectangular grid, as
+// "X1 X2 output" lines with X2 running fastest: the grid_output_*.dat
+// format. The text is exactly what the drivers' point-by-point loops
+//
+//     for (double X1 = x_min; X1 <= x_max; X1 += step)
+//         for (double X2 = x_min; X2 <= x_max; X2 += step) {
+//             net.feed_forward(input, output);
+//             file << X1 << " " << X2 << " " << output[0] << "\n";
+//         }
+//
+// write, but the grid is split into tiles (one grid row by up to
+// Grid_tile_columns points) that are spread across threads, and each
+// tile goes through the network as one batch.
+//
+// The first layer's pre-activation is separable, z = (b + W[:,0]*X1) +
+// W[:,1]*X2, and is evaluated in that order, which is the order of the
+// gemv in feed_forward. b + W[:,0]*X1 is computed once per grid row, so
+// a grid point only costs one multiply-add per first-layer neuron, and
+// the results are bitwise the same as feed_forward's. Likewise the
+// coordinates are formatted once per row/column rather than per point.
+
+// Number of grid points in a tile
+constexpr unsigned Grid_tile_columns = 256;
+
+// Grid coordinates x_min, x_min + step, ... up to x_max, accumulated the
+// same way as the drivers' loops (so including their rounding)
+inline std::vector<double> grid_axis(double x_min, double x_max, double step) {
+    if (!(step > 0.0)) throw std::invalid_argument("Grid step must be positive.");
+    std::vector<double> values;
+    for (double x = x_min; x <= x_max; x += step) {
+        values.push_back(x);
+    }
+    return values;
+}
+
+// n_points equally spaced grid coordinates from x_min to x_max
+inline std::vector<double> uniform_grid_axis(double x_min, double x_max, unsigned n_points) {
+    std::vector<double> values(n_points);
+    for (unsigned k = 0; k < n_points; ++k) {
+        values[k] = (n_points == 1) ? x_min : x_min + (x_max - x_min) * k / (n_points - 1);
+    }
+    if (n_points > 1) values.back() = x_max;
+    return values;
+}
+
+// Writes the network's first output at every point (X1, X2) of the grid
+// x1_values x x2_values, as the lines "X1 X2 output"
+inline void write_grid_output(const NeuralNetwork& net, const std::vector<double>& x1_values,
+                              const std::vector<double>& x2_values, std::ostream& out,
+                              unsigned n_threads = ThreadPool::default_size()) {
+    const auto& layers = net.get_layers();
+    if (layers.empty() || layers.front().get_weights().m() != 2) {
+        throw std::invalid_argument("Grid output needs a network with two inputs.");
+    }
+    const unsigned n_rows = x1_values.size();
+    const unsigned n_columns = x2_values.size();
+    if (n_rows == 0 || n_columns == 0) return;
+
+    const DoubleMatrix& first_weights = layers.front().get_weights();
+    const unsigned n_first = first_weights.n();
+    const unsigned tile_columns = std::min(n_columns, Grid_tile_columns);
+    const unsigned n_tiles_per_row = (n_columns + tile_columns - 1) / tile_columns;
+
+    // The coordinates' text, "X1" per row and " X2 " per column
+    char buffer[64];
+    std::vector<std::string> x1_text(n_rows), x2_text(n_columns);
+    for (unsigned r = 0; r < n_rows; ++r) {
+        std::snprintf(buffer, sizeof(buffer), "%g", x1_values[r]);
+        x1_text[r] = buffer;
+    }
+    for (unsigned c = 0; c < n_columns; ++c) {
+        std::snprintf(buffer, sizeof(buffer), " %g ", x2_values[c]);
+        x2_text[c] = buffer;
+    }
+
+    // b + W[:,0]*X1 for every row
+    std::vector<double> row_terms(std::size_t(n_rows) * n_first);
+    for (unsigned r = 0; r < n_rows; ++r) {
+        Kernels::gemv(n_first, 1, first_weights.data(), first_weights.m(), &x1_values[r],
+                      layers.front().get_biases().data(), &row_terms[std::size_t(r) * n_first]);
+    }
+
+    // Per-thread buffers for the layers' outputs on one tile
+    ThreadPool pool(n_threads);
+    struct TileWorkspace {
+        std::vector<DoubleMatrix> zs, activations;
+    };
+    std::vector<TileWorkspace> workspaces(pool.size());
+    for (auto& workspace : workspaces) {
+        for (const auto& layer : layers) {
+            workspace.zs.emplace_back(layer.get_weights().n(), tile_columns);
+            workspace.activations.emplace_back(layer.get_weights().n(), tile_columns);
+        }
+    }
+
+    // Rows are rendered in bands, so only one band's text is held at a time
+    const unsigned band_rows = std::max(16u, 4 * pool.size());
+    std::vector<std::string> tile_text(std::size_t(band_rows) * n_tiles_per_row);
+
+    auto render_tile = [&](unsigned r, unsigned c_begin, unsigned c_end, TileWorkspace& workspace,
+                           std::string& text) {
+        unsigned n = c_end - c_begin;
+        auto& zs = workspace.zs;
+        auto& activations = workspace.activations;
+
+        // First layer: (b + W[:,0]*X1) + W[:,1]*X2
+        Kernels::gemm(n_first, 1, n, first_weights.data() + 1, first_weights.m(), 1, &x2_values[c_begin], n,
+                      &row_terms[std::size_t(r) * n_first], zs[0].data(), zs[0].m());
+        for (unsigned i = 0; i < n_first; ++i) {
+            layers[0].activate(zs[0].data() + i * zs[0].m(), activations[0].data() + i * activations[0].m(), n);
+        }
+        for (unsigned l = 1; l < layers.size(); ++l) {
+            layers[l].forward(activations[l - 1], n, zs[l], activations[l]);
+        }
+
+        const double* output = activations.back().data();
+        char value[64];
+        text.clear();
+        for (unsigned s = 0; s < n; ++s) {
+            std::snprintf(value, sizeof(value), "%g\n", output[s]);
+            text += x1_text[r];
+            text += x2_text[c_begin + s];
+            text += value;
+        }
+    };
+
+    for (unsigned band_begin = 0; band_begin < n_rows; band_begin += band_rows) {
+        unsigned n_band_tiles = (std::min(n_rows, band_begin + band_rows) - band_begin) * n_tiles_per_row;
+        std::atomic<unsigned> next_tile(0);
+        pool.run([&](unsigned t) {
+            for (unsigned tile = next_tile++; tile < n_band_tiles; tile = next_tile++) {
+                unsigned r = band_begin + tile / n_tiles_per_row;
+                unsigned c_begin = (tile % n_tiles_per_row) * tile_columns;
+                unsigned c_end = std::min(n_columns, c_begin + tile_columns);
+                render_tile(r, c_begin, c_end, workspaces[t], tile_text[tile]);
+            }
+        });
+        for (unsigned tile = 0; tile < n_band_tiles; ++tile) {
+            out.write(tile_text[tile].data(), tile_text[tile].size());
+        }
+    }
+}
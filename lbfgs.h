@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+// Limited-memory BFGS for NeuralNetwork::train (TrainingMethod::LBFGS).
+// Each iteration computes the search direction d = -H g from the gradient
+// g and the last few steps s = x_new - x and gradient changes
+// y = g_new - g (the two-loop recursion, with H_0 = (s^T y / y^T y) I for
+// the newest pair), then finds a step length a along d that satisfies the
+// strong Wolfe conditions
+//
+//   f(x + a d) <= f(x) + c1 a g^T d      (sufficient decrease)
+//   |g(x + a d)^T d| <= c2 |g^T d|       (curvature)
+//
+// The parameters, gradients and history all live in flat double arrays, in
+// the order of NeuralNetwork::get_parameters.
+struct LBFGSOptions {
+    // Number of (s, y) pairs kept
+    unsigned history = 10;
+
+    // c1 and c2 of the Wolfe conditions
+    double sufficient_decrease = 1e-4;
+    double curvature = 0.9;
+
+    // Evaluations of the cost and gradient allowed per line search
+    unsigned max_evaluations = 20;
+};
+
+// The (s, y) pairs, oldest first, in a ring of capacity options.history
+class LBFGSHistory {
+public:
+    LBFGSHistory(unsigned n_parameters, unsigned capacity)
+        : n(n_parameters), capacity(std::max(capacity, 1u)), s(std::size_t(n) * this->capacity),
+          y(std::size_t(n) * this->capacity), rho(this->capacity), alpha(this->capacity) {}
+
+    unsigned size() const { return count; }
+    void clear() { count = 0; }
+
+    // Adds the pair, dropping the oldest one if the history is full. Pairs
+    // without positive curvature (s^T y <= 0) would make H indefinite and
+    // are skipped; returns whether the pair was added.
+    bool add(const double* new_s, const double* new_y) {
+        double sy = dot(new_s, new_y);
+        if (!(sy > 0.0)) return false;
+        unsigned slot = (first + count) % capacity;
+        if (count == capacity) {
+            first = (first + 1) % capacity;
+        } else {
+            ++count;
+        }
+        std::copy(new_s, new_s + n, s.data() + std::size_t(slot) * n);
+        std::copy(new_y, new_y + n, y.data() + std::size_t(slot) * n);
+        rho[slot] = 1.0 / sy;
+        return true;
+    }
+
+    // d = -H g by the two-loop recursion; d = -g with an empty history
+    void direction(const double* g, double* d) {
+        for (unsigned p = 0; p < n; ++p) d[p] = -g[p];
+        for (unsigned k = count; k-- > 0;) {
+            unsigned slot = (first + k) % capacity;
+            alpha[slot] = rho[slot] * dot(s_of(slot), d);
+            axpy(-alpha[slot], y_of(slot), d);
+        }
+        if (count > 0) {
+            unsigned newest = (first + count - 1) % capacity;
+            double gamma = 1.0 / (rho[newest] * dot(y_of(newest), y_of(newest)));
+            for (unsigned p = 0; p < n; ++p) d[p] *= gamma;
+        }
+        for (unsigned k = 0; k < count; ++k) {
+            unsigned slot = (first + k) % capacity;
+            double beta = rho[slot] * dot(y_of(slot), d);
+            axpy(alpha[slot] - beta, s_of(slot), d);
+        }
+    }
+
+    // The number of pairs and the pairs, oldest first (s then y), for a
+    // TrainingSnapshot
+    std::vector<double> state() const {
+        std::vector<double> values(1, double(count));
+        for (unsigned k = 0; k < count; ++k) {
+            unsigned slot = (first + k) % capacity;
+            values.insert(values.end(), s_of(slot), s_of(slot) + n);
+            values.insert(values.end(), y_of(slot), y_of(slot) + n);
+        }
+        return values;
+    }
+
+    void restore_state(const std::vector<double>& values) {
+        if (values.empty() || values[0] != std::floor(values[0]) || values[0] < 0.0 || values[0] > capacity ||
+            values.size() != 1 + 2 * std::size_t(values[0]) * n) {
+            throw std::invalid_argument("L-BFGS state does not match the history.");
+        }
+        clear();
+        first = 0;
+        for (unsigned k = 0; k < unsigned(values[0]); ++k) {
+            const double* pair = values.data() + 1 + 2 * std::size_t(k) * n;
+            if (!add(pair, pair + n)) throw std::invalid_argument("L-BFGS state has a pair without curvature.");
+        }
+    }
+
+    static double dot(const double* a, const double* b, unsigned n) {
+        double sum = 0.0;
+        for (unsigned p = 0; p < n; ++p) sum += a[p] * b[p];
+        return sum;
+    }
+
+private:
+    double dot(const double* a, const double* b) const { return dot(a, b, n); }
+
+    void axpy(double a, const double* x, double* result) const {
+        for (unsigned p = 0; p < n; ++p) result[p] += a * x[p];
+    }
+
+    const double* s_of(unsigned slot) const { return s.data() + std::size_t(slot) * n; }
+    const double* y_of(unsigned slot) const { return y.data() + std::size_t(slot) * n; }
+
+    unsigned n, capacity;
+    unsigned first = 0, count = 0;
+    std::vector<double> s, y;
+    std::vector<double> rho, alpha;
+};
+
+struct LineSearchResult {
+    bool success = false;
+    double step = 0.0;
+    double value = 0.0;
+    unsigned evaluations = 0;
+};
+
+// Minimiser of the cubic through (a, fa, dfa) and (b, fb, dfb), kept at
+// least a tenth of the interval away from its ends; the midpoint if the
+// cubic has no minimum there
+inline double cubic_minimiser(double a, double fa, double dfa, double b, double fb, double dfb) {
+    double lo = std::min(a, b), hi = std::max(a, b), margin = 0.1 * (hi - lo);
+    double d1 = dfa + dfb - 3.0 * (fa - fb) / (a - b);
+    double discriminant = d1 * d1 - dfa * dfb;
+    if (discriminant < 0.0) return 0.5 * (a + b);
+    double d2 = std::copysign(std::sqrt(discriminant), b - a);
+    double step = b - (b - a) * (dfb + d2 - d1) / (dfb - dfa + 2.0 * d2);
+    if (!std::isfinite(step)) return 0.5 * (a + b);
+    return std::min(std::max(step, lo + margin), hi - margin);
+}
+
+// Line search for the strong Wolfe conditions (Nocedal and Wright,
+// Numerical Optimization, algorithms 3.5 and 3.6): the step grows from
+// initial_step until it brackets an acceptable one, and the bracket is then
+// shrunk by cubic interpolation. evaluate(step, derivative) returns
+// f(x + step d) and sets derivative to g(x + step d)^T d. A successful
+// search returns the step of the last evaluation, so the caller's buffers
+// still hold its point and gradient.
+template <class Evaluate>
+LineSearchResult strong_wolfe_line_search(Evaluate&& evaluate, double value, double slope, double initial_step,
+                                          const LBFGSOptions& options) {
+    LineSearchResult result;
+    const double c1 = options.sufficient_decrease, c2 = options.curvature;
+    auto sufficient = [&](double step, double trial_value) { return trial_value <= value + c1 * step * slope; };
+    auto accept = [&](double step, double trial_value) {
+        result.success = true;
+        result.step = step;
+        result.value = trial_value;
+        return result;
+    };
+
+    double previous_step = 0.0, previous_value = value, previous_slope = slope;
+    double step = initial_step;
+    double lo = 0.0, lo_value = 0.0, lo_slope = 0.0, hi = 0.0, hi_value = 0.0, hi_slope = 0.0;
+    bool bracketed = false;
+    while (!bracketed && result.evaluations < options.max_evaluations) {
+        double trial_slope;
+        double trial_value = evaluate(step, trial_slope);
+        ++result.evaluations;
+        if (!std::isfinite(trial_value) || !sufficient(step, trial_value) ||
+            (result.evaluations > 1 && trial_value >= previous_value)) {
+            lo = previous_step, lo_value = previous_value, lo_slope = previous_slope;
+            hi = step, hi_value = trial_value, hi_slope = trial_slope;
+            bracketed = true;
+        } else if (std::fabs(trial_slope) <= -c2 * slope) {
+            return accept(step, trial_value);
+        } else if (trial_slope >= 0.0) {
+            lo = step, lo_value = trial_value, lo_slope = trial_slope;
+            hi = previous_step, hi_value = previous_value, hi_slope = previous_slope;
+            bracketed = true;
+        } else {
+            previous_step = step, previous_value = trial_value, previous_slope = trial_slope;
+            step *= 2.0;
+        }
+    }
+
+    // Zoom: lo always satisfies the sufficient decrease condition and has
+    // the lowest value so far; the minimiser lies between lo and hi
+    while (bracketed && result.evaluations < options.max_evaluations) {
+        if (std::isfinite(hi_value) && std::isfinite(hi_slope)) {
+            step = cubic_minimiser(lo, lo_value, lo_slope, hi, hi_value, hi_slope);
+        } else {
+            step = 0.5 * (lo + hi);
+        }
+        if (step == lo || step == hi) break;
+        double trial_slope;
+        double trial_value = evaluate(step, trial_slope);
+        ++result.evaluations;
+        if (!std::isfinite(trial_value) || !sufficient(step, trial_value) || trial_value >= lo_value) {
+            hi = step, hi_value = trial_value, hi_slope = trial_slope;
+        } else {
+            if (std::fabs(trial_slope) <= -c2 * slope) return accept(step, trial_value);
+            if (trial_slope * (hi - lo) >= 0.0) {
+                hi = lo, hi_value = lo_value, hi_slope = lo_slope;
+            }
+            lo = step, lo_value = trial_value, lo_slope = trial_slope;
+        }
+    }
+    return result;
+}
@@ -1,4 +1,6 @@
 #include "project2_a.h"
+#include "grid_output.h"
+#include "dataset.h"
 #include <iostream>
 #include <vector>
 #include <fstream>
@@ -18,22 +20,13 @@ int main() {
 
     // Load training data
     std::vector<std::pair<DoubleVector, DoubleVector>> training_data;
-    std::ifstream training_file("project_training_data.dat");
-    if (!training_file) {
-        std::cerr << "Error: Could not open training data file." << std::endl;
+    try {
+        training_data = load_training_data("project_training_data.dat");
+    } catch (const std::exception& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
         return 1;
     }
 
-    double x1, x2, y;
-    while (training_file >> x1 >> x2 >> y) {
-        DoubleVector input(2), output(1);
-        input[0] = x1;
-        input[1] = x2;
-        output[0] = y;
-        training_data.emplace_back(input, output);
-    }
-    training_file.close();
-
     std::cout << "Loaded " << training_data.size() << " training samples." << std::endl;
 
     // Training parameters
@@ -67,16 +60,8 @@ int main() {
             std::ostringstream fname;
             fname << "grid_output_run" << run << ".dat";
             std::ofstream grid_output_file(fname.str());
-            double step = 0.02; // or whatever step you use
-            for (double X1 = -1.0; X1 <= 1.0; X1 += step) {
-                for (double X2 = -1.0; X2 <= 1.0; X2 += step) {
-                    DoubleVector input(2), output(1);
-                    input[0] = X1;
-                    input[1] = X2;
-                    net.feed_forward(input, output);
-                    grid_output_file << X1 << " " << X2 << " " << output[0] << std::endl;
-                }
-            }
+            std::vector<double> grid = grid_axis(-1.0, 1.0, 0.02);
+            write_grid_output(net, grid, grid, grid_output_file);
             std::cout << "Grid output for run " << run << " saved." << std::endl;
         }
 
@@ -1,4 +1,6 @@
 #include "project2_a.h"
+#include "grid_output.h"
+#include "dataset.h"
 #include <iostream>
 #include <vector>
 #include <fstream>
@@ -20,22 +22,13 @@ int main() {
 
     // Load training data
     std::vector<std::pair<DoubleVector, DoubleVector>> training_data;
-    std::ifstream training_file("spiral_training_data.dat");
-    if (!training_file) {
-        std::cerr << "Error: Could not open spiral_training_data.dat" << std::endl;
+    try {
+        training_data = load_training_data("spiral_training_data.dat");
+    } catch (const std::exception& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
         return 1;
     }
 
-    double x1, x2, label;
-    while (training_file >> x1 >> x2 >> label) {
-        DoubleVector input(2), output(1);
-        input[0] = x1;
-        input[1] = x2;
-        output[0] = label;
-        training_data.emplace_back(input, output);
-    }
-    training_file.close();
-
     std::cout << "Loaded " << training_data.size() << " training samples." << std::endl;
 
     // Training parameters
@@ -66,16 +59,8 @@ int main() {
         std::cerr << "Error: Could not open grid_output_arch2.dat for writing." << std::endl;
         return 1;
     }
-    double step = 0.01;
-    for (double X1 = 0.0; X1 <= 1.0; X1 += step) {
-        for (double X2 = 0.0; X2 <= 1.0; X2 += step) {
-            DoubleVector input(2), output(1);
-            input[0] = X1;
-            input[1] = X2;
-            net.feed_forward(input, output);
-            grid_output_file << X1 << " " << X2 << " " << output[0] << std::endl;
-        }
-    }
+    std::vector<double> grid = grid_axis(0.0, 1.0, 0.01);
+    write_grid_output(net, grid, grid, grid_output_file);
     grid_output_file.close();
     std::cout << "Grid output saved to grid_output_arch2.dat." << std::endl;
 
@@ -1,4 +1,6 @@
 #include "project2_a.h"
+#include "grid_output.h"
+#include "dataset.h"
 #include <iostream>
 #include <vector>
 #include <fstream>
@@ -12,7 +14,7 @@ void run_architecture(
     const std::vector<std::pair<unsigned, ActivationFunction*>>& layers_config,
     const std::vector<std::pair<DoubleVector, DoubleVector>>& training_data,
     double learning_rate, double target_cost, unsigned max_iterations,
-    double regularization_lambda,
+    double regularization_lambda, unsigned batch_size,
     const std::string& cost_log_filename,
     const std::string& grid_output_filename)
 {
@@ -22,7 +24,7 @@ void run_architecture(
 
     // Train the network and log cost
     std::vector<double> cost_log;
-    net.train(training_data, learning_rate, target_cost, max_iterations, cost_log, regularization_lambda);
+    net.train(training_data, learning_rate, target_cost, max_iterations, cost_log, regularization_lambda, batch_size);
 
     // Save cost log
     std::ofstream cost_log_file(cost_log_filename);
@@ -43,16 +45,8 @@ void run_architecture(
         std::cerr << "Error: Could not open " << grid_output_filename << " for writing." << std::endl;
         return;
     }
-    double step = 0.01;
-    for (double X1 = 0.0; X1 <= 1.0; X1 += step) {
-        for (double X2 = 0.0; X2 <= 1.0; X2 += step) {
-            DoubleVector input(2), output(1);
-            input[0] = X1;
-            input[1] = X2;
-            net.feed_forward(input, output);
-            grid_output_file << X1 << " " << X2 << " " << output[0] << "\n";
-        }
-    }
+    std::vector<double> grid = grid_axis(0.0, 1.0, 0.01);
+    write_grid_output(net, grid, grid, grid_output_file);
     grid_output_file.close();
     std::cout << "Grid output saved to " << grid_output_filename << "." << std::endl;
 }
@@ -68,22 +62,13 @@ int main() {
 
     // Load training data
     std::vector<std::pair<DoubleVector, DoubleVector>> training_data;
-    std::ifstream training_file("spiral_training_data.dat");
-    if (!training_file) {
-        std::cerr << "Error: Could not open spiral_training_data.dat" << std::endl;
+    try {
+        training_data = load_training_data("spiral_training_data.dat");
+    } catch (const std::exception& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
         return 1;
     }
 
-    double x1, x2, label;
-    while (training_file >> x1 >> x2 >> label) {
-        DoubleVector input(2), output(1);
-        input[0] = x1;
-        input[1] = x2;
-        output[0] = label;
-        training_data.emplace_back(input, output);
-    }
-    training_file.close();
-
     std::cout << "Loaded " << training_data.size() << " training samples." << std::endl;
 
     // Training parameters
@@ -91,6 +76,7 @@ int main() {
     double target_cost = 1e-3;
     unsigned max_iterations = 4000000;
     double regularization_lambda = 0.0;
+    unsigned batch_size = 1; // 1 = per-sample SGD, >1 = mini-batch
 
     // Run Architecture 2
     run_architecture(
@@ -100,6 +86,7 @@ int main() {
         target_cost,
         max_iterations,
         regularization_lambda,
+        batch_size,
         "cost_log_8.dat",          // Unique cost log filename
         "grid_output_8.dat"        // Unique grid output filename
     );
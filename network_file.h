@@ -0,0 +1,176 @@
+#pragma once
+
+#include "dataset.h"
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Binary format of a trained network, written by NeuralNetwork::save and
+// read by NeuralNetwork::load. The file holds the topology, each layer's
+// activation and all weights and biases, so a model can be evaluated on
+// new data or rendered on a grid without training it again:
+//
+//   NetworkFileHeader                 64 bytes
+//   NetworkFileLayer per layer        64 bytes each
+//   parameters                        for each layer, its weights (row by
+//                                     row, as stored in the layer) and
+//                                     then its biases; every array starts
+//                                     at a 64-byte aligned offset
+//
+// Everything is in native byte order. The parameters are stored in the
+// scalar type of the network that wrote them (scalar_size 8 for double, 4
+// for float); a network of the other type converts them on loading.
+// Readers reject files with a newer version than Network_file_version.
+
+struct NetworkFileHeader {
+    char magic[8];             // "NNMODEL"
+    std::uint32_t version;     // Network_file_version when written
+    std::uint32_t byte_order;  // Network_file_byte_order_mark as written
+    std::uint32_t scalar_size; // bytes per parameter
+    std::uint32_t n_layers;
+    std::uint32_t input_size;
+    std::uint32_t unused;
+    std::uint64_t layers_offset; // of the layer table, in bytes from the start of the file
+    std::uint64_t file_size;
+    char padding[16];
+};
+static_assert(sizeof(NetworkFileHeader) == 64, "NetworkFileHeader must be 64 bytes");
+
+// Activations a file can record
+enum class NetworkFileActivation : std::uint32_t {
+    Tanh = 0,  // TanhActivationFunction
+    Other = 1  // anything else, identified by its name()
+};
+
+constexpr std::size_t Network_file_name_size = 32;
+
+struct NetworkFileLayer {
+    std::uint32_t input_size;
+    std::uint32_t output_size;
+    std::uint32_t activation; // a NetworkFileActivation
+    std::uint32_t unused;
+    char activation_name[Network_file_name_size]; // ActivationFunction::name(), truncated and zero-terminated
+    std::uint64_t weights_offset;
+    std::uint64_t biases_offset;
+};
+static_assert(sizeof(NetworkFileLayer) == 64, "NetworkFileLayer must be 64 bytes");
+
+constexpr char Network_file_magic[8] = "NNMODEL";
+constexpr std::uint32_t Network_file_version = 1;
+constexpr std::uint32_t Network_file_byte_order_mark = 0x01020304;
+
+// A network file mapped into memory (see map_file), with its header and
+// layer table checked. The parameters are read straight from the mapping.
+class NetworkFile {
+public:
+    explicit NetworkFile(const std::string& filename) : mapping(map_file(filename)) {
+        const char* bytes = mapping.bytes();
+        if (mapping.size < sizeof(NetworkFileHeader)) {
+            throw std::runtime_error(filename + " is not a network file");
+        }
+        std::memcpy(&file_header, bytes, sizeof(file_header));
+        if (std::memcmp(file_header.magic, Network_file_magic, sizeof(Network_file_magic)) != 0) {
+            throw std::runtime_error(filename + " is not a network file");
+        }
+        if (file_header.byte_order != Network_file_byte_order_mark) {
+            throw std::runtime_error(filename + " was written with a different byte order");
+        }
+        if (file_header.version == 0 || file_header.version > Network_file_version) {
+            throw std::runtime_error(filename + " has network file version " +
+                                     std::to_string(file_header.version) + ", this reader supports up to " +
+                                     std::to_string(Network_file_version));
+        }
+        if (file_header.scalar_size != sizeof(double) && file_header.scalar_size != sizeof(float)) {
+            throw std::runtime_error(filename + " has an unsupported scalar size");
+        }
+        if (file_header.n_layers == 0 || file_header.file_size != mapping.size ||
+            !section_fits(file_header.layers_offset, file_header.n_layers, sizeof(NetworkFileLayer))) {
+            throw std::runtime_error(filename + " is truncated or corrupt");
+        }
+
+        // Layer sizes must chain and every array must lie within the file
+        std::uint32_t input_size = file_header.input_size;
+        for (std::uint32_t l = 0; l < file_header.n_layers; ++l) {
+            NetworkFileLayer layer;
+            std::memcpy(&layer, bytes + file_header.layers_offset + l * sizeof(NetworkFileLayer), sizeof(layer));
+            if (layer.input_size != input_size || layer.output_size == 0 ||
+                layer.weights_offset % file_header.scalar_size != 0 ||
+                layer.biases_offset % file_header.scalar_size != 0 ||
+                !section_fits(layer.weights_offset, std::uint64_t(layer.output_size) * layer.input_size,
+                              file_header.scalar_size) ||
+                !section_fits(layer.biases_offset, layer.output_size, file_header.scalar_size) ||
+                layer.activation_name[sizeof(layer.activation_name) - 1] != '\0') {
+                throw std::runtime_error(filename + " is truncated or corrupt");
+            }
+            layers.push_back(layer);
+            input_size = layer.output_size;
+        }
+    }
+
+    const NetworkFileHeader& header() const { return file_header; }
+    unsigned n_layers() const { return layers.size(); }
+    const NetworkFileLayer& layer(unsigned l) const { return layers[l]; }
+
+    // Weights (output_size x input_size) and biases of layer l, converted
+    // to T; plain copies if the file holds T
+    template <class T>
+    void copy_weights(unsigned l, T* destination) const {
+        copy_parameters(layers[l].weights_offset, std::size_t(layers[l].output_size) * layers[l].input_size,
+                        destination);
+    }
+
+    template <class T>
+    void copy_biases(unsigned l, T* destination) const {
+        copy_parameters(layers[l].biases_offset, layers[l].output_size, destination);
+    }
+
+    // Offsets of the layer table and of the parameters of a network with
+    // the given layer sizes (sizes[0] is the input size), as save lays
+    // them out; returns the file size
+    static std::uint64_t layout(const std::vector<unsigned>& sizes, std::uint32_t scalar_size,
+                                std::vector<NetworkFileLayer>& file_layers) {
+        file_layers.assign(sizes.size() - 1, NetworkFileLayer());
+        std::uint64_t offset =
+            aligned_offset(sizeof(NetworkFileHeader) + file_layers.size() * sizeof(NetworkFileLayer));
+        for (std::size_t l = 0; l < file_layers.size(); ++l) {
+            NetworkFileLayer& layer = file_layers[l];
+            layer.input_size = sizes[l];
+            layer.output_size = sizes[l + 1];
+            layer.weights_offset = offset;
+            offset = aligned_offset(offset + std::uint64_t(layer.output_size) * layer.input_size * scalar_size);
+            layer.biases_offset = offset;
+            offset = aligned_offset(offset + std::uint64_t(layer.output_size) * scalar_size);
+        }
+        return offset;
+    }
+
+private:
+    template <class T>
+    void copy_parameters(std::uint64_t offset, std::size_t n, T* destination) const {
+        const char* source = mapping.bytes() + offset;
+        if (file_header.scalar_size == sizeof(T)) {
+            std::memcpy(destination, source, n * sizeof(T));
+        } else if (file_header.scalar_size == sizeof(double)) {
+            const double* values = reinterpret_cast<const double*>(source);
+            for (std::size_t i = 0; i < n; ++i) destination[i] = T(values[i]);
+        } else {
+            const float* values = reinterpret_cast<const float*>(source);
+            for (std::size_t i = 0; i < n; ++i) destination[i] = T(values[i]);
+        }
+    }
+
+    // Whether n elements of element_size bytes at offset lie within the
+    // mapping; offsets and counts come from the file, so nothing is added
+    // or multiplied that could wrap
+    bool section_fits(std::uint64_t offset, std::uint64_t n, std::uint64_t element_size) const {
+        return offset <= mapping.size && n <= (mapping.size - offset) / element_size;
+    }
+
+    static std::uint64_t aligned_offset(std::uint64_t offset) { return (offset + 63) / 64 * 64; }
+
+    FileMapping mapping;
+    NetworkFileHeader file_header;
+    std::vector<NetworkFileLayer> layers;
+};
@@ -0,0 +1,294 @@
+#pragma once
+
+#include "dense_linear_algebra.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Update rules for NeuralNetwork::train. Each step takes the gradient g of
+// the cost plus the L2 term (lambda * w for weights, nothing for biases)
+// and updates the parameters with the learning rate r:
+//
+//   SGD       w -= r g
+//   Momentum  v = mu v + g;  w -= r v
+//   Nesterov  v = mu v + g;  w -= r (g + mu v)
+//   RMSProp   s = rho s + (1 - rho) g^2;  w -= r g / (sqrt(s) + eps)
+//   Adam      m = beta1 m + (1 - beta1) g;  s = beta2 s + (1 - beta2) g^2;
+//             w -= r (m / (1 - beta1^t)) / (sqrt(s / (1 - beta2^t)) + eps)
+//
+// where t counts the steps. A step is one update: one sample in per-sample
+// training, one mini-batch otherwise.
+enum class OptimizerKind {
+    SGD,
+    Momentum,
+    Nesterov,
+    RMSProp,
+    Adam
+};
+
+inline const char* optimizer_name(OptimizerKind kind) {
+    switch (kind) {
+    case OptimizerKind::Momentum: return "momentum";
+    case OptimizerKind::Nesterov: return "nesterov";
+    case OptimizerKind::RMSProp: return "rmsprop";
+    case OptimizerKind::Adam: return "adam";
+    default: return "sgd";
+    }
+}
+
+// Optimizer from its name as returned by optimizer_name
+inline OptimizerKind optimizer_kind(const std::string& name) {
+    for (OptimizerKind kind : {OptimizerKind::SGD, OptimizerKind::Momentum, OptimizerKind::Nesterov,
+                               OptimizerKind::RMSProp, OptimizerKind::Adam}) {
+        if (name == optimizer_name(kind)) return kind;
+    }
+    throw std::invalid_argument("Unknown optimizer " + name);
+}
+
+struct OptimizerOptions {
+    OptimizerKind kind = OptimizerKind::SGD;
+    double momentum = 0.9;       // mu, for Momentum and Nesterov
+    double rmsprop_decay = 0.9;  // rho
+    double beta1 = 0.9;          // Adam
+    double beta2 = 0.999;        // Adam
+    double epsilon = 1e-8;       // RMSProp and Adam
+};
+
+// Learning rate as a function of the training iteration (one sweep over
+// the training data), as a multiple of the learning rate passed to train:
+//
+//   Constant  1
+//   Step      step_factor^(iteration / step_interval)
+//   Cosine    min_factor + (1 - min_factor) (1 + cos(pi iteration / period)) / 2,
+//             then min_factor; period 0 means the whole run (max_iterations)
+//
+// With warmup_iterations > 0, the factor first rises linearly from
+// 1/warmup_iterations to 1 over that many iterations, and the schedule
+// proper starts after them.
+enum class LearningRateScheduleKind {
+    Constant,
+    Step,
+    Cosine
+};
+
+struct LearningRateSchedule {
+    LearningRateScheduleKind kind = LearningRateScheduleKind::Constant;
+    unsigned step_interval = 1000;
+    double step_factor = 0.5;
+    unsigned period = 0;
+    double min_factor = 0.0;
+    unsigned warmup_iterations = 0;
+
+    double learning_rate(double base_rate, unsigned iteration, unsigned max_iterations) const {
+        if (iteration < warmup_iterations) {
+            return base_rate * (iteration + 1) / warmup_iterations;
+        }
+        iteration -= warmup_iterations;
+        switch (kind) {
+        case LearningRateScheduleKind::Step:
+            return base_rate * std::pow(step_factor, double(iteration / std::max(step_interval, 1u)));
+        case LearningRateScheduleKind::Cosine: {
+            double length = (period > 0) ? period : double(max_iterations) - warmup_iterations;
+            if (length <= 0.0 || iteration >= length) return base_rate * min_factor;
+            return base_rate * (min_factor + (1.0 - min_factor) * 0.5 * (1.0 + std::cos(M_PI * iteration / length)));
+        }
+        default:
+            return base_rate;
+        }
+    }
+};
+
+// Square roots of n non-negative numbers, in place. The compiler does not
+// vectorise std::sqrt in a loop (it may have to set errno), so on x86 this
+// uses the SSE2 instructions, which every x86-64 CPU has; the results are
+// the same, as both round correctly.
+inline void square_roots(std::size_t n, double* x) {
+    std::size_t i = 0;
+#ifdef DENSE_LINEAR_ALGEBRA_X86_KERNELS
+    for (; i + 2 <= n; i += 2) _mm_storeu_pd(x + i, _mm_sqrt_pd(_mm_loadu_pd(x + i)));
+#endif
+    for (; i < n; ++i) x[i] = std::sqrt(x[i]);
+}
+
+inline void square_roots(std::size_t n, float* x) {
+    std::size_t i = 0;
+#ifdef DENSE_LINEAR_ALGEBRA_X86_KERNELS
+    for (; i + 4 <= n; i += 4) _mm_storeu_ps(x + i, _mm_sqrt_ps(_mm_loadu_ps(x + i)));
+#endif
+    for (; i < n; ++i) x[i] = std::sqrt(x[i]);
+}
+
+// State of an optimizer for a network with parameters of type T: for each
+// layer, one contiguous buffer per moment, holding the entries for the
+// weights (row by row, like the weight matrix) followed by those for the
+// biases. Momentum and Nesterov keep one moment, RMSProp one (the second),
+// Adam both and SGD none. Rows of a layer can be updated independently, so
+// threads can share the update of a layer.
+template <class T>
+class BasicOptimizer {
+public:
+    typedef DenseMatrix<T> Matrix;
+    typedef DenseVector<T> Vector;
+
+    // layer_shapes: (rows, columns) of each layer's weight matrix
+    BasicOptimizer(const OptimizerOptions& options, const std::vector<std::pair<unsigned, unsigned>>& layer_shapes)
+        : options(options), shapes(layer_shapes) {
+        bool first = (options.kind == OptimizerKind::Momentum || options.kind == OptimizerKind::Nesterov ||
+                      options.kind == OptimizerKind::Adam);
+        bool second = (options.kind == OptimizerKind::RMSProp || options.kind == OptimizerKind::Adam);
+        for (const auto& [n_rows, n_cols] : shapes) {
+            std::size_t n = std::size_t(n_rows) * (n_cols + 1);
+            first_moments.emplace_back(first ? n : 0, T(0));
+            second_moments.emplace_back(second ? n : 0, T(0));
+        }
+    }
+
+    OptimizerKind kind() const { return options.kind; }
+    unsigned long steps() const { return n_steps; }
+
+    // Starts the next step, with learning rate r; must be called once per
+    // step, before the rows are updated
+    void begin_step(double learning_rate) {
+        ++n_steps;
+        rate = T(learning_rate);
+        if (options.kind == OptimizerKind::Adam) {
+            first_correction = T(1.0 / (1.0 - std::pow(options.beta1, double(n_steps))));
+            second_correction = T(1.0 / (1.0 - std::pow(options.beta2, double(n_steps))));
+        }
+    }
+
+    // Updates rows [row_begin, row_end) of layer l from its gradients
+    void update_rows(unsigned l, unsigned row_begin, unsigned row_end, Matrix& weights, Vector& biases,
+                     const Matrix& grad_w, const Vector& grad_b, double regularization_lambda) {
+        unsigned n_rows = shapes[l].first, n_cols = shapes[l].second;
+        std::size_t w_begin = std::size_t(row_begin) * n_cols, w_count = std::size_t(row_end - row_begin) * n_cols;
+        std::size_t b_begin = std::size_t(n_rows) * n_cols + row_begin, b_count = row_end - row_begin;
+        T lambda = T(regularization_lambda);
+        update<true>(w_count, weights.data() + w_begin, grad_w.data() + w_begin, lambda,
+                     moment(first_moments[l], w_begin), moment(second_moments[l], w_begin));
+        update<false>(b_count, biases.data() + row_begin, grad_b.data() + row_begin, lambda,
+                      moment(first_moments[l], b_begin), moment(second_moments[l], b_begin));
+    }
+
+    // The step count and all moments, in double precision (exact for
+    // float), for a TrainingSnapshot; empty for SGD
+    std::vector<double> state() const {
+        std::vector<double> values;
+        if (options.kind == OptimizerKind::SGD) return values;
+        values.push_back(double(n_steps));
+        for (unsigned l = 0; l < shapes.size(); ++l) {
+            values.insert(values.end(), first_moments[l].begin(), first_moments[l].end());
+            values.insert(values.end(), second_moments[l].begin(), second_moments[l].end());
+        }
+        return values;
+    }
+
+    void restore_state(const std::vector<double>& values) {
+        std::size_t n = (options.kind == OptimizerKind::SGD) ? 0 : 1;
+        for (unsigned l = 0; l < shapes.size(); ++l) n += first_moments[l].size() + second_moments[l].size();
+        if (values.size() != n) throw std::invalid_argument("Optimizer state does not match the optimizer.");
+        if (n == 0) return;
+        auto value = values.begin();
+        n_steps = (unsigned long)*value++;
+        for (unsigned l = 0; l < shapes.size(); ++l) {
+            for (T& entry : first_moments[l]) entry = T(*value++);
+            for (T& entry : second_moments[l]) entry = T(*value++);
+        }
+    }
+
+private:
+    static T* moment(std::vector<T>& buffer, std::size_t offset) {
+        return buffer.empty() ? nullptr : buffer.data() + offset;
+    }
+
+    // Update of n contiguous parameters; the L2 term only for weights.
+    // Plain elementwise loops, which the compiler vectorises. For SGD this
+    // is exactly the update train has always done. RMSProp and Adam go
+    // through blocks of up to Block_size parameters: the moments and the
+    // arguments of the square roots first, then the roots (square_roots),
+    // then the parameters.
+    template <bool Regularized>
+    void update(std::size_t n, T* __restrict params, const T* __restrict grads, T lambda, T* __restrict first,
+                T* __restrict second) const {
+        const T r = rate;
+        switch (options.kind) {
+        case OptimizerKind::SGD:
+            for (std::size_t i = 0; i < n; ++i) {
+                if (Regularized) {
+                    params[i] -= r * (grads[i] + lambda * params[i]);
+                } else {
+                    params[i] -= r * grads[i];
+                }
+            }
+            break;
+        case OptimizerKind::Momentum:
+        case OptimizerKind::Nesterov: {
+            const T mu = T(options.momentum);
+            const bool nesterov = (options.kind == OptimizerKind::Nesterov);
+            for (std::size_t i = 0; i < n; ++i) {
+                T g = Regularized ? grads[i] + lambda * params[i] : grads[i];
+                T v = mu * first[i] + g;
+                first[i] = v;
+                params[i] -= r * (nesterov ? g + mu * v : v);
+            }
+            break;
+        }
+        case OptimizerKind::RMSProp: {
+            const T rho = T(options.rmsprop_decay), eps = T(options.epsilon);
+            T roots[Block_size];
+            for (std::size_t start = 0; start < n; start += Block_size) {
+                std::size_t n_block = std::min(Block_size, n - start);
+                T* __restrict p = params + start;
+                const T* __restrict gr = grads + start;
+                T* __restrict s = second + start;
+                for (std::size_t i = 0; i < n_block; ++i) {
+                    T g = Regularized ? gr[i] + lambda * p[i] : gr[i];
+                    s[i] = rho * s[i] + (T(1) - rho) * g * g;
+                    roots[i] = s[i];
+                }
+                square_roots(n_block, roots);
+                for (std::size_t i = 0; i < n_block; ++i) {
+                    T g = Regularized ? gr[i] + lambda * p[i] : gr[i];
+                    p[i] -= r * g / (roots[i] + eps);
+                }
+            }
+            break;
+        }
+        case OptimizerKind::Adam: {
+            const T beta1 = T(options.beta1), beta2 = T(options.beta2), eps = T(options.epsilon);
+            const T c1 = first_correction, c2 = second_correction;
+            T roots[Block_size];
+            for (std::size_t start = 0; start < n; start += Block_size) {
+                std::size_t n_block = std::min(Block_size, n - start);
+                T* __restrict p = params + start;
+                const T* __restrict gr = grads + start;
+                T* __restrict m = first + start;
+                T* __restrict s = second + start;
+                for (std::size_t i = 0; i < n_block; ++i) {
+                    T g = Regularized ? gr[i] + lambda * p[i] : gr[i];
+                    m[i] = beta1 * m[i] + (T(1) - beta1) * g;
+                    s[i] = beta2 * s[i] + (T(1) - beta2) * g * g;
+                    roots[i] = s[i] * c2;
+                }
+                square_roots(n_block, roots);
+                for (std::size_t i = 0; i < n_block; ++i) {
+                    p[i] -= r * (m[i] * c1) / (roots[i] + eps);
+                }
+            }
+            break;
+        }
+        }
+    }
+
+    static constexpr std::size_t Block_size = 256;
+
+    OptimizerOptions options;
+    std::vector<std::pair<unsigned, unsigned>> shapes;
+    std::vector<std::vector<T>> first_moments, second_moments;
+    unsigned long n_steps = 0;
+    T rate = 0, first_correction = 1, second_correction = 1;
+};
@@ -2,55 +2,427 @@
 
 #include "project2_a_basics.h"
 #include "dense_linear_algebra.h"
+#include "activation_functions.h"
+#include "dataset.h"
+#include "thread_pool.h"
+#include "training_report.h"
+#include "network_file.h"
+#include "training_snapshot.h"
+#include "optimizer.h"
+#include "lbfgs.h"
 #include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <cmath>
 #include <iostream>
 #include <random>
 #include <fstream>
 #include <stdexcept>
+#include <algorithm>
+#include <memory>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <type_traits>
 
 
 using namespace BasicDenseLinearAlgebra;
 
 // Forward declarations
-inline DoubleVector multiply(const DoubleMatrix& mat, const DoubleVector& vec);
-inline DoubleMatrix transpose(const DoubleMatrix& mat);
-inline DoubleMatrix outer_product(const DoubleVector& a, const DoubleVector& b);
+template <class T>
+inline DenseVector<T> multiply(const DenseMatrix<T>& mat, const DenseVector<T>& vec);
+template <class T>
+inline DenseMatrix<T> transpose(const DenseMatrix<T>& mat);
+template <class T>
+inline DenseMatrix<T> outer_product(const DenseVector<T>& a, const DenseVector<T>& b);
+template <class T>
+inline void multiply_transposed(const DenseMatrix<T>& mat, const DenseVector<T>& vec, DenseVector<T>& result);
+template <class T>
+inline void multiply_transposed(const DenseMatrix<T>& a, const DenseMatrix<T>& b, unsigned n_cols,
+                                DenseMatrix<T>& result);
+template <class T>
+inline void outer_product(const DenseVector<T>& a, const DenseVector<T>& b, DenseMatrix<T>& result);
 
-// Neural Network Layer
-class NeuralNetworkLayer {
+// Neural Network Layer, with weights, biases and buffers of scalar type T
+// (double or float)
+template <class T>
+class BasicNeuralNetworkLayer {
 public:
-    NeuralNetworkLayer(unsigned input_size, unsigned output_size, ActivationFunction* act_func)
-        : weights(output_size, input_size), biases(output_size), activation_function(act_func) {}
+    typedef DenseMatrix<T> Matrix;
+    typedef DenseVector<T> Vector;
 
-    DoubleVector forward(const DoubleVector& input, DoubleVector& z) const {
-        z = DoubleVector(weights.n());
-        DoubleVector output(weights.n());
+    BasicNeuralNetworkLayer(unsigned input_size, unsigned output_size, ActivationFunction* act_func)
+        : weights(output_size, input_size), biases(output_size), activation_function(act_func),
+          activation_kind(classify_activation(act_func)) {}
+
+    Vector forward(const Vector& input, Vector& z) const {
+        z = Vector(weights.n());
+        Vector output(weights.n());
+        forward(input, z, output);
+        return output;
+    }
+
+    // In-place forward pass: z and output must already have the layer's
+    // output size
+    void forward(const Vector& input, Vector& z, Vector& output) const {
+        // z = W*input + b
+        Kernels::gemv(weights.n(), weights.m(), weights.data(), weights.m(),
+                      input.data(), biases.data(), z.data());
+        activate(z.data(), output.data(), weights.n());
+    }
+
+    // In-place forward pass for training: also stores sigma'(z) in dsigma,
+    // so the backward pass doesn't have to evaluate the activation again
+    void forward(const Vector& input, Vector& z, Vector& output, Vector& dsigma) const {
+        Kernels::gemv(weights.n(), weights.m(), weights.data(), weights.m(),
+                      input.data(), biases.data(), z.data());
+        activate(z.data(), output.data(), dsigma.data(), weights.n());
+    }
+
+    // Batched in-place forward pass: each column of input is one sample, so
+    // a whole mini-batch goes through the layer as Z = W*X + b. Only the
+    // first n_samples columns are used.
+    void forward(const Matrix& input, unsigned n_samples, Matrix& z, Matrix& output) const {
+        Kernels::gemm(weights.n(), weights.m(), n_samples, weights.data(), weights.m(), 1,
+                      input.data(), input.m(), biases.data(), z.data(), z.m());
         for (unsigned i = 0; i < weights.n(); ++i) {
-            double sum = biases[i];
-            for (unsigned j = 0; j < weights.m(); ++j) {
-                sum += weights(i, j) * input[j];
-            }
-            z[i] = sum;
-            output[i] = activation_function->sigma(sum);
+            activate(z.data() + i * z.m(), output.data() + i * output.m(), n_samples);
         }
-        return output;
     }
 
-    DoubleMatrix& get_weights() { return weights; }
-    DoubleVector& get_biases() { return biases; }
+    // Batched forward pass for training, also storing sigma'(Z) in dsigma
+    void forward(const Matrix& input, unsigned n_samples, Matrix& z, Matrix& output,
+                 Matrix& dsigma) const {
+        Kernels::gemm(weights.n(), weights.m(), n_samples, weights.data(), weights.m(), 1,
+                      input.data(), input.m(), biases.data(), z.data(), z.m());
+        for (unsigned i = 0; i < weights.n(); ++i) {
+            activate(z.data() + i * z.m(), output.data() + i * output.m(),
+                     dsigma.data() + i * dsigma.m(), n_samples);
+        }
+    }
+
+    // Whole-buffer activation entry points: the activation type is
+    // resolved once per call (tanh is evaluated inline, without virtual
+    // calls), then the n entries are processed in one loop
+    void activate(const T* z, T* a, unsigned n) const {
+        apply_activation(activation_kind, activation_function, z, a, n);
+    }
+
+    // a = sigma(z) and d = sigma'(z); for tanh the derivative is obtained
+    // from the output as 1 - a^2
+    void activate(const T* z, T* a, T* d, unsigned n) const {
+        apply_activation_with_derivative(activation_kind, activation_function, z, a, d, n);
+    }
+
+    void activate_derivative(const T* z, T* d, unsigned n) const {
+        apply_activation_derivative(activation_kind, activation_function, z, d, n);
+    }
+
+    // delta[i] *= sigma'(z[i])
+    void scale_by_derivative(const T* z, T* delta, unsigned n) const {
+        scale_by_activation_derivative(activation_kind, activation_function, z, delta, n);
+    }
+
+    Matrix& get_weights() { return weights; }
+    Vector& get_biases() { return biases; }
+    const Matrix& get_weights() const { return weights; }
+    const Vector& get_biases() const { return biases; }
     ActivationFunction* get_activation_function() const { return activation_function; }
+    ActivationKind get_activation_kind() const { return activation_kind; }
 
 private:
-    DoubleMatrix weights;
-    DoubleVector biases;
+    Matrix weights;
+    Vector biases;
     ActivationFunction* activation_function;
+    ActivationKind activation_kind;
+};
+
+using NeuralNetworkLayer = BasicNeuralNetworkLayer<double>;
+
+// Preallocated buffers for a training step. Everything is sized once from
+// the layer configuration, so backpropagation and the parameter update
+// don't touch the heap.
+template <class T>
+struct BasicNeuralNetworkWorkspace {
+    typedef DenseMatrix<T> Matrix;
+    typedef DenseVector<T> Vector;
+
+    BasicNeuralNetworkWorkspace(const std::vector<BasicNeuralNetworkLayer<T>>& layers, unsigned batch_size = 1)
+        : batch_size(std::max(batch_size, 1u)),
+          batch_targets(layers.back().get_weights().n(), this->batch_size) {
+        unsigned input_size = layers.front().get_weights().m();
+        activations.emplace_back(input_size);
+        batch_activations.emplace_back(input_size, this->batch_size);
+        for (const auto& layer : layers) {
+            unsigned n = layer.get_weights().n();
+            unsigned m = layer.get_weights().m();
+            activations.emplace_back(n);
+            zs.emplace_back(n);
+            dsigmas.emplace_back(n);
+            deltas.emplace_back(n);
+            batch_activations.emplace_back(n, this->batch_size);
+            batch_zs.emplace_back(n, this->batch_size);
+            batch_dsigmas.emplace_back(n, this->batch_size);
+            batch_deltas.emplace_back(n, this->batch_size);
+            grad_w.emplace_back(n, m);
+            grad_b.emplace_back(n);
+        }
+    }
+
+    // Maximum number of samples in a mini-batch
+    unsigned batch_size;
+
+    // Per-sample buffers: activations[0] is the input, activations[l+1],
+    // zs[l], dsigmas[l] (sigma'(z), stored by the forward pass) and
+    // deltas[l] belong to layer l
+    std::vector<Vector> activations, zs, dsigmas, deltas;
+
+    // Per-batch buffers, same layout with one column per sample
+    std::vector<Matrix> batch_activations, batch_zs, batch_dsigmas, batch_deltas;
+    Matrix batch_targets;
+
+    // Gradients of the cost with respect to the weights and biases
+    std::vector<Matrix> grad_w;
+    std::vector<Vector> grad_b;
+
+    // If track_cost is set, the training forward passes add the cost of
+    // every sample they see to cost_sum (from the outputs they compute
+    // anyway, i.e. before that sample's own update). The sum is kept in
+    // double precision whatever T is.
+    bool track_cost = false;
+    double cost_sum = 0.0;
+
+    // Per-phase timings of the training steps run with this workspace
+    // (empty unless compiled with NEURAL_NETWORK_PROFILE)
+    PhaseProfile profile;
+};
+
+using NeuralNetworkWorkspace = BasicNeuralNetworkWorkspace<double>;
+
+// How NeuralNetwork::train uses more than one thread
+enum class ParallelMode {
+    // Each mini-batch is split across the threads, every thread computes the
+    // gradient of its share into its own workspace and the shares are summed
+    // in thread order. Bitwise reproducible for a given number of threads.
+    Deterministic,
+    // Asynchronous, lock-free ("Hogwild") SGD: each thread sweeps its own
+    // part of the training data and updates the shared parameters directly,
+    // without any synchronisation. Threads may read weights while another
+    // thread is updating them, so results are not reproducible.
+    Hogwild
+};
+
+// How NeuralNetwork::train minimises the cost
+enum class TrainingMethod {
+    // Gradient steps with TrainingOptions::optimizer, per sample or per
+    // mini-batch; one iteration is one sweep over the training data
+    FirstOrder,
+    // Levenberg-Marquardt: every iteration assembles the Jacobian J of the
+    // residuals (output - target) of all samples with respect to all
+    // parameters, and solves (J^T J + mu I) step = -J^T r with the LU
+    // solver. The damping mu shrinks after every step that lowers the cost
+    // and grows until one does. The solve costs O(P^3) for P parameters,
+    // so larger networks fall back to first-order training.
+    LevenbergMarquardt,
+    // Full-batch L-BFGS (see lbfgs.h): every iteration is one line search
+    // along the quasi-Newton direction, each evaluation of it one fused
+    // pass over the training data for the cost and the gradient. Needs
+    // O(history * P) memory only, so it suits networks of any size.
+    LBFGS
+};
+
+inline const char* training_method_name(TrainingMethod method) {
+    switch (method) {
+    case TrainingMethod::LevenbergMarquardt: return "levenberg-marquardt";
+    case TrainingMethod::LBFGS: return "lbfgs";
+    default: return "first-order";
+    }
+}
+
+// Training method from its name as returned by training_method_name
+inline TrainingMethod training_method(const std::string& name) {
+    for (TrainingMethod method :
+         {TrainingMethod::FirstOrder, TrainingMethod::LevenbergMarquardt, TrainingMethod::LBFGS}) {
+        if (name == training_method_name(method)) return method;
+    }
+    throw std::invalid_argument("Unknown training method " + name);
+}
+
+struct LevenbergMarquardtOptions {
+    double initial_damping = 1e-3;
+    double damping_increase = 10.0;
+    double damping_decrease = 10.0;
+
+    // Training stops when the damping needed to lower the cost exceeds this
+    double max_damping = 1e10;
+
+    // Networks with more parameters are trained with first-order steps
+    unsigned long max_parameters = 1000;
+};
+
+// Periodic snapshots of a training run, to resume it after an interruption
+// (see training_snapshot.h). Snapshots are written in the background; a
+// final one is taken when the run ends, and when the process receives
+// SIGTERM, after which train returns early.
+struct SnapshotOptions {
+    // Snapshot file; empty for no snapshots
+    std::string filename;
+
+    // Iterations between snapshots; 0 for only the final one
+    unsigned interval = 1000;
+
+    // Continue from the snapshot in filename if there is one (otherwise
+    // start afresh). The network, data and options must be the ones the
+    // snapshot was taken with.
+    bool resume = false;
+};
+
+// Settings for NeuralNetwork::train
+struct TrainingOptions {
+    unsigned batch_size = 1; // 1 = per-sample SGD, >1 = mini-batch
+    unsigned n_threads = 1;
+    ParallelMode parallel_mode = ParallelMode::Deterministic;
+
+    // Visit the samples in a new random order in every sweep, instead of
+    // in the order of the training set
+    bool shuffle = false;
+
+    // Generator for the initial weights and biases and for shuffling;
+    // nullptr uses RandomNumber::Random_number_generator. Runs that train
+    // concurrently must each have their own.
+    std::mt19937* random_number_generator = nullptr;
+
+    // Where the progress messages go; nullptr for none
+    std::ostream* log_stream = &std::cout;
+
+    // The cost is logged and checked against target_cost every 50
+    // iterations. Every exact_cost_interval-th of these (0 = never) it is
+    // the cost over the training set, recomputed with an extra forward
+    // pass over all samples; the others use the running cost of the sweep
+    // just done, accumulated for free from the training steps' own forward
+    // passes. The running cost lags behind a little, since each sample's
+    // cost is taken before its update. The default recomputes every time.
+    unsigned exact_cost_interval = 1;
+
+    // If set, receives the run's iteration count, throughput and (with
+    // NEURAL_NETWORK_PROFILE) per-phase timings
+    TrainingReport* report = nullptr;
+
+    // Update rule and learning rate schedule (see optimizer.h); the
+    // defaults are plain SGD at the learning rate passed to train. Hogwild
+    // training only supports plain SGD.
+    OptimizerOptions optimizer;
+    LearningRateSchedule schedule;
+
+    // Levenberg-Marquardt and L-BFGS ignore the learning rate, the batch
+    // size, the optimizer, shuffling and the parallel mode. Their threads
+    // share the assembly of J^T J, or the samples of the gradient, and
+    // the result does not depend on the timing.
+    TrainingMethod method = TrainingMethod::FirstOrder;
+    LevenbergMarquardtOptions levenberg_marquardt;
+    LBFGSOptions lbfgs;
+
+    SnapshotOptions snapshots;
+};
+
+// Finite-difference approximation of the gradient of a sample's cost
+enum class FiniteDifferenceScheme {
+    Forward, // (C(p+h) - C(p)) / h: one extra cost evaluation per parameter
+    Central  // (C(p+h) - C(p-h)) / 2h: two per parameter, error O(h^2)
+};
+
+struct FiniteDifferenceOptions {
+    FiniteDifferenceScheme scheme = FiniteDifferenceScheme::Forward;
+
+    // Perturbation of each parameter; 0 picks the usual step for the
+    // scheme, about sqrt(eps) for forward and eps^(1/3) for central
+    // differences
+    double step = 0.0;
+
+    // Parameters are shared out between this many threads
+    unsigned n_threads = 1;
+
+    // Step for a network of scalar type T; in single precision the usual
+    // steps are about 3e-4 and 5e-3
+    template <class T = double>
+    double step_size() const {
+        if (step > 0.0) return step;
+        bool forward = (scheme == FiniteDifferenceScheme::Forward);
+        if (std::is_same<T, float>::value) return forward ? 3.0e-4 : 5.0e-3;
+        return forward ? 1.0e-8 : 1.0e-5;
+    }
+};
+
+// Largest difference between the finite-difference and backpropagation
+// gradients of a sample, from NeuralNetwork::check_gradient
+struct GradientCheckResult {
+    double max_abs_deviation = 0.0;
+    // |fd - bp| / max(|fd|, |bp|), over entries where either is above 1e-12
+    double max_rel_deviation = 0.0;
+
+    // Where the largest absolute deviation is: weight (row, column) of the
+    // layer, or bias row if is_bias
+    unsigned layer = 0, row = 0, column = 0;
+    bool is_bias = false;
+};
+
+// Sum of the costs of the samples of a dataset. In double precision they
+// are simply added up; in single precision the sum uses Neumaier's
+// compensated summation, so that its error does not grow with the number
+// of samples and the comparison with target_cost stays meaningful.
+template <class T>
+class CostSum {
+public:
+    void add(T cost) {
+        T sum_new = sum + cost;
+        if (std::fabs(sum) >= std::fabs(cost)) {
+            compensation += (sum - sum_new) + cost;
+        } else {
+            compensation += (cost - sum_new) + sum;
+        }
+        sum = sum_new;
+    }
+
+    double value() const { return double(sum) + double(compensation); }
+
+private:
+    T sum = 0, compensation = 0;
+};
+
+template <>
+class CostSum<double> {
+public:
+    void add(double cost) { sum += cost; }
+    double value() const { return sum; }
+
+private:
+    double sum = 0.0;
 };
 
-// Neural Network
-class NeuralNetwork : public NeuralNetworkBasis {
+// Copy of a vector with its entries converted to scalar type U
+template <class U, class V>
+inline DenseVector<U> convert_vector(const DenseVector<V>& vec) {
+    DenseVector<U> result(vec.n());
+    for (unsigned i = 0; i < vec.n(); ++i) {
+        result[i] = U(vec[i]);
+    }
+    return result;
+}
+
+// Neural Network with parameters of scalar type T (double or float). The
+// interface (inputs, targets and costs) is in double precision, whatever
+// T is; the conversions are free for double.
+template <class T>
+class BasicNeuralNetwork : public NeuralNetworkBasis {
 public:
-    NeuralNetwork(unsigned input_size, const std::vector<std::pair<unsigned, ActivationFunction*>>& layers_config) {
+    typedef DenseMatrix<T> Matrix;
+    typedef DenseVector<T> Vector;
+    typedef BasicNeuralNetworkLayer<T> Layer;
+    typedef BasicNeuralNetworkWorkspace<T> Workspace;
+    typedef BasicOptimizer<T> Optimizer;
+
+    BasicNeuralNetwork(unsigned input_size, const std::vector<std::pair<unsigned, ActivationFunction*>>& layers_config) {
         unsigned prev_size = input_size;
         for (auto& [size, act] : layers_config) {
             layers.emplace_back(prev_size, size, act);
@@ -59,12 +431,12 @@ public:
     }
 
     void feed_forward(const DoubleVector& input, DoubleVector& output) const override {
-        DoubleVector activation = input;
+        Vector activation = convert_vector<T>(input);
         for (auto& layer : layers) {
-            DoubleVector z;
+            Vector z;
             activation = layer.forward(activation, z);
         }
-        output = activation;
+        output = convert_vector<double>(activation);
     }
 
     double cost(const DoubleVector& input, const DoubleVector& target_output) const override {
@@ -86,153 +458,1691 @@ public:
         return total_cost / training_data.size();
     }
 
+    // Same value as above (bitwise, for double), but the samples are read
+    // from the dataset's contiguous arrays and go through the network a
+    // batch at a time, using the batch buffers of the workspace. The
+    // per-sample costs are summed by CostSum<T>, compensated for float.
+    double cost_for_training_data(const Dataset& training_data, Workspace& workspace) const {
+        check_sizes(training_data);
+        auto& activations = workspace.batch_activations;
+        unsigned long n_data = training_data.n_samples();
+        CostSum<T> total_cost;
+        for (unsigned long start = 0; start < n_data; start += workspace.batch_size) {
+            unsigned n_samples = std::min<unsigned long>(workspace.batch_size, n_data - start);
+            DatasetBatch batch = training_data.batch(start, n_samples);
+            pack_batch(batch, workspace);
+            for (unsigned l = 0; l < layers.size(); ++l) {
+                layers[l].forward(activations[l], n_samples, workspace.batch_zs[l], activations[l + 1]);
+            }
+            for (unsigned s = 0; s < n_samples; ++s) {
+                T cost_val = 0;
+                for (unsigned i = 0; i < batch.output_size; ++i) {
+                    T diff = activations.back()(i, s) - T(batch.target(s)[i]);
+                    cost_val += T(0.5) * diff * diff;
+                }
+                total_cost.add(cost_val);
+            }
+        }
+        return total_cost.value() / n_data;
+    }
+
+    double cost_for_training_data(const Dataset& training_data) const {
+        Workspace workspace = make_workspace(cost_batch_size(training_data));
+        return cost_for_training_data(training_data, workspace);
+    }
+
     void initialise_parameters() {
-        std::mt19937& gen = RandomNumber::Random_number_generator;
+        initialise_parameters(RandomNumber::Random_number_generator);
+    }
+
+    void initialise_parameters(std::mt19937& gen) {
         std::normal_distribution<double> dist(0.0, 0.1);
 
         for (auto& layer : layers) {
             for (unsigned i = 0; i < layer.get_weights().n(); ++i) {
                 for (unsigned j = 0; j < layer.get_weights().m(); ++j) {
-                    layer.get_weights()(i, j) = dist(gen);
+                    layer.get_weights()(i, j) = T(dist(gen));
                 }
             }
 
             for (unsigned i = 0; i < layer.get_biases().n(); ++i) {
-                layer.get_biases()[i] = dist(gen);
+                layer.get_biases()[i] = T(dist(gen));
+            }
+        }
+    }
+
+    const std::vector<Layer>& get_layers() const { return layers; }
+
+    // All weights and biases as one flat array: for each layer, its
+    // weights row by row and then its biases
+    unsigned long n_parameters() const {
+        unsigned long n = 0;
+        for (const auto& layer : layers) n += (unsigned long)layer.get_weights().n() * (layer.get_weights().m() + 1);
+        return n;
+    }
+
+    void get_parameters(T* parameters) const {
+        for (const auto& layer : layers) {
+            const Matrix& weights = layer.get_weights();
+            std::size_t n_weights = std::size_t(weights.n()) * weights.m();
+            std::copy(weights.data(), weights.data() + n_weights, parameters);
+            std::copy(layer.get_biases().data(), layer.get_biases().data() + weights.n(), parameters + n_weights);
+            parameters += n_weights + weights.n();
+        }
+    }
+
+    void set_parameters(const T* parameters) {
+        for (auto& layer : layers) {
+            Matrix& weights = layer.get_weights();
+            std::size_t n_weights = std::size_t(weights.n()) * weights.m();
+            std::copy(parameters, parameters + n_weights, weights.data());
+            std::copy(parameters + n_weights, parameters + n_weights + weights.n(), layer.get_biases().data());
+            parameters += n_weights + weights.n();
+        }
+    }
+
+    // Writes the topology, the activations and all parameters in the binary
+    // network format (see network_file.h). The file is written under a
+    // temporary name first, so an existing file is only ever replaced by a
+    // complete one.
+    void save(const std::string& filename) const {
+        std::vector<unsigned> sizes(1, layers.front().get_weights().m());
+        for (const auto& layer : layers) sizes.push_back(layer.get_weights().n());
+        std::vector<NetworkFileLayer> file_layers;
+        std::uint64_t file_size = NetworkFile::layout(sizes, sizeof(T), file_layers);
+
+        NetworkFileHeader header = {};
+        std::memcpy(header.magic, Network_file_magic, sizeof(Network_file_magic));
+        header.version = Network_file_version;
+        header.byte_order = Network_file_byte_order_mark;
+        header.scalar_size = sizeof(T);
+        header.n_layers = layers.size();
+        header.input_size = sizes[0];
+        header.layers_offset = sizeof(NetworkFileHeader);
+        header.file_size = file_size;
+
+        std::vector<char> contents(file_size, 0);
+        std::memcpy(contents.data(), &header, sizeof(header));
+        for (unsigned l = 0; l < layers.size(); ++l) {
+            NetworkFileLayer& file_layer = file_layers[l];
+            file_layer.activation = std::uint32_t((layers[l].get_activation_kind() == ActivationKind::Tanh)
+                                                      ? NetworkFileActivation::Tanh
+                                                      : NetworkFileActivation::Other);
+            std::snprintf(file_layer.activation_name, sizeof(file_layer.activation_name), "%s",
+                          activation_name(layers[l].get_activation_function()).c_str());
+            std::memcpy(contents.data() + header.layers_offset + l * sizeof(NetworkFileLayer), &file_layer,
+                        sizeof(file_layer));
+            const Matrix& weights = layers[l].get_weights();
+            std::memcpy(contents.data() + file_layer.weights_offset, weights.data(),
+                        std::size_t(weights.n()) * weights.m() * sizeof(T));
+            std::memcpy(contents.data() + file_layer.biases_offset, layers[l].get_biases().data(),
+                        std::size_t(weights.n()) * sizeof(T));
+        }
+
+        std::string temporary_filename = filename + ".tmp";
+        std::ofstream file(temporary_filename, std::ios::binary);
+        if (!file) throw std::runtime_error("Could not open " + temporary_filename + " for writing");
+        file.write(contents.data(), contents.size());
+        file.close();
+        if (!file || std::rename(temporary_filename.c_str(), filename.c_str()) != 0) {
+            std::remove(temporary_filename.c_str());
+            throw std::runtime_error("Could not write " + filename);
+        }
+    }
+
+    // Network stored in a file: the binary format written by save, or the
+    // text format of project_test_data.dat (see load_text). Tanh layers
+    // share one TanhActivationFunction; files with other activations need
+    // activation_functions, one per layer, whose names must match the ones
+    // recorded in the file.
+    static BasicNeuralNetwork load(const std::string& filename,
+                                   const std::vector<ActivationFunction*>& activation_functions = {}) {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file) throw std::runtime_error("Could not open " + filename);
+        char magic[sizeof(Network_file_magic)] = {};
+        file.read(magic, sizeof(magic));
+        file.close();
+        if (std::memcmp(magic, Network_file_magic, sizeof(magic)) == 0) {
+            return load_binary(filename, activation_functions);
+        }
+        return load_text(filename, activation_functions);
+    }
+
+    // Network written by save, in either precision. The file is mapped and
+    // the parameters are copied from the mapping straight into the layers,
+    // without any parsing.
+    static BasicNeuralNetwork load_binary(const std::string& filename,
+                                          const std::vector<ActivationFunction*>& activation_functions = {}) {
+        NetworkFile file(filename);
+        check_activation_count(filename, file.n_layers(), activation_functions);
+        std::vector<std::pair<unsigned, ActivationFunction*>> layers_config;
+        for (unsigned l = 0; l < file.n_layers(); ++l) {
+            const NetworkFileLayer& file_layer = file.layer(l);
+            layers_config.emplace_back(file_layer.output_size,
+                                       activation_for_layer(filename, l, file_layer.activation_name,
+                                                            activation_functions));
+        }
+
+        BasicNeuralNetwork net(file.header().input_size, layers_config);
+        for (unsigned l = 0; l < file.n_layers(); ++l) {
+            file.copy_weights(l, net.layers[l].get_weights().data());
+            file.copy_biases(l, net.layers[l].get_biases().data());
+        }
+        return net;
+    }
+
+    // Network in the text format of project_test_data.dat: for each layer,
+    // the activation function's name, the input and output sizes, then the
+    // biases and the weights as written by DoubleVector::output and
+    // DoubleMatrix::output. activation_functions as for load.
+    static BasicNeuralNetwork load_text(const std::string& filename,
+                                        const std::vector<ActivationFunction*>& activation_functions = {}) {
+        std::ifstream file(filename);
+        if (!file) throw std::runtime_error("Could not open " + filename);
+        std::vector<std::pair<unsigned, ActivationFunction*>> layers_config;
+        std::vector<Vector> biases;
+        std::vector<Matrix> weights;
+        unsigned input_size = 0;
+        std::string name;
+        while (file >> name) {
+            unsigned l = layers_config.size();
+            int n_inputs = 0, n_outputs = 0;
+            if (!(file >> n_inputs >> n_outputs) || n_inputs <= 0 || n_outputs <= 0 ||
+                (l > 0 && unsigned(n_inputs) != layers_config.back().first)) {
+                throw std::runtime_error(filename + ": invalid sizes for layer " + std::to_string(l));
             }
+            if (l == 0) input_size = n_inputs;
+            layers_config.emplace_back(n_outputs, activation_for_layer(filename, l, name, activation_functions));
+            biases.emplace_back(n_outputs);
+            weights.emplace_back(n_outputs, n_inputs);
+            biases.back().read(file);
+            weights.back().read(file);
+            if (!file) throw std::runtime_error(filename + ": incomplete parameters for layer " + std::to_string(l));
+        }
+        if (layers_config.empty()) throw std::runtime_error(filename + " contains no layers");
+        check_activation_count(filename, layers_config.size(), activation_functions);
+
+        BasicNeuralNetwork net(input_size, layers_config);
+        for (unsigned l = 0; l < layers_config.size(); ++l) {
+            net.layers[l].get_weights() = weights[l];
+            net.layers[l].get_biases() = biases[l];
         }
+        return net;
+    }
+
+    // Workspace sized for this network and mini-batches of up to batch_size samples
+    Workspace make_workspace(unsigned batch_size = 1) const {
+        return Workspace(layers, batch_size);
     }
 
     void train(const std::vector<std::pair<DoubleVector, DoubleVector>>& training_data,
                double learning_rate, double target_cost, unsigned max_iterations,
-               std::vector<double>& cost_log, double regularization_lambda) {
-        initialise_parameters();
-        unsigned iteration = 0;
-        double current_cost = cost_for_training_data(training_data);
+               std::vector<double>& cost_log, double regularization_lambda,
+               unsigned batch_size = 1) {
+        TrainingOptions options;
+        options.batch_size = batch_size;
+        train(training_data, learning_rate, target_cost, max_iterations, cost_log, regularization_lambda, options);
+    }
 
-        while (current_cost > target_cost && iteration < max_iterations) {
-            for (const auto& [input, target] : training_data) {
-                std::vector<DoubleMatrix> grad_w;
-                std::vector<DoubleVector> grad_b;
-                grad_w.reserve(layers.size());
-                grad_b.reserve(layers.size());
-                for (unsigned l = 0; l < layers.size(); ++l) {
-                    grad_w.emplace_back(layers[l].get_weights().n(), layers[l].get_weights().m());
-                    grad_b.emplace_back(layers[l].get_biases().n());
-                }
+    void train(const std::vector<std::pair<DoubleVector, DoubleVector>>& training_data,
+               double learning_rate, double target_cost, unsigned max_iterations,
+               std::vector<double>& cost_log, double regularization_lambda,
+               const TrainingOptions& options) {
+        train(Dataset(training_data), learning_rate, target_cost, max_iterations, cost_log,
+              regularization_lambda, options);
+    }
+
+    void train(const Dataset& training_data, double learning_rate, double target_cost, unsigned max_iterations,
+               std::vector<double>& cost_log, double regularization_lambda, unsigned batch_size = 1) {
+        TrainingOptions options;
+        options.batch_size = batch_size;
+        train(training_data, learning_rate, target_cost, max_iterations, cost_log, regularization_lambda, options);
+    }
 
-                backpropagation(input, target, grad_w, grad_b);
+    void train(const Dataset& training_data, double learning_rate, double target_cost, unsigned max_iterations,
+               std::vector<double>& cost_log, double regularization_lambda, const TrainingOptions& options) {
+        check_sizes(training_data);
+        auto start_time = std::chrono::steady_clock::now();
+        std::uint64_t start_counter = profile_counter();
 
-                // Update parameters
-                for (unsigned l = 0; l < layers.size(); ++l) {
-                    auto& weights = layers[l].get_weights();
-                    auto& biases = layers[l].get_biases();
+        // All buffers for the training steps are allocated here, once
+        TrainingRun run(*this, training_data, options);
 
-                    for (unsigned i = 0; i < weights.n(); ++i) {
-                        for (unsigned j = 0; j < weights.m(); ++j) {
-                            weights(i, j) -= learning_rate * (grad_w[l](i, j) + regularization_lambda * weights(i, j));
-                        }
-                    }
+        std::mt19937& gen = (options.random_number_generator != nullptr) ? *options.random_number_generator
+                                                                          : RandomNumber::Random_number_generator;
 
-                    for (unsigned i = 0; i < biases.n(); ++i) {
-                        biases[i] -= learning_rate * grad_b[l][i];
-                    }
-                }
+        // Snapshots: a writer thread, and SIGTERM caught while this runs.
+        // Only the cost log entries of this run go into the snapshots.
+        const SnapshotOptions& snapshots = options.snapshots;
+        std::unique_ptr<SnapshotWriter> snapshot_writer;
+        std::unique_ptr<TerminationGuard> termination_guard;
+        if (!snapshots.filename.empty()) {
+            snapshot_writer = std::make_unique<SnapshotWriter>(snapshots.filename);
+            termination_guard = std::make_unique<TerminationGuard>();
+        }
+        std::size_t cost_log_start = cost_log.size();
+        bool resume = snapshot_writer && snapshots.resume && std::ifstream(snapshots.filename).good();
+
+        // With shuffling, every sweep first gathers the samples into
+        // shuffled_data in the new order, so the sweep itself still reads
+        // the samples sequentially. The order is shuffled further in every
+        // sweep.
+        bool shuffle = (options.shuffle && !run.full_batch());
+        std::vector<unsigned long> order;
+        Dataset shuffled_data;
+        if (shuffle) {
+            order.resize(training_data.n_samples());
+            std::iota(order.begin(), order.end(), 0ul);
+        }
+
+        // Phases outside the training steps are timed in this profile
+        PhaseProfile profile;
+        PhaseMark mark = profile.start();
+
+        // Without any exact evaluation, the cost is unknown until the end
+        // of the first sweep
+        bool exact_cost = (options.exact_cost_interval > 0);
+        Workspace cost_workspace =
+            make_workspace((exact_cost || run.full_batch()) ? cost_batch_size(training_data) : 1);
+        unsigned iteration = 0;
+        double current_cost;
+        if (resume) {
+            resume_training(snapshots.filename, run, gen, order, cost_log, iteration, current_cost);
+        } else {
+            initialise_parameters(gen);
+            current_cost = (exact_cost || run.full_batch()) ? cost_for_training_data(training_data, cost_workspace)
+                                                            : std::numeric_limits<double>::infinity();
+        }
+        unsigned first_iteration = iteration;
+        bool interrupted = false;
+        bool stalled = false;
+        profile.lap(TrainingPhase::Cost, mark);
+
+        while (current_cost > target_cost && iteration < max_iterations) {
+            // Log cost every 50 iterations, exact or from this sweep
+            bool log_cost = (iteration % 50 == 0);
+            bool exact_now = log_cost && exact_cost && (iteration / 50) % options.exact_cost_interval == 0;
+            run.start_sweep(log_cost && !exact_now);
+
+            const Dataset* sweep_data = &training_data;
+            if (shuffle) {
+                mark = profile.start();
+                std::shuffle(order.begin(), order.end(), gen);
+                training_data.reorder(order, shuffled_data);
+                sweep_data = &shuffled_data;
+                profile.lap(TrainingPhase::Shuffle, mark);
             }
 
-            // Log cost every 50 iterations
-            if (iteration % 50 == 0) {
-                current_cost = cost_for_training_data(training_data);
+            // The first-order steps time themselves in their workspaces
+            double rate = options.schedule.learning_rate(learning_rate, iteration, max_iterations);
+            mark = profile.start();
+            stalled = !training_iteration(*sweep_data, rate, regularization_lambda, options, run, current_cost);
+            if (run.full_batch()) profile.lap(TrainingPhase::Update, mark);
+            if (stalled) break;
+
+            if (log_cost) {
+                mark = profile.start();
+                if (run.full_batch()) {
+                    // current_cost is the exact cost after the step
+                } else if (exact_now) {
+                    current_cost = cost_for_training_data(training_data, cost_workspace);
+                } else {
+                    current_cost = run.cost_sum() / training_data.n_samples();
+                }
                 cost_log.push_back(current_cost);
-                std::cout << "Iteration " << iteration << ": Cost = " << current_cost << std::endl;
+                profile.lap(TrainingPhase::Cost, mark);
+                if (options.log_stream != nullptr) {
+                    *options.log_stream << "Iteration " << iteration << ": Cost = " << current_cost << std::endl;
+                    profile.lap(TrainingPhase::Logging, mark);
+                }
             }
 
             ++iteration;
+
+            if (snapshot_writer) {
+                if (TerminationGuard::requested()) {
+                    interrupted = true;
+                    break;
+                }
+                if (snapshots.interval > 0 && iteration % snapshots.interval == 0) {
+                    snapshot_writer->submit(
+                        make_snapshot(iteration, current_cost, cost_log, cost_log_start, gen, order, run.state()));
+                }
+            }
+        }
+
+        // Final snapshot, waiting for it to be written
+        if (snapshot_writer) {
+            snapshot_writer->submit(
+                make_snapshot(iteration, current_cost, cost_log, cost_log_start, gen, order, run.state()));
+            snapshot_writer->flush();
         }
 
-        if (current_cost <= target_cost) {
-            std::cout << "Training converged successfully after " << iteration << " iterations." << std::endl;
+        if (options.report != nullptr) {
+            TrainingReport& report = *options.report;
+            report = TrainingReport();
+            report.iterations = iteration;
+            report.first_iteration = first_iteration;
+            report.interrupted = interrupted;
+            report.samples = (unsigned long long)(iteration - first_iteration) * training_data.n_samples();
+            report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+            report.samples_per_second = (report.seconds > 0.0) ? report.samples / report.seconds : 0.0;
+            report.final_cost = current_cost;
+            run.merge_profiles(profile);
+            report.set_phases(profile, profile_counter() - start_counter);
+        }
+
+        if (options.log_stream == nullptr) {
+            return;
+        }
+        if (interrupted) {
+            *options.log_stream << "Training interrupted after " << iteration << " iterations; snapshot saved to "
+                                << snapshots.filename << "." << std::endl;
+        } else if (current_cost <= target_cost) {
+            *options.log_stream << "Training converged successfully after " << iteration << " iterations." << std::endl;
+        } else if (stalled) {
+            *options.log_stream << "Training stopped after " << iteration << " iterations: no "
+                                << (run.method == TrainingMethod::LBFGS ? "L-BFGS line search"
+                                                                        : "Levenberg-Marquardt step")
+                                << " lowers the cost any further." << std::endl;
         } else {
-            std::cout << "Training stopped after reaching the maximum number of iterations." << std::endl;
+            *options.log_stream << "Training stopped after reaching the maximum number of iterations." << std::endl;
         }
     }
 
     void backpropagation(const DoubleVector& input, const DoubleVector& target,
-                         std::vector<DoubleMatrix>& grad_w, std::vector<DoubleVector>& grad_b) {
-        std::vector<DoubleVector> activations, zs;
-        DoubleVector activation = input;
-        activations.push_back(activation);
+                         std::vector<Matrix>& grad_w, std::vector<Vector>& grad_b) {
+        Workspace workspace = make_workspace();
+        backpropagation(input, target, workspace);
+        grad_w = workspace.grad_w;
+        grad_b = workspace.grad_b;
+    }
 
-        // Forward pass
-        for (auto& layer : layers) {
-            DoubleVector z;
-            activation = layer.forward(activation, z);
-            zs.push_back(z);
-            activations.push_back(activation);
+    // Allocation-free backpropagation: the gradients are returned in
+    // workspace.grad_w and workspace.grad_b
+    void backpropagation(const DoubleVector& input, const DoubleVector& target,
+                         Workspace& workspace) const {
+        backpropagation(input.data(), target.data(), workspace);
+    }
+
+    // As above, for a sample stored elsewhere (e.g. in a Dataset)
+    void backpropagation(const double* input, const double* target, Workspace& workspace) const {
+        auto& activations = workspace.activations;
+        auto& dsigmas = workspace.dsigmas;
+        auto& deltas = workspace.deltas;
+
+        PhaseMark mark = workspace.profile.start();
+        for (unsigned i = 0; i < activations[0].n(); ++i) {
+            activations[0][i] = T(input[i]);
         }
 
-        // Backward pass: output layer
-        DoubleVector delta = activations.back();
-        for (unsigned i = 0; i < delta.n(); ++i) {
-            delta[i] -= target[i]; // delta = a^(L) - y
+        // Forward pass, storing sigma'(z) for the backward pass
+        for (unsigned l = 0; l < layers.size(); ++l) {
+            layers[l].forward(activations[l], workspace.zs[l], activations[l + 1], dsigmas[l]);
         }
+        workspace.profile.lap(TrainingPhase::Forward, mark);
 
-        // Apply derivative of activation at output layer
+        // Backward pass: output layer, delta = (a^(L) - y) * sigma'(z^(L))
+        Vector& delta = deltas.back();
+        T cost_val = 0;
         for (unsigned i = 0; i < delta.n(); ++i) {
-            double dz = layers.back().get_activation_function()->dsigma(zs.back()[i]);
-            delta[i] *= dz;
+            T diff = activations.back()[i] - T(target[i]);
+            delta[i] = diff * dsigmas.back()[i];
+            cost_val += T(0.5) * diff * diff;
         }
+        if (workspace.track_cost) workspace.cost_sum += cost_val;
 
-        grad_w.back() = outer_product(delta, activations[activations.size() - 2]);
-        grad_b.back() = delta;
+        outer_product(delta, activations[activations.size() - 2], workspace.grad_w.back());
+        workspace.grad_b.back() = delta;
 
         // Hidden layers
         for (int l = (int)layers.size() - 2; l >= 0; --l) {
-            delta = multiply(transpose(layers[l + 1].get_weights()), delta);
+            multiply_transposed(layers[l + 1].get_weights(), deltas[l + 1], deltas[l]);
+
+            for (unsigned i = 0; i < deltas[l].n(); ++i) {
+                deltas[l][i] *= dsigmas[l][i];
+            }
+
+            outer_product(deltas[l], activations[l], workspace.grad_w[l]);
+            workspace.grad_b[l] = deltas[l];
+        }
+        workspace.profile.lap(TrainingPhase::Backward, mark);
+    }
+
+    // Fused backpropagation and SGD update for a single sample. Each weight
+    // row is swept once: it contributes to W^T * delta for the layer below
+    // (using the old weight) and then gets the rank-1 update and the L2
+    // regularisation term in place, so the gradient matrices are never
+    // formed. Gives exactly the same parameters as backpropagation()
+    // followed by a separate update.
+    void sgd_step(const DoubleVector& input, const DoubleVector& target,
+                  double learning_rate, double regularization_lambda,
+                  Workspace& workspace) {
+        sgd_step(input.data(), target.data(), learning_rate, regularization_lambda, workspace);
+    }
+
+    void sgd_step(const double* input, const double* target, double learning_rate, double regularization_lambda,
+                  Workspace& workspace) {
+        auto& activations = workspace.activations;
+        auto& dsigmas = workspace.dsigmas;
+        auto& deltas = workspace.deltas;
+
+        PhaseMark mark = workspace.profile.start();
+        for (unsigned i = 0; i < activations[0].n(); ++i) {
+            activations[0][i] = T(input[i]);
+        }
+
+        // Forward pass, storing sigma'(z) for the backward pass
+        for (unsigned l = 0; l < layers.size(); ++l) {
+            layers[l].forward(activations[l], workspace.zs[l], activations[l + 1], dsigmas[l]);
+        }
+        workspace.profile.lap(TrainingPhase::Forward, mark);
+
+        // Output layer: delta = (a^(L) - y) * sigma'(z^(L))
+        Vector& delta = deltas.back();
+        T cost_val = 0;
+        for (unsigned i = 0; i < delta.n(); ++i) {
+            T diff = activations.back()[i] - T(target[i]);
+            delta[i] = diff * dsigmas.back()[i];
+            cost_val += T(0.5) * diff * diff;
+        }
+        if (workspace.track_cost) workspace.cost_sum += cost_val;
+
+        // Backward sweep with in-place update of each layer
+        T rate = T(learning_rate);
+        for (int l = (int)layers.size() - 1; l >= 0; --l) {
+            auto& weights = layers[l].get_weights();
+            auto& biases = layers[l].get_biases();
+            const Vector& delta_l = deltas[l];
+            bool propagate = (l > 0);
+
+            Kernels::fused_backward_update(weights.n(), weights.m(), weights.data(), weights.m(),
+                                           delta_l.data(), activations[l].data(),
+                                           rate, T(regularization_lambda),
+                                           propagate ? deltas[l - 1].data() : nullptr);
+            for (unsigned i = 0; i < biases.n(); ++i) {
+                biases[i] -= rate * delta_l[i];
+            }
+
+            if (propagate) {
+                for (unsigned j = 0; j < weights.m(); ++j) {
+                    deltas[l - 1][j] *= dsigmas[l - 1][j];
+                }
+            }
+        }
+        workspace.profile.lap(TrainingPhase::Backward, mark);
+    }
+
+    // Batched backpropagation: each column of inputs/targets is one sample.
+    // The gradients are averaged over the batch, so a batch of one sample
+    // gives exactly the same result as the per-sample version above.
+    void backpropagation(const DoubleMatrix& inputs, const DoubleMatrix& targets,
+                         std::vector<Matrix>& grad_w, std::vector<Vector>& grad_b) {
+        unsigned n_samples = inputs.m();
+        Workspace workspace = make_workspace(n_samples);
+        for (unsigned s = 0; s < n_samples; ++s) {
+            for (unsigned j = 0; j < inputs.n(); ++j) workspace.batch_activations[0](j, s) = T(inputs(j, s));
+            for (unsigned j = 0; j < targets.n(); ++j) workspace.batch_targets(j, s) = T(targets(j, s));
+        }
+        backpropagation(n_samples, workspace);
+        grad_w = workspace.grad_w;
+        grad_b = workspace.grad_b;
+    }
+
+    // Batched backpropagation for consecutive samples of a Dataset; the
+    // batch must fit in the workspace
+    void backpropagation(const DatasetBatch& batch, Workspace& workspace) const {
+        pack_batch(batch, workspace);
+        backpropagation(batch.n_samples, workspace);
+    }
+
+    // Allocation-free batched backpropagation, averaging the gradients over
+    // the first n_samples columns of workspace.batch_activations[0] and
+    // workspace.batch_targets
+    void backpropagation(unsigned n_samples, Workspace& workspace) const {
+        backpropagation(n_samples, workspace, T(1.0 / n_samples));
+    }
+
+    // As above, but the gradients summed over the samples are multiplied by
+    // scale (1/(size of the whole batch) when a batch is split across
+    // threads)
+    void backpropagation(unsigned n_samples, Workspace& workspace, T scale) const {
+        auto& activations = workspace.batch_activations;
+        auto& dsigmas = workspace.batch_dsigmas;
+        auto& deltas = workspace.batch_deltas;
+
+        // Forward pass, storing sigma'(Z) for the backward pass
+        PhaseMark mark = workspace.profile.start();
+        for (unsigned l = 0; l < layers.size(); ++l) {
+            layers[l].forward(activations[l], n_samples, workspace.batch_zs[l], activations[l + 1], dsigmas[l]);
+        }
+        workspace.profile.lap(TrainingPhase::Forward, mark);
+
+        // Backward pass: output layer, delta = (A^(L) - Y) * sigma'(Z^(L))
+        Matrix& delta = deltas.back();
+        for (unsigned i = 0; i < delta.n(); ++i) {
+            for (unsigned s = 0; s < n_samples; ++s) {
+                delta(i, s) = (activations.back()(i, s) - workspace.batch_targets(i, s)) * dsigmas.back()(i, s);
+            }
+        }
+        if (workspace.track_cost) {
+            for (unsigned s = 0; s < n_samples; ++s) {
+                T cost_val = 0;
+                for (unsigned i = 0; i < delta.n(); ++i) {
+                    T diff = activations.back()(i, s) - workspace.batch_targets(i, s);
+                    cost_val += T(0.5) * diff * diff;
+                }
+                workspace.cost_sum += cost_val;
+            }
+        }
+
+        batch_gradients(delta, activations[activations.size() - 2], n_samples, scale,
+                        workspace.grad_w.back(), workspace.grad_b.back());
+
+        // Hidden layers: delta = (W^T * delta) * sigma'(Z)
+        for (int l = (int)layers.size() - 2; l >= 0; --l) {
+            multiply_transposed(layers[l + 1].get_weights(), deltas[l + 1], n_samples, deltas[l]);
 
-            for (unsigned i = 0; i < delta.n(); ++i) {
-                double dz = layers[l].get_activation_function()->dsigma(zs[l][i]);
-                delta[i] *= dz;
+            for (unsigned i = 0; i < deltas[l].n(); ++i) {
+                for (unsigned s = 0; s < n_samples; ++s) {
+                    deltas[l](i, s) *= dsigmas[l](i, s);
+                }
             }
 
-            grad_w[l] = outer_product(delta, activations[l]);
-            grad_b[l] = delta;
+            batch_gradients(deltas[l], activations[l], n_samples, scale, workspace.grad_w[l], workspace.grad_b[l]);
         }
+        workspace.profile.lap(TrainingPhase::Backward, mark);
     }
 
-    // Measure finite differencing cost
-    void compute_finite_difference() {
-        // Placeholder for finite-differencing functionality
+    // Adds the gradient of the summed (not averaged) cost of samples
+    // [begin, end) of the dataset to gradient, a flat array in the order of
+    // get_parameters, going through the samples a workspace batch at a
+    // time; returns their summed cost. The cost comes from the same forward
+    // passes, so one call is a fused (cost, gradient) pass.
+    double accumulate_gradient(const Dataset& training_data, unsigned long begin, unsigned long end,
+                               Workspace& workspace, double* gradient) const {
+        bool track_cost = workspace.track_cost;
+        workspace.track_cost = true;
+        workspace.cost_sum = 0.0;
+        for (unsigned long start = begin; start < end; start += workspace.batch_size) {
+            unsigned n_samples = std::min<unsigned long>(workspace.batch_size, end - start);
+            pack_batch(training_data.batch(start, n_samples), workspace);
+            backpropagation(n_samples, workspace, T(1));
+            double* entry = gradient;
+            for (unsigned l = 0; l < layers.size(); ++l) {
+                const Matrix& grad_w = workspace.grad_w[l];
+                std::size_t n_weights = std::size_t(grad_w.n()) * grad_w.m();
+                for (std::size_t k = 0; k < n_weights; ++k) entry[k] += grad_w.data()[k];
+                for (unsigned k = 0; k < grad_w.n(); ++k) entry[n_weights + k] += workspace.grad_b[l][k];
+                entry += n_weights + grad_w.n();
+            }
+        }
+        workspace.track_cost = track_cost;
+        return workspace.cost_sum;
     }
 
-    // Measure backpropagation cost
-    void compute_backpropagation_cost() {
-        // Placeholder for backpropagation functionality
+    unsigned get_layer_count() const { return layers.size(); }
+    const Matrix& get_weights(unsigned l) const { return layers[l].get_weights(); }
+    const Vector& get_biases(unsigned l) const { return layers[l].get_biases(); }
+
+    // Gradient of the cost of one sample with respect to the weights and
+    // biases by finite differences (see FiniteDifferenceGradient, which
+    // can be reused across samples)
+    void compute_finite_difference(const DoubleVector& input, const DoubleVector& target,
+                                   std::vector<Matrix>& grad_w, std::vector<Vector>& grad_b,
+                                   const FiniteDifferenceOptions& options = FiniteDifferenceOptions()) const;
+
+    // The same gradient by backpropagation
+    void compute_backpropagation(const DoubleVector& input, const DoubleVector& target,
+                                 std::vector<Matrix>& grad_w, std::vector<Vector>& grad_b) const {
+        Workspace workspace = make_workspace();
+        backpropagation(input, target, workspace);
+        grad_w = workspace.grad_w;
+        grad_b = workspace.grad_b;
+    }
+
+    // Compares the backpropagation gradient of a sample with central
+    // finite differences (or the given scheme)
+    GradientCheckResult check_gradient(const DoubleVector& input, const DoubleVector& target,
+                                       FiniteDifferenceOptions options = central_differences()) const;
+
+    // Optimizer (with its state, if any) for the layers of this network
+    Optimizer make_optimizer(const OptimizerOptions& options) const {
+        std::vector<std::pair<unsigned, unsigned>> shapes;
+        for (const auto& layer : layers) {
+            shapes.emplace_back(layer.get_weights().n(), layer.get_weights().m());
+        }
+        return Optimizer(options, shapes);
+    }
+
+    // Optimizer step with L2 regularisation on the weights, using the
+    // gradients stored in the workspace; the step must have been started
+    // with optimizer.begin_step
+    void update_parameters(const Workspace& workspace, Optimizer& optimizer, double regularization_lambda) {
+        for (unsigned l = 0; l < layers.size(); ++l) {
+            update_rows(l, 0, layers[l].get_weights().n(), workspace, optimizer, regularization_lambda);
+        }
     }
 
 private:
-    std::vector<NeuralNetworkLayer> layers;
+
+    // Optimizer step for rows [row_begin, row_end) of layer l
+    void update_rows(unsigned l, unsigned row_begin, unsigned row_end, const Workspace& workspace,
+                     Optimizer& optimizer, double regularization_lambda) {
+        optimizer.update_rows(l, row_begin, row_end, layers[l].get_weights(), layers[l].get_biases(),
+                              workspace.grad_w[l], workspace.grad_b[l], regularization_lambda);
+    }
+
+    // Snapshot of a training run after the given number of iterations
+    TrainingSnapshot make_snapshot(unsigned iteration, double current_cost, const std::vector<double>& cost_log,
+                                   std::size_t cost_log_start, const std::mt19937& gen,
+                                   const std::vector<unsigned long>& order,
+                                   std::vector<double> optimizer_state) const {
+        TrainingSnapshot snapshot;
+        snapshot.scalar_size = sizeof(T);
+        snapshot.layer_sizes.push_back(layers.front().get_weights().m());
+        for (const auto& layer : layers) {
+            const Matrix& weights = layer.get_weights();
+            snapshot.layer_sizes.push_back(weights.n());
+            const char* weights_bytes = reinterpret_cast<const char*>(weights.data());
+            const char* biases_bytes = reinterpret_cast<const char*>(layer.get_biases().data());
+            snapshot.parameters.insert(snapshot.parameters.end(), weights_bytes,
+                                       weights_bytes + std::size_t(weights.n()) * weights.m() * sizeof(T));
+            snapshot.parameters.insert(snapshot.parameters.end(), biases_bytes,
+                                       biases_bytes + std::size_t(weights.n()) * sizeof(T));
+        }
+        snapshot.iteration = iteration;
+        snapshot.current_cost = current_cost;
+        snapshot.cost_log.assign(cost_log.begin() + cost_log_start, cost_log.end());
+        snapshot.generator = gen;
+        snapshot.order.assign(order.begin(), order.end());
+        snapshot.optimizer_state = std::move(optimizer_state);
+        return snapshot;
+    }
+
+    // Restores the parameters, the generator and the sample order from a
+    // snapshot of a run of this network (train restores the optimizer
+    // state)
+    void restore_snapshot(const TrainingSnapshot& snapshot, const std::string& filename, std::mt19937& gen,
+                          std::vector<unsigned long>& order) {
+        bool same_shape = (snapshot.scalar_size == sizeof(T) && snapshot.layer_sizes.size() == layers.size() + 1 &&
+                           snapshot.layer_sizes[0] == layers.front().get_weights().m());
+        std::size_t n_bytes = 0;
+        for (unsigned l = 0; same_shape && l < layers.size(); ++l) {
+            const Matrix& weights = layers[l].get_weights();
+            same_shape = (snapshot.layer_sizes[l + 1] == weights.n());
+            n_bytes += std::size_t(weights.n()) * (weights.m() + 1) * sizeof(T);
+        }
+        if (!same_shape || snapshot.parameters.size() != n_bytes) {
+            throw std::invalid_argument(filename + " is a snapshot of a different network.");
+        }
+        if (snapshot.order.size() != order.size()) {
+            throw std::invalid_argument(filename + " is a snapshot of a run with different shuffling or data.");
+        }
+
+        const char* bytes = snapshot.parameters.data();
+        for (auto& layer : layers) {
+            Matrix& weights = layer.get_weights();
+            std::size_t weights_bytes = std::size_t(weights.n()) * weights.m() * sizeof(T);
+            std::memcpy(weights.data(), bytes, weights_bytes);
+            bytes += weights_bytes;
+            std::memcpy(layer.get_biases().data(), bytes, weights.n() * sizeof(T));
+            bytes += weights.n() * sizeof(T);
+        }
+        gen = snapshot.generator;
+        order.assign(snapshot.order.begin(), snapshot.order.end());
+    }
+
+    // The activation function for layer l of a network file, whose
+    // activation is recorded by name
+    static ActivationFunction* activation_for_layer(const std::string& filename, unsigned l,
+                                                    const std::string& name,
+                                                    const std::vector<ActivationFunction*>& activation_functions) {
+        static TanhActivationFunction tanh_act;
+        if (!activation_functions.empty()) {
+            if (l >= activation_functions.size()) return nullptr; // reported by check_activation_count
+            ActivationFunction* act_func = activation_functions[l];
+            std::string given_name = activation_name(act_func);
+            // Names in binary files are truncated
+            if (given_name.compare(0, Network_file_name_size - 1, name, 0, Network_file_name_size - 1) != 0) {
+                throw std::invalid_argument("Layer " + std::to_string(l) + " of " + filename + " uses " + name +
+                                            ", not " + given_name + ".");
+            }
+            return act_func;
+        }
+        if (name == "TanhActivationFunction") return &tanh_act;
+        throw std::invalid_argument("Layer " + std::to_string(l) + " of " + filename + " uses " + name +
+                                    "; pass the activation functions to load it.");
+    }
+
+    static void check_activation_count(const std::string& filename, unsigned n_layers,
+                                       const std::vector<ActivationFunction*>& activation_functions) {
+        if (!activation_functions.empty() && activation_functions.size() != n_layers) {
+            throw std::invalid_argument(filename + " has " + std::to_string(n_layers) + " layers, but " +
+                                        std::to_string(activation_functions.size()) +
+                                        " activation functions were given.");
+        }
+    }
+
+    static std::string activation_name(ActivationFunction* act_func) {
+        return (classify_activation(act_func) == ActivationKind::Tanh) ? std::string("TanhActivationFunction")
+                                                                       : act_func->name();
+    }
+
+    void check_sizes(const Dataset& training_data) const {
+        if (training_data.n_samples() > 0 &&
+            (training_data.input_size() != layers.front().get_weights().m() ||
+             training_data.output_size() != layers.back().get_weights().n())) {
+            throw std::invalid_argument("Dataset sizes do not match the network's input and output sizes.");
+        }
+    }
+
+    // Batch size for evaluating the cost over a whole dataset
+    static unsigned cost_batch_size(const Dataset& training_data) {
+        return std::min<unsigned long>(std::max(training_data.n_samples(), 1ul), 256);
+    }
+
+    // Copies the samples of the batch into the columns of the workspace's
+    // batch input and target matrices
+    static void pack_batch(const DatasetBatch& batch, Workspace& workspace) {
+        Matrix& inputs = workspace.batch_activations[0];
+        Matrix& targets = workspace.batch_targets;
+        for (unsigned s = 0; s < batch.n_samples; ++s) {
+            const double* input = batch.input(s);
+            const double* target = batch.target(s);
+            for (unsigned j = 0; j < batch.input_size; ++j) inputs(j, s) = T(input[j]);
+            for (unsigned j = 0; j < batch.output_size; ++j) targets(j, s) = T(target[j]);
+        }
+    }
+
+    // One sweep over the training data in consecutive mini-batches of
+    // workspace.batch_size samples (the last batch may be smaller)
+    void train_mini_batches(const Dataset& training_data, double learning_rate, double regularization_lambda,
+                            Optimizer& optimizer, Workspace& workspace) {
+        unsigned long n_data = training_data.n_samples();
+        for (unsigned long start = 0; start < n_data; start += workspace.batch_size) {
+            unsigned n_samples = std::min<unsigned long>(workspace.batch_size, n_data - start);
+            backpropagation(training_data.batch(start, n_samples), workspace);
+            PhaseMark mark = workspace.profile.start();
+            optimizer.begin_step(learning_rate);
+            update_parameters(workspace, optimizer, regularization_lambda);
+            workspace.profile.lap(TrainingPhase::Update, mark);
+        }
+    }
+
+    // As train_mini_batches, with each mini-batch split into one contiguous
+    // share per thread. Thread t computes the gradient of its share, scaled
+    // by 1/(batch size), in thread_workspaces[t]; then each thread sums the
+    // shares for its own rows of every layer, always in thread order, and
+    // updates those rows. The result depends on the number of threads (the
+    // sums are split differently) but not on the timing.
+    void train_mini_batches_parallel(const Dataset& training_data, double learning_rate,
+                                     double regularization_lambda, Optimizer& optimizer, Workspace& workspace,
+                                     ThreadPool& pool, std::vector<Workspace>& thread_workspaces) {
+        unsigned long n_data = training_data.n_samples();
+        unsigned n_threads = pool.size();
+        for (unsigned long start = 0; start < n_data; start += workspace.batch_size) {
+            unsigned n_samples = std::min<unsigned long>(workspace.batch_size, n_data - start);
+            T scale = T(1.0 / n_samples);
+
+            // Gradients of each thread's share
+            pool.run([&](unsigned t) {
+                unsigned begin = (n_samples * t) / n_threads;
+                unsigned end = (n_samples * (t + 1)) / n_threads;
+                if (end > begin) {
+                    pack_batch(training_data.batch(start + begin, end - begin), thread_workspaces[t]);
+                    backpropagation(end - begin, thread_workspaces[t], scale);
+                }
+            });
+
+            // Fixed-order reduction and update, split by rows
+            optimizer.begin_step(learning_rate);
+            pool.run([&](unsigned t) {
+                PhaseProfile& profile = thread_workspaces[t].profile;
+                PhaseMark mark = profile.start();
+                for (unsigned l = 0; l < layers.size(); ++l) {
+                    unsigned n_rows = layers[l].get_weights().n();
+                    unsigned row_begin = (n_rows * t) / n_threads;
+                    unsigned row_end = (n_rows * (t + 1)) / n_threads;
+                    reduce_rows(l, row_begin, row_end, n_samples, thread_workspaces, workspace);
+                    profile.lap(TrainingPhase::Reduction, mark);
+                    update_rows(l, row_begin, row_end, workspace, optimizer, regularization_lambda);
+                    profile.lap(TrainingPhase::Update, mark);
+                }
+            });
+        }
+    }
+
+    // workspace.grad_w/grad_b for rows [row_begin, row_end) of layer l =
+    // sum of the thread gradients, added in thread order (threads whose
+    // share of the n_samples samples was empty are skipped)
+    void reduce_rows(unsigned l, unsigned row_begin, unsigned row_end, unsigned n_samples,
+                     const std::vector<Workspace>& thread_workspaces,
+                     Workspace& workspace) const {
+        unsigned n_threads = thread_workspaces.size();
+        unsigned n_cols = layers[l].get_weights().m();
+        auto& grad_w = workspace.grad_w[l];
+        auto& grad_b = workspace.grad_b[l];
+        bool first = true;
+        for (unsigned t = 0; t < n_threads; ++t) {
+            if ((n_samples * (t + 1)) / n_threads == (n_samples * t) / n_threads) continue;
+            const auto& thread_grad_w = thread_workspaces[t].grad_w[l];
+            const auto& thread_grad_b = thread_workspaces[t].grad_b[l];
+            for (unsigned i = row_begin; i < row_end; ++i) {
+                for (unsigned j = 0; j < n_cols; ++j) {
+                    grad_w(i, j) = first ? thread_grad_w(i, j) : grad_w(i, j) + thread_grad_w(i, j);
+                }
+                grad_b[i] = first ? thread_grad_b[i] : grad_b[i] + thread_grad_b[i];
+            }
+            first = false;
+        }
+    }
+
+    // One Hogwild sweep: thread t trains on the t-th contiguous part of the
+    // training data (per sample, or in mini-batches of batch_size samples),
+    // updating the shared parameters without locks. The updates of different
+    // threads race with each other by design; on the hardware we use a
+    // racing read of a double or float sees either the old or the new value.
+    // The optimizer is plain SGD, whose steps need no state but the rate, so
+    // the sweep is one optimizer step as far as it is concerned.
+    void train_hogwild(const Dataset& training_data, double learning_rate, double regularization_lambda,
+                       unsigned batch_size, Optimizer& optimizer, ThreadPool& pool,
+                       std::vector<Workspace>& thread_workspaces) {
+        unsigned long n_data = training_data.n_samples();
+        unsigned n_threads = pool.size();
+        optimizer.begin_step(learning_rate);
+        pool.run([&](unsigned t) {
+            unsigned long begin = (n_data * t) / n_threads;
+            unsigned long end = (n_data * (t + 1)) / n_threads;
+            Workspace& thread_workspace = thread_workspaces[t];
+            if (batch_size <= 1) {
+                for (unsigned long s = begin; s < end; ++s) {
+                    sgd_step(training_data.input(s), training_data.target(s), learning_rate,
+                             regularization_lambda, thread_workspace);
+                }
+            } else {
+                for (unsigned long start = begin; start < end; start += batch_size) {
+                    unsigned n_samples = std::min<unsigned long>(batch_size, end - start);
+                    backpropagation(training_data.batch(start, n_samples), thread_workspace);
+                    PhaseMark mark = thread_workspace.profile.start();
+                    update_parameters(thread_workspace, optimizer, regularization_lambda);
+                    thread_workspace.profile.lap(TrainingPhase::Update, mark);
+                }
+            }
+        });
+    }
+
+    // Batch-averaged gradients of one layer over the first n_samples columns:
+    // grad_w = scale * delta * A^T, grad_b = scale * (row sums of delta)
+    static void batch_gradients(const Matrix& delta, const Matrix& activation,
+                                unsigned n_samples, T scale,
+                                Matrix& grad_w, Vector& grad_b) {
+        Kernels::gemm_nt(delta.n(), activation.n(), n_samples, scale,
+                         delta.data(), delta.m(), activation.data(), activation.m(),
+                         grad_w.data(), grad_w.m());
+        for (unsigned i = 0; i < delta.n(); ++i) {
+            T sum = 0;
+            for (unsigned s = 0; s < n_samples; ++s) {
+                sum += delta(i, s);
+            }
+            grad_b[i] = scale * sum;
+        }
+    }
+
+    // Buffers of Levenberg-Marquardt training. The Jacobian is assembled a
+    // chunk of samples at a time, transposed: row p of jacobian holds the
+    // derivatives of the chunk's residuals with respect to parameter p
+    // (parameters in the order of get_parameters, residuals sample by
+    // sample). Everything the LU solver sees is double, whatever T is.
+    struct LevenbergMarquardtWorkspace {
+        LevenbergMarquardtWorkspace(const BasicNeuralNetwork& network, const Dataset& training_data)
+            : workspace(network.make_workspace(cost_batch_size(training_data))),
+              n_parameters(network.n_parameters()),
+              n_columns(workspace.batch_size * training_data.output_size()),
+              jacobian(n_parameters * n_columns),
+              residuals(n_columns),
+              product(n_parameters * n_parameters),
+              partial_gradient(n_parameters),
+              normal_matrix(n_parameters),
+              gradient(n_parameters),
+              previous_parameters(n_parameters),
+              parameters(n_parameters) {}
+
+        Workspace workspace;
+        unsigned n_parameters;
+        unsigned n_columns; // residuals per full chunk
+        std::vector<double> jacobian;
+        std::vector<double> residuals;
+        std::vector<double> product;
+        std::vector<double> partial_gradient;
+        SquareDoubleMatrix normal_matrix; // J^T J (+ regularization)
+        DoubleVector gradient;            // J^T r (+ regularization)
+        std::vector<T> previous_parameters;
+        std::vector<T> parameters;
+        LULinearSolver solver;
+    };
+
+    // One Levenberg-Marquardt step on the objective
+    //   E = sum over samples of 0.5 |output - target|^2 + (N lambda / 2) |w|^2,
+    // which is N times the cost plus the L2 term that first-order training
+    // decays the weights by. Solves (J^T J + N lambda I_w + mu I) step = -g
+    // for g = J^T r + N lambda w, raising mu until the step lowers E, and
+    // lowers mu for the next step. current_cost is the (unregularized) cost
+    // afterwards. Returns false, with the parameters unchanged, if no step
+    // lowers E before mu exceeds options.max_damping.
+    bool levenberg_marquardt_step(const Dataset& training_data, double regularization_lambda,
+                                  const LevenbergMarquardtOptions& options, double& damping,
+                                  double& current_cost, LevenbergMarquardtWorkspace& lm, ThreadPool* pool) {
+        const unsigned n_parameters = lm.n_parameters;
+        const double n_lambda = regularization_lambda * training_data.n_samples();
+        assemble_normal_equations(training_data, lm, pool);
+
+        // Regularization, on the weights only
+        get_parameters(lm.previous_parameters.data());
+        double weight_norm = 0.0;
+        for (unsigned offset = 0, l = 0; l < layers.size(); ++l) {
+            std::size_t n_weights = std::size_t(layers[l].get_weights().n()) * layers[l].get_weights().m();
+            for (std::size_t p = offset; p < offset + n_weights; ++p) {
+                double w = lm.previous_parameters[p];
+                weight_norm += w * w;
+                lm.normal_matrix(p, p) += n_lambda;
+                lm.gradient[p] += n_lambda * w;
+            }
+            offset += n_weights + layers[l].get_weights().n();
+        }
+        double objective = training_data.n_samples() * current_cost + 0.5 * n_lambda * weight_norm;
+
+        SquareDoubleMatrix damped(n_parameters);
+        DoubleVector rhs(n_parameters);
+        for (unsigned p = 0; p < n_parameters; ++p) rhs[p] = -lm.gradient[p];
+        // The factors do not depend on the number of threads
+        lm.solver.set_thread_pool(pool);
+        while (damping <= options.max_damping) {
+            std::copy(lm.normal_matrix.data(), lm.normal_matrix.data() + std::size_t(n_parameters) * n_parameters,
+                      damped.data());
+            for (unsigned p = 0; p < n_parameters; ++p) damped(p, p) += damping;
+
+            DoubleVector step;
+            bool solved = true;
+            try {
+                step = lm.solver.lu_solve(damped, rhs);
+            } catch (const LinearSolverError&) {
+                solved = false;
+            }
+            for (unsigned p = 0; solved && p < n_parameters; ++p) solved = std::isfinite(step[p]);
+
+            if (solved) {
+                double trial_norm = 0.0;
+                for (unsigned offset = 0, l = 0; l < layers.size(); ++l) {
+                    std::size_t n_weights = std::size_t(layers[l].get_weights().n()) * layers[l].get_weights().m();
+                    for (std::size_t p = offset; p < offset + n_weights + layers[l].get_weights().n(); ++p) {
+                        lm.parameters[p] = T(lm.previous_parameters[p] + step[p]);
+                        if (p < offset + n_weights) trial_norm += double(lm.parameters[p]) * lm.parameters[p];
+                    }
+                    offset += n_weights + layers[l].get_weights().n();
+                }
+                set_parameters(lm.parameters.data());
+                double trial_cost = cost_for_training_data(training_data, lm.workspace);
+                double trial_objective = training_data.n_samples() * trial_cost + 0.5 * n_lambda * trial_norm;
+                if (trial_objective < objective) {
+                    current_cost = trial_cost;
+                    damping = std::max(damping / options.damping_decrease, std::numeric_limits<double>::min());
+                    return true;
+                }
+            }
+            damping *= options.damping_increase;
+        }
+        set_parameters(lm.previous_parameters.data());
+        return false;
+    }
+
+    // J^T J into lm.normal_matrix and J^T r into lm.gradient, over all
+    // samples. The rows of each chunk's J^T J are split across the threads
+    // of the pool, so the sums, and the result, do not depend on them.
+    void assemble_normal_equations(const Dataset& training_data, LevenbergMarquardtWorkspace& lm, ThreadPool* pool) {
+        const unsigned n_parameters = lm.n_parameters;
+        const unsigned n_outputs = layers.back().get_weights().n();
+        Workspace& workspace = lm.workspace;
+        auto& activations = workspace.batch_activations;
+        auto& dsigmas = workspace.batch_dsigmas;
+        auto& deltas = workspace.batch_deltas;
+        std::fill(lm.normal_matrix.data(), lm.normal_matrix.data() + std::size_t(n_parameters) * n_parameters, 0.0);
+        for (unsigned p = 0; p < n_parameters; ++p) lm.gradient[p] = 0.0;
+
+        unsigned long n_data = training_data.n_samples();
+        for (unsigned long start = 0; start < n_data; start += workspace.batch_size) {
+            unsigned n_samples = std::min<unsigned long>(workspace.batch_size, n_data - start);
+            unsigned n_columns = n_samples * n_outputs;
+            pack_batch(training_data.batch(start, n_samples), workspace);
+            for (unsigned l = 0; l < layers.size(); ++l) {
+                layers[l].forward(activations[l], n_samples, workspace.batch_zs[l], activations[l + 1], dsigmas[l]);
+            }
+            for (unsigned s = 0; s < n_samples; ++s) {
+                for (unsigned i = 0; i < n_outputs; ++i) {
+                    lm.residuals[s * n_outputs + i] = double(activations.back()(i, s)) - workspace.batch_targets(i, s);
+                }
+            }
+
+            // One backward pass per output i, from delta = e_i sigma'(Z^(L))
+            for (unsigned i = 0; i < n_outputs; ++i) {
+                Matrix& delta = deltas.back();
+                for (unsigned k = 0; k < n_outputs; ++k) {
+                    for (unsigned s = 0; s < n_samples; ++s) delta(k, s) = (k == i) ? dsigmas.back()(k, s) : T(0);
+                }
+                for (int l = (int)layers.size() - 2; l >= 0; --l) {
+                    multiply_transposed(layers[l + 1].get_weights(), deltas[l + 1], n_samples, deltas[l]);
+                    for (unsigned a = 0; a < deltas[l].n(); ++a) {
+                        for (unsigned s = 0; s < n_samples; ++s) deltas[l](a, s) *= dsigmas[l](a, s);
+                    }
+                }
+
+                // dr/dW(a,b) = delta(a) activation(b), dr/db(a) = delta(a)
+                double* row = lm.jacobian.data();
+                for (unsigned l = 0; l < layers.size(); ++l) {
+                    const Matrix& activation = activations[l];
+                    for (unsigned a = 0; a < deltas[l].n(); ++a) {
+                        for (unsigned b = 0; b < activation.n(); ++b, row += n_columns) {
+                            for (unsigned s = 0; s < n_samples; ++s) {
+                                row[s * n_outputs + i] = double(deltas[l](a, s)) * activation(b, s);
+                            }
+                        }
+                    }
+                    for (unsigned a = 0; a < deltas[l].n(); ++a, row += n_columns) {
+                        for (unsigned s = 0; s < n_samples; ++s) row[s * n_outputs + i] = deltas[l](a, s);
+                    }
+                }
+            }
+
+            Kernels::gemv(n_parameters, n_columns, lm.jacobian.data(), n_columns, lm.residuals.data(), nullptr,
+                          lm.partial_gradient.data());
+            for (unsigned p = 0; p < n_parameters; ++p) lm.gradient[p] += lm.partial_gradient[p];
+
+            auto add_rows = [&](unsigned t) {
+                unsigned n_threads = pool ? pool->size() : 1;
+                unsigned begin = (n_parameters * t) / n_threads;
+                unsigned end = (n_parameters * (t + 1)) / n_threads;
+                if (begin == end) return;
+                double* product = lm.product.data() + std::size_t(begin) * n_parameters;
+                Kernels::gemm_nt(end - begin, n_parameters, n_columns, 1.0,
+                                 lm.jacobian.data() + std::size_t(begin) * n_columns, n_columns,
+                                 lm.jacobian.data(), n_columns, product, n_parameters);
+                double* normal = lm.normal_matrix.data() + std::size_t(begin) * n_parameters;
+                for (std::size_t k = 0; k < std::size_t(end - begin) * n_parameters; ++k) normal[k] += product[k];
+            };
+            if (pool != nullptr) {
+                pool->run(add_rows);
+            } else {
+                add_rows(0);
+            }
+        }
+    }
+
+    // Buffers of L-BFGS training: the point x (the parameters, in double
+    // precision), its gradient and the search direction, the trial point
+    // of the line search and its gradient, and one workspace and partial
+    // gradient per thread for the fused cost and gradient passes
+    struct LBFGSWorkspace {
+        LBFGSWorkspace(const BasicNeuralNetwork& network, const Dataset& training_data, const LBFGSOptions& options,
+                       unsigned n_threads)
+            : n_parameters(network.n_parameters()),
+              history(n_parameters, options.history),
+              x(n_parameters), gradient(n_parameters), direction(n_parameters),
+              trial_x(n_parameters), trial_gradient(n_parameters),
+              step(n_parameters), gradient_change(n_parameters),
+              parameters(n_parameters),
+              partial_gradients(n_threads, std::vector<double>(n_parameters)),
+              partial_costs(n_threads) {
+            for (unsigned t = 0; t < n_threads; ++t) {
+                workspaces.push_back(network.make_workspace(cost_batch_size(training_data)));
+            }
+        }
+
+        unsigned n_parameters;
+        LBFGSHistory history;
+        bool started = false; // x, gradient and objective are set
+        double objective = 0.0;
+        double trial_cost = 0.0;
+        std::vector<double> x, gradient, direction;
+        std::vector<double> trial_x, trial_gradient;
+        std::vector<double> step, gradient_change;
+        std::vector<T> parameters;
+        std::vector<Workspace> workspaces;
+        std::vector<std::vector<double>> partial_gradients;
+        std::vector<double> partial_costs;
+    };
+
+    // One L-BFGS iteration on the objective cost + (lambda / 2) |w|^2,
+    // whose gradient is the one first-order training steps along: the line
+    // search along the quasi-Newton direction, and the new (s, y) pair.
+    // If the search fails, it is retried once along the steepest descent
+    // direction with the history cleared. current_cost is the cost at the
+    // new point. Returns false, with the parameters unchanged, if no step
+    // lowers the objective.
+    bool lbfgs_step(const Dataset& training_data, double regularization_lambda, const LBFGSOptions& options,
+                    double& current_cost, LBFGSWorkspace& lbfgs, ThreadPool* pool) {
+        const unsigned n_parameters = lbfgs.n_parameters;
+        if (!lbfgs.started) {
+            get_parameters(lbfgs.parameters.data());
+            lbfgs.x.assign(lbfgs.parameters.begin(), lbfgs.parameters.end());
+            lbfgs.objective = objective_and_gradient(training_data, regularization_lambda, lbfgs.x.data(),
+                                                     lbfgs.gradient.data(), current_cost, lbfgs, pool);
+            lbfgs.started = true;
+        }
+
+        // Trial points are rounded to T, so that x is always exactly the
+        // network's parameters
+        auto evaluate = [&](double step, double& slope) {
+            for (unsigned p = 0; p < n_parameters; ++p) {
+                lbfgs.parameters[p] = T(lbfgs.x[p] + step * lbfgs.direction[p]);
+                lbfgs.trial_x[p] = lbfgs.parameters[p];
+            }
+            set_parameters(lbfgs.parameters.data());
+            double value = objective_and_gradient(training_data, regularization_lambda, lbfgs.trial_x.data(),
+                                                  lbfgs.trial_gradient.data(), lbfgs.trial_cost, lbfgs, pool);
+            slope = LBFGSHistory::dot(lbfgs.trial_gradient.data(), lbfgs.direction.data(), n_parameters);
+            return value;
+        };
+
+        while (true) {
+            lbfgs.history.direction(lbfgs.gradient.data(), lbfgs.direction.data());
+            double slope = LBFGSHistory::dot(lbfgs.gradient.data(), lbfgs.direction.data(), n_parameters);
+            if (slope < 0.0) {
+                // Steepest descent steps start at length 1 in parameter space
+                double initial_step = 1.0;
+                if (lbfgs.history.size() == 0) initial_step = std::min(1.0, 1.0 / std::sqrt(-slope));
+                LineSearchResult result =
+                    strong_wolfe_line_search(evaluate, lbfgs.objective, slope, initial_step, options);
+                if (result.success) {
+                    for (unsigned p = 0; p < n_parameters; ++p) {
+                        lbfgs.step[p] = lbfgs.trial_x[p] - lbfgs.x[p];
+                        lbfgs.gradient_change[p] = lbfgs.trial_gradient[p] - lbfgs.gradient[p];
+                    }
+                    lbfgs.history.add(lbfgs.step.data(), lbfgs.gradient_change.data());
+                    std::swap(lbfgs.x, lbfgs.trial_x);
+                    std::swap(lbfgs.gradient, lbfgs.trial_gradient);
+                    lbfgs.objective = result.value;
+                    current_cost = lbfgs.trial_cost;
+                    return true;
+                }
+                for (unsigned p = 0; p < n_parameters; ++p) lbfgs.parameters[p] = T(lbfgs.x[p]);
+                set_parameters(lbfgs.parameters.data());
+            }
+            if (lbfgs.history.size() == 0) return false;
+            lbfgs.history.clear();
+        }
+    }
+
+    // Fused pass over the training data for the objective of lbfgs_step at
+    // point (the network's parameters) and its gradient; sets cost to the
+    // cost without the L2 term. With a pool, each thread takes one
+    // contiguous share of the samples, and the shares are summed in thread
+    // order, so the result depends on the number of threads but not on the
+    // timing.
+    double objective_and_gradient(const Dataset& training_data, double regularization_lambda, const double* point,
+                                  double* gradient, double& cost, LBFGSWorkspace& lbfgs, ThreadPool* pool) {
+        const unsigned n_parameters = lbfgs.n_parameters;
+        unsigned long n_data = training_data.n_samples();
+        unsigned n_threads = pool ? pool->size() : 1;
+        auto share = [&](unsigned t) {
+            std::vector<double>& partial = lbfgs.partial_gradients[t];
+            std::fill(partial.begin(), partial.end(), 0.0);
+            lbfgs.partial_costs[t] = accumulate_gradient(training_data, (n_data * t) / n_threads,
+                                                         (n_data * (t + 1)) / n_threads, lbfgs.workspaces[t],
+                                                         partial.data());
+        };
+        if (pool != nullptr) {
+            pool->run(share);
+        } else {
+            share(0);
+        }
+
+        double cost_sum = 0.0;
+        std::fill(gradient, gradient + n_parameters, 0.0);
+        for (unsigned t = 0; t < n_threads; ++t) {
+            cost_sum += lbfgs.partial_costs[t];
+            for (unsigned p = 0; p < n_parameters; ++p) gradient[p] += lbfgs.partial_gradients[t][p];
+        }
+        cost = cost_sum / n_data;
+        for (unsigned p = 0; p < n_parameters; ++p) gradient[p] /= n_data;
+
+        // L2 term, on the weights only
+        double weight_norm = 0.0;
+        for (unsigned offset = 0, l = 0; l < layers.size(); ++l) {
+            std::size_t n_weights = std::size_t(layers[l].get_weights().n()) * layers[l].get_weights().m();
+            for (std::size_t p = offset; p < offset + n_weights; ++p) {
+                weight_norm += point[p] * point[p];
+                gradient[p] += regularization_lambda * point[p];
+            }
+            offset += n_weights + layers[l].get_weights().n();
+        }
+        return cost + 0.5 * regularization_lambda * weight_norm;
+    }
+
+    // The method train() uses with these options: Levenberg-Marquardt
+    // falls back to first-order steps for networks too large for it
+    TrainingMethod training_method_for(const TrainingOptions& options) const {
+        if (options.method == TrainingMethod::LevenbergMarquardt &&
+            n_parameters() > options.levenberg_marquardt.max_parameters) {
+            if (options.log_stream != nullptr) {
+                *options.log_stream << "The network has " << n_parameters() << " parameters, more than "
+                                    << options.levenberg_marquardt.max_parameters
+                                    << " for Levenberg-Marquardt; training with first-order steps." << std::endl;
+            }
+            return TrainingMethod::FirstOrder;
+        }
+        return options.method;
+    }
+
+    // What a train() run keeps from one iteration to the next besides the
+    // parameters: how it trains, the buffers of its steps (the main
+    // workspace plus one per thread, or those of the full-batch method)
+    // and the state of its method, i.e. the optimizer, the
+    // Levenberg-Marquardt damping or the L-BFGS history
+    struct TrainingRun {
+        TrainingRun(const BasicNeuralNetwork& network, const Dataset& training_data,
+                    const TrainingOptions& options)
+            : method(network.training_method_for(options)),
+              batch_size(std::max(options.batch_size, 1u)),
+              n_threads(std::max(options.n_threads, 1u)),
+              hogwild(!full_batch() && n_threads > 1 && options.parallel_mode == ParallelMode::Hogwild),
+              plain_sgd(options.optimizer.kind == OptimizerKind::SGD),
+              workspace(network.make_workspace(batch_size)),
+              optimizer(network.make_optimizer(options.optimizer)),
+              damping(options.levenberg_marquardt.initial_damping) {
+            if (!full_batch() && n_threads > 1 && !hogwild && batch_size == 1) {
+                throw std::invalid_argument("Deterministic multithreaded training splits mini-batches across "
+                                            "threads, so it needs batch_size > 1.");
+            }
+            if (hogwild && !plain_sgd) {
+                throw std::invalid_argument("Hogwild training only supports plain SGD.");
+            }
+            if (n_threads > 1) {
+                pool = std::make_unique<ThreadPool>(n_threads);
+                unsigned thread_batch_size = hogwild ? batch_size : (batch_size + n_threads - 1) / n_threads;
+                for (unsigned t = 0; !full_batch() && t < n_threads; ++t) {
+                    thread_workspaces.push_back(network.make_workspace(thread_batch_size));
+                }
+            }
+            if (method == TrainingMethod::LevenbergMarquardt) {
+                lm_workspace = std::make_unique<LevenbergMarquardtWorkspace>(network, training_data);
+            } else if (method == TrainingMethod::LBFGS) {
+                lbfgs_workspace = std::make_unique<LBFGSWorkspace>(network, training_data, options.lbfgs, n_threads);
+            }
+        }
+
+        bool full_batch() const { return method != TrainingMethod::FirstOrder; }
+
+        // Starts a sweep of first-order steps, adding up the cost of its
+        // samples if track_cost is set
+        void start_sweep(bool track_cost) {
+            workspace.track_cost = track_cost;
+            workspace.cost_sum = 0.0;
+            for (auto& thread_workspace : thread_workspaces) {
+                thread_workspace.track_cost = track_cost;
+                thread_workspace.cost_sum = 0.0;
+            }
+        }
+
+        // Summed cost of the samples of the sweep
+        double cost_sum() const {
+            double sum = workspace.cost_sum;
+            for (const auto& thread_workspace : thread_workspaces) sum += thread_workspace.cost_sum;
+            return sum;
+        }
+
+        // The state of the method, for the snapshots
+        std::vector<double> state() const {
+            if (method == TrainingMethod::LevenbergMarquardt) return std::vector<double>(1, damping);
+            if (method == TrainingMethod::LBFGS) return lbfgs_workspace->history.state();
+            return optimizer.state();
+        }
+
+        // Restores the state of the method from a snapshot read from filename
+        void restore_state(const std::vector<double>& state, const std::string& filename) {
+            if (method == TrainingMethod::LevenbergMarquardt) {
+                if (state.size() != 1 || !(state[0] > 0.0)) {
+                    throw std::invalid_argument(filename + " is not a snapshot of a Levenberg-Marquardt run.");
+                }
+                damping = state[0];
+            } else if (method == TrainingMethod::LBFGS) {
+                try {
+                    lbfgs_workspace->history.restore_state(state);
+                } catch (const std::invalid_argument&) {
+                    throw std::invalid_argument(filename + " is not a snapshot of an L-BFGS run.");
+                }
+            } else {
+                try {
+                    optimizer.restore_state(state);
+                } catch (const std::invalid_argument&) {
+                    throw std::invalid_argument(filename + " is a snapshot of a run with a different optimizer.");
+                }
+            }
+        }
+
+        // Adds the timings of the training steps to profile
+        void merge_profiles(PhaseProfile& profile) const {
+            profile.merge(workspace.profile);
+            for (const auto& thread_workspace : thread_workspaces) profile.merge(thread_workspace.profile);
+        }
+
+        TrainingMethod method;
+        unsigned batch_size, n_threads;
+        bool hogwild, plain_sgd;
+        Workspace workspace;
+        std::unique_ptr<ThreadPool> pool;
+        std::vector<Workspace> thread_workspaces;
+        Optimizer optimizer;
+        double damping;
+        std::unique_ptr<LevenbergMarquardtWorkspace> lm_workspace;
+        std::unique_ptr<LBFGSWorkspace> lbfgs_workspace;
+    };
+
+    // Continues a train() run from its snapshot in filename: restores the
+    // parameters, the generator, the sample order and the state of the
+    // run's method, appends the snapshot's cost log to cost_log and returns
+    // the iteration and the cost it had reached
+    void resume_training(const std::string& filename, TrainingRun& run, std::mt19937& gen,
+                         std::vector<unsigned long>& order, std::vector<double>& cost_log, unsigned& iteration,
+                         double& current_cost) {
+        TrainingSnapshot snapshot = TrainingSnapshot::read(filename);
+        restore_snapshot(snapshot, filename, gen, order);
+        run.restore_state(snapshot.optimizer_state, filename);
+        iteration = snapshot.iteration;
+        current_cost = snapshot.current_cost;
+        cost_log.insert(cost_log.end(), snapshot.cost_log.begin(), snapshot.cost_log.end());
+    }
+
+    // One iteration of a train() run: a sweep of first-order steps over
+    // sweep_data, or one Levenberg-Marquardt or L-BFGS step, which also
+    // updates current_cost. Returns false if the full-batch method cannot
+    // lower the cost any further.
+    bool training_iteration(const Dataset& sweep_data, double rate, double regularization_lambda,
+                            const TrainingOptions& options, TrainingRun& run, double& current_cost) {
+        Workspace& workspace = run.workspace;
+        if (run.method == TrainingMethod::LevenbergMarquardt) {
+            return levenberg_marquardt_step(sweep_data, regularization_lambda, options.levenberg_marquardt,
+                                            run.damping, current_cost, *run.lm_workspace, run.pool.get());
+        } else if (run.method == TrainingMethod::LBFGS) {
+            return lbfgs_step(sweep_data, regularization_lambda, options.lbfgs, current_cost, *run.lbfgs_workspace,
+                              run.pool.get());
+        } else if (run.hogwild) {
+            train_hogwild(sweep_data, rate, regularization_lambda, run.batch_size, run.optimizer, *run.pool,
+                          run.thread_workspaces);
+        } else if (run.batch_size <= 1 && run.plain_sgd) {
+            for (unsigned long s = 0; s < sweep_data.n_samples(); ++s) {
+                sgd_step(sweep_data.input(s), sweep_data.target(s), rate, regularization_lambda, workspace);
+            }
+        } else if (run.batch_size <= 1) {
+            // Other optimizers need the gradient before they can update
+            for (unsigned long s = 0; s < sweep_data.n_samples(); ++s) {
+                backpropagation(sweep_data.input(s), sweep_data.target(s), workspace);
+                PhaseMark mark = workspace.profile.start();
+                run.optimizer.begin_step(rate);
+                update_parameters(workspace, run.optimizer, regularization_lambda);
+                workspace.profile.lap(TrainingPhase::Update, mark);
+            }
+        } else if (run.n_threads > 1) {
+            train_mini_batches_parallel(sweep_data, rate, regularization_lambda, run.optimizer, workspace, *run.pool,
+                                        run.thread_workspaces);
+        } else {
+            train_mini_batches(sweep_data, rate, regularization_lambda, run.optimizer, workspace);
+        }
+        return true;
+    }
+
+    static FiniteDifferenceOptions central_differences() {
+        FiniteDifferenceOptions options;
+        options.scheme = FiniteDifferenceScheme::Central;
+        return options;
+    }
+
+    std::vector<Layer> layers;
 };
 
+using NeuralNetwork = BasicNeuralNetwork<double>;
+using FloatNeuralNetwork = BasicNeuralNetwork<float>;
+
+// Finite-difference gradient of the cost C = 1/2 |a^(L) - y|^2 of one
+// sample with respect to every weight and bias. Each parameter is
+// perturbed in turn in a private copy of the layers, and the perturbed
+// cost is evaluated from the unperturbed network's activations onwards:
+// perturbing a parameter of layer l only changes one pre-activation of
+// that layer, so only that entry is recomputed (by the same kernel as in
+// a full pass) and only layers l+1, ... are evaluated again. The result is
+// bitwise the same as evaluating the whole network for every perturbation.
+//
+// The parameters are split between the threads, each with its own copy of
+// the layers, so the result does not depend on the number of threads. The
+// object keeps its threads and buffers for reuse over many samples.
+// The costs and differences are computed in the network's scalar type T.
+template <class T>
+class BasicFiniteDifferenceGradient {
+public:
+    typedef DenseMatrix<T> Matrix;
+    typedef DenseVector<T> Vector;
+    typedef BasicNeuralNetworkLayer<T> Layer;
+
+    explicit BasicFiniteDifferenceGradient(const FiniteDifferenceOptions& options = FiniteDifferenceOptions())
+        : options(options), pool(std::max(options.n_threads, 1u)), thread_states(pool.size()) {}
+
+    // grad_w and grad_b are resized to the network's layers if necessary
+    void compute(const BasicNeuralNetwork<T>& net, const double* input, const double* target,
+                 std::vector<Matrix>& grad_w, std::vector<Vector>& grad_b) {
+        const auto& layers = net.get_layers();
+        unsigned n_layers = layers.size();
+        prepare(layers);
+        resize_gradients(layers, grad_w, grad_b);
+
+        // Unperturbed pass
+        for (unsigned i = 0; i < base_activations[0].n(); ++i) {
+            base_activations[0][i] = T(input[i]);
+        }
+        for (unsigned l = 0; l < n_layers; ++l) {
+            layers[l].forward(base_activations[l], base_zs[l], base_activations[l + 1]);
+        }
+        T base_cost = sample_cost(base_activations.back(), target);
+
+        // Parameters in order: the weights of layer 0 row by row, its
+        // biases, then those of layer 1, ...
+        std::vector<unsigned long> layer_begin(n_layers + 1, 0);
+        for (unsigned l = 0; l < n_layers; ++l) {
+            const Matrix& weights = layers[l].get_weights();
+            layer_begin[l + 1] = layer_begin[l] + (unsigned long)weights.n() * (weights.m() + 1);
+        }
+        unsigned long n_parameters = layer_begin.back();
+
+        T h = T(options.template step_size<T>());
+        bool central = (options.scheme == FiniteDifferenceScheme::Central);
+        unsigned n_threads = pool.size();
+        pool.run([&](unsigned t) {
+            ThreadState& state = thread_states[t];
+            unsigned long begin = (n_parameters * t) / n_threads;
+            unsigned long end = (n_parameters * (t + 1)) / n_threads;
+            unsigned l = 0;
+            for (unsigned long k = begin; k < end; ++k) {
+                while (k >= layer_begin[l + 1]) ++l;
+                Matrix& weights = state.layers[l].get_weights();
+                unsigned long offset = k - layer_begin[l];
+                bool is_bias = (offset >= (unsigned long)weights.n() * weights.m());
+                unsigned i = is_bias ? offset - (unsigned long)weights.n() * weights.m() : offset / weights.m();
+                unsigned j = is_bias ? 0 : offset % weights.m();
+                T& parameter = is_bias ? state.layers[l].get_biases()[i] : weights(i, j);
+
+                // Differences are taken over the steps actually representable
+                T original = parameter;
+                parameter = original + h;
+                T plus = parameter;
+                T cost_plus = perturbed_cost(state, l, i, target);
+                T derivative;
+                if (central) {
+                    parameter = original - h;
+                    T minus = parameter;
+                    T cost_minus = perturbed_cost(state, l, i, target);
+                    derivative = (cost_plus - cost_minus) / (plus - minus);
+                } else {
+                    derivative = (cost_plus - base_cost) / (plus - original);
+                }
+                parameter = original;
+
+                if (is_bias) {
+                    grad_b[l][i] = derivative;
+                } else {
+                    grad_w[l](i, j) = derivative;
+                }
+            }
+        });
+    }
+
+    void compute(const BasicNeuralNetwork<T>& net, const DoubleVector& input, const DoubleVector& target,
+                 std::vector<Matrix>& grad_w, std::vector<Vector>& grad_b) {
+        compute(net, input.data(), target.data(), grad_w, grad_b);
+    }
+
+private:
+    struct ThreadState {
+        std::vector<Layer> layers;
+        std::vector<Vector> zs, activations;
+    };
+
+    static T sample_cost(const Vector& output, const double* target) {
+        T cost_val = 0;
+        for (unsigned i = 0; i < output.n(); ++i) {
+            T diff = output[i] - T(target[i]);
+            cost_val += T(0.5) * diff * diff;
+        }
+        return cost_val;
+    }
+
+    // Cost with row i of layer l of the thread's layers perturbed (in its
+    // weights or bias), starting from the unperturbed activations
+    T perturbed_cost(ThreadState& state, unsigned l, unsigned i, const double* target) const {
+        const auto& layers = state.layers;
+        const Matrix& weights = layers[l].get_weights();
+        Vector& z = state.zs[l];
+        Vector& a = state.activations[l + 1];
+        z = base_zs[l];
+        a = base_activations[l + 1];
+        Kernels::gemv(1, weights.m(), weights.data() + std::size_t(i) * weights.m(), weights.m(),
+                      base_activations[l].data(), layers[l].get_biases().data() + i, z.data() + i);
+        layers[l].activate(z.data() + i, a.data() + i, 1);
+        for (unsigned k = l + 1; k < layers.size(); ++k) {
+            layers[k].forward(state.activations[k], state.zs[k], state.activations[k + 1]);
+        }
+        return sample_cost(state.activations.back(), target);
+    }
+
+    // Copies the network's current parameters into every thread's layers,
+    // (re)allocating the buffers when the architecture changes
+    void prepare(const std::vector<Layer>& layers) {
+        bool same_shape = (base_zs.size() == layers.size());
+        for (unsigned l = 0; same_shape && l < layers.size(); ++l) {
+            same_shape = (base_zs[l].n() == layers[l].get_weights().n() &&
+                          base_activations[l].n() == layers[l].get_weights().m());
+        }
+        if (!same_shape) {
+            base_zs.clear();
+            base_activations.assign(1, Vector(layers.front().get_weights().m()));
+            for (const auto& layer : layers) {
+                base_zs.emplace_back(layer.get_weights().n());
+                base_activations.emplace_back(layer.get_weights().n());
+            }
+            for (auto& state : thread_states) {
+                state.layers = layers;
+                state.zs = base_zs;
+                state.activations = base_activations;
+            }
+            return;
+        }
+        for (auto& state : thread_states) {
+            for (unsigned l = 0; l < layers.size(); ++l) {
+                state.layers[l].get_weights() = layers[l].get_weights();
+                state.layers[l].get_biases() = layers[l].get_biases();
+            }
+        }
+    }
+
+    static void resize_gradients(const std::vector<Layer>& layers, std::vector<Matrix>& grad_w,
+                                 std::vector<Vector>& grad_b) {
+        bool same_shape = (grad_w.size() == layers.size() && grad_b.size() == layers.size());
+        for (unsigned l = 0; same_shape && l < layers.size(); ++l) {
+            same_shape = (grad_w[l].n() == layers[l].get_weights().n() &&
+                          grad_w[l].m() == layers[l].get_weights().m() &&
+                          grad_b[l].n() == layers[l].get_biases().n());
+        }
+        if (same_shape) return;
+        grad_w.clear();
+        grad_b.clear();
+        for (const auto& layer : layers) {
+            grad_w.emplace_back(layer.get_weights().n(), layer.get_weights().m());
+            grad_b.emplace_back(layer.get_biases().n());
+        }
+    }
+
+    FiniteDifferenceOptions options;
+    ThreadPool pool;
+    std::vector<ThreadState> thread_states;
+    std::vector<Vector> base_zs, base_activations;
+};
+
+using FiniteDifferenceGradient = BasicFiniteDifferenceGradient<double>;
+
+template <class T>
+inline void BasicNeuralNetwork<T>::compute_finite_difference(const DoubleVector& input, const DoubleVector& target,
+                                                             std::vector<Matrix>& grad_w,
+                                                             std::vector<Vector>& grad_b,
+                                                             const FiniteDifferenceOptions& options) const {
+    BasicFiniteDifferenceGradient<T> finite_difference(options);
+    finite_difference.compute(*this, input, target, grad_w, grad_b);
+}
+
+template <class T>
+inline GradientCheckResult BasicNeuralNetwork<T>::check_gradient(const DoubleVector& input,
+                                                                 const DoubleVector& target,
+                                                                 FiniteDifferenceOptions options) const {
+    std::vector<Matrix> fd_grad_w, bp_grad_w;
+    std::vector<Vector> fd_grad_b, bp_grad_b;
+    compute_finite_difference(input, target, fd_grad_w, fd_grad_b, options);
+    compute_backpropagation(input, target, bp_grad_w, bp_grad_b);
+
+    GradientCheckResult result;
+    auto compare = [&](double fd, double bp, unsigned l, unsigned i, unsigned j, bool is_bias) {
+        double deviation = std::fabs(fd - bp);
+        double scale = std::max(std::fabs(fd), std::fabs(bp));
+        if (scale > 1.0e-12) result.max_rel_deviation = std::max(result.max_rel_deviation, deviation / scale);
+        if (deviation > result.max_abs_deviation) {
+            result.max_abs_deviation = deviation;
+            result.layer = l;
+            result.row = i;
+            result.column = j;
+            result.is_bias = is_bias;
+        }
+    };
+    for (unsigned l = 0; l < layers.size(); ++l) {
+        for (unsigned i = 0; i < bp_grad_w[l].n(); ++i) {
+            for (unsigned j = 0; j < bp_grad_w[l].m(); ++j) {
+                compare(fd_grad_w[l](i, j), bp_grad_w[l](i, j), l, i, j, false);
+            }
+            compare(fd_grad_b[l][i], bp_grad_b[l][i], l, i, 0, true);
+        }
+    }
+    return result;
+}
+
 // Helper functions
-inline DoubleVector multiply(const DoubleMatrix& mat, const DoubleVector& vec) {
+template <class T>
+inline DenseVector<T> multiply(const DenseMatrix<T>& mat, const DenseVector<T>& vec) {
     if (mat.m() != vec.n()) {
         throw std::invalid_argument("Matrix and vector dimensions do not match.");
     }
 
-    DoubleVector result(mat.n());
-    for (unsigned i = 0; i < mat.n(); ++i) {
-        double sum = 0.0;
-        for (unsigned j = 0; j < mat.m(); ++j) {
-            sum += mat(i, j) * vec[j];
-        }
-        result[i] = sum;
-    }
+    DenseVector<T> result(mat.n());
+    Kernels::gemv(mat.n(), mat.m(), mat.data(), mat.m(), vec.data(), nullptr, result.data());
     return result;
 }
 
-inline DoubleMatrix transpose(const DoubleMatrix& mat) {
-    DoubleMatrix result(mat.m(), mat.n());
+template <class T>
+inline DenseMatrix<T> transpose(const DenseMatrix<T>& mat) {
+    DenseMatrix<T> result(mat.m(), mat.n());
     for (unsigned i = 0; i < mat.n(); ++i) {
         for (unsigned j = 0; j < mat.m(); ++j) {
             result(j, i) = mat(i, j);
@@ -241,12 +2151,46 @@ inline DoubleMatrix transpose(const DoubleMatrix& mat) {
     return result;
 }
 
-inline DoubleMatrix outer_product(const DoubleVector& a, const DoubleVector& b) {
-    DoubleMatrix result(a.n(), b.n());
+template <class T>
+inline DenseMatrix<T> outer_product(const DenseVector<T>& a, const DenseVector<T>& b) {
+    DenseMatrix<T> result(a.n(), b.n());
+    outer_product(a, b, result);
+    return result;
+}
+
+// In-place outer product: result must already be a.n() x b.n()
+template <class T>
+inline void outer_product(const DenseVector<T>& a, const DenseVector<T>& b, DenseMatrix<T>& result) {
     for (unsigned i = 0; i < a.n(); ++i) {
         for (unsigned j = 0; j < b.n(); ++j) {
-            result(i, j) = a[i] * b[j];
+            result(i, j) = T(0);
         }
     }
-    return result;
+    Kernels::ger(a.n(), b.n(), T(1), a.data(), b.data(), result.data(), result.m());
+}
+
+// Computes result = mat^T * vec without forming the transpose of mat:
+// the rows of mat are swept in storage order and scaled into result.
+// result must already have size mat.m().
+template <class T>
+inline void multiply_transposed(const DenseMatrix<T>& mat, const DenseVector<T>& vec, DenseVector<T>& result) {
+    if (mat.n() != vec.n()) {
+        throw std::invalid_argument("Matrix and vector dimensions do not match.");
+    }
+
+    Kernels::gemv_t(mat.n(), mat.m(), mat.data(), mat.m(), vec.data(), result.data());
+}
+
+// Computes the first n_cols columns of result = A^T * B without forming
+// the transpose of A
+template <class T>
+inline void multiply_transposed(const DenseMatrix<T>& a, const DenseMatrix<T>& b, unsigned n_cols,
+                                DenseMatrix<T>& result) {
+    if (a.n() != b.n()) {
+        throw std::invalid_argument("Matrix dimensions do not match.");
+    }
+
+    // A^T(i,k) = a[k*a.m()+i]
+    Kernels::gemm(a.m(), a.n(), n_cols, a.data(), 1, a.m(), b.data(), b.m(),
+                  nullptr, result.data(), result.m());
 }
@@ -0,0 +1,299 @@
+#include "project2_a.h"
+#include "grid_output.h"
+#include "dataset.h"
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Trains a set of architectures concurrently, one job per combination of
+// architecture, seed and learning rate, on a work-stealing thread pool.
+// Each job writes cost_log_<tag>.dat and grid_output_<tag>.dat with the
+// same contents as the single-architecture drivers (main_arch4.cpp etc.)
+// produce for that configuration, e.g. tag 2_16_16_1 for (2,16,16,1).
+//
+// Usage: sweep_architectures [--arch 4,4] [--arch 8,8] ... [--seed N] ...
+//            [--lr X] ... [--threads N] [--max-iterations N]
+//            [--target-cost X] [--lambda X] [--batch-size N] [--data FILE]
+//            [--grid-points N] [--reports 1] [--models 1]
+//            [--snapshot-interval N] [--optimizer NAME] [--method NAME]
+//
+// --arch gives the hidden layer sizes (default: 4,4 8,8 16,16). Without
+// --seed, every network starts from the random number generator's initial
+// state, exactly like a standalone driver; with --seed N the generator is
+// seeded with N and the tag gets a _seedN suffix. The tag gets an _lrX
+// suffix when more than one learning rate is given. --grid-points N writes
+// the grid output on N x N equally spaced points instead of the drivers'
+// grid with step 0.01. --reports 1 also writes each job's TrainingReport
+// to training_report_<tag>.json, and --models 1 saves each trained network
+// to network_<tag>.bin (see evaluate_network). --snapshot-interval N
+// snapshots each job every N iterations to snapshot_<tag>.snap and resumes
+// from that file if it exists, so a preempted sweep can simply be started
+// again; on SIGTERM every job saves a snapshot and stops without writing
+// its outputs. --optimizer trains with momentum, nesterov, rmsprop or adam
+// instead of plain SGD (see optimizer.h). --method levenberg-marquardt or
+// --method lbfgs trains with full-batch second-order steps instead (see
+// TrainingMethod); the cost log then has one entry per 50 of their
+// iterations, and --lr, --batch-size and --optimizer have no effect.
+
+struct SweepJob {
+    std::vector<unsigned> hidden_layers;
+    bool seeded = false;
+    unsigned seed = 0;
+    double learning_rate = 0.01;
+    std::string tag;
+
+    // Work per training iteration, to submit the longest jobs first
+    unsigned long n_parameters() const {
+        unsigned long n = 0;
+        unsigned prev_size = 2;
+        for (unsigned size : hidden_layers) {
+            n += (unsigned long)(prev_size + 1) * size;
+            prev_size = size;
+        }
+        return n + prev_size + 1;
+    }
+};
+
+struct SweepSettings {
+    double target_cost = 1e-3;
+    unsigned max_iterations = 4000000;
+    double regularization_lambda = 0.0;
+    unsigned batch_size = 1; // 1 = per-sample SGD, >1 = mini-batch
+    unsigned grid_points = 0; // 0 = step 0.01
+    bool write_reports = false;
+    bool write_models = false;
+    unsigned snapshot_interval = 0; // 0 = no snapshots
+    OptimizerKind optimizer = OptimizerKind::SGD;
+    TrainingMethod method = TrainingMethod::FirstOrder;
+};
+
+// Trains one job's network and writes its cost log and grid output;
+// returns false if training was interrupted
+bool run_job(const SweepJob& job, const SweepSettings& settings,
+             const Dataset& training_data, const std::mt19937& initial_generator, std::mutex& output_mutex) {
+    TanhActivationFunction tanh_act;
+    std::vector<std::pair<unsigned, ActivationFunction*>> layers_config;
+    for (unsigned size : job.hidden_layers) {
+        layers_config.emplace_back(size, &tanh_act);
+    }
+    layers_config.emplace_back(1, &tanh_act);
+
+    unsigned input_size = 2;
+    NeuralNetwork net(input_size, layers_config);
+
+    // Own generator, in the state a standalone driver would see
+    std::mt19937 gen = job.seeded ? std::mt19937(job.seed) : initial_generator;
+
+    TrainingOptions options;
+    options.batch_size = settings.batch_size;
+    options.random_number_generator = &gen;
+    options.log_stream = nullptr;
+    TrainingReport report;
+    options.report = &report;
+    options.optimizer.kind = settings.optimizer;
+    options.method = settings.method;
+    if (settings.snapshot_interval > 0) {
+        options.snapshots.filename = "snapshot_" + job.tag + ".snap";
+        options.snapshots.interval = settings.snapshot_interval;
+        options.snapshots.resume = true;
+    }
+
+    std::vector<double> cost_log;
+    net.train(training_data, job.learning_rate, settings.target_cost, settings.max_iterations, cost_log,
+              settings.regularization_lambda, options);
+
+    if (report.interrupted) {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cout << "[" << job.tag << "] interrupted after " << report.iterations << " iterations, saved "
+                  << options.snapshots.filename << std::endl;
+        return false;
+    }
+
+    std::string cost_log_filename = "cost_log_" + job.tag + ".dat";
+    std::string grid_output_filename = "grid_output_" + job.tag + ".dat";
+
+    // Save cost log
+    std::ofstream cost_log_file(cost_log_filename);
+    if (!cost_log_file) {
+        throw std::runtime_error("Could not open " + cost_log_filename + " for writing.");
+    }
+    for (size_t i = 0; i < cost_log.size(); ++i) {
+        // Cost was logged every 50 iterations
+        cost_log_file << i * 50 << " " << cost_log[i] << "\n";
+    }
+    cost_log_file.close();
+
+    // Evaluate network output on a grid [0,1]x[0,1]; the jobs already keep
+    // the threads busy, so this uses just the job's own
+    std::ofstream grid_output_file(grid_output_filename);
+    if (!grid_output_file) {
+        throw std::runtime_error("Could not open " + grid_output_filename + " for writing.");
+    }
+    std::vector<double> grid = (settings.grid_points > 0) ? uniform_grid_axis(0.0, 1.0, settings.grid_points)
+                                                          : grid_axis(0.0, 1.0, 0.01);
+    write_grid_output(net, grid, grid, grid_output_file, 1);
+    grid_output_file.close();
+
+    if (settings.write_reports) {
+        std::string report_filename = "training_report_" + job.tag + ".json";
+        std::ofstream report_file(report_filename);
+        if (!report_file) {
+            throw std::runtime_error("Could not open " + report_filename + " for writing.");
+        }
+        report.write_json(report_file);
+    }
+
+    if (settings.write_models) {
+        net.save("network_" + job.tag + ".bin");
+    }
+
+    std::lock_guard<std::mutex> lock(output_mutex);
+    std::cout << "[" << job.tag << "] final cost " << (cost_log.empty() ? 0.0 : cost_log.back()) << " after "
+              << report.seconds << " s (" << report.samples_per_second << " samples/s), saved " << cost_log_filename << " and " << grid_output_filename << std::endl;
+    return true;
+}
+
+std::vector<unsigned> parse_layer_sizes(const std::string& text) {
+    std::vector<unsigned> sizes;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        int size = std::stoi(item);
+        if (size <= 0) throw std::invalid_argument("Layer sizes must be positive: " + text);
+        sizes.push_back(size);
+    }
+    if (sizes.empty()) throw std::invalid_argument("No layer sizes in: " + text);
+    return sizes;
+}
+
+int main(int argc, char* argv[]) {
+    // State of the generator before anything has drawn from it
+    const std::mt19937 initial_generator = RandomNumber::Random_number_generator;
+
+    std::vector<std::vector<unsigned>> architectures;
+    std::vector<unsigned> seeds;
+    std::vector<double> learning_rates;
+    SweepSettings settings;
+    unsigned n_threads = ThreadPool::default_size();
+    std::string data_filename = "spiral_training_data.dat";
+
+    try {
+        for (int a = 1; a < argc; ++a) {
+            std::string option = argv[a];
+            if (a + 1 >= argc) throw std::invalid_argument("Missing value for " + option);
+            std::string value = argv[++a];
+            if (option == "--arch") {
+                architectures.push_back(parse_layer_sizes(value));
+            } else if (option == "--seed") {
+                seeds.push_back(std::stoul(value));
+            } else if (option == "--lr") {
+                learning_rates.push_back(std::stod(value));
+            } else if (option == "--threads") {
+                n_threads = std::stoul(value);
+            } else if (option == "--max-iterations") {
+                settings.max_iterations = std::stoul(value);
+            } else if (option == "--target-cost") {
+                settings.target_cost = std::stod(value);
+            } else if (option == "--lambda") {
+                settings.regularization_lambda = std::stod(value);
+            } else if (option == "--batch-size") {
+                settings.batch_size = std::stoul(value);
+            } else if (option == "--grid-points") {
+                settings.grid_points = std::stoul(value);
+            } else if (option == "--reports") {
+                settings.write_reports = (std::stoul(value) != 0);
+            } else if (option == "--models") {
+                settings.write_models = (std::stoul(value) != 0);
+            } else if (option == "--snapshot-interval") {
+                settings.snapshot_interval = std::stoul(value);
+            } else if (option == "--optimizer") {
+                settings.optimizer = optimizer_kind(value);
+            } else if (option == "--method") {
+                settings.method = training_method(value);
+            } else if (option == "--data") {
+                data_filename = value;
+            } else {
+                throw std::invalid_argument("Unknown option " + option);
+            }
+        }
+    } catch (const std::exception& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [--arch 4,4] ... [--seed N] ... [--lr X] ... [--threads N]"
+                  << " [--max-iterations N] [--target-cost X] [--lambda X] [--batch-size N] [--data FILE]"
+                  << " [--grid-points N] [--reports 1] [--models 1] [--snapshot-interval N]"
+                  << " [--optimizer NAME] [--method NAME]" << std::endl;
+        return 1;
+    }
+    if (architectures.empty()) architectures = {{4, 4}, {8, 8}, {16, 16}};
+    if (learning_rates.empty()) learning_rates = {0.01};
+
+    // Load training data
+    Dataset training_data;
+    try {
+        training_data = Dataset::load(data_filename);
+    } catch (const std::exception& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "Loaded " << training_data.n_samples() << " training samples." << std::endl;
+
+    // One job per architecture, seed and learning rate
+    std::vector<SweepJob> jobs;
+    for (const auto& hidden_layers : architectures) {
+        for (int s = seeds.empty() ? -1 : 0; s < (int)seeds.size(); ++s) {
+            for (double learning_rate : learning_rates) {
+                SweepJob job;
+                job.hidden_layers = hidden_layers;
+                job.learning_rate = learning_rate;
+                job.tag = "2";
+                for (unsigned size : hidden_layers) job.tag += "_" + std::to_string(size);
+                job.tag += "_1";
+                if (s >= 0) {
+                    job.seeded = true;
+                    job.seed = seeds[s];
+                    job.tag += "_seed" + std::to_string(job.seed);
+                }
+                if (learning_rates.size() > 1) {
+                    std::ostringstream lr;
+                    lr << learning_rate;
+                    job.tag += "_lr" + lr.str();
+                }
+                jobs.push_back(job);
+            }
+        }
+    }
+
+    // Longest jobs first; the pool balances the rest by stealing
+    std::stable_sort(jobs.begin(), jobs.end(), [](const SweepJob& a, const SweepJob& b) {
+        return a.n_parameters() > b.n_parameters();
+    });
+
+    std::cout << "Running " << jobs.size() << " jobs on " << n_threads << " threads." << std::endl;
+    std::mutex output_mutex;
+    std::atomic<bool> interrupted(false);
+    WorkStealingPool pool(n_threads);
+    for (const auto& job : jobs) {
+        pool.submit([&, job]() {
+            // Jobs not started before SIGTERM are left for the next run
+            if (interrupted) return;
+            if (!run_job(job, settings, training_data, initial_generator, output_mutex)) interrupted = true;
+        });
+    }
+    try {
+        pool.wait();
+    } catch (const std::exception& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
+        return 1;
+    }
+    if (interrupted) {
+        std::cerr << "Interrupted; run again with the same options to resume." << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed pool of threads for data-parallel loops. run(task) calls task(t)
+// for t = 0, ..., size()-1 concurrently, with task 0 on the calling thread
+// and the others on the pool's worker threads, and returns once all of them
+// have finished. The workers persist between calls, so a training loop can
+// dispatch every mini-batch to the same threads without creating new ones,
+// and the task is handed to them by reference, so run does not allocate.
+class ThreadPool {
+public:
+    // n_threads is the total number of threads, including the caller
+    explicit ThreadPool(unsigned n_threads) {
+        if (n_threads == 0) n_threads = 1;
+        for (unsigned t = 1; t < n_threads; ++t) {
+            workers.emplace_back([this, t]() { worker_loop(t); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        start_condition.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const { return workers.size() + 1; }
+
+    // Number of threads to use if none is specified
+    static unsigned default_size() {
+        unsigned n = std::thread::hardware_concurrency();
+        return (n == 0) ? 1 : n;
+    }
+
+    // Runs task(t) on every thread and waits for all of them. If any task
+    // throws, the first exception is rethrown here (after all have finished).
+    template <class Task>
+    void run(Task&& task) {
+        typedef std::remove_reference_t<Task> TaskType;
+        run_task(TaskReference{const_cast<void*>(static_cast<const void*>(std::addressof(task))),
+                               [](void* object, unsigned t) { (*static_cast<TaskType*>(object))(t); }});
+    }
+
+private:
+    // Non-owning reference to the caller's task, valid for one run
+    struct TaskReference {
+        void* object;
+        void (*call)(void*, unsigned);
+
+        void operator()(unsigned t) const { call(object, t); }
+    };
+
+    void run_task(TaskReference task) {
+        if (workers.empty()) {
+            task(0);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current_task = task;
+            n_running = workers.size();
+            first_exception = nullptr;
+            ++generation;
+        }
+        start_condition.notify_all();
+
+        std::exception_ptr caller_exception;
+        try {
+            task(0);
+        } catch (...) {
+            caller_exception = std::current_exception();
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done_condition.wait(lock, [this]() { return n_running == 0; });
+        if (caller_exception) std::rethrow_exception(caller_exception);
+        if (first_exception) std::rethrow_exception(first_exception);
+    }
+
+    void worker_loop(unsigned t) {
+        unsigned long seen_generation = 0;
+        while (true) {
+            TaskReference task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                start_condition.wait(lock, [&]() { return stopping || generation != seen_generation; });
+                if (stopping) return;
+                seen_generation = generation;
+                task = current_task;
+            }
+
+            std::exception_ptr exception;
+            try {
+                task(t);
+            } catch (...) {
+                exception = std::current_exception();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (exception && !first_exception) first_exception = exception;
+                if (--n_running == 0) done_condition.notify_one();
+            }
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable start_condition, done_condition;
+    TaskReference current_task{nullptr, nullptr};
+    unsigned long generation = 0;
+    unsigned n_running = 0;
+    bool stopping = false;
+    std::exception_ptr first_exception;
+};
+
+// Pool for independent jobs of uneven length, such as whole training runs.
+// Every worker has its own queue: it takes jobs from the front of its own
+// queue and, once that is empty, steals from the back of the others, so a
+// worker that drew short jobs helps with the queues of the busy ones. Jobs
+// are dealt out to the queues round-robin; submitting them longest first
+// gives the best balance.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned n_threads) {
+        if (n_threads == 0) n_threads = 1;
+        for (unsigned t = 0; t < n_threads; ++t) {
+            queues.push_back(std::make_unique<JobQueue>());
+        }
+        for (unsigned t = 0; t < n_threads; ++t) {
+            workers.emplace_back([this, t]() { worker_loop(t); });
+        }
+    }
+
+    // Finishes all submitted jobs before returning
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work_condition.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    unsigned size() const { return workers.size(); }
+
+    void submit(std::function<void()> job) {
+        JobQueue& queue = *queues[next_queue++ % queues.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.jobs.push_back(std::move(job));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++n_queued;
+            ++n_unfinished;
+        }
+        work_condition.notify_one();
+    }
+
+    // Waits until every submitted job has finished. If any job threw, the
+    // first exception is rethrown here.
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        done_condition.wait(lock, [this]() { return n_unfinished == 0; });
+        if (first_exception) {
+            std::exception_ptr exception = first_exception;
+            first_exception = nullptr;
+            std::rethrow_exception(exception);
+        }
+    }
+
+private:
+    struct JobQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> jobs;
+    };
+
+    void worker_loop(unsigned t) {
+        while (true) {
+            // Claim one of the queued jobs, then find it: n_queued never
+            // exceeds the number of jobs sitting in the queues
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                work_condition.wait(lock, [this]() { return stopping || n_queued > 0; });
+                if (n_queued == 0) return;
+                --n_queued;
+            }
+            std::function<void()> job;
+            while (!take_job(t, job)) std::this_thread::yield();
+
+            std::exception_ptr exception;
+            try {
+                job();
+            } catch (...) {
+                exception = std::current_exception();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (exception && !first_exception) first_exception = exception;
+                if (--n_unfinished == 0) done_condition.notify_all();
+            }
+        }
+    }
+
+    // Oldest job of queue t, or else the newest job of another queue
+    bool take_job(unsigned t, std::function<void()>& job) {
+        {
+            JobQueue& own = *queues[t];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.jobs.empty()) {
+                job = std::move(own.jobs.front());
+                own.jobs.pop_front();
+                return true;
+            }
+        }
+        for (unsigned k = 1; k < queues.size(); ++k) {
+            JobQueue& victim = *queues[(t + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.jobs.empty()) {
+                job = std::move(victim.jobs.back());
+                victim.jobs.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<std::unique_ptr<JobQueue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_condition, done_condition;
+    std::atomic<unsigned long> next_queue{0};
+    unsigned long n_queued = 0, n_unfinished = 0;
+    bool stopping = false;
+    std::exception_ptr first_exception;
+};
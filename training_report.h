@@ -0,0 +1,172 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#if defined(NEURAL_NETWORK_PROFILE) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+// Instrumentation of NeuralNetwork::train. Every run can fill in a
+// TrainingReport (TrainingOptions::report) with the number of iterations,
+// the samples processed and the throughput. Compiled with
+// -DNEURAL_NETWORK_PROFILE, the training steps also accumulate the cycles
+// spent in each phase below; without it the per-phase timers are empty
+// inline functions and compile out to nothing.
+
+enum class TrainingPhase {
+    Forward,   // forward passes of the training steps
+    Backward,  // backward passes (per-sample SGD fuses the update into it)
+    Update,    // separate parameter updates (mini-batches)
+    Reduction, // summing the threads' gradients (deterministic parallel)
+    Cost,      // exact evaluations of the cost over the training set
+    Shuffle,   // reordering the training set
+    Logging    // writing to the log stream
+};
+
+constexpr unsigned N_training_phases = 7;
+
+inline const char* training_phase_name(TrainingPhase phase) {
+    switch (phase) {
+    case TrainingPhase::Forward: return "forward";
+    case TrainingPhase::Backward: return "backward";
+    case TrainingPhase::Update: return "update";
+    case TrainingPhase::Reduction: return "reduction";
+    case TrainingPhase::Cost: return "cost";
+    case TrainingPhase::Shuffle: return "shuffle";
+    case TrainingPhase::Logging: return "logging";
+    }
+    return "unknown";
+}
+
+#ifdef NEURAL_NETWORK_PROFILE
+constexpr bool Training_profile_enabled = true;
+
+// Cycle counter: the time stamp counter on x86, nanoseconds elsewhere
+inline std::uint64_t profile_counter() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Per-phase cycle and call counts of one thread. Phases are timed as laps:
+//
+//     PhaseMark mark = profile.start();
+//     ... forward pass ...
+//     profile.lap(TrainingPhase::Forward, mark);
+//     ... backward pass ...
+//     profile.lap(TrainingPhase::Backward, mark);
+struct PhaseMark {
+    std::uint64_t counter;
+};
+
+class PhaseProfile {
+public:
+    PhaseMark start() const { return PhaseMark{profile_counter()}; }
+
+    // Adds the cycles since mark to phase and restarts mark
+    void lap(TrainingPhase phase, PhaseMark& mark) {
+        std::uint64_t now = profile_counter();
+        cycles[unsigned(phase)] += now - mark.counter;
+        ++calls[unsigned(phase)];
+        mark.counter = now;
+    }
+
+    void merge(const PhaseProfile& other) {
+        for (unsigned p = 0; p < N_training_phases; ++p) {
+            cycles[p] += other.cycles[p];
+            calls[p] += other.calls[p];
+        }
+    }
+
+    void clear() { *this = PhaseProfile(); }
+
+    std::uint64_t phase_cycles(unsigned p) const { return cycles[p]; }
+    std::uint64_t phase_calls(unsigned p) const { return calls[p]; }
+
+private:
+    std::uint64_t cycles[N_training_phases] = {};
+    std::uint64_t calls[N_training_phases] = {};
+};
+#else
+constexpr bool Training_profile_enabled = false;
+
+inline std::uint64_t profile_counter() { return 0; }
+
+struct PhaseMark {};
+
+class PhaseProfile {
+public:
+    PhaseMark start() const { return PhaseMark(); }
+    void lap(TrainingPhase, PhaseMark&) {}
+    void merge(const PhaseProfile&) {}
+    void clear() {}
+    std::uint64_t phase_cycles(unsigned) const { return 0; }
+    std::uint64_t phase_calls(unsigned) const { return 0; }
+};
+#endif
+
+struct TrainingPhaseReport {
+    std::uint64_t cycles = 0;
+    std::uint64_t calls = 0;
+    double seconds = 0.0;
+};
+
+// Summary of one NeuralNetwork::train run. Phase times are summed over the
+// threads, so with several threads they add up to more than the wall time.
+struct TrainingReport {
+    // Whether the per-phase accumulators were compiled in
+    bool profiled = Training_profile_enabled;
+
+    unsigned iterations = 0;
+    unsigned first_iteration = 0;   // > 0 if the run was resumed from a snapshot
+    bool interrupted = false;       // stopped by SIGTERM, after a final snapshot
+    unsigned long long samples = 0; // samples processed by training steps (in this run)
+    double seconds = 0.0;           // wall time of the whole run
+    double samples_per_second = 0.0;
+    double final_cost = 0.0;
+
+    TrainingPhaseReport phases[N_training_phases];
+
+    const TrainingPhaseReport& phase(TrainingPhase p) const { return phases[unsigned(p)]; }
+
+    // Fills in the phases from the merged per-thread profiles; cycles are
+    // converted to seconds with the counter's rate over the run
+    void set_phases(const PhaseProfile& profile, std::uint64_t run_cycles) {
+        double seconds_per_cycle = (run_cycles > 0) ? seconds / run_cycles : 0.0;
+        for (unsigned p = 0; p < N_training_phases; ++p) {
+            phases[p].cycles = profile.phase_cycles(p);
+            phases[p].calls = profile.phase_calls(p);
+            phases[p].seconds = phases[p].cycles * seconds_per_cycle;
+        }
+    }
+
+    void write_json(std::ostream& out) const {
+        char buffer[64];
+        auto number = [&](double value) {
+            std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+            return buffer;
+        };
+        out << "{\n";
+        out << "  \"profiled\": " << (profiled ? "true" : "false") << ",\n";
+        out << "  \"iterations\": " << iterations << ",\n";
+        out << "  \"first_iteration\": " << first_iteration << ",\n";
+        out << "  \"interrupted\": " << (interrupted ? "true" : "false") << ",\n";
+        out << "  \"samples\": " << samples << ",\n";
+        out << "  \"seconds\": " << number(seconds) << ",\n";
+        out << "  \"samples_per_second\": " << number(samples_per_second) << ",\n";
+        out << "  \"final_cost\": " << number(final_cost) << ",\n";
+        out << "  \"phases\": {";
+        for (unsigned p = 0; p < N_training_phases; ++p) {
+            out << (p == 0 ? "\n" : ",\n");
+            out << "    \"" << training_phase_name(TrainingPhase(p)) << "\": {\"seconds\": "
+                << number(phases[p].seconds) << ", \"cycles\": " << phases[p].cycles
+                << ", \"calls\": " << phases[p].calls << "}";
+        }
+        out << "\n  }\n}\n";
+    }
+};
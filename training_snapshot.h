@@ -0,0 +1,296 @@
+#pragma once
+
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Snapshots of a NeuralNetwork::train run, from which the run can be
+// resumed (TrainingOptions::snapshots). A snapshot holds everything the
+// rest of the run depends on: the parameters, the optimizer state, the
+// iteration counter, the current cost, the state of the random number
+// generator, the shuffled sample order and the cost log so far. Resuming
+// from it continues the run bit for bit as if it had never stopped (except
+// in Hogwild mode, which is not reproducible anyway).
+//
+// File format: the 64-byte header below, followed by the sections
+//
+//   layer sizes      uint32 per layer, plus the input size first
+//   parameters       each layer's weights (row by row) and then biases,
+//                    in the network's scalar type
+//   cost log         doubles
+//   generator state  the generator written to a stream, as text
+//   sample order     uint64 per sample (empty without shuffling)
+//   optimizer state  doubles (empty for plain SGD)
+//
+// each preceded by its length in bytes as a uint64, in native byte order.
+
+struct TrainingSnapshotHeader {
+    char magic[8];             // "NNSNAP1"
+    std::uint32_t version;     // Training_snapshot_version when written
+    std::uint32_t byte_order;  // Training_snapshot_byte_order_mark as written
+    std::uint32_t scalar_size; // bytes per parameter
+    std::uint32_t n_layers;
+    std::uint64_t iteration;
+    double current_cost;
+    std::uint64_t file_size;
+    char padding[16];
+};
+static_assert(sizeof(TrainingSnapshotHeader) == 64, "TrainingSnapshotHeader must be 64 bytes");
+
+constexpr char Training_snapshot_magic[8] = "NNSNAP1";
+constexpr std::uint32_t Training_snapshot_version = 1;
+constexpr std::uint32_t Training_snapshot_byte_order_mark = 0x01020304;
+
+struct TrainingSnapshot {
+    unsigned scalar_size = sizeof(double);
+    std::vector<std::uint32_t> layer_sizes; // input size, then each layer's output size
+    std::vector<char> parameters;
+    unsigned long iteration = 0;
+    double current_cost = 0.0;
+    std::vector<double> cost_log;
+    std::mt19937 generator;
+    std::vector<std::uint64_t> order;
+    std::vector<double> optimizer_state;
+
+    // Writes the snapshot under a temporary name and renames it into
+    // place, so filename always holds a complete snapshot
+    void write(const std::string& filename) const {
+        std::ostringstream generator_stream;
+        generator_stream << generator;
+        std::string generator_state = generator_stream.str();
+
+        TrainingSnapshotHeader header = {};
+        std::memcpy(header.magic, Training_snapshot_magic, sizeof(Training_snapshot_magic));
+        header.version = Training_snapshot_version;
+        header.byte_order = Training_snapshot_byte_order_mark;
+        header.scalar_size = scalar_size;
+        header.n_layers = layer_sizes.empty() ? 0 : layer_sizes.size() - 1;
+        header.iteration = iteration;
+        header.current_cost = current_cost;
+        header.file_size = sizeof(header) + 6 * sizeof(std::uint64_t) +
+                           layer_sizes.size() * sizeof(std::uint32_t) + parameters.size() +
+                           cost_log.size() * sizeof(double) + generator_state.size() +
+                           order.size() * sizeof(std::uint64_t) + optimizer_state.size() * sizeof(double);
+
+        std::string temporary_filename = filename + ".tmp";
+        std::ofstream file(temporary_filename, std::ios::binary);
+        if (!file) throw std::runtime_error("Could not open " + temporary_filename + " for writing");
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        write_section(file, layer_sizes.data(), layer_sizes.size() * sizeof(std::uint32_t));
+        write_section(file, parameters.data(), parameters.size());
+        write_section(file, cost_log.data(), cost_log.size() * sizeof(double));
+        write_section(file, generator_state.data(), generator_state.size());
+        write_section(file, order.data(), order.size() * sizeof(std::uint64_t));
+        write_section(file, optimizer_state.data(), optimizer_state.size() * sizeof(double));
+        file.close();
+        if (!file || std::rename(temporary_filename.c_str(), filename.c_str()) != 0) {
+            std::remove(temporary_filename.c_str());
+            throw std::runtime_error("Could not write " + filename);
+        }
+    }
+
+    static TrainingSnapshot read(const std::string& filename) {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file) throw std::runtime_error("Could not open " + filename);
+        std::vector<char> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        TrainingSnapshotHeader header;
+        if (contents.size() < sizeof(header)) throw std::runtime_error(filename + " is not a training snapshot");
+        std::memcpy(&header, contents.data(), sizeof(header));
+        if (std::memcmp(header.magic, Training_snapshot_magic, sizeof(Training_snapshot_magic)) != 0) {
+            throw std::runtime_error(filename + " is not a training snapshot");
+        }
+        if (header.byte_order != Training_snapshot_byte_order_mark) {
+            throw std::runtime_error(filename + " was written with a different byte order");
+        }
+        if (header.version == 0 || header.version > Training_snapshot_version) {
+            throw std::runtime_error(filename + " has snapshot version " + std::to_string(header.version) +
+                                     ", this reader supports up to " + std::to_string(Training_snapshot_version));
+        }
+        if (header.file_size != contents.size()) throw std::runtime_error(filename + " is truncated or corrupt");
+
+        TrainingSnapshot snapshot;
+        snapshot.scalar_size = header.scalar_size;
+        snapshot.iteration = header.iteration;
+        snapshot.current_cost = header.current_cost;
+        std::size_t position = sizeof(header);
+        read_section(filename, contents, position, snapshot.layer_sizes);
+        read_section(filename, contents, position, snapshot.parameters);
+        read_section(filename, contents, position, snapshot.cost_log);
+        std::vector<char> generator_state;
+        read_section(filename, contents, position, generator_state);
+        std::istringstream generator_stream(std::string(generator_state.begin(), generator_state.end()));
+        generator_stream >> snapshot.generator;
+        if (!generator_stream) throw std::runtime_error(filename + ": invalid random number generator state");
+        read_section(filename, contents, position, snapshot.order);
+        read_section(filename, contents, position, snapshot.optimizer_state);
+        if (position != contents.size() || snapshot.layer_sizes.size() != header.n_layers + 1) {
+            throw std::runtime_error(filename + " is truncated or corrupt");
+        }
+        return snapshot;
+    }
+
+private:
+    static void write_section(std::ofstream& file, const void* data, std::uint64_t n_bytes) {
+        file.write(reinterpret_cast<const char*>(&n_bytes), sizeof(n_bytes));
+        file.write(static_cast<const char*>(data), n_bytes);
+    }
+
+    template <class V>
+    static void read_section(const std::string& filename, const std::vector<char>& contents, std::size_t& position,
+                             std::vector<V>& values) {
+        std::uint64_t n_bytes;
+        if (contents.size() - position < sizeof(n_bytes)) {
+            throw std::runtime_error(filename + " is truncated or corrupt");
+        }
+        std::memcpy(&n_bytes, contents.data() + position, sizeof(n_bytes));
+        position += sizeof(n_bytes);
+        if (n_bytes > contents.size() - position || n_bytes % sizeof(V) != 0) {
+            throw std::runtime_error(filename + " is truncated or corrupt");
+        }
+        values.resize(n_bytes / sizeof(V));
+        std::memcpy(values.data(), contents.data() + position, n_bytes);
+        position += n_bytes;
+    }
+};
+
+// Writes snapshots on a thread of its own, so training never waits for the
+// disk: submit() only hands the snapshot over. If snapshots come faster
+// than they can be written, the ones not yet started are replaced by the
+// newest. Errors are reported by flush() (and the next submit()).
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(const std::string& filename) : filename(filename), thread([this]() { run(); }) {}
+
+    ~SnapshotWriter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        thread.join();
+    }
+
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+    void submit(TrainingSnapshot&& snapshot) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            rethrow_error();
+            pending = std::make_unique<TrainingSnapshot>(std::move(snapshot));
+        }
+        condition.notify_all();
+    }
+
+    // Waits until every submitted snapshot has been written
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this]() { return pending == nullptr && !writing; });
+        rethrow_error();
+    }
+
+    const std::string& get_filename() const { return filename; }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            condition.wait(lock, [this]() { return pending != nullptr || stopping; });
+            if (pending == nullptr) return;
+            std::unique_ptr<TrainingSnapshot> snapshot = std::move(pending);
+            writing = true;
+            lock.unlock();
+            try {
+                snapshot->write(filename);
+            } catch (...) {
+                lock.lock();
+                error = std::current_exception();
+                lock.unlock();
+            }
+            lock.lock();
+            writing = false;
+            condition.notify_all();
+        }
+    }
+
+    // Called with the mutex held
+    void rethrow_error() {
+        if (error) {
+            std::exception_ptr e = error;
+            error = nullptr;
+            std::rethrow_exception(e);
+        }
+    }
+
+    std::string filename;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::unique_ptr<TrainingSnapshot> pending;
+    bool writing = false;
+    bool stopping = false;
+    std::exception_ptr error;
+    std::thread thread;
+};
+
+// SIGTERM handling for runs that take snapshots: while at least one such
+// run is active, SIGTERM only sets a flag; every run then takes a final
+// snapshot and returns. The previous handler is restored when the last run
+// ends.
+inline volatile std::sig_atomic_t& termination_requested() {
+    static volatile std::sig_atomic_t flag = 0;
+    return flag;
+}
+
+extern "C" inline void request_termination(int) {
+    termination_requested() = 1;
+}
+
+class TerminationGuard {
+public:
+    TerminationGuard() {
+        std::lock_guard<std::mutex> lock(state().mutex);
+        if (state().n_active++ == 0) {
+            termination_requested() = 0;
+            state().previous_handler = std::signal(SIGTERM, request_termination);
+            if (state().previous_handler == SIG_ERR) state().previous_handler = SIG_DFL;
+        }
+    }
+
+    ~TerminationGuard() {
+        std::lock_guard<std::mutex> lock(state().mutex);
+        if (--state().n_active == 0) {
+            std::signal(SIGTERM, state().previous_handler);
+        }
+    }
+
+    TerminationGuard(const TerminationGuard&) = delete;
+    TerminationGuard& operator=(const TerminationGuard&) = delete;
+
+    static bool requested() { return termination_requested() != 0; }
+
+private:
+    struct State {
+        std::mutex mutex;
+        unsigned n_active = 0;
+        void (*previous_handler)(int) = SIG_DFL;
+    };
+
+    static State& state() {
+        static State s;
+        return s;
+    }
+};